@@ -35,7 +35,12 @@
         "dependencies/lmdb/libraries/liblmdb/chacha8.c",
         "dependencies/lz4/lib/lz4.h",
         "dependencies/lz4/lib/lz4.c",
+        "dependencies/lz4/lib/lz4hc.c",
+        "dependencies/lz4/lib/lz4frame.c",
+        "dependencies/lz4/lib/xxhash.c",
         "src/writer.cpp",
+        "src/redo-log.cpp",
+        "src/write-queue.cpp",
         "src/env.cpp",
         "src/compression.cpp",
         "src/ordered-binary.cpp",
@@ -53,7 +53,8 @@ static uint32_t rol32(uint32_t x, int r) {
 	return (x << (r & 31)) | (x >> (-r & 31));
 }
 
-void chacha8(const void* data, size_t length, const uint8_t* key, const uint8_t* iv, char* cipher) {
+/* The portable implementation, starting at the given block counter */
+static void chacha8_scalar(const void* data, size_t length, const uint8_t* key, const uint8_t* iv, char* cipher, uint64_t counter) {
   uint32_t x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15;
   uint32_t j0, j1, j2, j3, j4, j5, j6, j7, j8, j9, j10, j11, j12, j13, j14, j15;
   char* ctarget = 0;
@@ -74,8 +75,8 @@ void chacha8(const void* data, size_t length, const uint8_t* key, const uint8_t*
   j9  = U8TO32_LITTLE(key + 20);
   j10 = U8TO32_LITTLE(key + 24);
   j11 = U8TO32_LITTLE(key + 28);
-  j12 = 0;
-  j13 = 0;
+  j12 = (uint32_t) counter;
+  j13 = (uint32_t) (counter >> 32);
   j14 = U8TO32_LITTLE(iv + 0);
   j15 = U8TO32_LITTLE(iv + 4);
 
@@ -181,3 +182,228 @@ void chacha8(const void* data, size_t length, const uint8_t* key, const uint8_t*
     data = (uint8_t*)data + 64;
   }
 }
+
+/*
+ * The SIMD implementations run the same rounds on several consecutive blocks
+ * at once, with each vector holding one state word of every block, and then
+ * transpose the vectors back into the keystream of each block. They produce
+ * exactly the same output as the scalar code, which still handles the tail.
+ */
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__)) || \
+	(defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CHACHA8_SSE2	1
+#include <emmintrin.h>
+#if (defined(__GNUC__) && (defined(__clang__) || __GNUC__ >= 5)) || (defined(_MSC_VER) && _MSC_VER >= 1900)
+#define CHACHA8_AVX2	1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CHACHA8_TARGET_AVX2
+#else
+#define CHACHA8_TARGET_AVX2	__attribute__((target("avx2")))
+#endif
+#endif
+#endif
+
+static void chacha8_init(uint32_t* j, const uint8_t* key, const uint8_t* iv) {
+  int i;
+  for (i = 0; i < 4; i++)
+    j[i] = U8TO32_LITTLE(sigma + i * 4);
+  for (i = 0; i < 8; i++)
+    j[i + 4] = U8TO32_LITTLE(key + i * 4);
+  j[12] = 0;
+  j[13] = 0;
+  j[14] = U8TO32_LITTLE(iv + 0);
+  j[15] = U8TO32_LITTLE(iv + 4);
+}
+
+#define VQUARTERROUND(vadd, vxor, r16, r12, r8, r7, a, b, c, d) \
+  a = vadd(a, b); d = r16(vxor(d, a)); \
+  c = vadd(c, d); b = r12(vxor(b, c)); \
+  a = vadd(a, b); d = r8(vxor(d, a)); \
+  c = vadd(c, d); b = r7(vxor(b, c));
+
+#define VDOUBLEROUND(vadd, vxor, r16, r12, r8, r7, x) \
+  VQUARTERROUND(vadd, vxor, r16, r12, r8, r7, x[0], x[4], x[8], x[12]) \
+  VQUARTERROUND(vadd, vxor, r16, r12, r8, r7, x[1], x[5], x[9], x[13]) \
+  VQUARTERROUND(vadd, vxor, r16, r12, r8, r7, x[2], x[6], x[10], x[14]) \
+  VQUARTERROUND(vadd, vxor, r16, r12, r8, r7, x[3], x[7], x[11], x[15]) \
+  VQUARTERROUND(vadd, vxor, r16, r12, r8, r7, x[0], x[5], x[10], x[15]) \
+  VQUARTERROUND(vadd, vxor, r16, r12, r8, r7, x[1], x[6], x[11], x[12]) \
+  VQUARTERROUND(vadd, vxor, r16, r12, r8, r7, x[2], x[7], x[8], x[13]) \
+  VQUARTERROUND(vadd, vxor, r16, r12, r8, r7, x[3], x[4], x[9], x[14])
+
+#ifdef CHACHA8_SSE2
+#define SSE2_ROT(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+#define SSE2_ROT16(v) _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xb1), 0xb1)
+#define SSE2_ROT12(v) SSE2_ROT(v, 12)
+#define SSE2_ROT8(v) SSE2_ROT(v, 8)
+#define SSE2_ROT7(v) SSE2_ROT(v, 7)
+
+/* 4 blocks (256 bytes) at a time */
+static void chacha8_sse2(const uint8_t* in, size_t length, const uint32_t* j, uint64_t counter, uint8_t* out) {
+  __m128i s[16], x[16];
+  int i, g;
+  for (i = 0; i < 16; i++)
+    s[i] = _mm_set1_epi32((int) j[i]);
+  for (; length >= 256; length -= 256, in += 256, out += 256, counter += 4) {
+    s[12] = _mm_set_epi32((int) (uint32_t) (counter + 3), (int) (uint32_t) (counter + 2),
+      (int) (uint32_t) (counter + 1), (int) (uint32_t) counter);
+    s[13] = _mm_set_epi32((int) (uint32_t) ((counter + 3) >> 32), (int) (uint32_t) ((counter + 2) >> 32),
+      (int) (uint32_t) ((counter + 1) >> 32), (int) (uint32_t) (counter >> 32));
+    for (i = 0; i < 16; i++)
+      x[i] = s[i];
+    for (i = 8; i > 0; i -= 2) {
+      VDOUBLEROUND(_mm_add_epi32, _mm_xor_si128, SSE2_ROT16, SSE2_ROT12, SSE2_ROT8, SSE2_ROT7, x)
+    }
+    for (i = 0; i < 16; i++)
+      x[i] = _mm_add_epi32(x[i], s[i]);
+    /* transpose each group of 4 words into 16 bytes of each block */
+    for (g = 0; g < 4; g++) {
+      __m128i t0 = _mm_unpacklo_epi32(x[g * 4], x[g * 4 + 1]);
+      __m128i t1 = _mm_unpacklo_epi32(x[g * 4 + 2], x[g * 4 + 3]);
+      __m128i t2 = _mm_unpackhi_epi32(x[g * 4], x[g * 4 + 1]);
+      __m128i t3 = _mm_unpackhi_epi32(x[g * 4 + 2], x[g * 4 + 3]);
+      __m128i b[4];
+      b[0] = _mm_unpacklo_epi64(t0, t1);
+      b[1] = _mm_unpackhi_epi64(t0, t1);
+      b[2] = _mm_unpacklo_epi64(t2, t3);
+      b[3] = _mm_unpackhi_epi64(t2, t3);
+      for (i = 0; i < 4; i++) {
+        __m128i* p = (__m128i*) (out + i * 64 + g * 16);
+        _mm_storeu_si128(p, _mm_xor_si128(b[i], _mm_loadu_si128((const __m128i*) (in + i * 64 + g * 16))));
+      }
+    }
+  }
+}
+#endif
+
+#ifdef CHACHA8_AVX2
+#define AVX2_ROT(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+#define AVX2_ROT16(v) _mm256_shuffle_epi8(v, rot16)
+#define AVX2_ROT12(v) AVX2_ROT(v, 12)
+#define AVX2_ROT8(v) _mm256_shuffle_epi8(v, rot8)
+#define AVX2_ROT7(v) AVX2_ROT(v, 7)
+
+/* 8 blocks (512 bytes) at a time */
+CHACHA8_TARGET_AVX2
+static void chacha8_avx2(const uint8_t* in, size_t length, const uint32_t* j, uint64_t counter, uint8_t* out) {
+  __m256i s[16], x[16];
+  const __m256i rot16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+    2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+  const __m256i rot8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+    3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+  int i, h;
+  for (i = 0; i < 16; i++)
+    s[i] = _mm256_set1_epi32((int) j[i]);
+  for (; length >= 512; length -= 512, in += 512, out += 512, counter += 8) {
+    uint32_t lo[8], hi[8];
+    for (i = 0; i < 8; i++) {
+      lo[i] = (uint32_t) (counter + i);
+      hi[i] = (uint32_t) ((counter + i) >> 32);
+    }
+    s[12] = _mm256_loadu_si256((const __m256i*) lo);
+    s[13] = _mm256_loadu_si256((const __m256i*) hi);
+    for (i = 0; i < 16; i++)
+      x[i] = s[i];
+    for (i = 8; i > 0; i -= 2) {
+      VDOUBLEROUND(_mm256_add_epi32, _mm256_xor_si256, AVX2_ROT16, AVX2_ROT12, AVX2_ROT8, AVX2_ROT7, x)
+    }
+    for (i = 0; i < 16; i++)
+      x[i] = _mm256_add_epi32(x[i], s[i]);
+    /* transpose each half of the state (words 0-7, then 8-15) into 32 bytes of each block */
+    for (h = 0; h < 2; h++) {
+      __m256i* w = x + h * 8;
+      __m256i t0 = _mm256_unpacklo_epi32(w[0], w[1]), t1 = _mm256_unpackhi_epi32(w[0], w[1]);
+      __m256i t2 = _mm256_unpacklo_epi32(w[2], w[3]), t3 = _mm256_unpackhi_epi32(w[2], w[3]);
+      __m256i t4 = _mm256_unpacklo_epi32(w[4], w[5]), t5 = _mm256_unpackhi_epi32(w[4], w[5]);
+      __m256i t6 = _mm256_unpacklo_epi32(w[6], w[7]), t7 = _mm256_unpackhi_epi32(w[6], w[7]);
+      __m256i u[4], v[4], b[8];
+      u[0] = _mm256_unpacklo_epi64(t0, t2); /* words 0-3 of blocks 0 and 4 */
+      u[1] = _mm256_unpackhi_epi64(t0, t2); /* blocks 1 and 5 */
+      u[2] = _mm256_unpacklo_epi64(t1, t3); /* blocks 2 and 6 */
+      u[3] = _mm256_unpackhi_epi64(t1, t3); /* blocks 3 and 7 */
+      v[0] = _mm256_unpacklo_epi64(t4, t6); /* words 4-7 */
+      v[1] = _mm256_unpackhi_epi64(t4, t6);
+      v[2] = _mm256_unpacklo_epi64(t5, t7);
+      v[3] = _mm256_unpackhi_epi64(t5, t7);
+      for (i = 0; i < 4; i++) {
+        b[i] = _mm256_permute2x128_si256(u[i], v[i], 0x20);
+        b[i + 4] = _mm256_permute2x128_si256(u[i], v[i], 0x31);
+      }
+      for (i = 0; i < 8; i++) {
+        __m256i* p = (__m256i*) (out + i * 64 + h * 32);
+        _mm256_storeu_si256(p, _mm256_xor_si256(b[i], _mm256_loadu_si256((const __m256i*) (in + i * 64 + h * 32))));
+      }
+    }
+  }
+}
+
+static int chacha8_has_avx2(void) {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7)
+    return 0;
+  __cpuid(info, 1);
+  /* the OS must save the ymm registers */
+  if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6)
+    return 0;
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+static int chacha8_level = -1;
+
+int chacha8_simd(int level) {
+  int available = 0;
+#ifdef CHACHA8_SSE2
+  available = 1;
+#endif
+#ifdef CHACHA8_AVX2
+  if (chacha8_has_avx2())
+    available = 2;
+#endif
+  if (level < 0 || level > available)
+    level = available;
+  chacha8_level = level;
+  return level;
+}
+
+void chacha8(const void* data, size_t length, const uint8_t* key, const uint8_t* iv, char* cipher) {
+  uint64_t counter = 0;
+#ifdef CHACHA8_SSE2
+  int level = chacha8_level;
+  uint32_t j[16];
+  size_t done;
+  if (level < 0)
+    level = chacha8_simd(-1);
+  if (length >= 256 && level > 0) {
+    chacha8_init(j, key, iv);
+#ifdef CHACHA8_AVX2
+    if (level > 1 && length >= 512) {
+      done = length & ~(size_t) 511;
+      chacha8_avx2((const uint8_t*) data, done, j, counter, (uint8_t*) cipher);
+      data = (const uint8_t*) data + done;
+      cipher += done;
+      length -= done;
+      counter += done / 64;
+    }
+#endif
+    if (length >= 256) {
+      done = length & ~(size_t) 255;
+      chacha8_sse2((const uint8_t*) data, done, j, counter, (uint8_t*) cipher);
+      data = (const uint8_t*) data + done;
+      cipher += done;
+      length -= done;
+      counter += done / 64;
+    }
+  }
+#endif
+  chacha8_scalar(data, length, key, iv, cipher, counter);
+}
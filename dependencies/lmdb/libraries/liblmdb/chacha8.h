@@ -4,6 +4,9 @@
 extern "C" {
 #endif
 void chacha8(const void* data, size_t length, const uint8_t* key, const uint8_t* iv, char* cipher);
+/* Select the SIMD implementation: 0 for the portable code, 1 for SSE2 and 2 for AVX2,
+ * or -1 for the best available. Returns the level that will be used. */
+int chacha8_simd(int level);
 
 #define CHACHA8_KEY_SIZE 32
 #define CHACHA8_IV_SIZE 8
@@ -557,6 +557,21 @@ typedef struct MDB_metrics {
 	uint64_t time_sync;
 } MDB_metrics;
 
+/** @brief Statistics for the chunk cache, see #mdb_env_rpage_stat() */
+typedef struct MDB_rpage_stat {
+	unsigned int	rs_chunk;	/**< Pages per chunk */
+	unsigned int	rs_txn_size;	/**< Chunks per transaction list */
+	unsigned int	rs_env_size;	/**< Chunks in the env list */
+	unsigned int	rs_cached;	/**< Chunks currently in the env list */
+	mdb_size_t	rs_txn_hits;	/**< Lookups found in the transaction's list */
+	mdb_size_t	rs_env_hits;	/**< Lookups found in the env list */
+	mdb_size_t	rs_misses;	/**< Lookups that mapped a new chunk */
+	mdb_size_t	rs_maps;	/**< mmap calls, including remaps for overflow pages */
+	mdb_size_t	rs_unmaps;	/**< munmap calls */
+	mdb_size_t	rs_decrypts;	/**< Pages (or overflow pages) decrypted */
+	mdb_size_t	rs_decrypted_bytes;	/**< Bytes decrypted */
+} MDB_rpage_stat;
+
 /** @brief Statistics for a database in the environment */
 typedef struct MDB_stat {
 	unsigned int	ms_psize;			/**< Size of a database page.
@@ -578,6 +593,45 @@ typedef struct MDB_envinfo {
 	unsigned int me_numreaders;		/**< max reader slots used in the environment */
 } MDB_envinfo;
 
+/** @brief Results of an incremental compaction step, see #mdb_txn_compact() */
+typedef struct MDB_compact_stat {
+	mdb_size_t	cs_target;		/**< Page number that the used pages are being moved below */
+	mdb_size_t	cs_relocated;	/**< Number of pages relocated in this step */
+	mdb_size_t	cs_remaining;	/**< Estimated number of pages at or after the target that are left to relocate */
+	mdb_size_t	cs_truncated;	/**< Number of free pages removed from the end of the file */
+} MDB_compact_stat;
+
+/** @brief A callback function for the progress of #mdb_txn_warm().
+ *
+ * @param[in] ctx The context passed to #mdb_txn_warm()
+ * @param[in] warmed The number of pages prefaulted so far
+ * @param[in] total The number of pages that will be prefaulted (estimated
+ * from the database statistics and the budget)
+ */
+typedef void (MDB_warm_func)(void *ctx, mdb_size_t warmed, mdb_size_t total);
+
+/** @brief Page types in #MDB_residency */
+enum MDB_res_type {
+	MDB_RES_BRANCH,
+	MDB_RES_LEAF,
+	MDB_RES_OVERFLOW,
+	MDB_RES_TYPES
+};
+
+/** @brief Lock leaf pages too, for #mdb_txn_pin() */
+#define MDB_PIN_LEAVES	1
+
+/** @brief Depths reported in #MDB_residency, deeper pages are counted in the last one */
+#define MDB_RESIDENCY_DEPTHS	16
+
+/** @brief Page cache residency of a database, see #mdb_txn_residency() */
+typedef struct MDB_residency {
+	mdb_size_t	mr_pages[MDB_RES_TYPES];	/**< Number of pages by #MDB_res_type */
+	mdb_size_t	mr_resident[MDB_RES_TYPES];	/**< Number of those pages that are resident */
+	mdb_size_t	mr_depth_pages[MDB_RESIDENCY_DEPTHS];	/**< Number of branch and leaf pages by depth (0 is the root) */
+	mdb_size_t	mr_depth_resident[MDB_RESIDENCY_DEPTHS];	/**< Number of those pages that are resident */
+} MDB_residency;
+
 	/** @brief Return the LMDB library version information.
 	 *
 	 * @param[out] major if non-NULL, the library major version number is copied here
@@ -816,6 +870,74 @@ int  mdb_env_copy2(MDB_env *env, const char *path, unsigned int flags);
 	 */
 int  mdb_env_copyfd2(MDB_env *env, mdb_filehandle_t fd, unsigned int flags);
 
+	/** @brief Copy an LMDB environment to the specified path, with options
+	 *	and a number of threads for compaction.
+	 *
+	 * With #MDB_CP_COMPACT and more than one thread, the main DB and each
+	 * named DB are split into subtrees which are counted and then copied
+	 * in parallel, each to its preassigned range of pages, followed by the
+	 * branch pages above them. Otherwise, or if the environment remaps its
+	 * pages (encryption), this is the same as #mdb_env_copy2().
+	 * @param[in] env An environment handle returned by #mdb_env_create(). It
+	 * must have already been opened successfully.
+	 * @param[in] path The directory in which the copy will reside. See
+	 * #mdb_env_copy2().
+	 * @param[in] flags Special options for this operation. See #mdb_env_copy2().
+	 * @param[in] threads The number of threads to use, up to 64.
+	 * @return A non-zero error value on failure and 0 on success.
+	 */
+int  mdb_env_copy3(MDB_env *env, const char *path, unsigned int flags, int threads);
+
+	/** @brief Copy an LMDB environment to the specified file descriptor,
+	 *	with options and a number of threads for compaction.
+	 *
+	 * See #mdb_env_copy3(). A parallel copy writes at explicit offsets, so
+	 * copies to a pipe or socket are made by a single thread.
+	 * @param[in] env An environment handle returned by #mdb_env_create(). It
+	 * must have already been opened successfully.
+	 * @param[in] fd The filedescriptor to write the copy to. It must
+	 * have already been opened for Write access.
+	 * @param[in] flags Special options for this operation. See #mdb_env_copy2().
+	 * @param[in] threads The number of threads to use, up to 64.
+	 * @return A non-zero error value on failure and 0 on success.
+	 */
+int  mdb_env_copyfd3(MDB_env *env, mdb_filehandle_t fd, unsigned int flags, int threads);
+
+	/** @brief Write an incremental backup of an LMDB environment.
+	 *
+	 * Only the pages of the current snapshot that were written by transactions
+	 * newer than \b since are copied, along with the snapshot's meta page, so
+	 * the backup is about the size of the changes since that transaction.
+	 * A \b since of 0 produces a full backup. Apply backups in order with
+	 * #mdb_env_restore_incr().
+	 * @param[in] env An environment handle returned by #mdb_env_create(). It
+	 * must have already been opened successfully.
+	 * @param[in] path The file to write the backup to. It must not exist.
+	 * @param[in] since The txnid of the previous backup in the chain.
+	 * @param[out] txnid The txnid of the snapshot that was backed up, to be
+	 * used as \b since for the next backup.
+	 * @return A non-zero error value on failure and 0 on success.
+	 */
+int  mdb_env_copy_incr(MDB_env *env, const char *path, mdb_size_t since, mdb_size_t *txnid);
+
+	/** @brief Apply an incremental backup to a copy of an environment.
+	 *
+	 * The data file at \b path must be a full copy (#mdb_env_copy2() without
+	 * compaction) or a restore of the same environment, at a txnid between
+	 * the backup's base and snapshot, or must not exist yet for a backup made
+	 * with a \b since of 0. The environment must not be open while restoring.
+	 * @param[in] path The data file to restore into.
+	 * @param[in] incr_path The incremental backup file from #mdb_env_copy_incr().
+	 * @param[out] txnid The txnid of the restored snapshot.
+	 * @return A non-zero error value on failure and 0 on success. Some possible
+	 * errors are:
+	 * <ul>
+	 *	<li>#MDB_INVALID - a file is not an LMDB backup or data file.
+	 *	<li>#MDB_INCOMPATIBLE - the backup does not follow the data file's txnid.
+	 * </ul>
+	 */
+int  mdb_env_restore_incr(const char *path, const char *incr_path, mdb_size_t *txnid);
+
 	/** @brief Return statistics about the LMDB environment.
 	 *
 	 * @param[in] env An environment handle returned by #mdb_env_create()
@@ -1047,6 +1169,33 @@ void *mdb_env_get_userctx(MDB_env *env);
  */
 MDB_metrics *mdb_env_get_metrics(MDB_env *env);
 
+/** @brief Use io_uring to write the pages of each commit.
+ *
+ * All of a commit's page writes are submitted as one batch, with the data sync
+ * queued behind them, instead of issuing them one writev() at a time. This is only
+ * available on Linux, and the kernel support is detected when it is enabled.
+ * @param[in] env An environment handle returned by #mdb_env_create()
+ * @param[in] depth The submission queue depth, or 0 to disable io_uring.
+ * @return A non-zero error value on failure and 0 on success. ENOTSUP indicates
+ * it was not built with io_uring support, and errors from setting up the ring (like
+ * ENOSYS or EPERM) indicate it isn't available, in which case pwritev() is still used.
+ */
+int mdb_env_set_io_uring(MDB_env *env, unsigned int depth);
+
+/** @brief Start writeback of the pages of each commit as soon as they are written.
+ *
+ * Each flush of dirty pages is followed by sync_file_range(SYNC_FILE_RANGE_WRITE) on the
+ * file ranges it wrote, and with #MDB_OVERLAPPINGSYNC, a commit waits for its own ranges
+ * to be written before taking the sync lock, so the data sync that follows mostly has to
+ * flush the disk cache. The data sync is still needed for durability. This is only
+ * available on Linux.
+ * @param[in] env An environment handle returned by #mdb_env_create()
+ * @param[in] enable Non-zero to enable early writeback, zero to disable it.
+ * @return A non-zero error value on failure and 0 on success. ENOTSUP indicates
+ * it was not built with sync_file_range() support.
+ */
+int mdb_env_set_early_writeback(MDB_env *env, int enable);
+
 /** @brief A callback function for most LMDB assert() failures,
  * called before printing the message and aborting.
  *
@@ -1071,6 +1220,40 @@ typedef void (MDB_txn_visible)(const void* ctx, int finished);
 int mdb_env_set_callback(MDB_env *env, MDB_check_fd *func);
 int mdb_txn_set_callback(MDB_txn *txn, MDB_txn_visible *func, void* ctx);
 int	mdb_env_set_freespace_options(MDB_env *env, unsigned int max_to_load, unsigned int max_to_retain);
+
+/** @brief A callback function for a commit that needs to be synced, see #mdb_env_set_sync_scheduler()
+ *
+ * @param[in] ctx The context passed to #mdb_env_set_sync_scheduler()
+ * @param[in] txnid The id of the transaction that was committed
+ */
+typedef void (MDB_sync_request)(void *ctx, mdb_size_t txnid);
+
+	/** @brief Schedule the syncs of commits with #MDB_OVERLAPPINGSYNC.
+	 *
+	 * Instead of syncing after each commit (with #MDB_NOSYNC) when the
+	 * environment has #MDB_OVERLAPPINGSYNC, the commit calls \b func with
+	 * its transaction id once it is visible and the write lock is released,
+	 * and the transaction is only made durable by a later #mdb_env_sync(),
+	 * which syncs all the commits made before it. This lets a background
+	 * thread sync a group of commits at a time. A big commit (or one with a
+	 * big backlog of unsynced commits) still waits for a sync in progress
+	 * before the next transaction can start.
+	 * @param[in] env An environment handle returned by #mdb_env_create()
+	 * @param[in] func An #MDB_sync_request function, or NULL to sync after each commit again
+	 * @param[in] ctx A context for the function
+	 * @return A non-zero error value on failure and 0 on success.
+	 */
+int mdb_env_set_sync_scheduler(MDB_env *env, MDB_sync_request *func, void *ctx);
+
+	/** @brief Retrieve the name of a database handle.
+	 *
+	 * @param[in] txn A transaction handle returned by #mdb_txn_begin()
+	 * @param[in] dbi A database handle returned by #mdb_dbi_open()
+	 * @param[out] name The name of the database, which is empty for the main database.
+	 * The name remains valid until the handle is closed.
+	 * @return A non-zero error value on failure and 0 on success.
+	 */
+int mdb_dbi_name(MDB_txn *txn, MDB_dbi dbi, MDB_val *name);
 //</lmdb-js>
 
 #if MDB_RPAGE_CACHE
@@ -1090,13 +1273,44 @@ int mdb_env_set_encrypt(MDB_env *env, MDB_enc_func *func, const MDB_val *key, un
 
 	/** @brief Set checksums on an environment.
 	 *
-	 * This must be called before #mdb_env_open().
+	 * This must be called before #mdb_env_open(). The checksums are
+	 * verified when pages are remapped (see #MDB_REMAP_CHUNKS), and by
+	 * #mdb_txn_verify(). They can't be used with #MDB_WRITEMAP.
 	 * @param[in] env An environment handle returned by #mdb_env_create().
 	 * @param[in] func An #MDB_sum_func function.
 	 * @param[in] size The size of computed checksum values, in bytes.
 	 * @return A non-zero error value on failure and 0 on success.
 	 */
 int mdb_env_set_checksum(MDB_env *env, MDB_sum_func *func, unsigned int size);
+
+	/** @brief Size the chunk cache used with #MDB_REMAP_CHUNKS and encryption.
+	 *
+	 * Read-only pages are mapped (and decrypted) a chunk at a time, and the chunks
+	 * are tracked in a list per transaction and in a list shared by the env.
+	 * This must be called before #mdb_env_open(). Pass 0 for any value to keep
+	 * its default.
+	 * @param[in] env An environment handle returned by #mdb_env_create().
+	 * @param[in] chunk The number of pages per chunk, a power of 2 no larger than
+	 * the default of 16. On Windows it is raised as needed so that chunks are
+	 * 64KB aligned.
+	 * @param[in] txn_chunks The number of chunks a transaction may reference,
+	 * 4096 by default.
+	 * @param[in] env_chunks The number of chunks kept mapped by the env, 16384
+	 * by default. This must be at least txn_chunks.
+	 * @return A non-zero error value on failure and 0 on success.
+	 */
+int mdb_env_set_rpage_cache(MDB_env *env, unsigned int chunk, unsigned int txn_chunks, unsigned int env_chunks);
+
+	/** @brief Return the chunk cache settings and counters of an environment.
+	 *
+	 * Counters are updated when each transaction ends, so a running
+	 * transaction's accesses are not yet included.
+	 * @param[in] env An environment handle returned by #mdb_env_create().
+	 * @param[out] stat The address of an #MDB_rpage_stat structure
+	 * where the statistics will be copied.
+	 * @return A non-zero error value on failure and 0 on success.
+	 */
+int mdb_env_rpage_stat(MDB_env *env, MDB_rpage_stat *stat);
 #endif
 
 	/** @brief Create a transaction for use with the environment.
@@ -1349,6 +1563,123 @@ void mdb_dbi_close(MDB_env *env, MDB_dbi dbi);
 	 */
 int  mdb_drop(MDB_txn *txn, MDB_dbi dbi, int del);
 
+	/** @brief Run a step of online, incremental compaction.
+	 *
+	 * Relocates pages (and the paths to them) from the end of the file into
+	 * free pages nearer the front, across all databases in the environment,
+	 * up to the given number of pages. Each step continues the walk of the
+	 * databases from the key where the previous step in the environment
+	 * stopped. Once a whole walk finds nothing left to relocate, a step in a
+	 * new transaction with no other changes removes the free pages at the end
+	 * of the file from the freelist, and the file is truncated after the
+	 * transaction commits. Pages can only be removed once there are no
+	 * readers that may still be using them.
+	 * Named databases that are not open are opened for the step and closed
+	 * again. For the rest of the transaction, pages are only reused from
+	 * before the compaction target.
+	 * @param[in] txn A write transaction handle returned by #mdb_txn_begin(), not nested
+	 * @param[in] max_pages The maximum number of pages to relocate in this step
+	 * @param[out] stat The results of this step
+	 * @return A non-zero error value on failure and 0 on success.
+	 */
+int  mdb_txn_compact(MDB_txn *txn, mdb_size_t max_pages, MDB_compact_stat *stat);
+
+	/** @brief Prefault the pages of databases into the page cache.
+	 *
+	 * Walks the branch pages of the databases a level at a time, and then
+	 * the leaf pages below them, until the budget is used up, so the most
+	 * frequently used pages are loaded first. Each level, and then the leaves
+	 * (in batches), are read ahead in page order by several threads, with
+	 * madvise(MADV_WILLNEED) and touching the map, or by reading the file
+	 * when pages are remapped. Overflow pages and the pages of sorted
+	 * duplicates are not prefaulted.
+	 * @param[in] txn A transaction handle returned by #mdb_txn_begin()
+	 * @param[in] dbis The databases to prefault, in order of priority
+	 * @param[in] ndbis The number of databases
+	 * @param[in] budget The maximum number of bytes to prefault, or 0 for all of them
+	 * @param[in] threads The number of threads to use, up to 64
+	 * @param[in] progress An optional function called after each level and batch
+	 * @param[in] ctx A context for the progress function
+	 * @return A non-zero error value on failure and 0 on success.
+	 */
+int  mdb_txn_warm(MDB_txn *txn, MDB_dbi *dbis, unsigned int ndbis, mdb_size_t budget, int threads,
+	MDB_warm_func *progress, void *ctx);
+
+	/** @brief Report how much of databases is resident in the page cache.
+	 *
+	 * Takes a snapshot of the residency of the file with mincore(), and then
+	 * walks the databases to count their resident pages by type and depth.
+	 * Branch pages are read for the walk (after the snapshot), but leaf pages
+	 * that aren't resident are read (for their overflow pages and sorted
+	 * duplicates) from the file instead of the map, and then dropped from
+	 * the page cache again. Pages of sorted duplicates are counted by type
+	 * but not by depth. Not supported on Windows or with remapped (encrypted) pages.
+	 * @param[in] txn A transaction handle returned by #mdb_txn_begin()
+	 * @param[in] dbis The databases to report on
+	 * @param[in] ndbis The number of databases
+	 * @param[in] sample Only walk one in this many leaf pages, counting each of
+	 * them (and their overflow pages) this many times, or 0 or 1 for all of them
+	 * @param[out] res An array of ndbis results
+	 * @param[out] file_pages If non-NULL, the number of pages in use in the file
+	 * @param[out] file_resident If non-NULL, the number of those pages that are resident
+	 * @return A non-zero error value on failure and 0 on success. Some possible
+	 * errors are:
+	 * <ul>
+	 *	<li>#MDB_INCOMPATIBLE - residency isn't available on this platform or environment.
+	 * </ul>
+	 */
+int  mdb_txn_residency(MDB_txn *txn, MDB_dbi *dbis, unsigned int ndbis, unsigned int sample,
+	MDB_residency *res, mdb_size_t *file_pages, mdb_size_t *file_resident);
+
+	/** @brief Lock the top pages of databases in memory.
+	 *
+	 * Walks the branch pages of the databases a level at a time (and then
+	 * the leaf pages below them, with #MDB_PIN_LEAVES) until the budget is
+	 * used up, and locks them in memory with mlock(), so that they stay
+	 * resident under memory pressure. The pages that were locked by a
+	 * previous call that are no longer in use are unlocked, so calling this
+	 * again after commits (which copy the pages that they change) keeps the
+	 * current pages pinned. Calling this with no databases unlocks them all.
+	 * Locking is limited by RLIMIT_MEMLOCK; if it fails, the pages that were
+	 * locked stay locked and the error is returned. This must not be called
+	 * concurrently for the same environment. Not supported with remapped
+	 * (encrypted) pages.
+	 * @param[in] txn A transaction handle returned by #mdb_txn_begin()
+	 * @param[in] dbis The databases to pin, in order of priority
+	 * @param[in] ndbis The number of databases
+	 * @param[in] budget The maximum number of bytes to lock, or 0 for no limit
+	 * @param[in] flags Special options for this operation:
+	 * <ul>
+	 *	<li>#MDB_PIN_LEAVES
+	 *		Also lock leaf pages, after all the branch pages.
+	 * </ul>
+	 * @param[out] pinned If non-NULL, the number of bytes that are locked
+	 * @return A non-zero error value on failure and 0 on success.
+	 */
+int  mdb_txn_pin(MDB_txn *txn, MDB_dbi *dbis, unsigned int ndbis, mdb_size_t budget, unsigned int flags,
+	mdb_size_t *pinned);
+
+	/** @brief Check every reachable page of an environment.
+	 *
+	 * Walks the free DB, the main DB and all the named DBs, including their
+	 * sorted duplicates and overflow pages, and checks the page numbers,
+	 * types and node bounds of each page, and its checksum if the environment
+	 * has them (see #mdb_env_set_checksum()). The top levels are checked
+	 * first, and the subtrees below them are then shared by several threads,
+	 * which read the map directly, or the file when pages are remapped.
+	 * Pages below a corrupt page are not checked.
+	 * @param[in] txn A read-only transaction handle returned by #mdb_txn_begin()
+	 * @param[in] threads The number of threads to use, up to 64
+	 * @param[out] pages If non-NULL, the number of pages checked
+	 * @param[out] bad An array for the lowest corrupt page numbers
+	 * @param[in] max_bad The number of entries in \b bad
+	 * @param[out] nbad If non-NULL, the number of corrupt pages, which may be more than max_bad
+	 * @return A non-zero error value on failure and 0 on success, whether or
+	 * not any corrupt pages were found.
+	 */
+int  mdb_txn_verify(MDB_txn *txn, int threads, mdb_size_t *pages,
+	mdb_size_t *bad, unsigned int max_bad, unsigned int *nbad);
+
 	/** @brief Set a custom key comparison function for a database.
 	 *
 	 * The comparison function is called whenever it is necessary to compare a
@@ -114,6 +114,16 @@ static NtCloseFunc *NtClose;
 #if defined(__APPLE__) || defined(__MACH__)
 #include <sys/sysctl.h>
 #endif
+/*<lmdb-js>*/
+/** sync_file_range() is used (if enabled with #mdb_env_set_early_writeback()) to start
+ *	writeback of each commit's pages as soon as they are written.
+ */
+#if defined(__linux__) && defined(SYNC_FILE_RANGE_WRITE)
+# define MDB_SYNC_RANGES	1
+	/** Number of file ranges tracked for a write txn, beyond this they are merged */
+# define MDB_WB_RANGES	64
+#endif
+/*</lmdb-js>*/
 
 #if defined(__mips) && defined(__linux)
 /* MIPS has cache coherency issues, requires explicit cache control */
@@ -149,6 +159,19 @@ typedef SSIZE_T	ssize_t;
 #include <unistd.h>
 #endif
 
+/*<lmdb-js>*/
+/** io_uring is used (if enabled with #mdb_env_set_io_uring()) to submit all the page
+ *	writes of a commit at once. We use the raw syscalls so there is no dependency on liburing.
+ */
+#if defined(__linux__) && !defined(MDB_NO_IO_URING) && defined(__has_include)
+# if __has_include(<linux/io_uring.h>)
+#  define MDB_IO_URING	1
+#  include <linux/io_uring.h>
+#  include <sys/syscall.h>
+# endif
+#endif
+/*</lmdb-js>*/
+
 #if defined(__sun) || defined(__ANDROID__)
 /* Most platforms have posix_memalign, older may only have memalign */
 #define HAVE_MEMALIGN	1
@@ -1114,6 +1137,15 @@ typedef struct MDB_dovpage {
 	/** The number of overflow pages needed to store the given size. */
 #define OVPAGES(size, psize)	((PAGEHDRSZ-1 + (size)) / (psize) + 1)
 
+	/** Bytes reserved at the end of each page (or overflow page) for its
+	 *	checksum and authentication data.
+	 */
+#if MDB_RPAGE_CACHE
+#define PAGETAIL(env)	((env)->me_sumsize + (env)->me_esumsize)
+#else
+#define PAGETAIL(env)	0
+#endif
+
 	/** Link in #MDB_txn.%mt_loose_pgs list.
 	 *  Kept outside the page header, which is needed when reusing the page.
 	 */
@@ -1357,6 +1389,7 @@ struct MDB_txn {
 #if MDB_RPAGE_CACHE
 	pgno_t		mt_last_pgno;	/**< last written page */
 #endif
+	pgno_t		mt_compact_limit;	/**< if set, only reuse free pages before this */
 	/** The ID of this transaction. IDs are integers incrementing from 1.
 	 *	Only committed write transactions increment the ID. If a transaction
 	 *	aborts, the ID may be re-used by the next writer.
@@ -1432,15 +1465,17 @@ struct MDB_txn {
 #if MDB_RPAGE_CACHE
 	/** List of read-only pages (actually chunks) */
 	MDB_ID3L	mt_rpages;
-	/** We map chunks of 16 pages. Even though Windows uses 4KB pages, all
-	 * mappings must begin on 64KB boundaries. So we round off all pgnos to
-	 * a chunk boundary. We do the same on Linux for symmetry, and also to
-	 * reduce the frequency of mmap/munmap calls.
+	/** By default we map chunks of 16 pages. Even though Windows uses 4KB
+	 * pages, all mappings must begin on 64KB boundaries. So we round off all
+	 * pgnos to a chunk boundary. We do the same on Linux for symmetry, and
+	 * also to reduce the frequency of mmap/munmap calls. The chunk size can
+	 * be lowered with #mdb_env_set_rpage_cache(), but not raised, since
+	 * #MDB_ID3.muse has one bit per page of a chunk.
 	 */
 #define MDB_RPAGE_CHUNK	16
-#define MDB_TRPAGE_SIZE	4096	/**< size of #mt_rpages array of chunks */
-#define MDB_TRPAGE_MAX	(MDB_TRPAGE_SIZE-1)	/**< maximum chunk index */
+#define MDB_TRPAGE_SIZE	4096	/**< default size of #mt_rpages array of chunks */
 	unsigned int mt_rpcheck;	/**< threshold for reclaiming unref'd chunks */
+	MDB_rpage_stat	mt_rpstat;	/**< cache counters, added to the env's at txn end */
 #endif
 	/**	Number of DB records in use, or 0 when the txn is finished.
 	 *	This number only ever increments until the txn finishes; we
@@ -1465,6 +1500,9 @@ struct MDB_txn {
 #define MDB_TXN_SPILLS		0x08		/**< txn or a parent has spilled pages */
 #define MDB_TXN_HAS_CHILD	0x10		/**< txn has an #MDB_txn.%mt_child */
 #define MDB_TXN_DIRTYNUM	0x20		/**< dirty list uses nump list */
+#define MDB_TXN_FLUSH_SYNC	0x40		/**< page flush should sync the data (and remains set if it did) */
+#define MDB_TXN_NOFREELIST	0x80		/**< don't load more of the freeDB into me_pghead */
+#define MDB_TXN_TRUNCATE	0x100		/**< truncate the file to mt_next_pgno after commit */
 	/** most operations on the txn are currently illegal */
 #define MDB_TXN_BLOCKED		(MDB_TXN_FINISHED|MDB_TXN_ERROR|MDB_TXN_HAS_CHILD)
 /** @} */
@@ -1598,6 +1636,31 @@ struct MDB_last_map {
 	mdb_size_t		mapsize;
 };
 typedef struct MDB_last_map MDB_last_map;
+#ifdef MDB_IO_URING
+	/** An io_uring instance for writing pages */
+typedef struct MDB_uring {
+	int		ur_fd;
+	unsigned	ur_entries;		/**< submission queue depth */
+	unsigned	*ur_sq_head;
+	unsigned	*ur_sq_tail;
+	unsigned	*ur_sq_mask;
+	unsigned	*ur_sq_array;
+	unsigned	*ur_cq_head;
+	unsigned	*ur_cq_tail;
+	unsigned	*ur_cq_mask;
+	struct io_uring_sqe	*ur_sqes;
+	struct io_uring_cqe	*ur_cqes;
+	void	*ur_sq_ring;
+	void	*ur_cq_ring;
+	size_t	ur_sq_ring_size;
+	size_t	ur_cq_ring_size;
+	/** iovecs for all the writes of a flush, they must remain valid until the writes complete */
+	struct iovec	*ur_iov;
+	unsigned	ur_iov_size;
+	unsigned	ur_queued;		/**< sqes that haven't been submitted */
+	unsigned	ur_inflight;	/**< submitted sqes that haven't completed */
+} MDB_uring;
+#endif
 /*</lmdb-js>*/
 	/** The database environment. */
 struct MDB_env {
@@ -1654,6 +1717,9 @@ struct MDB_env {
 #	define		me_freelist_position	me_pgstate.mf_position
 #	define		me_freelist_written_start	me_pgstate.mf_written_start
 #	define		me_freelist_written_end	me_pgstate.mf_written_end
+	MDB_IDL_RUNS	me_pgruns;		/**< index of the runs in me_pghead, for large free lists */
+	/** Mark #me_pgruns stale after me_pghead is replaced or changed outside #mdb_page_alloc() */
+#	define		MDB_PGRUNS_RESET(env)	((env)->me_pgruns.ir_ids = NULL)
 	unsigned int me_maxfreepgs_to_load; /**< max freelist entries to load into memory */
 	unsigned int me_maxfreepgs_to_retain; /**< max freelist entries to load into memory */
 	int			me_freelist_state;		/**< state of writing freelist (if it is being deleted) */
@@ -1678,6 +1744,20 @@ struct MDB_env {
 	OVERLAPPED		*me_ov;			/**< Used for overlapping I/O requests */
 	int		me_ovs;				/**< Count of MDB_overlaps */
 #endif
+#ifdef MDB_IO_URING
+	MDB_uring	*me_uring;		/**< Used for batched page writes, if enabled */
+#endif
+#ifdef MDB_SYNC_RANGES
+	int		me_wb_enabled;		/**< Start writeback of pages when they are flushed */
+	unsigned	me_wb_nranges;		/**< Number of ranges in #me_wb_ranges */
+	/** Start and end offsets of the file ranges written by the current write txn */
+	MDB_OFF_T	me_wb_ranges[MDB_WB_RANGES * 2];
+#endif
+	pgno_t		*me_pins;		/**< Sorted pages locked by #mdb_txn_pin() */
+	unsigned	me_npins;
+	char		*me_pinmap;		/**< The map that the pages were locked in */
+	MDB_val		me_compact_db;	/**< The named DB that #mdb_txn_compact() stopped in, or NULL for the main DB */
+	MDB_val		me_compact_key;	/**< The key that #mdb_txn_compact() resumes at, or NULL to start over */
 #ifdef MDB_USE_POSIX_MUTEX	/* Posix mutexes reside in shared mem */
 #	define		me_rmutex	me_txns->mti_rmutex /**< Shared reader lock */
 #	define		me_wmutex	me_txns->mti_wmutex /**< Shared writer lock */
@@ -1692,15 +1772,20 @@ struct MDB_env {
 # endif
 #endif
 	mdb_size_t me_synced_txn_id;
+	MDB_sync_request *me_sync_request;	/**< Schedules syncs with #MDB_OVERLAPPINGSYNC */
+	void		*me_sync_ctx;
 #if MDB_RPAGE_CACHE
 	MDB_ID3L	me_rpages;	/**< like #mt_rpages, but global to env */
 	pthread_mutex_t	me_rpmutex;	/**< control access to #me_rpages */
 	MDB_sum_func *me_sumfunc;	/**< checksum env data */
 	unsigned short me_sumsize;	/**< size of per-page checksums */
-#define MDB_ERPAGE_SIZE	16384
-#define MDB_ERPAGE_MAX	(MDB_ERPAGE_SIZE-1)
+#define MDB_ERPAGE_SIZE	16384	/**< default size of #me_rpages array of chunks */
 	unsigned short me_esumsize;	/**< size of per-page authentication data */
 	unsigned int me_rpcheck;
+	unsigned int me_rpchunk;	/**< pages per mapped chunk, a power of 2 */
+	unsigned int me_trpsize;	/**< size of each txn's #mt_rpages */
+	unsigned int me_erpsize;	/**< size of #me_rpages */
+	MDB_rpage_stat	me_rpstat;	/**< cache counters, protected by #me_rpmutex */
 
 	MDB_enc_func *me_encfunc;	/**< encrypt env data */
 	MDB_val		me_enckey;	/**< key for env encryption */
@@ -1757,6 +1842,7 @@ static void mdb_txn_end(MDB_txn *txn, unsigned mode);
 #if MDB_RPAGE_CACHE
 #define MDB_PAGE_GET(mc, pg, numpgs, mp)	mdb_page_get(mc, pg, numpgs, mp)
 static void mdb_rpage_dispose(MDB_env *env, MDB_ID3 *id3);
+static void mdb_rpage_stat_add(MDB_rpage_stat *dst, const MDB_rpage_stat *src);
 #else
 /* Drop unused numpgs argument when !MDB_RPAGE_CACHE */
 #define MDB_PAGE_GET(mc, pg, numpgs, mp)	mdb_page_get(mc, pg, mp)
@@ -2320,7 +2406,7 @@ mdb_page_unref(MDB_txn *txn, MDB_page *mp)
 	unsigned x, rem;
 	if (IS_SUBP(mp) || IS_DIRTY_NW(txn, mp))
 		return;
-	rem = mp->mp_pgno & (MDB_RPAGE_CHUNK-1);
+	rem = mp->mp_pgno & (txn->mt_env->me_rpchunk-1);
 	pgno = mp->mp_pgno ^ rem;
 	x = mdb_mid3l_search(tl, pgno);
 	if (x != tl[0].mid && tl[x+1].mid == mp->mp_pgno)
@@ -2659,6 +2745,8 @@ mdb_page_dirty(MDB_txn *txn, MDB_page *mp)
 }
 
 const static int MAX_SCAN_SEGMENT = 50;
+/** Number of candidate blocks to consider for a best fit when searching the run index */
+static const int MAX_FIT_CANDIDATES = 8;
 
 /** Allocate page numbers and memory for writing.  Maintain me_freelist_start,
  * me_pghead and mt_next_pgno.  Set #MDB_TXN_ERROR on failure.
@@ -2742,6 +2830,7 @@ mdb_page_alloc(MDB_cursor *mc, int num, MDB_page **mp)
 		goto fail;
 	}
 	unsigned empty_entries = 0;
+	MDB_IDL_RUNS *runs = &env->me_pgruns;
 	unsigned best_fit_start; // this is a block we will use if we don't find an exact fit
 	pgno_t best_fit_size;
 /*	if (c++ % 100000 == 0) {
@@ -2771,6 +2860,66 @@ restart_search:
 		unsigned check_point = start + MAX_SCAN_SEGMENT;
 		if (check_point > mop_len) check_point = mop_len;
 		unsigned wrapped = 0;
+		if (mop_len > 2U * MAX_SCAN_SEGMENT && ((runs->ir_ids == mop && runs->ir_len == mop_len) ||
+				!mdb_midl_runs_build(runs, mop))) {
+			// a large (fragmented) free list, use the run index to go directly to the blocks that are big enough
+			// instead of scanning through all the entries
+			int candidates = 0;
+			unsigned x;
+			for (x = start;; x++) {
+				x = mdb_midl_runs_find(runs, x, num);
+				if (!x || (wrapped && x >= (unsigned) start)) {
+					if (wrapped || start == 1)
+						break;
+					// loop back and continue up to where we started
+					wrapped = 1;
+					x = 0;
+					continue;
+				}
+				i = x;
+				entry = mop[i];
+				if (entry > 0) {
+					pgno = entry;
+					block_size = 1;
+				} else {
+					block_size = -entry;
+					pgno = mop[++i];
+				}
+				if (txn->mt_compact_limit && pgno + num > txn->mt_compact_limit) {
+					x = i;
+					continue;
+				}
+				if (block_size == (unsigned) num) {
+					// we found a block of the right size
+					env->me_freelist_position = i + 1;
+					mop[i] = 0;
+					runs->ir_empty++;
+					if (env->me_freelist_written_end < (int) i) env->me_freelist_written_end = i;
+					if (entry < 1) {
+						mop[--i] = 0;
+						runs->ir_empty++;
+					}
+					mdb_midl_runs_update(runs, i);
+					if (env->me_freelist_written_start > (int) i || !env->me_freelist_written_start)
+						env->me_freelist_written_start = i;
+					goto search_done;
+				}
+				if (block_size < best_fit_size) {
+					best_fit_start = i - 1;
+					best_fit_size = block_size;
+					if ((int) i == 1 - env->me_freelist_position)
+						goto continue_best_fit;
+				}
+				if (++candidates >= MAX_FIT_CANDIDATES)
+					goto continue_best_fit;
+				x = i;
+			}
+			// nothing better than the best fit candidates, count this as a full scan of the list and its empty entries
+			empty_entries = runs->ir_empty;
+			i = start;
+			wrapped = 1;
+			goto scan_done;
+		}
 		// TODO: Don't scan if the list is too small
 		//fprintf(stderr, "loop from %u to %u over %u\n", start, end, mop_len);
 		for (i = start; 1; i++) {
@@ -2811,7 +2960,7 @@ restart_search:
 				pgno = mop[++i];
 			}
 
-			if (block_size >= num) {
+			if (block_size >= num && (!txn->mt_compact_limit || pgno + num <= txn->mt_compact_limit)) {
 				if (block_size == num) {
 					// we found a block of the right size
 					env->me_freelist_position = i + 1;
@@ -2819,6 +2968,7 @@ restart_search:
 					if (env->me_freelist_written_end < i) env->me_freelist_written_end = i;
 					if (entry < 1)
 						mop[--i] = 0;
+					MDB_PGRUNS_RESET(env);
 					if (env->me_freelist_written_start > i || !env->me_freelist_written_start)
 						env->me_freelist_written_start = i;
 					goto search_done;
@@ -2833,10 +2983,12 @@ restart_search:
 				}
 			}
 		}
+		scan_done:
 		// see if there is too many empty entries; after a respread it should be between one third and one quarter full of empty entries
 		if (empty_entries > ((i + (wrapped ? mop_len : 0) - start) / 3) + 10) {
 			unsigned old_length = env->me_pghead[0];
 			mdb_midl_respread(&env->me_pghead);
+			MDB_PGRUNS_RESET(env);
 			mop = env->me_pghead;
 			mop_len = mop[0];
 			// consider the whole free-list to be updated now
@@ -2848,7 +3000,7 @@ restart_search:
 		env->me_freelist_position = i;
 		i = 0;
 
-		if (mop_len > env->me_maxfreepgs_to_load) {
+		if (mop_len > env->me_maxfreepgs_to_load || (txn->mt_flags & MDB_TXN_NOFREELIST)) {
 			//fprintf(stderr, "Too many entries %u, looking for %u, best fit %u, not loading anymore\n", mop_len, num, best_fit_size);
 			//mdb_midl_print(stderr, mop);
 			goto continue_best_fit;
@@ -3012,6 +3164,7 @@ restart_search:
 		if ((rc = mdb_midl_xmerge(&mop, idl)) != 0)
 			goto fail;
 		if (mop != env->me_pghead) env->me_pghead = mop;
+		MDB_PGRUNS_RESET(env);
 		mop_len = mop[0];
 	}
 	continue_best_fit:
@@ -3024,6 +3177,11 @@ restart_search:
 		env->me_freelist_position = -best_fit_start;
 		pgno = mop[++best_fit_start];
 		mop[best_fit_start] += num; // update position
+		if (runs->ir_ids == mop) {
+			if (!mop[best_fit_start - 1])
+				runs->ir_empty++;
+			mdb_midl_runs_update(runs, best_fit_start - 1);
+		}
 		if (env->me_freelist_written_end < best_fit_start) env->me_freelist_written_end = best_fit_start;
 		//fprintf(stderr, "\nusing best fit size %u of %u\n", num, best_fit_size);
 		//env->me_block_size_cache[best_fit_size] = 0; // clear this out of the cache (TODO: could move it)
@@ -3628,6 +3786,7 @@ mdb_txn_renew0(MDB_txn *txn)
 				//fprintf(stderr, "freelist reset, expected txn id %u, db txn id %u\n", txn->mt_txnid, ti->mti_txnid);
 				if (env->me_pghead) mdb_midl_free(env->me_pghead);
 				env->me_pghead = NULL;
+				MDB_PGRUNS_RESET(env);
 				env->me_freelist_start = 0;
 				env->me_freelist_end = 0;
 				env->me_freelist_position = 0;
@@ -3649,6 +3808,9 @@ mdb_txn_renew0(MDB_txn *txn)
 			env->me_metrics.clock_txn = now;
 		}
 		txn->mt_txnid++;
+#ifdef MDB_SYNC_RANGES
+		env->me_wb_nranges = 0;
+#endif
 #if MDB_DEBUG
 		if (txn->mt_txnid == mdb_debug_start)
 			mdb_debug = 1;
@@ -3687,6 +3849,7 @@ mdb_txn_renew0(MDB_txn *txn)
 #endif
 
 	txn->mt_flags = flags;
+	txn->mt_compact_limit = 0;
 
 	/* Setup db info */
 	txn->mt_numdbs = env->me_numdbs;
@@ -3819,19 +3982,20 @@ mdb_txn_begin(MDB_env *env, MDB_txn *parent, unsigned int flags, MDB_txn **ret)
 	}
 #if MDB_RPAGE_CACHE
 	if (MDB_REMAPPING(env->me_flags) && !parent) {
-		txn->mt_rpages = malloc(MDB_TRPAGE_SIZE * sizeof(MDB_ID3));
+		txn->mt_rpages = malloc(env->me_trpsize * sizeof(MDB_ID3));
 		if (!txn->mt_rpages) {
 			free(txn);
 			return ENOMEM;
 		}
 		txn->mt_rpages[0].mid = 0;
-		txn->mt_rpcheck = MDB_TRPAGE_SIZE/2;
+		txn->mt_rpcheck = env->me_trpsize/2;
 	}
 #endif
 	txn->mt_dbxs = env->me_dbxs;	/* static */
 	txn->mt_dbs = (MDB_db *) ((char *)txn + tsize);
 	txn->mt_dbflags = (unsigned char *)txn + size - env->me_maxdbs;
 	txn->mt_flags = flags;
+	txn->mt_compact_limit = 0;
 	txn->mt_env = env;
 
 	if (parent) {
@@ -3880,6 +4044,7 @@ mdb_txn_begin(MDB_env *env, MDB_txn *parent, unsigned int flags, MDB_txn **ret)
 				memcpy(env->me_pghead, ntxn->mnt_pgstate.mf_pghead, size);
 			else
 				rc = ENOMEM;
+			MDB_PGRUNS_RESET(env);
 		}
 		if (!rc)
 			rc = mdb_cursor_shadow(parent, txn);
@@ -4014,6 +4179,7 @@ mdb_txn_end(MDB_txn *txn, unsigned mode)
 				env->me_pghead = NULL;
 				env->me_freelist_start = 0;
 				env->me_freelist_end = 0;
+				MDB_PGRUNS_RESET(env);
 			}
 
 			env->me_txn = NULL;
@@ -4026,6 +4192,7 @@ mdb_txn_end(MDB_txn *txn, unsigned mode)
 			txn->mt_parent->mt_child = NULL;
 			txn->mt_parent->mt_flags &= ~MDB_TXN_HAS_CHILD;
 			env->me_pgstate = ((MDB_ntxn *)txn)->mnt_pgstate;
+			MDB_PGRUNS_RESET(env);
 			mdb_midl_free(txn->mt_free_pgs);
 			free(txn->mt_u.dirty_list);
 		}
@@ -4036,9 +4203,10 @@ mdb_txn_end(MDB_txn *txn, unsigned mode)
 		unsigned i, x, n = tl[0].mid;
 		pthread_mutex_lock(&env->me_rpmutex);
 		for (i = 1; i <= n; i++) {
-			if (tl[i].mid & (MDB_RPAGE_CHUNK-1)) {
+			if (tl[i].mid & (env->me_rpchunk-1)) {
 				/* tmp overflow pages that we didn't share in env */
 				munmap(tl[i].mptr, tl[i].mcnt * env->me_psize);
+				txn->mt_rpstat.rs_unmaps++;
 				if (tl[i].menc) {
 					mdb_rpage_dispose(env, &tl[i]);
 					tl[i].menc = NULL;
@@ -4052,6 +4220,7 @@ mdb_txn_end(MDB_txn *txn, unsigned mode)
 				} else {
 					/* another tmp overflow page */
 					munmap(tl[i].mptr, tl[i].mcnt * env->me_psize);
+					txn->mt_rpstat.rs_unmaps++;
 					if (tl[i].menc) {
 						mdb_rpage_dispose(env, &tl[i]);
 						tl[i].menc = NULL;
@@ -4059,7 +4228,9 @@ mdb_txn_end(MDB_txn *txn, unsigned mode)
 				}
 			}
 		}
+		mdb_rpage_stat_add(&env->me_rpstat, &txn->mt_rpstat);
 		pthread_mutex_unlock(&env->me_rpmutex);
+		memset(&txn->mt_rpstat, 0, sizeof(txn->mt_rpstat));
 		tl[0].mid = 0;
 		if (mode & MDB_END_FREE)
 			free(tl);
@@ -4309,6 +4480,7 @@ mdb_freelist_save(MDB_txn *txn)
 		lost_loose += count;
 		for (; mp; mp = NEXT_LOOSE_PAGE(mp))
 			mdb_midl_append(&env->me_pghead, mp->mp_pgno);
+		MDB_PGRUNS_RESET(env);
 		txn->mt_loose_pgs = NULL;
 		txn->mt_loose_count = 0;
 		mop = env->me_pghead;
@@ -4419,10 +4591,259 @@ mdb_freelist_save(MDB_txn *txn)
 #if MDB_RPAGE_CACHE
 static int mdb_rpage_decrypt(MDB_env *env, MDB_ID3 *id3, int rem, int numpgs);
 static int mdb_page_encrypt(MDB_env *env, MDB_page *in, MDB_page *out, size_t size);
+static int mdb_page_decrypt(MDB_env *env, MDB_page *in, MDB_page *out, size_t size);
 static int mdb_page_chk_checksum(MDB_env *env, MDB_page *mp, size_t size);
 static void mdb_page_set_checksum(MDB_env *env, MDB_page *mp, size_t size);
 #endif
 
+/*<lmdb-js>*/
+#ifdef MDB_IO_URING
+static int mdb_uring_wait(MDB_uring *ur, unsigned max_inflight);
+
+static void
+mdb_uring_close(MDB_uring *ur)
+{
+	if (ur->ur_sqes)
+		munmap(ur->ur_sqes, ur->ur_entries * sizeof(struct io_uring_sqe));
+	if (ur->ur_cq_ring && ur->ur_cq_ring != ur->ur_sq_ring)
+		munmap(ur->ur_cq_ring, ur->ur_cq_ring_size);
+	if (ur->ur_sq_ring)
+		munmap(ur->ur_sq_ring, ur->ur_sq_ring_size);
+	if (ur->ur_fd >= 0)
+		close(ur->ur_fd);
+	free(ur->ur_iov);
+	free(ur);
+}
+
+/** Create an io_uring with the given queue depth.
+ * Fails (and the caller falls back to pwritev) if the kernel doesn't
+ * support io_uring or it is blocked (by seccomp, for example).
+ */
+static int
+mdb_uring_open(unsigned entries, MDB_uring **ret)
+{
+	struct io_uring_params p;
+	MDB_uring *ur;
+	int rc;
+	memset(&p, 0, sizeof(p));
+	ur = calloc(1, sizeof(MDB_uring));
+	if (!ur)
+		return ENOMEM;
+	ur->ur_fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (ur->ur_fd < 0) {
+		rc = ErrCode();
+		free(ur);
+		return rc;
+	}
+	ur->ur_entries = p.sq_entries;
+	ur->ur_sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ur->ur_cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ur->ur_cq_ring_size > ur->ur_sq_ring_size)
+			ur->ur_sq_ring_size = ur->ur_cq_ring_size;
+		ur->ur_cq_ring_size = ur->ur_sq_ring_size;
+	}
+	ur->ur_sq_ring = mmap(NULL, ur->ur_sq_ring_size, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, ur->ur_fd, IORING_OFF_SQ_RING);
+	if (ur->ur_sq_ring == MAP_FAILED) {
+		ur->ur_sq_ring = NULL;
+		goto fail;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ur->ur_cq_ring = ur->ur_sq_ring;
+	} else {
+		ur->ur_cq_ring = mmap(NULL, ur->ur_cq_ring_size, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_POPULATE, ur->ur_fd, IORING_OFF_CQ_RING);
+		if (ur->ur_cq_ring == MAP_FAILED) {
+			ur->ur_cq_ring = NULL;
+			goto fail;
+		}
+	}
+	ur->ur_sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, ur->ur_fd, IORING_OFF_SQES);
+	if (ur->ur_sqes == MAP_FAILED) {
+		ur->ur_sqes = NULL;
+		goto fail;
+	}
+	ur->ur_sq_head = (unsigned *)((char *)ur->ur_sq_ring + p.sq_off.head);
+	ur->ur_sq_tail = (unsigned *)((char *)ur->ur_sq_ring + p.sq_off.tail);
+	ur->ur_sq_mask = (unsigned *)((char *)ur->ur_sq_ring + p.sq_off.ring_mask);
+	ur->ur_sq_array = (unsigned *)((char *)ur->ur_sq_ring + p.sq_off.array);
+	ur->ur_cq_head = (unsigned *)((char *)ur->ur_cq_ring + p.cq_off.head);
+	ur->ur_cq_tail = (unsigned *)((char *)ur->ur_cq_ring + p.cq_off.tail);
+	ur->ur_cq_mask = (unsigned *)((char *)ur->ur_cq_ring + p.cq_off.ring_mask);
+	ur->ur_cqes = (struct io_uring_cqe *)((char *)ur->ur_cq_ring + p.cq_off.cqes);
+	*ret = ur;
+	return MDB_SUCCESS;
+fail:
+	rc = ErrCode();
+	mdb_uring_close(ur);
+	return rc;
+}
+
+/** Get the next submission queue entry, submitting and waiting for
+ * completions if the queue is full.
+ */
+static struct io_uring_sqe *
+mdb_uring_sqe(MDB_uring *ur, int *rc)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail, index;
+	if (ur->ur_queued + ur->ur_inflight >= ur->ur_entries) {
+		*rc = mdb_uring_wait(ur, ur->ur_entries - 1);
+		if (*rc)
+			return NULL;
+	}
+	tail = *ur->ur_sq_tail;
+	index = tail & *ur->ur_sq_mask;
+	sqe = &ur->ur_sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	ur->ur_sq_array[index] = index;
+	__atomic_store_n(ur->ur_sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ur->ur_queued++;
+	return sqe;
+}
+
+/** Submit any queued entries, and wait until no more than max_inflight are still in progress.
+ * Writes record their expected size in user_data, so short writes are detected.
+ * @return the first error from any completed write
+ */
+static int
+mdb_uring_wait(MDB_uring *ur, unsigned max_inflight)
+{
+	int rc = 0, res;
+	unsigned head;
+	struct io_uring_cqe *cqe;
+	for (;;) {
+		/* reap the completions */
+		head = *ur->ur_cq_head;
+		while (head != __atomic_load_n(ur->ur_cq_tail, __ATOMIC_ACQUIRE)) {
+			cqe = &ur->ur_cqes[head & *ur->ur_cq_mask];
+			if (cqe->res < 0) {
+				if (!rc)
+					rc = -cqe->res;
+			} else if ((uint64_t)cqe->res != cqe->user_data && !rc) {
+				rc = EIO;
+				DPUTS("short write, filesystem full?");
+			}
+			head++;
+			ur->ur_inflight--;
+		}
+		__atomic_store_n(ur->ur_cq_head, head, __ATOMIC_RELEASE);
+		if (ur->ur_queued) {
+			/* submit first, so we never wait for more than has been submitted */
+			res = syscall(__NR_io_uring_enter, ur->ur_fd, ur->ur_queued, 0, 0, NULL, 0);
+		} else if (ur->ur_inflight > max_inflight) {
+			res = syscall(__NR_io_uring_enter, ur->ur_fd, 0, ur->ur_inflight - max_inflight,
+				IORING_ENTER_GETEVENTS, NULL, 0);
+		} else
+			return rc;
+		if (res < 0) {
+			res = ErrCode();
+			if (res == EINTR || res == EAGAIN || res == EBUSY)
+				continue;
+			/* the ring itself is broken, nothing that was queued was submitted */
+			*ur->ur_sq_tail -= ur->ur_queued;
+			ur->ur_queued = 0;
+			if (!ur->ur_inflight)
+				return rc ? rc : res;
+			if (!rc)
+				rc = res;
+			continue;
+		}
+		if (ur->ur_queued) {
+			ur->ur_queued -= res;
+			ur->ur_inflight += res;
+		}
+	}
+}
+#endif
+
+int ESECT
+mdb_env_set_io_uring(MDB_env *env, unsigned int depth)
+{
+#ifdef MDB_IO_URING
+	if (!env)
+		return EINVAL;
+	if (env->me_txn)
+		return EINVAL; /* can't switch while writing */
+	if (!depth) {
+		if (env->me_uring) {
+			mdb_uring_close(env->me_uring);
+			env->me_uring = NULL;
+		}
+		return MDB_SUCCESS;
+	}
+	if (env->me_uring)
+		return MDB_SUCCESS;
+	return mdb_uring_open(depth, &env->me_uring);
+#else
+	return ENOTSUP;
+#endif
+}
+
+int ESECT
+mdb_env_set_early_writeback(MDB_env *env, int enable)
+{
+#ifdef MDB_SYNC_RANGES
+	if (!env)
+		return EINVAL;
+	env->me_wb_enabled = enable;
+	return MDB_SUCCESS;
+#else
+	return ENOTSUP;
+#endif
+}
+
+#ifdef MDB_SYNC_RANGES
+/** Add a written file range to the ranges of the current write txn.
+ *	Pages are written in order within a flush, so this usually extends the
+ *	last range. Once the list is full, ranges are merged into the last one,
+ *	which only means waiting on some pages that weren't written.
+ */
+static void
+mdb_wb_add(MDB_env *env, MDB_OFF_T pos, MDB_OFF_T end)
+{
+	MDB_OFF_T *r = env->me_wb_ranges;
+	unsigned n = env->me_wb_nranges;
+	if (n) {
+		MDB_OFF_T *last = r + (n - 1) * 2;
+		if (pos <= last[1] && end >= last[0]) {
+			if (pos < last[0])
+				last[0] = pos;
+			if (end > last[1])
+				last[1] = end;
+			return;
+		}
+		if (n == MDB_WB_RANGES) {
+			if (pos < last[0])
+				last[0] = pos;
+			if (end > last[1])
+				last[1] = end;
+			return;
+		}
+	}
+	r[n * 2] = pos;
+	r[n * 2 + 1] = end;
+	env->me_wb_nranges = n + 1;
+}
+
+/** Start writeback of the given ranges, and with \b wait, wait for it to complete. */
+static void
+mdb_wb_ranges(MDB_env *env, MDB_OFF_T *r, unsigned n, int wait)
+{
+	unsigned flags = wait ?
+		SYNC_FILE_RANGE_WAIT_BEFORE|SYNC_FILE_RANGE_WRITE|SYNC_FILE_RANGE_WAIT_AFTER :
+		SYNC_FILE_RANGE_WRITE;
+	unsigned i;
+	for (i = 0; i < n; i++) {
+		/* this is only an optimization, the data sync still has to follow, so errors are ignored */
+		(void) sync_file_range(env->me_fd, r[i * 2], r[i * 2 + 1] - r[i * 2], flags);
+	}
+}
+#endif
+/*</lmdb-js>*/
+
 /** Flush (some) dirty pages to the map, after clearing their dirty flag.
  * @param[in] txn the transaction that's being committed
  * @param[in] keep number of initial pages in dirty_list to keep dirty.
@@ -4455,6 +4876,14 @@ mdb_page_flush(MDB_txn *txn, int keep)
 	ssize_t		wsize = 0, wres;
 	MDB_OFF_T	wpos = 0, next_pos = 1; /* impossible pos, so pos != next_pos */
 	int			n = 0;
+	/* <lmdb-js addition> */
+	int			sync_request = txn->mt_flags & MDB_TXN_FLUSH_SYNC;
+	txn->mt_flags &= ~MDB_TXN_FLUSH_SYNC;
+#ifdef MDB_SYNC_RANGES
+	/* the last range may be extended by this flush, so it is started again too */
+	unsigned	wb_first = env->me_wb_nranges ? env->me_wb_nranges - 1 : 0;
+#endif
+	/* </lmdb-js addition> */
 
 	j = i = keep;
 
@@ -4481,6 +4910,19 @@ mdb_page_flush(MDB_txn *txn, int keep)
 		}
 	}
 	txn->mt_flags |= MDB_TXN_DIRTYNUM;
+#ifdef MDB_IO_URING
+	/* with io_uring, all the writes are queued and the iovecs must remain until they complete */
+	MDB_uring *ur = env->me_uring;
+	unsigned ur_iov_used = 0;
+	if (ur && ur->ur_iov_size < (unsigned) pagecount) {
+		struct iovec *ur_iov = realloc(ur->ur_iov, pagecount * 1.5 * sizeof(struct iovec));
+		if (ur_iov) {
+			ur->ur_iov = ur_iov;
+			ur->ur_iov_size = pagecount * 1.5;
+		} else
+			ur = NULL; /* fall back to synchronous writes */
+	}
+#endif
 	/* <lmdb-js addition> */
 	n = 0;
 	
@@ -4603,6 +5045,24 @@ retry_write:
 					rc = 0;
 				}
 #else /* _WIN32 */
+#ifdef MDB_IO_URING
+				if (ur) {
+					struct io_uring_sqe *sqe = mdb_uring_sqe(ur, &rc);
+					if (!sqe) {
+						mdb_uring_wait(ur, 0);
+						return rc;
+					}
+					memcpy(ur->ur_iov + ur_iov_used, iov, n * sizeof(struct iovec));
+					sqe->opcode = IORING_OP_WRITEV;
+					sqe->fd = fd;
+					sqe->off = wpos;
+					sqe->addr = (uint64_t)(size_t)(ur->ur_iov + ur_iov_used);
+					sqe->len = n;
+					sqe->user_data = wsize; /* to verify the size that was written */
+					ur_iov_used += n;
+					wres = wsize;
+				} else
+#endif
 #ifdef MDB_USE_PWRITEV
 				wres = pwritev(fd, iov, n, wpos);
 #else
@@ -4639,6 +5099,10 @@ retry_seek:
 				write_i++;
 				if (rc)
 					return rc;
+#ifdef MDB_SYNC_RANGES
+				if (env->me_wb_enabled)
+					mdb_wb_add(env, wpos, wpos + wsize);
+#endif
 				n = 0;
 			}
 			if (i > pagecount)
@@ -4678,6 +5142,31 @@ retry_seek:
 	if (MDB_REMAPPING(env->me_flags) && pgno > txn->mt_last_pgno)
 		txn->mt_last_pgno = pgno;
 #endif
+#ifdef MDB_IO_URING
+	if (ur) {
+		if (sync_request) {
+			/* the data sync is drained behind all the writes, so the commit doesn't need another one */
+			struct io_uring_sqe *sqe = mdb_uring_sqe(ur, &rc);
+			if (sqe) {
+				sqe->opcode = IORING_OP_FSYNC;
+				sqe->fd = fd;
+				sqe->flags = IOSQE_IO_DRAIN;
+				sqe->fsync_flags = (env->me_flags & MDB_FSYNCONLY) ? 0 : IORING_FSYNC_DATASYNC;
+				sqe->user_data = 0;
+			}
+		}
+		wres = mdb_uring_wait(ur, 0);
+		if (rc || (rc = wres))
+			return rc;
+		if (sync_request)
+			txn->mt_flags |= MDB_TXN_FLUSH_SYNC;
+	}
+#endif
+#ifdef MDB_SYNC_RANGES
+	/* get the pages on their way to the disk now, so the data sync has less to wait for */
+	if (env->me_wb_enabled && !(txn->mt_flags & MDB_TXN_FLUSH_SYNC))
+		mdb_wb_ranges(env, env->me_wb_ranges + wb_first * 2, env->me_wb_nranges - wb_first, 0);
+#endif
 
 	/* MIPS has cache coherency issues, this is a no-op everywhere else
 	 * Note: for any size >= on-chip cache size, entire on-chip cache is
@@ -4901,6 +5390,7 @@ mdb_txn_commit(MDB_txn *txn)
 		parent->mt_last_workid = txn->mt_last_workid;
 		parent->mt_child = NULL;
 		mdb_midl_free(((MDB_ntxn *)txn)->mnt_pgstate.mf_pghead);
+		MDB_PGRUNS_RESET(env);
 		free(txn);
 		return rc;
 	}
@@ -4956,6 +5446,8 @@ mdb_txn_commit(MDB_txn *txn)
 	mdb_audit(txn);
 #endif
 	int dirty_pages = txn->mt_u.dirty_list[0].mid;
+	if (!F_ISSET(txn->mt_flags, MDB_TXN_NOSYNC) && !(env->me_flags & MDB_NOSYNC))
+		txn->mt_flags |= MDB_TXN_FLUSH_SYNC; /* the page flush can do the data sync if it is batching writes */
 	if ((rc = mdb_page_flush(txn, 0)))
 		goto fail;
 	if ((unsigned)txn->mt_loose_count < txn->mt_u.dirty_list[0].mid) {
@@ -4964,9 +5456,10 @@ mdb_txn_commit(MDB_txn *txn)
 		rc = MDB_PROBLEM; /* mt_loose_pgs does not match dirty_list */
 		goto fail;
 	}
-	if (!F_ISSET(txn->mt_flags, MDB_TXN_NOSYNC) &&
+	if (!(txn->mt_flags & (MDB_TXN_NOSYNC|MDB_TXN_FLUSH_SYNC)) &&
 		(rc = mdb_env_sync0(env, 0, txn->mt_next_pgno)))
 		goto fail;
+	txn->mt_flags &= ~MDB_TXN_FLUSH_SYNC;
 
 	//<lmdb-js>
 	if ((txn->mt_flags & MDB_NOSYNC) && (env->me_flags & MDB_OVERLAPPINGSYNC))
@@ -4979,6 +5472,11 @@ mdb_txn_commit(MDB_txn *txn)
 		goto fail;
 
 	//<lmdb-js>
+#ifndef _WIN32
+	/* Free pages at the end of the file were removed by #mdb_txn_compact() */
+	if ((txn->mt_flags & MDB_TXN_TRUNCATE) && !(env->me_flags & (MDB_WRITEMAP|MDB_RAWPART)))
+		(void) ftruncate(env->me_fd, (MDB_OFF_T) txn->mt_next_pgno * env->me_psize);
+#endif
 	MDB_txn_visible* callback = txn->mt_callback;
 	void* ctx = txn->mt_ctx;
 	if (callback) {
@@ -5005,14 +5503,54 @@ done:
 		env->me_metrics.time_during_txns += get_time64() - env->me_metrics.clock_txn;
 		env->me_metrics.txns++;
 	}
-	if ((txn->mt_flags & MDB_NOSYNC) && (env->me_flags & MDB_OVERLAPPINGSYNC)) {
+	if ((txn->mt_flags & MDB_NOSYNC) && (env->me_flags & MDB_OVERLAPPINGSYNC) && env->me_sync_request) {
+		/* the scheduler syncs this, along with any other commits made by then */
+		size_t txn_id = txn->mt_txnid;
+#ifdef MDB_SYNC_RANGES
+		MDB_OFF_T wb_ranges[MDB_WB_RANGES * 2];
+		unsigned wb_nranges = env->me_wb_nranges;
+		memcpy(wb_ranges, env->me_wb_ranges, wb_nranges * 2 * sizeof(MDB_OFF_T));
+#endif
+		if (dirty_pages * (txn->mt_txnid - env->me_synced_txn_id) > 500) {
+			/* as without a scheduler, with a big txn or unsynced backlog, wait for the
+			 * sync in progress (the scheduler's last group sync) before allowing the next txn
+			 */
+			/* the commit is done either way, failing to lock just skips the wait */
+			int locked = !LOCK_MUTEX(rc, env, env->me_sync_mutex);
+			mdb_txn_end(txn, end_mode);
+			if (locked)
+				UNLOCK_MUTEX(env->me_sync_mutex);
+		} else {
+			mdb_txn_end(txn, end_mode);
+#ifdef MDB_SYNC_RANGES
+			/* so the scheduler's data sync mostly just has to flush the disk cache */
+			if (wb_nranges)
+				mdb_wb_ranges(env, wb_ranges, wb_nranges, 1);
+#endif
+		}
+		if (callback)
+			callback(ctx, 1);
+		env->me_sync_request(env->me_sync_ctx, txn_id);
+	} else if ((txn->mt_flags & MDB_NOSYNC) && (env->me_flags & MDB_OVERLAPPINGSYNC)) {
 		size_t txn_id = txn->mt_txnid;
+#ifdef MDB_SYNC_RANGES
+		/* the env's ranges belong to the next write txn once this one ends */
+		MDB_OFF_T wb_ranges[MDB_WB_RANGES * 2];
+		unsigned wb_nranges = env->me_wb_nranges;
+		memcpy(wb_ranges, env->me_wb_ranges, wb_nranges * 2 * sizeof(MDB_OFF_T));
+#endif
 		if (dirty_pages * (txn->mt_txnid - env->me_synced_txn_id) > 500) {
 			// for bigger txns we wait for the flush before allowing next txn
 			LOCK_MUTEX(rc, env, env->me_sync_mutex);
 			mdb_txn_end(txn, end_mode);
 		} else {
 			mdb_txn_end(txn, end_mode);
+#ifdef MDB_SYNC_RANGES
+			/* wait for this txn's own pages before taking the sync lock, so the data sync
+			 * holding it (ours or another commit's) mostly just has to flush the disk cache */
+			if (wb_nranges)
+				mdb_wb_ranges(env, wb_ranges, wb_nranges, 1);
+#endif
 			LOCK_MUTEX(rc, env, env->me_sync_mutex);
 		}
 		if (callback) {
@@ -5452,6 +5990,11 @@ mdb_env_create(MDB_env **env)
 	e->me_sync_mutex->semid = -1;
 #endif
 	e->me_pid = getpid();
+#if MDB_RPAGE_CACHE
+	e->me_rpchunk = MDB_RPAGE_CHUNK;
+	e->me_trpsize = MDB_TRPAGE_SIZE;
+	e->me_erpsize = MDB_ERPAGE_SIZE;
+#endif
 	GET_PAGESIZE(e->me_os_psize);
 	VGMEMP_CREATE(e,0,0);
 	*env = e;
@@ -5973,6 +6516,11 @@ mdb_env_open2(MDB_env *env, int prev)
 	} else {
 		env->me_psize = meta.mm_psize;
 	}
+#if MDB_RPAGE_CACHE && defined(_WIN32)
+	/* views must begin on the 64KB allocation granularity */
+	while (env->me_rpchunk < MDB_RPAGE_CHUNK && env->me_rpchunk * env->me_psize < 0x10000)
+		env->me_rpchunk <<= 1;
+#endif
 
 	/* Was a mapsize configured? */
 	if (!env->me_mapsize) {
@@ -6039,8 +6587,8 @@ mdb_env_open2(MDB_env *env, int prev)
 	}
 #endif
 
-	env->me_maxfree_1pg = (env->me_psize - PAGEHDRSZ) / sizeof(pgno_t) - 2;
-	env->me_nodemax = (((env->me_psize - PAGEHDRSZ) / MDB_MINKEYS) & -2)
+	env->me_maxfree_1pg = (env->me_psize - PAGEHDRSZ - PAGETAIL(env)) / sizeof(pgno_t) - 2;
+	env->me_nodemax = (((env->me_psize - PAGEHDRSZ - PAGETAIL(env)) / MDB_MINKEYS) & -2)
 		- sizeof(indx_t);
 #if !(MDB_MAXKEYSIZE)
 	env->me_maxkey = env->me_nodemax - (NODESIZE + sizeof(MDB_db));
@@ -6689,6 +7237,11 @@ mdb_env_open(MDB_env *env, const char *path, unsigned int flags, mdb_mode_t mode
 			return EINVAL;
 #endif
 	}
+#if MDB_RPAGE_CACHE
+	/* pages written through the map would never get their checksums */
+	if (env->me_sumfunc && (flags & MDB_WRITEMAP))
+		return EINVAL;
+#endif
 
 	rc = mdb_fname_init(path, flags, &fname);
 	if (rc)
@@ -6741,13 +7294,13 @@ mdb_env_open(MDB_env *env, const char *path, unsigned int flags, mdb_mode_t mode
 #if MDB_RPAGE_CACHE
 	if (MDB_REMAPPING(flags))
 	{
-		env->me_rpages = malloc(MDB_ERPAGE_SIZE * sizeof(MDB_ID3));
+		env->me_rpages = malloc(env->me_erpsize * sizeof(MDB_ID3));
 		if (!env->me_rpages) {
 			rc = ENOMEM;
 			goto leave;
 		}
 		env->me_rpages[0].mid = 0;
-		env->me_rpcheck = MDB_ERPAGE_SIZE/2;
+		env->me_rpcheck = env->me_erpsize/2;
 	}
 #endif
 	/*<lmdb-js>*/
@@ -6881,14 +7434,14 @@ mdb_env_open(MDB_env *env, const char *path, unsigned int flags, mdb_mode_t mode
 				txn->mt_env = env;
 #if MDB_RPAGE_CACHE
 				if (MDB_REMAPPING(env->me_flags)) {
-				txn->mt_rpages = malloc(MDB_TRPAGE_SIZE * sizeof(MDB_ID3));
+				txn->mt_rpages = malloc(env->me_trpsize * sizeof(MDB_ID3));
 				if (!txn->mt_rpages) {
 					free(txn);
 					rc = ENOMEM;
 					goto leave;
 				}
 				txn->mt_rpages[0].mid = 0;
-				txn->mt_rpcheck = MDB_TRPAGE_SIZE/2;
+				txn->mt_rpcheck = env->me_trpsize/2;
 				}
 #endif
 				txn->mt_dbxs = env->me_dbxs;
@@ -6947,6 +7500,7 @@ mdb_env_close_active(MDB_env *env, int excl)
 #endif
 	free(env->me_txn0);
 	mdb_midl_free(env->me_free_pgs);
+	mdb_midl_runs_free(&env->me_pgruns);
 
 	if (env->me_flags & MDB_ENV_TXKEY) {
 		pthread_key_delete(env->me_txkey);
@@ -6977,8 +7531,18 @@ mdb_env_close_active(MDB_env *env, int excl)
 			/*</lmdb-js>*/
 		}
 	}
+	/* unmapping unlocks the pinned pages */
+	free(env->me_pins);
+	env->me_pins = NULL;
+	env->me_npins = 0;
 	if (env->me_mfd != INVALID_HANDLE_VALUE)
 		(void) close(env->me_mfd);
+#ifdef MDB_IO_URING
+	if (env->me_uring) {
+		mdb_uring_close(env->me_uring);
+		env->me_uring = NULL;
+	}
+#endif
 #ifdef _WIN32
 	if (env->me_ovs > 0) {
 		for (i = 0; i < env->me_ovs; i++) {
@@ -7100,6 +7664,8 @@ mdb_env_close(MDB_env *env)
 #if MDB_RPAGE_CACHE
 	free(env->me_enckey.mv_data);
 #endif
+	free(env->me_compact_db.mv_data);
+	free(env->me_compact_key.mv_data);
 	free(env);
 }
 
@@ -7352,13 +7918,30 @@ mdb_cursor_push(MDB_cursor *mc, MDB_page *mp)
 
 #if MDB_RPAGE_CACHE
 
+static void
+mdb_rpage_stat_add(MDB_rpage_stat *dst, const MDB_rpage_stat *src)
+{
+	dst->rs_txn_hits += src->rs_txn_hits;
+	dst->rs_env_hits += src->rs_env_hits;
+	dst->rs_misses += src->rs_misses;
+	dst->rs_maps += src->rs_maps;
+	dst->rs_unmaps += src->rs_unmaps;
+	dst->rs_decrypts += src->rs_decrypts;
+	dst->rs_decrypted_bytes += src->rs_decrypted_bytes;
+}
+
 static int
-mdb_rpage_encsum(MDB_env *env, MDB_ID3 *id3, unsigned rem, int numpgs)
+mdb_rpage_encsum(MDB_txn *txn, MDB_ID3 *id3, unsigned rem, int numpgs)
 {
+	MDB_env *env = txn->mt_env;
 	int rc = 0;
 	if (env->me_encfunc) {
 		unsigned short muse = id3->muse;
 		rc = mdb_rpage_decrypt(env, id3, rem, numpgs);
+		if (muse != id3->muse) {
+			txn->mt_rpstat.rs_decrypts++;
+			txn->mt_rpstat.rs_decrypted_bytes += numpgs * env->me_psize;
+		}
 		if (!rc && env->me_sumfunc && muse != id3->muse) {
 			MDB_page *p = (MDB_page *)((char *)id3->menc + rem * env->me_psize);
 			rc = mdb_page_chk_checksum(env, p, numpgs * env->me_psize);
@@ -7368,7 +7951,7 @@ mdb_rpage_encsum(MDB_env *env, MDB_ID3 *id3, unsigned rem, int numpgs)
 			MDB_page *p;
 			int bit;
 			/* If this is an overflow page, set all use bits to the end */
-			if (rem + numpgs > MDB_RPAGE_CHUNK)
+			if (rem + numpgs > env->me_rpchunk)
 				bit = 0xffff;
 			else
 				bit = 1;
@@ -7464,7 +8047,7 @@ mdb_rpage_get(MDB_txn *txn, pgno_t pg0, int numpgs, MDB_page **ret)
 	/* remember the offset of the actual page number, so we can
 	 * return the correct pointer at the end.
 	 */
-	rem = pg0 & (MDB_RPAGE_CHUNK-1);
+	rem = pg0 & (env->me_rpchunk-1);
 	pgno = pg0 ^ rem;
 
 	id3.mid = 0;
@@ -7482,6 +8065,7 @@ mdb_rpage_get(MDB_txn *txn, pgno_t pg0, int numpgs, MDB_page **ret)
 			MAP(rc, env, id3.mptr, len, off);
 			if (rc)
 				return rc;
+			txn->mt_rpstat.rs_maps++;
 			/* setup for encryption */
 			if (env->me_encfunc) {
 				id3.menc = malloc(len);
@@ -7513,6 +8097,7 @@ mdb_rpage_get(MDB_txn *txn, pgno_t pg0, int numpgs, MDB_page **ret)
 					if (el[i].mref == 1) {
 						/* just us, replace it */
 						munmap(el[i].mptr, el[i].mcnt * env->me_psize);
+						txn->mt_rpstat.rs_unmaps++;
 						el[i].mptr = tl[x].mptr;
 						el[i].mcnt = tl[x].mcnt;
 						if (el[i].menc)
@@ -7532,8 +8117,9 @@ mdb_rpage_get(MDB_txn *txn, pgno_t pg0, int numpgs, MDB_page **ret)
 		id3.menc = tl[x].menc;
 		id3.muse = tl[x].muse;
 		tl[x].mref++;
+		txn->mt_rpstat.rs_txn_hits++;
 		if (env->me_encfunc || env->me_sumfunc) {
-			rc = mdb_rpage_encsum(env, &id3, rem, numpgs);
+			rc = mdb_rpage_encsum(txn, &id3, rem, numpgs);
 			if (rc) return rc;
 			tl[x].muse = id3.muse;
 		}
@@ -7541,7 +8127,7 @@ mdb_rpage_get(MDB_txn *txn, pgno_t pg0, int numpgs, MDB_page **ret)
 	}
 
 notlocal:
-	if (tl[0].mid >= MDB_TRPAGE_MAX - txn->mt_rpcheck) {
+	if (tl[0].mid >= env->me_trpsize - 1 - txn->mt_rpcheck) {
 		unsigned i, y;
 		/* purge unref'd pages from our list and unref in env */
 		pthread_mutex_lock(&env->me_rpmutex);
@@ -7551,8 +8137,9 @@ retry:
 			if (!tl[i].mref) {
 				if (!y) y = i;
 				/* tmp overflow pages don't go to env */
-				if (tl[i].mid & (MDB_RPAGE_CHUNK-1)) {
+				if (tl[i].mid & (env->me_rpchunk-1)) {
 					munmap(tl[i].mptr, tl[i].mcnt * env->me_psize);
+					txn->mt_rpstat.rs_unmaps++;
 					if (tl[i].menc)
 						mdb_rpage_dispose(env, &tl[i]);
 					continue;
@@ -7566,7 +8153,7 @@ retry:
 			/* we didn't find any unref'd chunks.
 			 * if we're out of room, fail.
 			 */
-			if (tl[0].mid >= MDB_TRPAGE_MAX)
+			if (tl[0].mid >= env->me_trpsize - 1)
 				return MDB_TXN_FULL;
 			/* otherwise, raise threshold for next time around
 			 * and let this go.
@@ -7581,19 +8168,19 @@ retry:
 			/* decrease the check threshold toward its original value */
 			if (!txn->mt_rpcheck)
 				txn->mt_rpcheck = 1;
-			while (txn->mt_rpcheck < tl[0].mid && txn->mt_rpcheck < MDB_TRPAGE_SIZE/2)
+			while (txn->mt_rpcheck < tl[0].mid && txn->mt_rpcheck < env->me_trpsize/2)
 				txn->mt_rpcheck *= 2;
 		}
 	}
-	if (tl[0].mid < MDB_TRPAGE_SIZE) {
+	if (tl[0].mid < env->me_trpsize) {
 		id3.mref = 1;
 		if (id3.mid)
 			goto found;
 		/* don't map past last written page in read-only envs */
-		if ((env->me_flags & MDB_RDONLY) && pgno + MDB_RPAGE_CHUNK-1 > txn->mt_last_pgno)
+		if ((env->me_flags & MDB_RDONLY) && pgno + env->me_rpchunk-1 > txn->mt_last_pgno)
 			id3.mcnt = txn->mt_last_pgno + 1 - pgno;
 		else
-			id3.mcnt = numpgs + rem > MDB_RPAGE_CHUNK ? numpgs + rem : MDB_RPAGE_CHUNK;
+			id3.mcnt = numpgs + rem > env->me_rpchunk ? numpgs + rem : env->me_rpchunk;
 		len = id3.mcnt * env->me_psize;
 		id3.mid = pgno;
 
@@ -7604,12 +8191,14 @@ retry:
 			id3.mptr = el[x].mptr;
 			id3.menc = el[x].menc;
 			id3.muse = el[x].muse;
+			txn->mt_rpstat.rs_env_hits++;
 			/* check for overflow size */
 			if (id3.mcnt > el[x].mcnt) {
 				SET_OFF(off, pgno * env->me_psize);
 				MAP(rc, env, id3.mptr, len, off);
 				if (rc)
 					goto fail;
+				txn->mt_rpstat.rs_maps++;
 				if (env->me_encfunc) {
 					id3.menc = malloc(len);
 					if (!id3.menc) {
@@ -7620,6 +8209,7 @@ retry:
 				}
 				if (!el[x].mref) {
 					munmap(el[x].mptr, env->me_psize * el[x].mcnt);
+					txn->mt_rpstat.rs_unmaps++;
 					el[x].mptr = id3.mptr;
 					el[x].mcnt = id3.mcnt;
 					if (el[x].menc)
@@ -7629,7 +8219,7 @@ retry:
 				} else {
 					id3.mid = pg0;
 					if (env->me_encfunc || env->me_sumfunc) {
-						rc = mdb_rpage_encsum(env, &id3, rem, numpgs);
+						rc = mdb_rpage_encsum(txn, &id3, rem, numpgs);
 						if (rc)
 							goto fail;
 						el[x].muse = id3.muse;
@@ -7640,7 +8230,7 @@ retry:
 			}
 			el[x].mref++;
 			if (env->me_encfunc || env->me_sumfunc) {
-				rc = mdb_rpage_encsum(env, &id3, rem, numpgs);
+				rc = mdb_rpage_encsum(txn, &id3, rem, numpgs);
 				if (rc)
 					goto fail;
 				el[x].muse = id3.muse;
@@ -7648,13 +8238,14 @@ retry:
 			pthread_mutex_unlock(&env->me_rpmutex);
 			goto found;
 		}
-		if (el[0].mid >= MDB_ERPAGE_MAX - env->me_rpcheck) {
+		if (el[0].mid >= env->me_erpsize - 1 - env->me_rpcheck) {
 			/* purge unref'd pages */
 			unsigned i, y = 0;
 			for (i=1; i<=el[0].mid; i++) {
 				if (!el[i].mref) {
 					if (!y) y = i;
 					munmap(el[i].mptr, env->me_psize * el[i].mcnt);
+					txn->mt_rpstat.rs_unmaps++;
 					if (el[i].menc)
 						mdb_rpage_dispose(env, &el[i]);
 				}
@@ -7666,7 +8257,7 @@ retry:
 					id3.mid = 0;
 					goto retry;
 				}
-				if (el[0].mid >= MDB_ERPAGE_MAX) {
+				if (el[0].mid >= env->me_erpsize - 1) {
 					pthread_mutex_unlock(&env->me_rpmutex);
 					return MDB_MAP_FULL;
 				}
@@ -7678,7 +8269,7 @@ retry:
 				el[0].mid = y-1;
 				if (!env->me_rpcheck)
 					env->me_rpcheck = 1;
-				while (env->me_rpcheck < el[0].mid && env->me_rpcheck < MDB_ERPAGE_SIZE/2)
+				while (env->me_rpcheck < el[0].mid && env->me_rpcheck < env->me_erpsize/2)
 					env->me_rpcheck *= 2;
 			}
 		}
@@ -7689,6 +8280,8 @@ fail:
 			pthread_mutex_unlock(&env->me_rpmutex);
 			return rc;
 		}
+		txn->mt_rpstat.rs_misses++;
+		txn->mt_rpstat.rs_maps++;
 		if (env->me_encfunc) {
 			id3.menc = malloc(len);
 			if (!id3.menc) {
@@ -7697,7 +8290,7 @@ fail:
 			}
 		}
 		if (env->me_encfunc || env->me_sumfunc) {
-			rc = mdb_rpage_encsum(env, &id3, rem, numpgs);
+			rc = mdb_rpage_encsum(txn, &id3, rem, numpgs);
 			if (rc)
 				goto fail;
 		}
@@ -7713,7 +8306,7 @@ ok:
 	p = (MDB_page *)(base + rem * env->me_psize);
 	rc = MDB_SUCCESS;
 	if (env->me_encfunc || env->me_sumfunc) {
-		rc = mdb_rpage_encsum(env, &id3, rem, numpgs);
+		rc = mdb_rpage_encsum(txn, &id3, rem, numpgs);
 	}
 #if MDB_DEBUG	/* we don't need this check any more */
 	if (IS_OVERFLOW(p)) {
@@ -7749,45 +8342,47 @@ static int mdb_page_encrypt(MDB_env *env, MDB_page *dp, MDB_page *encp, size_t s
 	return env->me_encfunc(&in, &out, enckeys, 1);
 }
 
+static int mdb_page_decrypt(MDB_env *env, MDB_page *encp, MDB_page *dp, size_t size)
+{
+	MDB_val in, out, enckeys[3];
+	int xsize = sizeof(pgno_t) + sizeof(txnid_t);
+	in.mv_size = size - xsize;
+	in.mv_data = (char *)encp + xsize;
+	enckeys[0] = env->me_enckey;
+	enckeys[1].mv_size = xsize;
+	enckeys[1].mv_data = encp;
+	if (env->me_esumsize) {
+		in.mv_size -= env->me_esumsize;
+		enckeys[2].mv_size = env->me_esumsize;
+		enckeys[2].mv_data = (char *)in.mv_data + in.mv_size;
+	} else {
+		enckeys[2].mv_size = 0;
+		enckeys[2].mv_data = 0;
+	}
+	out.mv_size = in.mv_size;
+	out.mv_data = (char *)dp + xsize;
+	if (env->me_encfunc(&in, &out, enckeys, 0))
+		return MDB_CRYPTO_FAIL;
+	dp->mp_pgno = encp->mp_pgno;
+	dp->mp_txnid = encp->mp_txnid;
+	return MDB_SUCCESS;
+}
+
 static int mdb_rpage_decrypt(MDB_env *env, MDB_ID3 *id3, int rem, int numpgs)
 {
 	int rc = 0;
 	if (!(id3->muse & (1 << rem))) {
-		MDB_val in, out, enckeys[3];
 		int bit;
-		int xsize = sizeof(pgno_t) + sizeof(txnid_t);
 
 		/* If this is an overflow page, set all use bits to the end */
-		if (rem + numpgs > MDB_RPAGE_CHUNK)
+		if ((unsigned)(rem + numpgs) > env->me_rpchunk)
 			bit = 0xffff;
 		else
 			bit = 1;
 
 		id3->muse |= (bit << rem);
-		in.mv_size = numpgs * env->me_psize - xsize;
-		in.mv_data = (char *)id3->mptr + rem * env->me_psize + xsize;
-		enckeys[0] = env->me_enckey;
-		enckeys[1].mv_size = xsize;
-		enckeys[1].mv_data = (char *)in.mv_data - xsize;
-		if (env->me_esumsize) {
-			in.mv_size -= env->me_esumsize;
-			enckeys[2].mv_size = env->me_esumsize;
-			enckeys[2].mv_data = (char *)in.mv_data + in.mv_size;
-		} else {
-			enckeys[2].mv_size = 0;
-			enckeys[2].mv_data = 0;
-		}
-		out.mv_size = in.mv_size;
-		out.mv_data = (char *)id3->menc + rem * env->me_psize + xsize;
-		if (env->me_encfunc(&in, &out, enckeys, 0))
-			rc = MDB_CRYPTO_FAIL;
-		else {
-			MDB_page *penc, *pclr;
-			penc = (MDB_page *)enckeys[1].mv_data;
-			pclr = (MDB_page *)((char *)out.mv_data - xsize);
-			pclr->mp_pgno = penc->mp_pgno;
-			pclr->mp_txnid = penc->mp_txnid;
-		}
+		rc = mdb_page_decrypt(env, (MDB_page *)((char *)id3->mptr + rem * env->me_psize),
+			(MDB_page *)((char *)id3->menc + rem * env->me_psize), numpgs * env->me_psize);
 	}
 	return rc;
 }
@@ -7796,15 +8391,16 @@ static int mdb_rpage_decrypt(MDB_env *env, MDB_ID3 *id3, int rem, int numpgs)
 static void mdb_rpage_dispose(MDB_env *env, MDB_ID3 *id3)
 {
 	char *base = id3->menc;
-	int i, j;
-	for (i=0, j=1; i<15; i++) {
+	unsigned i;
+	int j;
+	for (i=0, j=1; i<env->me_rpchunk-1; i++) {
 		if (id3->muse & j)
 			memset(base, 0, env->me_psize);
 		j <<= 1;
 		base += env->me_psize;
 	}
 	if (id3->muse & j) {
-		i = id3->mcnt - (MDB_RPAGE_CHUNK - 1);
+		i = id3->mcnt - (env->me_rpchunk - 1);
 		memset(base, 0, i * env->me_psize);
 	}
 	free(id3->menc);
@@ -7813,7 +8409,8 @@ static void mdb_rpage_dispose(MDB_env *env, MDB_ID3 *id3)
 static void mdb_page_set_checksum(MDB_env *env, MDB_page *mp, size_t size)
 {
 	MDB_val src, dst, *key;
-	src.mv_size = size - env->me_sumsize;
+	/* the sum goes before any authentication data from encryption */
+	src.mv_size = size - env->me_sumsize - env->me_esumsize;
 	src.mv_data = mp;
 	dst.mv_size = env->me_sumsize;
 	dst.mv_data = (char *)src.mv_data + src.mv_size;
@@ -7828,7 +8425,7 @@ static int mdb_page_chk_checksum(MDB_env *env, MDB_page *mp, size_t size)
 {
 	MDB_val src, dst, chk, *key;
 	char sumbuf[256];
-	src.mv_size = size - env->me_sumsize;
+	src.mv_size = size - env->me_sumsize - env->me_esumsize;
 	src.mv_data = mp;
 	chk.mv_size = env->me_sumsize;
 	chk.mv_data = (char *)src.mv_data + src.mv_size;
@@ -8196,6 +8793,7 @@ mdb_ovpage_free(MDB_cursor *mc, MDB_page *mp)
 release:
 		/* Insert in me_pghead */
 		mdb_midl_insert(&env->me_pghead, pg, ovpages);
+		MDB_PGRUNS_RESET(env);
 	} else {
 		rc = mdb_midl_append_range(&txn->mt_free_pgs, pg, ovpages);
 		if (rc)
@@ -8307,6 +8905,8 @@ mdb_direct_write(MDB_txn *txn, MDB_dbi dbi,
     MDB_val *key, unsigned int offset, MDB_val *data)
 {
 	if (txn->mt_env->me_flags & MDB_REMAP_CHUNKS) return -1;
+	/* the page's checksum would no longer match */
+	if (txn->mt_env->me_sumfunc) return -1;
 	MDB_val existing_data;
 	int rc = mdb_get_with_txn(txn, dbi, key, &existing_data, NULL);
 	if (rc == 0) {
@@ -9389,7 +9989,7 @@ prep_subDB:
 					if ((rc = mdb_page_alloc(mc, 1, &mp)))
 						return rc;
 					fp_flags |= mp->mp_flags; /* P_ADM_FLAGS */
-					offset = env->me_psize - olddata.mv_size;
+					offset = env->me_psize - PAGETAIL(env) - olddata.mv_size;
 					flags |= F_DUPDATA|F_SUBDATA;
 					dummy.md_root = mp->mp_pgno;
 					sub_root = mp;
@@ -9425,7 +10025,7 @@ current:
 		if (F_ISSET(leaf->mn_flags, F_BIGDATA)) {
 			MDB_page *omp;
 			MDB_ovpage ovp;
-			int ovpages, dpages = OVPAGES(data->mv_size, env->me_psize);
+			int ovpages, dpages = OVPAGES(data->mv_size + PAGETAIL(env), env->me_psize);
 
 			memcpy(&ovp, olddata.mv_data, sizeof(ovp));
 			if ((rc2 = MDB_PAGE_GET(mc, ovp.op_pgno, ovp.op_pages, &omp)) != 0)
@@ -9894,7 +10494,7 @@ mdb_node_add(MDB_cursor *mc, indx_t indx,
 			/* Data already on overflow page. */
 			node_size += sizeof(MDB_ovpage);
 		} else if (node_size + data->mv_size > mc->mc_txn->mt_env->me_nodemax) {
-			int ovpages = OVPAGES(data->mv_size, mc->mc_txn->mt_env->me_psize);
+			int ovpages = OVPAGES(data->mv_size + PAGETAIL(mc->mc_txn->mt_env), mc->mc_txn->mt_env->me_psize);
 			int rc;
 			/* Put data on overflow page. */
 			DPRINTF(("data size is %"Z"u, node would be %"Z"u, put data on overflow page",
@@ -11336,7 +11936,7 @@ mdb_page_split(MDB_cursor *mc, MDB_val *newkey, MDB_val *newdata, pgno_t newpgno
 		} else {
 			int psize, nsize, k;
 			/* Maximum free space in an empty page */
-			pmax = env->me_psize - PAGEHDRSZ;
+			pmax = env->me_psize - PAGEHDRSZ - PAGETAIL(env);
 			if (IS_LEAF(mp))
 				nsize = mdb_leaf_size(env, newkey, newdata);
 			else
@@ -11352,7 +11952,7 @@ mdb_page_split(MDB_cursor *mc, MDB_val *newkey, MDB_val *newdata, pgno_t newpgno
 			copy->mp_pgno  = mp->mp_pgno;
 			copy->mp_flags = mp->mp_flags;
 			copy->mp_lower = (PAGEHDRSZ-PAGEBASE);
-			copy->mp_upper = env->me_psize - PAGEBASE;
+			copy->mp_upper = env->me_psize - PAGEBASE - PAGETAIL(env);
 
 			/* prepare to insert */
 			for (i=0, j=0; i<nkeys; i++) {
@@ -11662,6 +12262,40 @@ mdb_put(MDB_txn *txn, MDB_dbi dbi,
 	return rc;
 }
 
+/** Read or write a range of a file, retrying short transfers. */
+static int ESECT
+mdb_fio(HANDLE fd, char *buf, mdb_size_t len, mdb_size_t off, int wr)
+{
+	while (len) {
+		size_t n = len > MAX_WRITE ? MAX_WRITE : len;
+#ifdef _WIN32
+		DWORD done;
+		OVERLAPPED ov;
+		memset(&ov, 0, sizeof(ov));
+		ov.Offset = off & 0xffffffff;
+		ov.OffsetHigh = off >> 16 >> 16;
+		if (!(wr ? WriteFile(fd, buf, n, &done, &ov) : ReadFile(fd, buf, n, &done, &ov))) {
+			int rc = ErrCode();
+			return rc == ERROR_HANDLE_EOF ? MDB_INVALID : rc;
+		}
+#else
+		ssize_t done = wr ? pwrite(fd, buf, n, off) : pread(fd, buf, n, off);
+		if (done < 0) {
+			int rc = ErrCode();
+			if (rc == EINTR)
+				continue;
+			return rc;
+		}
+#endif
+		if (done == 0)
+			return wr ? EIO : MDB_INVALID;
+		buf += done;
+		len -= done;
+		off += done;
+	}
+	return MDB_SUCCESS;
+}
+
 #ifndef MDB_WBUF
 #define MDB_WBUF	(1024*1024)
 #endif
@@ -11685,6 +12319,11 @@ typedef struct mdb_copy {
 	 *	to fail the copy.  Not mutex-protected, LMDB expects atomic int.
 	 */
 	volatile int mc_error;
+	/** Parallel copy this walker belongs to. Its buffer is written by
+	 *	the walker itself, at #mc_wpos, instead of by a writer thread.
+	 */
+	struct mdb_pcopy *mc_pc;
+	mdb_size_t mc_wpos;
 } mdb_copy;
 
 	/** Dedicated writer thread for compacting copy. */
@@ -11772,6 +12411,19 @@ again:
 static int ESECT
 mdb_env_cthr_toggle(mdb_copy *my, int adjust)
 {
+	if (my->mc_pc) {
+		int toggle = my->mc_toggle, rc = my->mc_error;
+		if (!rc && my->mc_wlen[toggle])
+			rc = mdb_fio(my->mc_fd, my->mc_wbuf[toggle], my->mc_wlen[toggle], my->mc_wpos, 1);
+		my->mc_wpos += my->mc_wlen[toggle];
+		if (!rc && my->mc_olen[toggle])
+			rc = mdb_fio(my->mc_fd, my->mc_over[toggle], my->mc_olen[toggle], my->mc_wpos, 1);
+		my->mc_wpos += my->mc_olen[toggle];
+		my->mc_wlen[toggle] = my->mc_olen[toggle] = 0;
+		if (rc)
+			my->mc_error = rc;
+		return rc;
+	}
 	pthread_mutex_lock(&my->mc_mutex);
 	my->mc_new += adjust;
 	pthread_cond_signal(&my->mc_cond);
@@ -11785,6 +12437,8 @@ mdb_env_cthr_toggle(mdb_copy *my, int adjust)
 	return my->mc_error;
 }
 
+static pgno_t mdb_pcopy_root(struct mdb_pcopy *pc, pgno_t root);
+
 	/** Depth-first tree traversal for compacting copy.
 	 * @param[in] my control structure.
 	 * @param[in,out] pg database root.
@@ -11888,11 +12542,16 @@ mdb_env_cwalk(mdb_copy *my, pgno_t *pg, int flags)
 						}
 
 						memcpy(&db, NODEDATA(ni), sizeof(db));
-						my->mc_toggle = toggle;
-						rc = mdb_env_cwalk(my, &db.md_root, ni->mn_flags & F_DUPDATA);
-						if (rc)
-							goto done;
-						toggle = my->mc_toggle;
+						if (my->mc_pc && !(ni->mn_flags & F_DUPDATA)) {
+							/* named DBs are copied separately by a parallel copy */
+							db.md_root = mdb_pcopy_root(my->mc_pc, db.md_root);
+						} else {
+							my->mc_toggle = toggle;
+							rc = mdb_env_cwalk(my, &db.md_root, ni->mn_flags & F_DUPDATA);
+							if (rc)
+								goto done;
+							toggle = my->mc_toggle;
+						}
 						memcpy(NODEDATA(ni), &db, sizeof(db));
 					}
 				}
@@ -12089,39 +12748,503 @@ done2:
 	return rc ? rc : my.mc_error;
 }
 
-	/** Copy environment as-is. */
+#define MDB_PCOPY_MAXTHREADS	64
+
+	/** A subtree copied by one thread of a parallel compacting copy. */
+typedef struct mdb_pcunit {
+	pgno_t pu_root;		/**< root in the environment */
+	pgno_t pu_new_root;	/**< root in the copy */
+	pgno_t pu_base;		/**< first page number in the copy */
+	pgno_t pu_count;	/**< pages, including overflow and sub-DB pages */
+} mdb_pcunit;
+
+	/** A tree (the main DB or a named DB) split into subtrees. */
+typedef struct mdb_pctree {
+	pgno_t pt_root;
+	pgno_t pt_new_root;
+	MDB_IDL pt_top;		/**< branch pages above the subtrees, breadth-first */
+	pgno_t pt_base;		/**< page number of the first top page in the copy */
+	unsigned pt_unit;	/**< first subtree in #mdb_pcopy.%pc_units */
+	unsigned pt_nunits;
+} mdb_pctree;
+
+	/** State needed for a parallel compacting copy. Each subtree
+	 *	is counted first, so every thread can write its subtrees
+	 *	to preassigned page numbers.
+	 */
+typedef struct mdb_pcopy {
+	MDB_env *pc_env;
+	MDB_txn *pc_txn;
+	HANDLE pc_fd;
+	pthread_mutex_t pc_mutex;
+	mdb_pcunit *pc_units;
+	unsigned pc_nunits;
+	unsigned pc_maxunits;
+	mdb_pctree *pc_trees;	/**< main DB, then named DBs sorted by root */
+	unsigned pc_ntrees;
+	unsigned pc_maxtrees;
+	unsigned pc_next;		/**< next subtree for a thread to take */
+	unsigned pc_end;
+	int pc_copying;			/**< copying subtrees, otherwise counting them */
+	volatile int pc_error;
+} mdb_pcopy;
+
+	/** Add a tree to be split and copied. */
 static int ESECT
-mdb_env_copyfd0(MDB_env *env, HANDLE fd)
+mdb_pcopy_tree(mdb_pcopy *pc, pgno_t root)
 {
-	MDB_txn *txn = NULL;
-	mdb_mutexref_t wmutex = NULL;
-	int rc;
-	mdb_size_t wsize, w3;
-	char *ptr;
-#ifdef _WIN32
-	DWORD len, w2;
-#define DO_WRITE(rc, fd, ptr, w2, len)	rc = WriteFile(fd, ptr, w2, &len, NULL)
-#else
-	ssize_t len;
-	size_t w2;
-#define DO_WRITE(rc, fd, ptr, w2, len)	len = write(fd, ptr, w2); rc = (len >= 0)
-#endif
-
-	/* Do the lock/unlock of the reader mutex before starting the
-	 * write txn.  Otherwise other read txns could block writers.
-	 */
-	rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
-	if (rc)
-		return rc;
+	mdb_pctree *pt;
+	int rc = MDB_SUCCESS;
 
-	if (env->me_txns) {
-		/* We must start the actual read txn after blocking writers */
-		mdb_txn_end(txn, MDB_END_RESET_TMP);
+	pthread_mutex_lock(&pc->pc_mutex);
+	if (pc->pc_ntrees == pc->pc_maxtrees) {
+		unsigned max = pc->pc_maxtrees ? pc->pc_maxtrees * 2 : 16;
+		if ((pt = realloc(pc->pc_trees, max * sizeof(mdb_pctree))) != NULL) {
+			pc->pc_trees = pt;
+			pc->pc_maxtrees = max;
+		} else
+			rc = ENOMEM;
+	}
+	if (!rc) {
+		pt = &pc->pc_trees[pc->pc_ntrees++];
+		memset(pt, 0, sizeof(*pt));
+		pt->pt_root = root;
+	}
+	pthread_mutex_unlock(&pc->pc_mutex);
+	return rc;
+}
 
-		/* Temporarily block writers until we snapshot the meta pages */
-		wmutex = env->me_wmutex;
-		if (LOCK_MUTEX(rc, env, wmutex))
-			goto leave;
+static int
+mdb_pcopy_cmp(const void *a, const void *b)
+{
+	pgno_t x = ((const mdb_pctree *)a)->pt_root, y = ((const mdb_pctree *)b)->pt_root;
+	return x < y ? -1 : x > y;
+}
+
+	/** Find the root in the copy of a named DB. */
+static pgno_t
+mdb_pcopy_root(mdb_pcopy *pc, pgno_t root)
+{
+	mdb_pctree key, *pt;
+
+	if (root == P_INVALID)
+		return root;
+	key.pt_root = root;
+	pt = bsearch(&key, pc->pc_trees + 1, pc->pc_ntrees - 1, sizeof(mdb_pctree), mdb_pcopy_cmp);
+	if (pt)
+		return pt->pt_new_root;
+	pc->pc_error = MDB_CORRUPTED;
+	return root;
+}
+
+	/** Count the pages that #mdb_env_cwalk() will write for a subtree.
+	 *	Named DBs are not part of it, they are added as separate trees.
+	 */
+static int ESECT
+mdb_pcopy_count(mdb_pcopy *pc, MDB_cursor *mc, pgno_t pg, int flags, pgno_t *count)
+{
+	MDB_page *mp;
+	MDB_node *ni;
+	unsigned i, n;
+	int rc;
+
+	if ((rc = MDB_PAGE_GET(mc, pg, 1, &mp)))
+		return rc;
+	(*count)++;
+	n = NUMKEYS(mp);
+	if (IS_BRANCH(mp)) {
+		for (i = 0; i < n && !rc; i++)
+			rc = mdb_pcopy_count(pc, mc, NODEPGNO(NODEPTR(mp, i)), flags, count);
+	} else if (!IS_LEAF2(mp) && !(flags & F_DUPDATA)) {
+		for (i = 0; i < n && !rc; i++) {
+			ni = NODEPTR(mp, i);
+			if (ni->mn_flags & F_BIGDATA) {
+				MDB_ovpage ovp;
+				memcpy(&ovp, NODEDATA(ni), sizeof(ovp));
+				*count += ovp.op_pages;
+			} else if (ni->mn_flags & F_SUBDATA) {
+				MDB_db db;
+				memcpy(&db, NODEDATA(ni), sizeof(db));
+				if (db.md_root == P_INVALID)
+					continue;
+				if (ni->mn_flags & F_DUPDATA)
+					rc = mdb_pcopy_count(pc, mc, db.md_root, F_DUPDATA, count);
+				else
+					rc = mdb_pcopy_tree(pc, db.md_root);
+			}
+		}
+	}
+	return rc;
+}
+
+	/** Split a tree into subtrees for the copy threads, going down a level
+	 *	at a time until there are at least \b want of them. The branch pages
+	 *	above the subtrees are written afterwards by #mdb_pcopy_top().
+	 */
+static int ESECT
+mdb_pcopy_split(mdb_pcopy *pc, MDB_cursor *mc, mdb_pctree *pt, unsigned want)
+{
+	MDB_IDL level, next, tmp;
+	MDB_page *mp;
+	mdb_pcunit *pu;
+	unsigned i, j;
+	int rc = MDB_SUCCESS;
+
+	level = mdb_midl_alloc(MDB_IDL_UM_MAX);
+	next = mdb_midl_alloc(MDB_IDL_UM_MAX);
+	pt->pt_top = mdb_midl_alloc(MDB_IDL_UM_MAX);
+	if (!level || !next || !pt->pt_top) {
+		rc = ENOMEM;
+		goto done;
+	}
+	mdb_midl_xappend(level, pt->pt_root);
+	while (level[0] < want) {
+		if ((rc = MDB_PAGE_GET(mc, level[1], 1, &mp)))
+			goto done;
+		if (!IS_BRANCH(mp))
+			break;
+		next[0] = 0;
+		for (i = 1; i <= level[0]; i++) {
+			if ((rc = MDB_PAGE_GET(mc, level[i], 1, &mp)) ||
+				(rc = mdb_midl_append(&pt->pt_top, level[i])))
+				goto done;
+			for (j = 0; j < NUMKEYS(mp); j++) {
+				if ((rc = mdb_midl_append(&next, NODEPGNO(NODEPTR(mp, j)))))
+					goto done;
+			}
+		}
+		tmp = level;
+		level = next;
+		next = tmp;
+	}
+	if (pc->pc_nunits + level[0] > pc->pc_maxunits) {
+		unsigned max = pc->pc_nunits + level[0] + 64;
+		if ((pu = realloc(pc->pc_units, max * sizeof(mdb_pcunit))) == NULL) {
+			rc = ENOMEM;
+			goto done;
+		}
+		pc->pc_units = pu;
+		pc->pc_maxunits = max;
+	}
+	pt->pt_unit = pc->pc_nunits;
+	pt->pt_nunits = level[0];
+	for (i = 1; i <= level[0]; i++) {
+		pu = &pc->pc_units[pc->pc_nunits++];
+		memset(pu, 0, sizeof(*pu));
+		pu->pu_root = level[i];
+	}
+done:
+	mdb_midl_free(level);
+	mdb_midl_free(next);
+	return rc;
+}
+
+	/** Write the branch pages above the subtrees of a tree, now that the
+	 *	new roots of the subtrees are known. In breadth-first order, the
+	 *	children of the top pages are the following top pages and then the
+	 *	subtrees, in sequence.
+	 */
+static int ESECT
+mdb_pcopy_top(mdb_pcopy *pc, MDB_cursor *mc, mdb_pctree *pt, char *buf)
+{
+	MDB_env *env = pc->pc_env;
+	MDB_page *mp, *mo = (MDB_page *)buf;
+	MDB_node *ni;
+	pgno_t ntop = pt->pt_top[0], c = 1, pg;
+	unsigned i, j;
+	int rc;
+
+	if (!ntop) {
+		pt->pt_new_root = pc->pc_units[pt->pt_unit].pu_new_root;
+		return MDB_SUCCESS;
+	}
+	for (i = 1; i <= ntop; i++) {
+		if ((rc = MDB_PAGE_GET(mc, pt->pt_top[i], 1, &mp)))
+			return rc;
+		memcpy(mo, mp, env->me_psize);
+		mo->mp_pgno = pt->pt_base + i - 1;
+		mo->mp_txnid = 1;
+		for (j = 0; j < NUMKEYS(mo); j++, c++) {
+			ni = NODEPTR(mo, j);
+			if (c < ntop) {
+				pg = pt->pt_top[c + 1];
+				SETPGNO(ni, pt->pt_base + c);
+			} else {
+				if (c - ntop >= pt->pt_nunits)
+					return MDB_CORRUPTED;
+				pg = pc->pc_units[pt->pt_unit + c - ntop].pu_root;
+				SETPGNO(ni, pc->pc_units[pt->pt_unit + c - ntop].pu_new_root);
+			}
+			if (NODEPGNO(NODEPTR(mp, j)) != pg)
+				return MDB_CORRUPTED;
+		}
+		if ((rc = mdb_fio(pc->pc_fd, buf, env->me_psize, (mdb_size_t)mo->mp_pgno * env->me_psize, 1)))
+			return rc;
+	}
+	pt->pt_new_root = pt->pt_base;
+	return MDB_SUCCESS;
+}
+
+	/** Thread that counts or copies subtrees until there are none left. */
+static THREAD_RET ESECT CALL_CONV
+mdb_pcopy_thr(void *arg)
+{
+	mdb_pcopy *pc = arg;
+	MDB_env *env = pc->pc_env;
+	MDB_cursor mc = {0};
+	mdb_copy my = {0};
+	mdb_pcunit *pu;
+	unsigned i;
+	int rc = MDB_SUCCESS;
+
+	mc.mc_snum = 1;
+	mc.mc_txn = pc->pc_txn;
+	mc.mc_flags = pc->pc_txn->mt_flags & (C_ORIG_RDONLY|C_WRITEMAP);
+	if (pc->pc_copying) {
+#ifdef _WIN32
+		if ((my.mc_wbuf[0] = _aligned_malloc(MDB_WBUF, env->me_os_psize)) == NULL)
+			rc = ERROR_NOT_ENOUGH_MEMORY;
+#elif defined(HAVE_MEMALIGN)
+		if ((my.mc_wbuf[0] = memalign(env->me_os_psize, MDB_WBUF)) == NULL)
+			rc = errno;
+#else
+		void *p;
+		if ((rc = posix_memalign(&p, env->me_os_psize, MDB_WBUF)) == 0)
+			my.mc_wbuf[0] = p;
+#endif
+		if (rc) {
+			pc->pc_error = rc;
+			return (THREAD_RET)0;
+		}
+		my.mc_wbuf[1] = my.mc_wbuf[0];
+		my.mc_env = env;
+		my.mc_txn = pc->pc_txn;
+		my.mc_fd = pc->pc_fd;
+		my.mc_pc = pc;
+	}
+	for (;;) {
+		pthread_mutex_lock(&pc->pc_mutex);
+		i = pc->pc_next++;
+		pthread_mutex_unlock(&pc->pc_mutex);
+		if (i >= pc->pc_end || pc->pc_error)
+			break;
+		pu = &pc->pc_units[i];
+		if (pc->pc_copying) {
+			pu->pu_new_root = pu->pu_root;
+			my.mc_next_pgno = pu->pu_base;
+			my.mc_wpos = (mdb_size_t)pu->pu_base * env->me_psize;
+			rc = mdb_env_cwalk(&my, &pu->pu_new_root, 0);
+			if (!rc)
+				rc = mdb_env_cthr_toggle(&my, 1);
+			/* a different count would overwrite the next subtree */
+			if (!rc && my.mc_next_pgno != pu->pu_base + pu->pu_count)
+				rc = MDB_INCOMPATIBLE;
+		} else
+			rc = mdb_pcopy_count(pc, &mc, pu->pu_root, 0, &pu->pu_count);
+		if (rc) {
+			pc->pc_error = rc;
+			break;
+		}
+	}
+#ifdef _WIN32
+	if (my.mc_wbuf[0]) _aligned_free(my.mc_wbuf[0]);
+#else
+	free(my.mc_wbuf[0]);
+#endif
+	return (THREAD_RET)0;
+}
+
+	/** Count or copy the subtrees from \b first to \b end with up to \b threads threads. */
+static int ESECT
+mdb_pcopy_run(mdb_pcopy *pc, int copying, unsigned first, unsigned end, int threads)
+{
+	pthread_t thr[MDB_PCOPY_MAXTHREADS];
+	int i, rc;
+
+	pc->pc_copying = copying;
+	pc->pc_next = first;
+	pc->pc_end = end;
+	if (threads > (int)(end - first))
+		threads = end - first;
+	for (i = 0; i < threads; i++) {
+		if ((rc = THREAD_CREATE(thr[i], mdb_pcopy_thr, pc)) != 0) {
+			pc->pc_error = rc;
+			break;
+		}
+	}
+	while (i > 0)
+		THREAD_FINISH(thr[--i]);
+	return pc->pc_error;
+}
+
+	/** Copy environment with compaction, splitting the main DB and each
+	 *	named DB into subtrees that are copied by several threads.
+	 */
+static int ESECT
+mdb_env_copyfd_parallel(MDB_env *env, HANDLE fd, int threads)
+{
+	mdb_pcopy pc = {0};
+	MDB_txn *txn = NULL;
+	MDB_cursor mc = {0};
+	MDB_page *mp;
+	MDB_meta *mm;
+	mdb_pctree *pt;
+	char *buf = NULL;
+	pgno_t pos;
+	unsigned t, u, nmain, want = threads * 4;
+	int rc;
+
+	rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+	if (rc)
+		return rc;
+	if (txn->mt_dbs[MAIN_DBI].md_root == P_INVALID) {
+		/* nothing to split */
+		mdb_txn_abort(txn);
+		return mdb_env_copyfd1(env, fd);
+	}
+#ifdef _WIN32
+	if (!(pc.pc_mutex = CreateMutex(NULL, FALSE, NULL))) {
+		rc = ErrCode();
+		goto done;
+	}
+	if ((buf = _aligned_malloc(MDB_WBUF, env->me_os_psize)) == NULL) {
+		rc = ERROR_NOT_ENOUGH_MEMORY;
+		goto done;
+	}
+#else
+	if ((rc = pthread_mutex_init(&pc.pc_mutex, NULL)) != 0) {
+		mdb_txn_abort(txn);
+		return rc;
+	}
+#ifdef HAVE_MEMALIGN
+	if ((buf = memalign(env->me_os_psize, MDB_WBUF)) == NULL) {
+		rc = errno;
+		goto done;
+	}
+#else
+	{
+		void *p;
+		if ((rc = posix_memalign(&p, env->me_os_psize, MDB_WBUF)) != 0)
+			goto done;
+		buf = p;
+	}
+#endif
+#endif
+	pc.pc_env = env;
+	pc.pc_txn = txn;
+	pc.pc_fd = fd;
+	mc.mc_snum = 1;
+	mc.mc_txn = txn;
+	mc.mc_flags = txn->mt_flags & (C_ORIG_RDONLY|C_WRITEMAP);
+
+	/* Counting the subtrees of the main DB finds the named DBs */
+	rc = mdb_pcopy_tree(&pc, txn->mt_dbs[MAIN_DBI].md_root);
+	if (!rc)
+		rc = mdb_pcopy_split(&pc, &mc, &pc.pc_trees[0], want);
+	if (!rc)
+		rc = mdb_pcopy_run(&pc, 0, 0, pc.pc_nunits, threads);
+	if (rc)
+		goto done;
+	nmain = pc.pc_nunits;
+	qsort(pc.pc_trees + 1, pc.pc_ntrees - 1, sizeof(mdb_pctree), mdb_pcopy_cmp);
+	for (t = 1; t < pc.pc_ntrees && !rc; t++)
+		rc = mdb_pcopy_split(&pc, &mc, &pc.pc_trees[t], want);
+	if (!rc)
+		rc = mdb_pcopy_run(&pc, 0, nmain, pc.pc_nunits, threads);
+	if (rc)
+		goto done;
+
+	/* Lay out the named DBs first, so their new roots are known
+	 * by the time the leaves of the main DB are copied.
+	 */
+	pos = NUM_METAS;
+	for (t = 1; t <= pc.pc_ntrees; t++) {
+		pt = &pc.pc_trees[t % pc.pc_ntrees];
+		for (u = pt->pt_unit; u < pt->pt_unit + pt->pt_nunits; u++) {
+			pc.pc_units[u].pu_base = pos;
+			pos += pc.pc_units[u].pu_count;
+		}
+		pt->pt_base = pos;
+		pos += pt->pt_top[0];
+	}
+	rc = mdb_pcopy_run(&pc, 1, nmain, pc.pc_nunits, threads);
+	for (t = 1; t < pc.pc_ntrees && !rc; t++)
+		rc = mdb_pcopy_top(&pc, &mc, &pc.pc_trees[t], buf);
+	if (!rc)
+		rc = mdb_pcopy_run(&pc, 1, 0, nmain, threads);
+	if (!rc)
+		rc = mdb_pcopy_top(&pc, &mc, &pc.pc_trees[0], buf);
+	if (rc)
+		goto done;
+
+	memset(buf, 0, NUM_METAS * env->me_psize);
+	mp = (MDB_page *)buf;
+	mp->mp_pgno = 0;
+	mp->mp_flags = P_META;
+	mm = (MDB_meta *)METADATA(mp);
+	mdb_env_init_meta0(env, mm);
+	mm->mm_address = env->me_metas[0]->mm_address;
+
+	mp = (MDB_page *)(buf + env->me_psize);
+	mp->mp_pgno = 1;
+	mp->mp_flags = P_META;
+	*(MDB_meta *)METADATA(mp) = *mm;
+	mm = (MDB_meta *)METADATA(mp);
+	mm->mm_last_pg = pos - 1;
+	mm->mm_dbs[MAIN_DBI] = txn->mt_dbs[MAIN_DBI];
+	mm->mm_dbs[MAIN_DBI].md_root = pc.pc_trees[0].pt_new_root;
+	mm->mm_txnid = txn->mt_txnid | 1;
+	rc = mdb_fio(fd, buf, NUM_METAS * env->me_psize, 0, 1);
+
+done:
+	for (t = 0; t < pc.pc_ntrees; t++)
+		mdb_midl_free(pc.pc_trees[t].pt_top);
+	free(pc.pc_trees);
+	free(pc.pc_units);
+#ifdef _WIN32
+	if (buf) _aligned_free(buf);
+	if (pc.pc_mutex) CloseHandle(pc.pc_mutex);
+#else
+	free(buf);
+	pthread_mutex_destroy(&pc.pc_mutex);
+#endif
+	mdb_txn_abort(txn);
+	return rc;
+}
+
+	/** Copy environment as-is. */
+static int ESECT
+mdb_env_copyfd0(MDB_env *env, HANDLE fd)
+{
+	MDB_txn *txn = NULL;
+	mdb_mutexref_t wmutex = NULL;
+	int rc;
+	mdb_size_t wsize, w3;
+	char *ptr;
+#ifdef _WIN32
+	DWORD len, w2;
+#define DO_WRITE(rc, fd, ptr, w2, len)	rc = WriteFile(fd, ptr, w2, &len, NULL)
+#else
+	ssize_t len;
+	size_t w2;
+#define DO_WRITE(rc, fd, ptr, w2, len)	len = write(fd, ptr, w2); rc = (len >= 0)
+#endif
+
+	/* Do the lock/unlock of the reader mutex before starting the
+	 * write txn.  Otherwise other read txns could block writers.
+	 */
+	rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+	if (rc)
+		return rc;
+
+	if (env->me_txns) {
+		/* We must start the actual read txn after blocking writers */
+		mdb_txn_end(txn, MDB_END_RESET_TMP);
+
+		/* Temporarily block writers until we snapshot the meta pages */
+		wmutex = env->me_wmutex;
+		if (LOCK_MUTEX(rc, env, wmutex))
+			goto leave;
 
 		rc = mdb_txn_renew0(txn);
 		if (rc) {
@@ -12192,12 +13315,40 @@ leave:
 int ESECT
 mdb_env_copyfd2(MDB_env *env, HANDLE fd, unsigned int flags)
 {
+#if MDB_RPAGE_CACHE
+	/* compaction renumbers the pages, which invalidates their checksums */
+	if (env->me_sumfunc)
+		flags &= ~MDB_CP_COMPACT;
+#endif
 	if (flags & MDB_CP_COMPACT)
 		return mdb_env_copyfd1(env, fd);
 	else
 		return mdb_env_copyfd0(env, fd);
 }
 
+int ESECT
+mdb_env_copyfd3(MDB_env *env, HANDLE fd, unsigned int flags, int threads)
+{
+	/* the threads share the read txn, which remapped pages don't allow,
+	 * and write at offsets, which pipes and sockets don't allow
+	 */
+	if (!(flags & MDB_CP_COMPACT) || threads < 2 || MDB_REMAPPING(env->me_flags))
+		return mdb_env_copyfd2(env, fd, flags);
+#if MDB_RPAGE_CACHE
+	if (env->me_sumfunc)
+		return mdb_env_copyfd2(env, fd, flags);
+#endif
+#ifdef _WIN32
+	if (GetFileType(fd) != FILE_TYPE_DISK)
+#else
+	if (lseek(fd, 0, SEEK_CUR) < 0)
+#endif
+		return mdb_env_copyfd2(env, fd, flags);
+	if (threads > MDB_PCOPY_MAXTHREADS)
+		threads = MDB_PCOPY_MAXTHREADS;
+	return mdb_env_copyfd_parallel(env, fd, threads);
+}
+
 int ESECT
 mdb_env_copyfd(MDB_env *env, HANDLE fd)
 {
@@ -12206,6 +13357,12 @@ mdb_env_copyfd(MDB_env *env, HANDLE fd)
 
 int ESECT
 mdb_env_copy2(MDB_env *env, const char *path, unsigned int flags)
+{
+	return mdb_env_copy3(env, path, flags, 1);
+}
+
+int ESECT
+mdb_env_copy3(MDB_env *env, const char *path, unsigned int flags, int threads)
 {
 	int rc;
 	MDB_name fname;
@@ -12217,7 +13374,7 @@ mdb_env_copy2(MDB_env *env, const char *path, unsigned int flags)
 		mdb_fname_destroy(fname);
 	}
 	if (rc == MDB_SUCCESS) {
-		rc = mdb_env_copyfd2(env, newfd, flags);
+		rc = mdb_env_copyfd3(env, newfd, flags, threads);
 		if (close(newfd) < 0 && rc == MDB_SUCCESS)
 			rc = ErrCode();
 	}
@@ -12230,25 +13387,349 @@ mdb_env_copy(MDB_env *env, const char *path)
 	return mdb_env_copy2(env, path, 0);
 }
 
-int ESECT
-mdb_env_set_flags(MDB_env *env, unsigned int flag, int onoff)
+/** Header of an incremental backup file. It is followed by the meta page
+ *	of the snapshot, then the table of page runs (pairs of first page number
+ *	and page count), then the contents of the runs, each section padded to
+ *	a page boundary.
+ */
+typedef struct MDB_incr_hdr {
+	uint32_t	ih_magic;	/**< #MDB_INCR_MAGIC */
+	uint32_t	ih_version;	/**< #MDB_DATA_VERSION of the pages */
+	uint32_t	ih_psize;	/**< page size of the environment */
+	uint32_t	ih_pad;
+	mdb_size_t	ih_since;	/**< base txnid, only newer pages are included */
+	mdb_size_t	ih_txnid;	/**< txnid of the snapshot */
+	mdb_size_t	ih_runs;	/**< number of page runs */
+	mdb_size_t	ih_pages;	/**< total number of pages in the runs */
+} MDB_incr_hdr;
+
+#define MDB_INCR_MAGIC	0xBEEFC1DE
+
+/** Collect the pages reachable in \b txn that were written after \b since.
+ *	Every write copies the path from the modified page up to the root, so
+ *	a page written at or before \b since can only refer to other such pages
+ *	and its subtree is skipped; the walk is proportional to the changes.
+ */
+static int ESECT
+mdb_env_incr_walk(MDB_txn *txn, txnid_t since, MDB_IDL *pages)
 {
-	if (flag & ~CHANGEABLE)
-		return EINVAL;
-	if (onoff)
-		env->me_flags |= flag;
-	else
-		env->me_flags &= ~flag;
-	return MDB_SUCCESS;
+	MDB_cursor mc = {0};
+	MDB_IDL todo;
+	MDB_page *mp, *omp;
+	MDB_node *ni;
+	pgno_t pg;
+	unsigned i, n;
+	int rc = MDB_SUCCESS;
+
+	if ((todo = mdb_midl_alloc(MDB_IDL_UM_MAX)) == NULL)
+		return ENOMEM;
+	mc.mc_snum = 1;
+	mc.mc_txn = txn;
+	mc.mc_flags = txn->mt_flags & (C_ORIG_RDONLY|C_WRITEMAP);
+
+	for (i = FREE_DBI; i <= MAIN_DBI && !rc; i++) {
+		if (txn->mt_dbs[i].md_root != P_INVALID)
+			rc = mdb_midl_append(&todo, txn->mt_dbs[i].md_root);
+	}
+	while (todo[0] && !rc) {
+		pg = todo[todo[0]--];
+		if ((rc = MDB_PAGE_GET(&mc, pg, 1, &mp)))
+			break;
+		if (mp->mp_txnid <= since) {
+			MDB_PAGE_UNREF(txn, mp);
+			continue;
+		}
+		rc = mdb_midl_append(pages, pg);
+		n = NUMKEYS(mp);
+		if (IS_BRANCH(mp)) {
+			for (i = 0; i < n && !rc; i++)
+				rc = mdb_midl_append(&todo, NODEPGNO(NODEPTR(mp, i)));
+		} else if (!IS_LEAF2(mp)) {
+			for (i = 0; i < n && !rc; i++) {
+				ni = NODEPTR(mp, i);
+				if (ni->mn_flags & F_BIGDATA) {
+					MDB_ovpage ovp;
+					memcpy(&ovp, NODEDATA(ni), sizeof(ovp));
+					if ((rc = MDB_PAGE_GET(&mc, ovp.op_pgno, ovp.op_pages, &omp)))
+						break;
+					if (omp->mp_txnid > since)
+						rc = mdb_midl_append_range(pages, ovp.op_pgno, ovp.op_pages);
+					MDB_PAGE_UNREF(txn, omp);
+				} else if (ni->mn_flags & F_SUBDATA) {
+					/* named DB or dupsort sub-DB */
+					MDB_db db;
+					memcpy(&db, NODEDATA(ni), sizeof(db));
+					if (db.md_root != P_INVALID)
+						rc = mdb_midl_append(&todo, db.md_root);
+				}
+			}
+		}
+		MDB_PAGE_UNREF(txn, mp);
+	}
+	mdb_midl_free(todo);
+	return rc;
 }
 
 int ESECT
-mdb_env_get_flags(MDB_env *env, unsigned int *arg)
+mdb_env_copy_incr(MDB_env *env, const char *path, mdb_size_t since, mdb_size_t *txnid)
 {
-	if (!env || !arg)
-		return EINVAL;
-
-	*arg = env->me_flags & EXPOSED;
+	MDB_txn *txn = NULL;
+	MDB_name fname;
+	HANDLE fd = INVALID_HANDLE_VALUE;
+	MDB_IDL pages = NULL;
+	MDB_incr_hdr *hdr;
+	MDB_page *mp;
+	MDB_meta *mm;
+	mdb_size_t *runs = NULL, nruns = 0, i, r, tsize, bsize, off, pos, len;
+	unsigned int psize = env->me_psize;
+	char *buf = NULL;
+	int rc;
+
+	rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+	if (rc)
+		return rc;
+	if ((pages = mdb_midl_alloc(MDB_IDL_UM_MAX)) == NULL) {
+		rc = ENOMEM;
+		goto done;
+	}
+	rc = mdb_env_incr_walk(txn, since, &pages);
+	if (rc)
+		goto done;
+	/* sorted in descending order, so runs are read from the end */
+	mdb_midl_sort(pages);
+	for (i = pages[0]; i > 0; i--) {
+		if (i == pages[0] || pages[i] != pages[i+1] + 1)
+			nruns++;
+	}
+	tsize = (nruns * 2 * sizeof(mdb_size_t) + psize - 1) / psize * psize;
+	if ((runs = calloc(1, tsize ? tsize : 1)) == NULL) {
+		rc = ENOMEM;
+		goto done;
+	}
+	for (i = pages[0], r = 0; i > 0; i--) {
+		if (i == pages[0] || pages[i] != pages[i+1] + 1) {
+			runs[r++] = pages[i];
+			runs[r++] = 1;
+		} else
+			runs[r-1]++;
+	}
+	bsize = MDB_WBUF;
+	/* the copy may be opened for direct I/O, which needs aligned buffers */
+#ifdef _WIN32
+	if ((buf = _aligned_malloc(bsize, env->me_os_psize)) == NULL) {
+		rc = ERROR_NOT_ENOUGH_MEMORY;
+		goto done;
+	}
+#elif defined(HAVE_MEMALIGN)
+	if ((buf = memalign(env->me_os_psize, bsize)) == NULL) {
+		rc = errno;
+		goto done;
+	}
+#else
+	{
+		void *p;
+		if ((rc = posix_memalign(&p, env->me_os_psize, bsize)) != 0)
+			goto done;
+		buf = p;
+	}
+#endif
+	memset(buf, 0, NUM_METAS * psize);
+	hdr = (MDB_incr_hdr *)buf;
+	hdr->ih_magic = MDB_INCR_MAGIC;
+	hdr->ih_version = MDB_DATA_VERSION;
+	hdr->ih_psize = psize;
+	hdr->ih_since = since;
+	hdr->ih_txnid = txn->mt_txnid;
+	hdr->ih_runs = nruns;
+	hdr->ih_pages = pages[0];
+
+	mp = (MDB_page *)(buf + psize);
+	mp->mp_flags = P_META;
+	mm = (MDB_meta *)METADATA(mp);
+	mdb_env_init_meta0(env, mm);
+	mm->mm_address = env->me_metas[0]->mm_address;
+	mm->mm_dbs[FREE_DBI] = txn->mt_dbs[FREE_DBI];
+	mm->mm_dbs[MAIN_DBI] = txn->mt_dbs[MAIN_DBI];
+	mm->mm_last_pg = txn->mt_next_pgno - 1;
+	mm->mm_txnid = txn->mt_txnid;
+
+	rc = mdb_fname_init(path, env->me_flags | MDB_NOSUBDIR | MDB_NOLOCK, &fname);
+	if (rc)
+		goto done;
+	rc = mdb_fopen(env, &fname, MDB_O_COPY, 0666, &fd);
+	mdb_fname_destroy(fname);
+	if (rc)
+		goto done;
+	pos = NUM_METAS * psize;
+	rc = mdb_fio(fd, buf, pos, 0, 1);
+	for (off = 0; off < tsize && !rc; off += len, pos += len) {
+		len = tsize - off > bsize ? bsize : tsize - off;
+		memcpy(buf, (char *)runs + off, len);
+		rc = mdb_fio(fd, buf, len, pos, 1);
+	}
+	/* copy the raw pages, so encrypted pages stay encrypted */
+	for (r = 0; r < nruns * 2 && !rc; r += 2) {
+		off = runs[r] * psize;
+		for (len = runs[r+1] * psize; len && !rc; ) {
+			mdb_size_t n = len > bsize ? bsize : len;
+			if (!(rc = mdb_fio(env->me_fd, buf, n, off, 0)))
+				rc = mdb_fio(fd, buf, n, pos, 1);
+			off += n;
+			pos += n;
+			len -= n;
+		}
+	}
+	if (!rc && txnid)
+		*txnid = txn->mt_txnid;
+
+done:
+	if (fd != INVALID_HANDLE_VALUE && close(fd) < 0 && !rc)
+		rc = ErrCode();
+#ifdef _WIN32
+	if (buf) _aligned_free(buf);
+#else
+	free(buf);
+#endif
+	free(runs);
+	mdb_midl_free(pages);
+	mdb_txn_abort(txn);
+	return rc;
+}
+
+int ESECT
+mdb_env_restore_incr(const char *path, const char *incr_path, mdb_size_t *txnid)
+{
+	MDB_env env0;
+	MDB_name fname;
+	HANDLE ifd = INVALID_HANDLE_VALUE, fd = INVALID_HANDLE_VALUE;
+	MDB_incr_hdr hdr;
+	MDB_page *mp;
+	MDB_meta *mm;
+	mdb_size_t *runs = NULL, r, tsize, fsize = 0, off, pos, len, current = 0;
+	char *buf = NULL;
+	int i, rc;
+
+	/* no environment is opened, these just select plain file names */
+	memset(&env0, 0, sizeof(env0));
+	env0.me_flags = MDB_NOSUBDIR | MDB_NOLOCK;
+	rc = mdb_fname_init(incr_path, env0.me_flags, &fname);
+	if (rc)
+		return rc;
+	rc = mdb_fopen(&env0, &fname, MDB_O_RDONLY, 0, &ifd);
+	mdb_fname_destroy(fname);
+	if (rc)
+		return rc;
+	if ((rc = mdb_fio(ifd, (char *)&hdr, sizeof(hdr), 0, 0)))
+		goto done;
+	if (hdr.ih_magic != MDB_INCR_MAGIC || hdr.ih_psize < sizeof(MDB_metabuf) ||
+		hdr.ih_psize > MAX_PAGESIZE || (hdr.ih_psize & (hdr.ih_psize - 1))) {
+		rc = MDB_INVALID;
+		goto done;
+	}
+	if ((hdr.ih_version & 0xffff) != MDB_DATA_VERSION) {
+		rc = MDB_VERSION_MISMATCH;
+		goto done;
+	}
+	tsize = (hdr.ih_runs * 2 * sizeof(mdb_size_t) + hdr.ih_psize - 1) / hdr.ih_psize * hdr.ih_psize;
+	if ((runs = malloc(tsize ? tsize : 1)) == NULL || (buf = malloc(MDB_WBUF)) == NULL) {
+		rc = ENOMEM;
+		goto done;
+	}
+	if ((rc = mdb_fio(ifd, (char *)runs, tsize, NUM_METAS * hdr.ih_psize, 0)))
+		goto done;
+
+	rc = mdb_fname_init(path, env0.me_flags, &fname);
+	if (rc)
+		goto done;
+	rc = mdb_fopen(&env0, &fname, MDB_O_RDWR, 0666, &fd);
+	mdb_fname_destroy(fname);
+	if (rc)
+		goto done;
+	/* The target must be a copy of the same environment that is at least as
+	 * new as the base of this increment, and no newer than its snapshot.
+	 */
+	if ((rc = mdb_fsize(fd, &fsize)))
+		goto done;
+	if (fsize) {
+		if ((rc = mdb_fio(fd, buf, NUM_METAS * hdr.ih_psize, 0, 0)))
+			goto done;
+		for (i = 0; i < NUM_METAS; i++) {
+			mm = (MDB_meta *)METADATA((MDB_page *)(buf + i * hdr.ih_psize));
+			if (mm->mm_magic != MDB_MAGIC) {
+				rc = MDB_INVALID;
+				goto done;
+			}
+			if (mm->mm_psize != hdr.ih_psize) {
+				rc = MDB_INCOMPATIBLE;
+				goto done;
+			}
+			if (mm->mm_txnid > current)
+				current = mm->mm_txnid;
+		}
+	}
+	if (current < hdr.ih_since || current > hdr.ih_txnid) {
+		rc = MDB_INCOMPATIBLE;
+		goto done;
+	}
+
+	pos = NUM_METAS * hdr.ih_psize + tsize;
+	for (r = 0; r < hdr.ih_runs * 2 && !rc; r += 2) {
+		off = runs[r] * hdr.ih_psize;
+		for (len = runs[r+1] * hdr.ih_psize; len && !rc; ) {
+			mdb_size_t n = len > MDB_WBUF ? MDB_WBUF : len;
+			if (!(rc = mdb_fio(ifd, buf, n, pos, 0)))
+				rc = mdb_fio(fd, buf, n, off, 1);
+			off += n;
+			pos += n;
+			len -= n;
+		}
+	}
+	/* The pages must be durable before the meta pages refer to them. Both
+	 * meta pages get the snapshot, so it is used whichever one is picked.
+	 */
+	if (!rc && MDB_FDATASYNC(fd))
+		rc = ErrCode();
+	if (!rc)
+		rc = mdb_fio(ifd, buf, hdr.ih_psize, hdr.ih_psize, 0);
+	for (i = 0; i < NUM_METAS && !rc; i++) {
+		mp = (MDB_page *)buf;
+		mp->mp_pgno = i;
+		rc = mdb_fio(fd, buf, hdr.ih_psize, i * hdr.ih_psize, 1);
+	}
+	if (!rc && MDB_FDATASYNC(fd))
+		rc = ErrCode();
+	if (!rc && txnid)
+		*txnid = hdr.ih_txnid;
+
+done:
+	if (fd != INVALID_HANDLE_VALUE && close(fd) < 0 && !rc)
+		rc = ErrCode();
+	if (ifd != INVALID_HANDLE_VALUE)
+		close(ifd);
+	free(buf);
+	free(runs);
+	return rc;
+}
+
+int ESECT
+mdb_env_set_flags(MDB_env *env, unsigned int flag, int onoff)
+{
+	if (flag & ~CHANGEABLE)
+		return EINVAL;
+	if (onoff)
+		env->me_flags |= flag;
+	else
+		env->me_flags &= ~flag;
+	return MDB_SUCCESS;
+}
+
+int ESECT
+mdb_env_get_flags(MDB_env *env, unsigned int *arg)
+{
+	if (!env || !arg)
+		return EINVAL;
+
+	*arg = env->me_flags & EXPOSED;
 	return MDB_SUCCESS;
 }
 
@@ -12295,6 +13776,25 @@ mdb_env_set_callback(MDB_env *env, MDB_check_fd *func)
 	return MDB_SUCCESS;
 }
 
+int ESECT
+mdb_env_set_sync_scheduler(MDB_env *env, MDB_sync_request *func, void *ctx)
+{
+	if (!env)
+		return EINVAL;
+	env->me_sync_request = func;
+	env->me_sync_ctx = ctx;
+	return MDB_SUCCESS;
+}
+
+int
+mdb_dbi_name(MDB_txn *txn, MDB_dbi dbi, MDB_val *name)
+{
+	if (!TXN_DBI_EXIST(txn, dbi, DB_USRVALID))
+		return EINVAL;
+	*name = txn->mt_dbxs[dbi].md_name;
+	return MDB_SUCCESS;
+}
+
 int ESECT
 mdb_env_set_freespace_options(MDB_env *env, unsigned int max_to_load, unsigned int max_to_retain)
 {
@@ -12340,6 +13840,49 @@ mdb_env_set_checksum(MDB_env *env, MDB_sum_func *func, unsigned int size)
 	env->me_sumsize = size;
 	return MDB_SUCCESS;
 }
+
+int ESECT
+mdb_env_set_rpage_cache(MDB_env *env, unsigned int chunk, unsigned int txn_chunks, unsigned int env_chunks)
+{
+	if (!env)
+		return EINVAL;
+	if (env->me_flags & MDB_ENV_ACTIVE)
+		return EINVAL;
+	if (!chunk)
+		chunk = env->me_rpchunk;
+	if (!txn_chunks)
+		txn_chunks = env->me_trpsize;
+	if (!env_chunks)
+		env_chunks = env->me_erpsize;
+	/* one #MDB_ID3.muse bit per page */
+	if (chunk > MDB_RPAGE_CHUNK || (chunk & (chunk - 1)))
+		return EINVAL;
+	/* every chunk a txn holds is also held in the env list */
+	if (txn_chunks < 4 || env_chunks < txn_chunks)
+		return EINVAL;
+	env->me_rpchunk = chunk;
+	env->me_trpsize = txn_chunks;
+	env->me_erpsize = env_chunks;
+	return MDB_SUCCESS;
+}
+
+int ESECT
+mdb_env_rpage_stat(MDB_env *env, MDB_rpage_stat *stat)
+{
+	if (!env || !stat)
+		return EINVAL;
+	memset(stat, 0, sizeof(*stat));
+	stat->rs_chunk = env->me_rpchunk;
+	stat->rs_txn_size = env->me_trpsize;
+	stat->rs_env_size = env->me_erpsize;
+	if (!(env->me_flags & MDB_ENV_ACTIVE) || !MDB_REMAPPING(env->me_flags))
+		return MDB_SUCCESS;
+	pthread_mutex_lock(&env->me_rpmutex);
+	mdb_rpage_stat_add(stat, &env->me_rpstat);
+	stat->rs_cached = env->me_rpages[0].mid;
+	pthread_mutex_unlock(&env->me_rpmutex);
+	return MDB_SUCCESS;
+}
 #endif
 
 int ESECT
@@ -12770,6 +14313,1517 @@ leave:
 	return rc;
 }
 
+/** State of an incremental compaction step, see #mdb_txn_compact() */
+typedef struct MDB_compact {
+	MDB_compact_stat	*cp_stat;
+	pgno_t		cp_target;		/**< pages at or after this are relocated */
+	mdb_size_t	cp_max;			/**< max pages to relocate in this step */
+	int			cp_full;		/**< no free space is left below the target */
+	int			cp_stop;		/**< the step ended, at the position saved in #cp_key */
+	MDB_val		*cp_key;		/**< where to save the key the step ended at, or NULL */
+	char		*cp_buf;		/**< copy of a relocated overflow value */
+	size_t		cp_bufsize;
+	MDB_val		cp_name;		/**< the named DB being relocated, mv_data NULL for the main DB */
+} MDB_compact;
+
+/** Copy \b size bytes into a malloc'd #MDB_val, NUL terminated (for DB names) */
+static int
+mdb_compact_save(MDB_val *dst, const void *src, size_t size)
+{
+	char *buf = realloc(dst->mv_data, size + 1);
+	if (!buf)
+		return ENOMEM;
+	memcpy(buf, src, size);
+	buf[size] = 0;
+	dst->mv_data = buf;
+	dst->mv_size = size;
+	return MDB_SUCCESS;
+}
+
+/** End the step at the i'th node of the cursor's leaf. Sub-DBs end with
+ * the node of their parent DB, which is where the next step resumes.
+ */
+static int
+mdb_compact_stop(MDB_cursor *mc, MDB_compact *cp, unsigned i)
+{
+	MDB_node *leaf;
+
+	cp->cp_stop = 1;
+	if ((mc->mc_flags & C_SUB) || !cp->cp_key)
+		return MDB_SUCCESS;
+	leaf = NODEPTR(mc->mc_pg[mc->mc_top], i);
+	return mdb_compact_save(cp->cp_key, NODEKEY(leaf), NODEKSZ(leaf));
+}
+
+/** Relocate the pages on a cursor's stack that are at or after the target,
+ * by touching the path down to the deepest of them.
+ */
+static int
+mdb_compact_path(MDB_cursor *mc, MDB_compact *cp)
+{
+	MDB_txn *txn = mc->mc_txn;
+	unsigned i, tail = 0, snum = mc->mc_snum, deepest = 0;
+	int rc;
+
+	for (i = 0; i < snum; i++) {
+		MDB_page *mp = mc->mc_pg[i];
+		if (mp->mp_pgno >= cp->cp_target && !IS_MUTABLE(txn, mp)) {
+			tail++;
+			deepest = i;
+		}
+	}
+	if (!tail)
+		return MDB_SUCCESS;
+	/* Parents must be copied to point to the new pages, children are left alone */
+	mc->mc_snum = deepest + 1;
+	rc = mdb_cursor_touch(mc);
+	mc->mc_snum = snum;
+	mc->mc_top = snum - 1;
+	if (rc)
+		return rc;
+	cp->cp_stat->cs_relocated += tail;
+	for (i = 0; i <= deepest; i++) {
+		/* the free space below the target is used up, new pages are coming from the end of the file */
+		if (mc->mc_pg[i]->mp_pgno >= cp->cp_target)
+			cp->cp_full = 1;
+	}
+	return MDB_SUCCESS;
+}
+
+/** Rewrite an overflow value so that it is copied to newly allocated pages */
+static int
+mdb_compact_ovpage(MDB_cursor *mc, MDB_compact *cp, unsigned i)
+{
+	MDB_node *leaf = NODEPTR(mc->mc_pg[mc->mc_top], i);
+	MDB_val key, data;
+	unsigned ksize = NODEKSZ(leaf);
+	int rc;
+
+	if ((rc = mdb_node_read(mc, leaf, &data)))
+		return rc;
+	/* the key and value are copied since the node and its pages are replaced */
+	if (cp->cp_bufsize < ksize + data.mv_size) {
+		char *buf = realloc(cp->cp_buf, ksize + data.mv_size);
+		if (!buf)
+			return ENOMEM;
+		cp->cp_buf = buf;
+		cp->cp_bufsize = ksize + data.mv_size;
+	}
+	memcpy(cp->cp_buf, NODEKEY(leaf), ksize);
+	memcpy(cp->cp_buf + ksize, data.mv_data, data.mv_size);
+	key.mv_size = ksize;
+	key.mv_data = cp->cp_buf;
+	data.mv_data = cp->cp_buf + ksize;
+	mc->mc_ki[mc->mc_top] = i;
+	mc->mc_flags |= C_INITIALIZED;
+	mc->mc_flags &= ~C_EOF;
+	return mdb_cursor_put(mc, &key, &data, MDB_CURRENT);
+}
+
+/** Relocate the pages of a DB (and its sorted-duplicate sub-DBs) that are
+ * at or after the compaction target, starting from the leaf with \b start
+ * (or the first leaf), until the step's pages are used up.
+ */
+static int
+mdb_compact_tree(MDB_cursor *mc, MDB_compact *cp, MDB_val *start)
+{
+	MDB_compact_stat *stat = cp->cp_stat;
+	MDB_node *leaf;
+	unsigned i, n;
+	int rc;
+
+	rc = mdb_page_search(mc, start, start ? 0 : MDB_PS_FIRST);
+	if (rc)
+		return rc == MDB_NOTFOUND ? MDB_SUCCESS : rc;
+	for (;;) {
+		if (cp->cp_full || stat->cs_relocated >= cp->cp_max)
+			return mdb_compact_stop(mc, cp, 0);
+		if ((rc = mdb_compact_path(mc, cp)))
+			return rc;
+		/* the large records of the freeDB are left alone, they are used up soon enough */
+		if (!IS_LEAF2(mc->mc_pg[mc->mc_top]) && !(mc->mc_flags & C_SUB) && mc->mc_dbi != FREE_DBI) {
+			n = NUMKEYS(mc->mc_pg[mc->mc_top]);
+			for (i = 0; i < n; i++) {
+				leaf = NODEPTR(mc->mc_pg[mc->mc_top], i);
+				if (leaf->mn_flags & F_BIGDATA) {
+					MDB_ovpage ovp;
+					memcpy(&ovp, NODEDATA(leaf), sizeof(ovp));
+					if (ovp.op_pgno + ovp.op_pages <= cp->cp_target)
+						continue;
+					if (cp->cp_full || stat->cs_relocated >= cp->cp_max)
+						return mdb_compact_stop(mc, cp, i);
+					if ((rc = mdb_compact_ovpage(mc, cp, i)))
+						return rc;
+					stat->cs_relocated += ovp.op_pages;
+				} else if ((leaf->mn_flags & (F_SUBDATA|F_DUPDATA)) == (F_SUBDATA|F_DUPDATA)) {
+					MDB_xcursor *mx = mc->mc_xcursor;
+					pgno_t root;
+					mc->mc_ki[mc->mc_top] = i;
+					mdb_xcursor_init1(mc, leaf);
+					root = mx->mx_db.md_root;
+					if ((rc = mdb_compact_tree(&mx->mx_cursor, cp, NULL)))
+						return rc;
+					if (mx->mx_db.md_root != root) {
+						/* the sub-DB was moved, update its record */
+						if ((rc = mdb_cursor_touch(mc)))
+							return rc;
+						leaf = NODEPTR(mc->mc_pg[mc->mc_top], i);
+						memcpy(NODEDATA(leaf), &mx->mx_db, sizeof(MDB_db));
+					}
+					/* the rest of the sub-DB is walked again from its start */
+					if (cp->cp_stop)
+						return mdb_compact_stop(mc, cp, i);
+				}
+			}
+		}
+		rc = mdb_cursor_sibling(mc, 1);
+		if (rc)
+			return rc == MDB_NOTFOUND ? MDB_SUCCESS : rc;
+	}
+}
+
+/** Find the named DB after \b name in the main DB (or the first one, if
+ * its mv_data is NULL), and copy its name into \b name.
+ */
+static int
+mdb_compact_next(MDB_txn *txn, MDB_val *name)
+{
+	MDB_cursor mc;
+	MDB_val key, data;
+	MDB_node *leaf;
+	int rc;
+
+	mdb_cursor_init(&mc, txn, MAIN_DBI, NULL);
+	if (name->mv_data) {
+		key = *name;
+		rc = mdb_cursor_get(&mc, &key, &data, MDB_SET_RANGE);
+		if (!rc && key.mv_size == name->mv_size && !memcmp(key.mv_data, name->mv_data, key.mv_size))
+			rc = mdb_cursor_get(&mc, &key, &data, MDB_NEXT);
+	} else
+		rc = mdb_cursor_get(&mc, &key, &data, MDB_FIRST);
+	for (; !rc; rc = mdb_cursor_get(&mc, &key, &data, MDB_NEXT)) {
+		leaf = NODEPTR(mc.mc_pg[mc.mc_top], mc.mc_ki[mc.mc_top]);
+		if ((leaf->mn_flags & (F_SUBDATA|F_DUPDATA)) == F_SUBDATA)
+			return mdb_compact_save(name, key.mv_data, key.mv_size);
+	}
+	return rc;
+}
+
+/** Relocate the pages of the named DB in \b cp_name, from \b start. If the
+ * DB isn't open it is opened for this, and closed again afterwards, so that
+ * compaction doesn't use up the DB handles.
+ */
+static int
+mdb_compact_named(MDB_txn *txn, MDB_compact *cp, MDB_val *start)
+{
+	MDB_env *env = txn->mt_env;
+	MDB_cursor *mc;
+	MDB_dbi dbi;
+	char *name = cp->cp_name.mv_data;
+	int rc, opened = 1;
+
+	for (dbi = CORE_DBS; dbi < txn->mt_numdbs; dbi++) {
+		if (txn->mt_dbxs[dbi].md_name.mv_data && !strcmp(name, txn->mt_dbxs[dbi].md_name.mv_data)) {
+			opened = 0;
+			break;
+		}
+	}
+	/* can't open it (out of DB slots), so its pages can't be moved */
+	if (opened && mdb_dbi_open(txn, name, 0, &dbi))
+		return MDB_SUCCESS;
+	if ((rc = mdb_cursor_open(txn, dbi, &mc)))
+		return rc;
+	rc = mdb_compact_tree(mc, cp, start);
+	mdb_cursor_close(mc);
+	if (rc || !opened)
+		return rc;
+	/* write its record now, since the handle is gone by the time the txn commits */
+	if (txn->mt_dbflags[dbi] & DB_DIRTY) {
+		MDB_cursor m2;
+		MDB_val data;
+		data.mv_size = sizeof(MDB_db);
+		data.mv_data = &txn->mt_dbs[dbi];
+		mdb_cursor_init(&m2, txn, MAIN_DBI, NULL);
+		if ((rc = mdb_cursor_put(&m2, &txn->mt_dbxs[dbi].md_name, &data, F_SUBDATA)))
+			return rc;
+	}
+	txn->mt_dbflags[dbi] = 0;
+	mdb_dbi_close(env, dbi);
+	return MDB_SUCCESS;
+}
+
+/** Iterate over the blocks of pages in a (run-length encoded) freeDB record */
+#define FREE_RECORD_EACH(idl, pg, num, body)	do { \
+	pgno_t *idl_ = (idl), n_ = idl_[0], j_; \
+	for (j_ = 1; j_ <= n_; j_++) { \
+		ssize_t entry_ = (ssize_t) idl_[j_]; \
+		if (!entry_) continue; \
+		if (entry_ < 0) { \
+			if (j_ == n_) break; \
+			num = -entry_; pg = idl_[++j_]; \
+		} else { \
+			num = 1; pg = entry_; \
+		} \
+		body \
+	} \
+} while (0)
+
+/** Shrink the file by taking the free pages at its end out of the freeDB and
+ * moving the end of the file back before them, see #mdb_txn_compact().
+ */
+static int
+mdb_compact_shrink(MDB_txn *txn, MDB_compact *cp)
+{
+	MDB_env *env = txn->mt_env;
+	MDB_cursor mc;
+	MDB_val key, data;
+	txnid_t oldest = mdb_find_oldest(txn), id;
+	pgno_t start = cp->cp_target, end = txn->mt_next_pgno, last_end = end, pg, num, q;
+	pgno_t *record = NULL;
+	size_t record_size = 0;
+	unsigned char *free_map;
+	int rc;
+
+	if (start >= end)
+		return MDB_SUCCESS;
+	/* Mark the reusable free pages after the target, to find the free run at the end of the file */
+	if (!(free_map = calloc((end - start + 7) >> 3, 1)))
+		return ENOMEM;
+	mdb_cursor_init(&mc, txn, FREE_DBI, NULL);
+	for (rc = mdb_cursor_first(&mc, &key, &data); !rc; rc = mdb_cursor_next(&mc, &key, &data, MDB_NEXT)) {
+		memcpy(&id, key.mv_data, sizeof(id));
+		if (id >= oldest)
+			break;
+		FREE_RECORD_EACH((pgno_t *) data.mv_data, pg, num, {
+			for (q = pg < start ? start : pg; q < pg + num && q < end; q++)
+				free_map[(q - start) >> 3] |= 1 << ((q - start) & 7);
+		});
+	}
+	if (rc && rc != MDB_NOTFOUND) {
+		free(free_map);
+		return rc;
+	}
+	for (pg = end; pg > start && (free_map[(pg - 1 - start) >> 3] & (1 << ((pg - 1 - start) & 7))); pg--)
+		;
+	free(free_map);
+	if (pg == end)
+		return MDB_SUCCESS;
+
+	/* The in-memory free list is discarded (as when another process has written),
+	 * and not reloaded in this txn while the freeDB records are rewritten.
+	 */
+	if (env->me_pghead)
+		mdb_midl_free(env->me_pghead);
+	env->me_pghead = NULL;
+	env->me_freelist_start = 0;
+	env->me_freelist_end = 0;
+	env->me_freelist_position = 0;
+	env->me_pgoldest = 0;
+	MDB_PGRUNS_RESET(env);
+	txn->mt_flags |= MDB_TXN_NOFREELIST | MDB_TXN_TRUNCATE;
+	txn->mt_next_pgno = end = pg;
+
+	mdb_cursor_init(&mc, txn, FREE_DBI, NULL);
+	for (rc = mdb_cursor_first(&mc, &key, &data); !rc; rc = mdb_cursor_next(&mc, &key, &data, MDB_NEXT)) {
+		pgno_t *idl = data.mv_data, count = 0;
+		int changed = 0;
+		memcpy(&id, key.mv_data, sizeof(id));
+		if (id >= oldest)
+			break;
+		if (record_size < data.mv_size) {
+			pgno_t *r = realloc(record, data.mv_size);
+			if (!r) {
+				rc = ENOMEM;
+				break;
+			}
+			record = r;
+			record_size = data.mv_size;
+		}
+		FREE_RECORD_EACH(idl, pg, num, {
+			if (pg + num > end) {
+				changed = 1;
+				if (pg >= end)
+					continue;
+				num = end - pg;
+			}
+			if (num > 1)
+				record[++count] = -(ssize_t) num;
+			record[++count] = pg;
+		});
+		if (!changed)
+			continue;
+		if (count) {
+			record[0] = count;
+			data.mv_size = (count + 1) * sizeof(pgno_t);
+			data.mv_data = record;
+			/* a shorter record is reinserted, so the key can't point into the page */
+			key.mv_data = &id;
+			rc = mdb_cursor_put(&mc, &key, &data, MDB_CURRENT);
+		} else
+			rc = mdb_cursor_del(&mc, 0);
+		if (rc)
+			break;
+	}
+	free(record);
+	if (rc && rc != MDB_NOTFOUND)
+		return rc;
+	cp->cp_stat->cs_truncated = last_end - txn->mt_next_pgno;
+	return MDB_SUCCESS;
+}
+
+/** Count the pages in the freeDB at or after \b from */
+static int
+mdb_compact_free(MDB_txn *txn, pgno_t from, pgno_t *count)
+{
+	MDB_cursor mc;
+	MDB_val key, data;
+	pgno_t pg, num;
+	int rc;
+
+	*count = 0;
+	mdb_cursor_init(&mc, txn, FREE_DBI, NULL);
+	for (rc = mdb_cursor_first(&mc, &key, &data); !rc; rc = mdb_cursor_next(&mc, &key, &data, MDB_NEXT)) {
+		FREE_RECORD_EACH((pgno_t *) data.mv_data, pg, num, {
+			if (pg + num > from)
+				*count += pg + num - (pg > from ? pg : from);
+		});
+	}
+	return rc == MDB_NOTFOUND ? MDB_SUCCESS : rc;
+}
+
+int
+mdb_txn_compact(MDB_txn *txn, mdb_size_t max_pages, MDB_compact_stat *stat)
+{
+	MDB_compact cp = {0};
+	MDB_env *env;
+	MDB_cursor *mc;
+	MDB_cursor m2;
+	MDB_val *start;
+	pgno_t free_pages, used, next_pgno;
+	int rc, fresh, from_start = 0;
+
+	if (!txn || !stat || txn->mt_parent)
+		return EINVAL;
+	if (F_ISSET(txn->mt_flags, MDB_TXN_RDONLY))
+		return EACCES;
+	if (txn->mt_flags & MDB_TXN_BLOCKED)
+		return MDB_BAD_TXN;
+	env = txn->mt_env;
+	memset(stat, 0, sizeof(*stat));
+	next_pgno = txn->mt_next_pgno;
+	/* Shrinking has to start from the freeDB as it was committed */
+	fresh = !txn->mt_u.dirty_list[0].mid && !txn->mt_loose_pgs && !txn->mt_free_pgs[0] &&
+		!(txn->mt_flags & MDB_TXN_DIRTY);
+
+	/* If the used pages were packed together, they would end at the target. Some
+	 * slack is left for the branch pages that are copied along with them.
+	 */
+	if ((rc = mdb_compact_free(txn, 0, &free_pages)))
+		return rc;
+	cp.cp_stat = stat;
+	cp.cp_max = max_pages;
+	cp.cp_target = free_pages < next_pgno ? next_pgno - free_pages + (free_pages >> 4) + 16 : NUM_METAS;
+	if (cp.cp_target > next_pgno)
+		cp.cp_target = next_pgno;
+	stat->cs_target = cp.cp_target;
+	/* The pages left to relocate are the ones after the target that aren't free */
+	if ((rc = mdb_compact_free(txn, cp.cp_target, &free_pages)))
+		return rc;
+	used = next_pgno - cp.cp_target > free_pages ? next_pgno - cp.cp_target - free_pages : 0;
+
+	/* Free space below the target is used for the relocated pages, and it
+	 * stays that way for the rest of the txn, so that the freeDB pages written
+	 * by the commit don't end up after the target either.
+	 */
+	txn->mt_compact_limit = cp.cp_target;
+	/* The freeDB is small, and its pages would keep the file from being shrunk */
+	mdb_cursor_init(&m2, txn, FREE_DBI, NULL);
+	rc = mdb_compact_tree(&m2, &cp, NULL);
+	if (!rc && !cp.cp_stop) {
+		/* Each step resumes the walk of the DBs where the last one stopped:
+		 * the main DB, and then the named DBs, in the order of their names.
+		 */
+		cp.cp_key = &env->me_compact_key;
+		cp.cp_name = env->me_compact_db;
+		start = env->me_compact_key.mv_data ? &env->me_compact_key : NULL;
+		from_start = !cp.cp_name.mv_data && !start;
+		env->me_compact_db.mv_data = NULL;
+		if (cp.cp_name.mv_data)
+			rc = mdb_compact_named(txn, &cp, start);
+		else if (!(rc = mdb_cursor_open(txn, MAIN_DBI, &mc))) {
+			rc = mdb_compact_tree(mc, &cp, start);
+			mdb_cursor_close(mc);
+		}
+		while (!rc && !cp.cp_stop && !(rc = mdb_compact_next(txn, &cp.cp_name)))
+			rc = mdb_compact_named(txn, &cp, NULL);
+		if (rc == MDB_NOTFOUND)
+			rc = MDB_SUCCESS;
+		if (cp.cp_stop) {
+			/* resume from here (in the DB being walked, which may be the main DB) */
+			env->me_compact_db = cp.cp_name;
+			cp.cp_name.mv_data = NULL;
+		} else {
+			/* the walk is done, the next step starts over */
+			free(env->me_compact_key.mv_data);
+			env->me_compact_key.mv_data = NULL;
+		}
+	}
+	stat->cs_remaining = used > stat->cs_relocated ? used - stat->cs_relocated : 0;
+	/* Only a whole walk that found nothing to relocate knows that nothing is left */
+	if (!rc && from_start && !cp.cp_stop && !stat->cs_relocated) {
+		stat->cs_remaining = 0;
+		if (fresh)
+			rc = mdb_compact_shrink(txn, &cp);
+	}
+	free(cp.cp_name.mv_data);
+	free(cp.cp_buf);
+	if (rc)
+		txn->mt_flags |= MDB_TXN_ERROR;
+	return rc;
+}
+
+	/** Pages to prefault, shared by the threads of #mdb_txn_warm(). */
+typedef struct mdb_warm {
+	MDB_env		*mw_env;
+	pgno_t		*mw_pgs;		/**< sorted page numbers */
+	unsigned	mw_next;		/**< next page for a thread to claim */
+	unsigned	mw_end;
+	pthread_mutex_t	mw_mutex;
+	volatile int	mw_error;
+} mdb_warm;
+
+	/** Pages claimed by a thread at a time, and the longest range read at once */
+#define MDB_WARM_RUN	256
+	/** Pages prefaulted between progress reports */
+#define MDB_WARM_BATCH	16384
+#define MDB_WARM_MAXTHREADS	64
+
+static int
+mdb_warm_cmp(const void *a, const void *b)
+{
+	pgno_t x = *(const pgno_t *)a, y = *(const pgno_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+	/** Fault in a range of pages. With a full map the range is touched
+	 *	after asking for readahead, so the page tables are populated too.
+	 *	Remapped (encrypted) pages aren't mapped, so the file is read
+	 *	into \b buf instead, to get it into the page cache.
+	 */
+static int ESECT
+mdb_warm_range(MDB_env *env, pgno_t pg, pgno_t num, char *buf)
+{
+	mdb_size_t off = (mdb_size_t)pg * env->me_psize, len = (mdb_size_t)num * env->me_psize, i;
+	volatile char *p;
+	char c = 0;
+
+	if (MDB_REMAPPING(env->me_flags))
+		return mdb_fio(env->me_fd, buf, len, off, 0);
+	p = (volatile char *)env->me_map + off;
+#ifdef MADV_WILLNEED
+	madvise((char *)p, len, MADV_WILLNEED);
+#endif
+	for (i = 0; i < len; i += env->me_os_psize)
+		c ^= p[i];
+	(void)c;
+	return MDB_SUCCESS;
+}
+
+	/** Thread that prefaults claimed pages until there are none left. */
+static THREAD_RET ESECT CALL_CONV
+mdb_warm_thr(void *arg)
+{
+	mdb_warm *mw = arg;
+	MDB_env *env = mw->mw_env;
+	char *buf = NULL;
+	unsigned i, end, run;
+	int rc = MDB_SUCCESS;
+
+	if (MDB_REMAPPING(env->me_flags) && !(buf = malloc((size_t)MDB_WARM_RUN * env->me_psize))) {
+		mw->mw_error = ENOMEM;
+		return (THREAD_RET)0;
+	}
+	for (;;) {
+		pthread_mutex_lock(&mw->mw_mutex);
+		i = mw->mw_next;
+		end = i + MDB_WARM_RUN < mw->mw_end ? i + MDB_WARM_RUN : mw->mw_end;
+		mw->mw_next = end;
+		pthread_mutex_unlock(&mw->mw_mutex);
+		if (i >= end || mw->mw_error)
+			break;
+		for (; i < end && !rc; i += run) {
+			for (run = 1; i + run < end && mw->mw_pgs[i + run] == mw->mw_pgs[i] + run; run++) ;
+			rc = mdb_warm_range(env, mw->mw_pgs[i], run, buf);
+		}
+		if (rc) {
+			mw->mw_error = rc;
+			break;
+		}
+	}
+	free(buf);
+	return (THREAD_RET)0;
+}
+
+	/** Sort and prefault \b n pages with up to \b threads threads. */
+static int ESECT
+mdb_warm_pages(mdb_warm *mw, pgno_t *pgs, unsigned n, int threads)
+{
+	pthread_t thr[MDB_WARM_MAXTHREADS];
+	int i, rc;
+
+	qsort(pgs, n, sizeof(pgno_t), mdb_warm_cmp);
+	mw->mw_pgs = pgs;
+	mw->mw_next = 0;
+	mw->mw_end = n;
+	if (threads > (int)(n + MDB_WARM_RUN - 1) / MDB_WARM_RUN)
+		threads = (n + MDB_WARM_RUN - 1) / MDB_WARM_RUN;
+	for (i = 0; i < threads; i++) {
+		if ((rc = THREAD_CREATE(thr[i], mdb_warm_thr, mw)) != 0) {
+			mw->mw_error = rc;
+			break;
+		}
+	}
+	while (i > 0)
+		THREAD_FINISH(thr[--i]);
+	return mw->mw_error;
+}
+
+	/** Grow the page numbers and depths of a level to \b size entries. */
+static int ESECT
+mdb_walk_grow(pgno_t **pgs, unsigned short **depths, unsigned size)
+{
+	pgno_t *p;
+	unsigned short *d;
+
+	if (!(p = realloc(*pgs, size * sizeof(pgno_t))))
+		return ENOMEM;
+	*pgs = p;
+	if (!(d = realloc(*depths, size * sizeof(unsigned short))))
+		return ENOMEM;
+	*depths = d;
+	return MDB_SUCCESS;
+}
+
+	/** Called with the branch pages of each level by #mdb_walk_levels(),
+	 *	before they are read. The pages may be reordered.
+	 */
+typedef int (mdb_level_func)(void *arg, pgno_t *pgs, unsigned n);
+
+	/** Walk the branch pages of databases a level at a time, up to \b limit
+	 *	pages, and collect the leaf pages below them, up to the rest of the
+	 *	limit. The leaves are returned in \b leaves (if it is non-NULL),
+	 *	which the caller frees.
+	 */
+static int ESECT
+mdb_walk_levels(MDB_txn *txn, MDB_dbi *dbis, unsigned ndbis, mdb_size_t limit,
+	mdb_level_func *level, void *arg, pgno_t **leaves, unsigned *nleaves)
+{
+	MDB_cursor mc = {0};
+	MDB_page *mp;
+	MDB_stat st;
+	/* page numbers and the levels from them to the leaves, for the current and next levels */
+	pgno_t *cur = NULL, *next = NULL, *pgs = NULL, *lv = NULL, *tmp;
+	unsigned short *cur_depth = NULL, *next_depth = NULL, *dtmp;
+	mdb_size_t branches = 0;
+	unsigned i, j, ncur = 0, nnext, npgs, nlv = 0, nkeys, size, cap = 0;
+	int rc;
+
+	mc.mc_snum = 1;
+	mc.mc_txn = txn;
+	mc.mc_flags = txn->mt_flags & (C_ORIG_RDONLY|C_WRITEMAP);
+
+	/* the roots, which mdb_stat() also refreshes for named DBs */
+	size = ndbis > 64 ? ndbis : 64;
+	if ((rc = mdb_walk_grow(&cur, &cur_depth, size)) || (rc = mdb_walk_grow(&next, &next_depth, size)))
+		goto done;
+	for (i = 0; i < ndbis; i++) {
+		if ((rc = mdb_stat(txn, dbis[i], &st)))
+			goto done;
+		if (txn->mt_dbs[dbis[i]].md_root == P_INVALID)
+			continue;
+		cur[ncur] = txn->mt_dbs[dbis[i]].md_root;
+		cur_depth[ncur++] = txn->mt_dbs[dbis[i]].md_depth;
+	}
+
+	while (ncur) {
+		if (!(pgs = malloc(ncur * sizeof(pgno_t)))) {
+			rc = ENOMEM;
+			break;
+		}
+		for (i = npgs = 0; i < ncur; i++) {
+			if (cur_depth[i] > 1) {
+				if (branches + npgs >= limit)
+					break;
+				pgs[npgs++] = cur[i];
+			} else if (leaves && branches + nlv < limit) {
+				if (nlv == cap) {
+					cap = cap ? cap * 2 : 1024;
+					if (!(tmp = realloc(lv, cap * sizeof(pgno_t)))) {
+						rc = ENOMEM;
+						break;
+					}
+					lv = tmp;
+				}
+				lv[nlv++] = cur[i];
+			}
+		}
+		ncur = i;
+		if (rc || !npgs || (rc = level(arg, pgs, npgs)))
+			break;
+		free(pgs);
+		pgs = NULL;
+		branches += npgs;
+		for (i = nnext = 0; i < ncur; i++) {
+			if (cur_depth[i] < 2)
+				continue;
+			if ((rc = MDB_PAGE_GET(&mc, cur[i], 1, &mp)))
+				break;
+			nkeys = NUMKEYS(mp);
+			if (nnext + nkeys > size) {
+				size = (nnext + nkeys) * 2;
+				/* the levels are swapped, so both have the same size */
+				if ((rc = mdb_walk_grow(&next, &next_depth, size)) ||
+					(rc = mdb_walk_grow(&cur, &cur_depth, size))) {
+					MDB_PAGE_UNREF(txn, mp);
+					break;
+				}
+			}
+			for (j = 0; j < nkeys; j++) {
+				next[nnext] = NODEPGNO(NODEPTR(mp, j));
+				next_depth[nnext++] = cur_depth[i] - 1;
+			}
+			MDB_PAGE_UNREF(txn, mp);
+		}
+		if (rc)
+			break;
+		tmp = cur, cur = next, next = tmp;
+		dtmp = cur_depth, cur_depth = next_depth, next_depth = dtmp;
+		ncur = nnext;
+	}
+	/* the branch pages may have used up more of the limit since the leaves were collected */
+	if (nlv > limit - branches)
+		nlv = limit - branches;
+done:
+	if (leaves && !rc) {
+		*leaves = lv;
+		*nleaves = nlv;
+	} else
+		free(lv);
+	free(pgs);
+	free(cur);
+	free(cur_depth);
+	free(next);
+	free(next_depth);
+	return rc;
+}
+
+	/** Progress of #mdb_txn_warm(). */
+typedef struct mdb_warm_ctx {
+	mdb_warm	wc_warm;
+	int			wc_threads;
+	mdb_size_t	wc_warmed;
+	mdb_size_t	wc_total;
+	MDB_warm_func	*wc_progress;
+	void		*wc_ctx;
+} mdb_warm_ctx;
+
+	/** Read a level of branch pages ahead (in page order) before they are walked. */
+static int ESECT
+mdb_warm_level(void *arg, pgno_t *pgs, unsigned n)
+{
+	mdb_warm_ctx *wc = arg;
+	int rc;
+
+	if ((rc = mdb_warm_pages(&wc->wc_warm, pgs, n, wc->wc_threads)))
+		return rc;
+	wc->wc_warmed += n;
+	if (wc->wc_progress)
+		wc->wc_progress(wc->wc_ctx, wc->wc_warmed, wc->wc_total);
+	return MDB_SUCCESS;
+}
+
+int
+mdb_txn_warm(MDB_txn *txn, MDB_dbi *dbis, unsigned int ndbis, mdb_size_t budget, int threads,
+	MDB_warm_func *progress, void *ctx)
+{
+	MDB_env *env;
+	MDB_stat st;
+	mdb_warm_ctx wc;
+	pgno_t *leaves;
+	mdb_size_t limit;
+	unsigned i, j, nleaves;
+	int rc;
+
+	if (!txn || (!dbis && ndbis))
+		return EINVAL;
+	if (txn->mt_flags & MDB_TXN_BLOCKED)
+		return MDB_BAD_TXN;
+	env = txn->mt_env;
+	memset(&wc, 0, sizeof(wc));
+	if (threads < 1)
+		threads = 1;
+	if (threads > MDB_WARM_MAXTHREADS)
+		threads = MDB_WARM_MAXTHREADS;
+	limit = budget ? budget / env->me_psize : (mdb_size_t)-1;
+	for (i = 0; i < ndbis; i++) {
+		if ((rc = mdb_stat(txn, dbis[i], &st)))
+			return rc;
+		wc.wc_total += st.ms_branch_pages + st.ms_leaf_pages;
+	}
+	if (wc.wc_total > limit)
+		wc.wc_total = limit;
+	wc.wc_warm.mw_env = env;
+	wc.wc_threads = threads;
+	wc.wc_progress = progress;
+	wc.wc_ctx = ctx;
+#ifdef _WIN32
+	if (!(wc.wc_warm.mw_mutex = CreateMutex(NULL, FALSE, NULL)))
+		return ErrCode();
+#else
+	if ((rc = pthread_mutex_init(&wc.wc_warm.mw_mutex, NULL)) != 0)
+		return rc;
+#endif
+
+	/* branch pages first, a level at a time, and then the leaves in page order */
+	rc = mdb_walk_levels(txn, dbis, ndbis, limit, mdb_warm_level, &wc, &leaves, &nleaves);
+	if (!rc) {
+		qsort(leaves, nleaves, sizeof(pgno_t), mdb_warm_cmp);
+		for (i = 0; i < nleaves && !rc; i += j) {
+			j = nleaves - i < MDB_WARM_BATCH ? nleaves - i : MDB_WARM_BATCH;
+			if (!(rc = mdb_warm_pages(&wc.wc_warm, leaves + i, j, threads))) {
+				wc.wc_warmed += j;
+				if (progress)
+					progress(ctx, wc.wc_warmed, wc.wc_total);
+			}
+		}
+		free(leaves);
+	}
+#ifdef _WIN32
+	CloseHandle(wc.wc_warm.mw_mutex);
+#else
+	pthread_mutex_destroy(&wc.wc_warm.mw_mutex);
+#endif
+	return rc;
+}
+
+	/** State for #mdb_txn_residency(). */
+typedef struct mdb_resw {
+	MDB_cursor	rw_mc;
+	unsigned char	*rw_vec;	/**< residency of the OS pages in the file */
+	pgno_t		rw_npages;		/**< pages in the file, covered by rw_vec */
+	unsigned	rw_ratio;		/**< OS pages per DB page */
+	unsigned	rw_sample;
+	mdb_size_t	rw_leaves;		/**< leaves seen, for sampling */
+	HANDLE		rw_fd;			/**< for reading the leaves that aren't resident */
+} mdb_resw;
+
+	/** Count a run of pages, which are resident if their first OS page is. */
+static void
+mdb_res_count(mdb_resw *rw, pgno_t pg, pgno_t num, mdb_size_t weight, mdb_size_t *pages, mdb_size_t *resident)
+{
+	pgno_t i;
+
+	for (i = 0; i < num && pg + i < rw->rw_npages; i++) {
+		if (rw->rw_vec[(mdb_size_t)(pg + i) * rw->rw_ratio] & 1)
+			*resident += weight;
+	}
+	*pages += (mdb_size_t)num * weight;
+}
+
+	/** Count the pages of a tree. Leaves that aren't resident are read from
+	 *	the file (for their overflow pages and sub-DBs) instead of the map, and
+	 *	then dropped from the page cache again, so that the report itself
+	 *	doesn't load them. Depths aren't counted for sub-DBs.
+	 */
+static int ESECT
+mdb_res_walk(mdb_resw *rw, pgno_t pg, unsigned levels, unsigned depth, int sub, MDB_residency *res)
+{
+	MDB_page *mp, *scratch = NULL;
+	MDB_node *ni;
+	mdb_size_t weight = 1, resident = 0, pages = 0;
+	unsigned i, n, d = depth < MDB_RESIDENCY_DEPTHS ? depth : MDB_RESIDENCY_DEPTHS - 1;
+	int type = levels > 1 ? MDB_RES_BRANCH : MDB_RES_LEAF, rc = MDB_SUCCESS;
+
+	if (type == MDB_RES_LEAF && rw->rw_sample > 1) {
+		if (rw->rw_leaves++ % rw->rw_sample)
+			return MDB_SUCCESS;
+		weight = rw->rw_sample;
+	}
+	mdb_res_count(rw, pg, 1, weight, &pages, &resident);
+	res->mr_pages[type] += pages;
+	res->mr_resident[type] += resident;
+	if (!sub) {
+		res->mr_depth_pages[d] += pages;
+		res->mr_depth_resident[d] += resident;
+	}
+	if (type == MDB_RES_LEAF && !resident) {
+		MDB_env *env = rw->rw_mc.mc_txn->mt_env;
+		off_t off = (off_t)pg * env->me_psize;
+		if (!(scratch = malloc(env->me_psize)))
+			return ENOMEM;
+		ssize_t len = pread(rw->rw_fd, scratch, env->me_psize, off);
+		if (len != (ssize_t)env->me_psize) {
+			rc = len < 0 ? ErrCode() : MDB_CORRUPTED;
+			free(scratch);
+			return rc;
+		}
+#ifdef POSIX_FADV_DONTNEED
+		posix_fadvise(rw->rw_fd, off, env->me_psize, POSIX_FADV_DONTNEED);
+#endif
+		mp = scratch;
+	} else if ((rc = MDB_PAGE_GET(&rw->rw_mc, pg, 1, &mp)))
+		return rc;
+	n = NUMKEYS(mp);
+	if (IS_BRANCH(mp)) {
+		for (i = 0; i < n && !rc; i++)
+			rc = mdb_res_walk(rw, NODEPGNO(NODEPTR(mp, i)), levels - 1, depth + 1, sub, res);
+	} else if (!IS_LEAF2(mp)) {
+		for (i = 0; i < n && !rc; i++) {
+			ni = NODEPTR(mp, i);
+			if (ni->mn_flags & F_BIGDATA) {
+				MDB_ovpage ovp;
+				memcpy(&ovp, NODEDATA(ni), sizeof(ovp));
+				mdb_res_count(rw, ovp.op_pgno, ovp.op_pages, weight,
+					&res->mr_pages[MDB_RES_OVERFLOW], &res->mr_resident[MDB_RES_OVERFLOW]);
+			} else if ((ni->mn_flags & (F_SUBDATA|F_DUPDATA)) == (F_SUBDATA|F_DUPDATA)) {
+				MDB_db db;
+				memcpy(&db, NODEDATA(ni), sizeof(db));
+				if (db.md_root != P_INVALID)
+					rc = mdb_res_walk(rw, db.md_root, db.md_depth, 0, 1, res);
+			}
+		}
+	}
+	if (scratch)
+		free(scratch);
+	else
+		MDB_PAGE_UNREF(rw->rw_mc.mc_txn, mp);
+	return rc;
+}
+
+int
+mdb_txn_residency(MDB_txn *txn, MDB_dbi *dbis, unsigned int ndbis, unsigned int sample,
+	MDB_residency *res, mdb_size_t *file_pages, mdb_size_t *file_resident)
+{
+#ifdef _WIN32
+	return MDB_INCOMPATIBLE;
+#else
+	MDB_env *env;
+	MDB_stat st;
+	MDB_name fname;
+	mdb_resw rw;
+	mdb_size_t i, len, resident = 0;
+	unsigned j;
+	int rc = MDB_SUCCESS;
+
+	if (!txn || !res || (!dbis && ndbis))
+		return EINVAL;
+	if (txn->mt_flags & MDB_TXN_BLOCKED)
+		return MDB_BAD_TXN;
+	env = txn->mt_env;
+	/* remapped pages aren't in the map to check */
+	if (MDB_REMAPPING(env->me_flags))
+		return MDB_INCOMPATIBLE;
+	memset(res, 0, ndbis * sizeof(MDB_residency));
+	memset(&rw, 0, sizeof(rw));
+	rw.rw_fd = INVALID_HANDLE_VALUE;
+
+	/* take a snapshot of the residency of the whole file first, so that
+	 * the branch pages read by the walk are reported as they were
+	 */
+	rw.rw_npages = txn->mt_next_pgno;
+	rw.rw_ratio = env->me_psize > env->me_os_psize ? env->me_psize / env->me_os_psize : 1;
+	len = (mdb_size_t)rw.rw_npages * env->me_psize;
+	if (!(rw.rw_vec = malloc((len + env->me_os_psize - 1) / env->me_os_psize)))
+		return ENOMEM;
+	if (mincore(env->me_map, len, (void *)rw.rw_vec)) {
+		rc = ErrCode();
+		goto done;
+	}
+	for (i = 0; i < rw.rw_npages; i++) {
+		if (rw.rw_vec[i * rw.rw_ratio] & 1)
+			resident++;
+	}
+	if (file_pages)
+		*file_pages = rw.rw_npages;
+	if (file_resident)
+		*file_resident = resident;
+
+	rw.rw_mc.mc_snum = 1;
+	rw.rw_mc.mc_txn = txn;
+	rw.rw_mc.mc_flags = txn->mt_flags & (C_ORIG_RDONLY|C_WRITEMAP);
+	rw.rw_sample = sample;
+	/* with its own handle, so there is no readahead around the leaves read from the file */
+	if (!(rc = mdb_fname_init(env->me_path, env->me_flags, &fname))) {
+		rc = mdb_fopen(env, &fname, MDB_O_RDONLY, 0, &rw.rw_fd);
+		mdb_fname_destroy(fname);
+	}
+	if (rc)
+		goto done;
+#ifdef POSIX_FADV_RANDOM
+	posix_fadvise(rw.rw_fd, 0, 0, POSIX_FADV_RANDOM);
+#endif
+	for (j = 0; j < ndbis && !rc; j++) {
+		/* mdb_stat() also refreshes the roots of named DBs */
+		if ((rc = mdb_stat(txn, dbis[j], &st)))
+			break;
+		if (txn->mt_dbs[dbis[j]].md_root != P_INVALID)
+			rc = mdb_res_walk(&rw, txn->mt_dbs[dbis[j]].md_root, txn->mt_dbs[dbis[j]].md_depth, 0, 0, &res[j]);
+	}
+done:
+	if (rw.rw_fd != INVALID_HANDLE_VALUE)
+		close(rw.rw_fd);
+	free(rw.rw_vec);
+	return rc;
+#endif
+}
+
+	/** Pages collected for #mdb_txn_pin(). */
+typedef struct mdb_pin_ctx {
+	pgno_t		*pc_pgs;
+	unsigned	pc_n;
+	unsigned	pc_cap;
+} mdb_pin_ctx;
+
+static int ESECT
+mdb_pin_add(mdb_pin_ctx *pc, pgno_t *pgs, unsigned n)
+{
+	pgno_t *p;
+
+	if (pc->pc_n + n > pc->pc_cap) {
+		pc->pc_cap = (pc->pc_n + n) * 2;
+		if (!(p = realloc(pc->pc_pgs, pc->pc_cap * sizeof(pgno_t))))
+			return ENOMEM;
+		pc->pc_pgs = p;
+	}
+	memcpy(pc->pc_pgs + pc->pc_n, pgs, n * sizeof(pgno_t));
+	pc->pc_n += n;
+	return MDB_SUCCESS;
+}
+
+static int ESECT
+mdb_pin_level(void *arg, pgno_t *pgs, unsigned n)
+{
+	return mdb_pin_add(arg, pgs, n);
+}
+
+	/** Lock or unlock sorted pages of a map, a run of contiguous pages at a time.
+	 *	Locking stops at the first failure, returning the number of pages
+	 *	that were locked in \b done.
+	 */
+static int ESECT
+mdb_pin_runs(MDB_env *env, char *map, pgno_t *pgs, unsigned n, int lock, unsigned *done)
+{
+	unsigned i, run;
+	char *p;
+	size_t len;
+	int rc = MDB_SUCCESS;
+
+	for (i = 0; i < n; i += run) {
+		for (run = 1; i + run < n && pgs[i + run] == pgs[i] + run; run++) ;
+		p = map + (mdb_size_t)pgs[i] * env->me_psize;
+		len = (size_t)run * env->me_psize;
+#ifdef _WIN32
+		if (!(lock ? VirtualLock(p, len) : VirtualUnlock(p, len)))
+			rc = ErrCode();
+#else
+		if (lock ? mlock(p, len) : munlock(p, len))
+			rc = ErrCode();
+#endif
+		if (rc && lock)
+			break;
+		rc = MDB_SUCCESS;
+	}
+	if (done)
+		*done = i;
+	return rc;
+}
+
+int
+mdb_txn_pin(MDB_txn *txn, MDB_dbi *dbis, unsigned int ndbis, mdb_size_t budget, unsigned int flags,
+	mdb_size_t *pinned)
+{
+	MDB_env *env;
+	mdb_pin_ctx pc = {0};
+	pgno_t *leaves = NULL, *old, *add = NULL, *drop = NULL, *keep = NULL;
+	unsigned i, j, nleaves = 0, nold, nadd = 0, ndrop = 0, nkeep = 0, locked = 0;
+	int rc;
+
+	if (!txn || (!dbis && ndbis))
+		return EINVAL;
+	if (txn->mt_flags & MDB_TXN_BLOCKED)
+		return MDB_BAD_TXN;
+	env = txn->mt_env;
+	/* remapped pages aren't in the map to lock */
+	if (MDB_REMAPPING(env->me_flags))
+		return MDB_INCOMPATIBLE;
+	old = env->me_pins;
+	nold = env->me_npins;
+	/* pages that were locked in a map that has since been replaced (by
+	 * growing it) were unlocked when it was unmapped, and its range may
+	 * have been reused since, so they are just locked again in the new one
+	 */
+	if (old && env->me_pinmap != env->me_map)
+		nold = 0;
+
+	if (ndbis) {
+		rc = mdb_walk_levels(txn, dbis, ndbis, budget ? budget / env->me_psize : (mdb_size_t)-1,
+			mdb_pin_level, &pc, &leaves, &nleaves);
+		if (!rc && (flags & MDB_PIN_LEAVES))
+			rc = mdb_pin_add(&pc, leaves, nleaves);
+		free(leaves);
+		if (rc)
+			goto fail;
+		qsort(pc.pc_pgs, pc.pc_n, sizeof(pgno_t), mdb_warm_cmp);
+	}
+
+	/* compare the new pages with the ones that are locked already */
+	if (!(add = malloc((pc.pc_n + 1) * sizeof(pgno_t))) || !(keep = malloc((pc.pc_n + 1) * sizeof(pgno_t))) ||
+		!(drop = malloc((nold + 1) * sizeof(pgno_t)))) {
+		rc = ENOMEM;
+		goto fail;
+	}
+	for (i = j = 0; i < pc.pc_n || j < nold; ) {
+		if (j == nold || (i < pc.pc_n && pc.pc_pgs[i] < old[j]))
+			add[nadd++] = pc.pc_pgs[i++];
+		else if (i == pc.pc_n || old[j] < pc.pc_pgs[i])
+			drop[ndrop++] = old[j++];
+		else {
+			keep[nkeep++] = pc.pc_pgs[i++];
+			j++;
+		}
+	}
+	mdb_pin_runs(env, env->me_map, drop, ndrop, 0, NULL);
+	/* if locking fails (usually from RLIMIT_MEMLOCK), keep what was locked */
+	rc = mdb_pin_runs(env, env->me_map, add, nadd, 1, &locked);
+
+	/* the pinned pages are now the kept ones and the added ones */
+	for (i = j = 0; i < nkeep || j < locked; ) {
+		if (j == locked || (i < nkeep && keep[i] < add[j]))
+			pc.pc_pgs[i + j] = keep[i], i++;
+		else
+			pc.pc_pgs[i + j] = add[j], j++;
+	}
+	free(env->me_pins);
+	env->me_pins = nkeep + locked ? pc.pc_pgs : NULL;
+	env->me_npins = nkeep + locked;
+	env->me_pinmap = env->me_map;
+	if (!env->me_pins)
+		free(pc.pc_pgs);
+	if (pinned)
+		*pinned = (mdb_size_t)env->me_npins * env->me_psize;
+	free(add);
+	free(keep);
+	free(drop);
+	return rc;
+
+fail:
+	if (nold != env->me_npins) {
+		/* the old pages were unlocked from a replaced map */
+		free(env->me_pins);
+		env->me_pins = NULL;
+		env->me_npins = 0;
+	}
+	free(pc.pc_pgs);
+	free(add);
+	free(keep);
+	free(drop);
+	return rc;
+}
+
+	/** A page, overflow run or tree to check in #mdb_txn_verify(). */
+typedef struct mdb_vitem {
+	pgno_t		vi_pgno;
+	pgno_t		vi_pages;		/**< number of overflow pages, or 0 for a tree page */
+	unsigned short	vi_depth;	/**< levels from this page to the leaves */
+	unsigned short	vi_flags;
+} mdb_vitem;
+
+	/** The item is in the main DB, whose leaves may hold named DBs */
+#define MDB_VI_MAIN	0x01
+	/** The item is in a sorted duplicates sub-DB */
+#define MDB_VI_DUP	0x02
+
+typedef struct mdb_vlist {
+	mdb_vitem	*vl_items;
+	unsigned	vl_n;
+	unsigned	vl_cap;
+} mdb_vlist;
+
+	/** State shared by the threads of #mdb_txn_verify(). */
+typedef struct mdb_verify {
+	MDB_txn		*mv_txn;
+	mdb_vlist	mv_work;		/**< subtrees of this round */
+	unsigned	mv_next;		/**< next subtree for a thread to claim */
+	mdb_vlist	mv_named;		/**< roots of named DBs, for the next round */
+	pgno_t		*mv_bad;		/**< corrupt pages found by all threads */
+	unsigned	mv_nbad;
+	mdb_size_t	mv_pages;
+	pthread_mutex_t	mv_mutex;
+	volatile int	mv_error;
+} mdb_verify;
+
+	/** Per-thread buffers and results of #mdb_txn_verify(). */
+typedef struct mdb_vthr {
+	mdb_verify	*vt_mv;
+	char		*vt_buf;		/**< pages read from the file when remapping */
+	char		*vt_clr;		/**< and decrypted */
+	pgno_t		vt_bufpgs;
+	mdb_vlist	vt_stack;
+	pgno_t		*vt_bad;
+	unsigned	vt_nbad;
+	unsigned	vt_badcap;
+	mdb_size_t	vt_pages;
+} mdb_vthr;
+
+	/** Items in the first round for each thread to claim */
+#define MDB_VERIFY_SPLIT	64
+
+static int ESECT
+mdb_vlist_add(mdb_vlist *vl, pgno_t pg, pgno_t pages, unsigned depth, unsigned flags)
+{
+	mdb_vitem *vi;
+
+	if (vl->vl_n == vl->vl_cap) {
+		vl->vl_cap = vl->vl_cap ? vl->vl_cap * 2 : 256;
+		if (!(vi = realloc(vl->vl_items, vl->vl_cap * sizeof(mdb_vitem))))
+			return ENOMEM;
+		vl->vl_items = vi;
+	}
+	vi = &vl->vl_items[vl->vl_n++];
+	vi->vi_pgno = pg;
+	vi->vi_pages = pages;
+	vi->vi_depth = depth;
+	vi->vi_flags = flags;
+	return MDB_SUCCESS;
+}
+
+	/** Read a page (or overflow run) for a thread. The map is only read,
+	 *	so it can be shared, but the remapped page cache can't, so remapped
+	 *	pages are read from the file and decrypted into the thread's buffers.
+	 */
+static int ESECT
+mdb_verify_read(mdb_vthr *vt, pgno_t pg, pgno_t num, MDB_page **ret)
+{
+	MDB_env *env = vt->vt_mv->mv_txn->mt_env;
+	size_t len = (size_t)num * env->me_psize;
+	char *p;
+	int rc;
+
+	if (!MDB_REMAPPING(env->me_flags)) {
+		*ret = (MDB_page *)(env->me_map + (size_t)pg * env->me_psize);
+		return MDB_SUCCESS;
+	}
+	if (num > vt->vt_bufpgs) {
+		if (!(p = realloc(vt->vt_buf, len)))
+			return ENOMEM;
+		vt->vt_buf = p;
+#if MDB_RPAGE_CACHE
+		if (env->me_encfunc) {
+			if (!(p = realloc(vt->vt_clr, len)))
+				return ENOMEM;
+			vt->vt_clr = p;
+		}
+#endif
+		vt->vt_bufpgs = num;
+	}
+	if ((rc = mdb_fio(env->me_fd, vt->vt_buf, len, (mdb_size_t)pg * env->me_psize, 0)))
+		return rc;
+	*ret = (MDB_page *)vt->vt_buf;
+#if MDB_RPAGE_CACHE
+	if (env->me_encfunc) {
+		if (mdb_page_decrypt(env, (MDB_page *)vt->vt_buf, (MDB_page *)vt->vt_clr, len))
+			*ret = NULL;	/* authentication failed */
+		else
+			*ret = (MDB_page *)vt->vt_clr;
+	}
+#endif
+	return MDB_SUCCESS;
+}
+
+	/** Check the structure (and checksum) of a page. */
+static int ESECT
+mdb_verify_check(MDB_env *env, MDB_page *mp, mdb_vitem *vi)
+{
+	unsigned i, n, end = env->me_psize - PAGEBASE - PAGETAIL(env), ptr;
+	MDB_node *node;
+
+	if (mp->mp_pgno != vi->vi_pgno)
+		return 0;
+	if (vi->vi_pages) {
+		if (!IS_OVERFLOW(mp) || mp->mp_pages != vi->vi_pages)
+			return 0;
+	} else {
+		if (IS_OVERFLOW(mp) || !(mp->mp_flags & (P_BRANCH|P_LEAF)) ||
+			(vi->vi_depth > 1) != !!IS_BRANCH(mp) ||
+			(IS_LEAF2(mp) && !(vi->vi_flags & MDB_VI_DUP)))
+			return 0;
+		if (mp->mp_lower < PAGEHDRSZ-PAGEBASE || mp->mp_lower > mp->mp_upper || mp->mp_upper > end)
+			return 0;
+		n = NUMKEYS(mp);
+		if (IS_BRANCH(mp) && !n)
+			return 0;
+		if (!IS_LEAF2(mp)) {
+			for (i = 0; i < n; i++) {
+				ptr = mp->mp_ptrs[i];
+				if (ptr < mp->mp_upper || ptr + NODESIZE > end)
+					return 0;
+				node = NODEPTR(mp, i);
+				if (ptr + NODESIZE + NODEKSZ(node) > end)
+					return 0;
+				if (IS_LEAF(mp) && ptr + NODESIZE + NODEKSZ(node) +
+					((node->mn_flags & F_BIGDATA) ? sizeof(MDB_ovpage) : NODEDSZ(node)) > end)
+					return 0;
+			}
+		}
+	}
+#if MDB_RPAGE_CACHE
+	if (env->me_sumfunc &&
+		mdb_page_chk_checksum(env, mp, (vi->vi_pages ? vi->vi_pages : 1) * env->me_psize))
+		return 0;
+#endif
+	return 1;
+}
+
+	/** Check a page, and add the pages below it to \b vl. Named DBs in
+	 *	the main DB are left for the next round.
+	 */
+static int ESECT
+mdb_verify_page(mdb_vthr *vt, mdb_vitem *vi, mdb_vlist *vl)
+{
+	mdb_verify *mv = vt->vt_mv;
+	MDB_txn *txn = mv->mv_txn;
+	MDB_page *mp = NULL;
+	MDB_node *node;
+	unsigned i, n, flags = vi->vi_flags;
+	pgno_t num = vi->vi_pages ? vi->vi_pages : 1, *p;
+	int rc;
+
+	vt->vt_pages += num;
+	if (vi->vi_pgno < NUM_METAS || vi->vi_pgno + num > txn->mt_next_pgno || vi->vi_pgno + num < num)
+		goto bad;
+	if ((rc = mdb_verify_read(vt, vi->vi_pgno, num, &mp)))
+		return rc;
+	if (!mp || !mdb_verify_check(txn->mt_env, mp, vi))
+		goto bad;
+	if (vi->vi_pages || IS_LEAF2(mp))
+		return MDB_SUCCESS;
+
+	n = NUMKEYS(mp);
+	for (i = 0, rc = MDB_SUCCESS; i < n && !rc; i++) {
+		node = NODEPTR(mp, i);
+		if (IS_BRANCH(mp)) {
+			rc = mdb_vlist_add(vl, NODEPGNO(node), 0, vi->vi_depth - 1, flags);
+		} else if (node->mn_flags & F_BIGDATA) {
+			MDB_ovpage ovp;
+			memcpy(&ovp, NODEDATA(node), sizeof(ovp));
+			rc = mdb_vlist_add(vl, ovp.op_pgno, ovp.op_pages ? ovp.op_pages : 1, 0, flags);
+		} else if (node->mn_flags & F_SUBDATA) {
+			MDB_db db;
+			if (NODEDSZ(node) != sizeof(db))
+				goto bad;
+			memcpy(&db, NODEDATA(node), sizeof(db));
+			if (db.md_root == P_INVALID)
+				continue;
+			if (node->mn_flags & F_DUPDATA) {
+				rc = mdb_vlist_add(vl, db.md_root, 0, db.md_depth, MDB_VI_DUP);
+			} else if (flags & MDB_VI_MAIN) {
+				pthread_mutex_lock(&mv->mv_mutex);
+				rc = mdb_vlist_add(&mv->mv_named, db.md_root, 0, db.md_depth, 0);
+				pthread_mutex_unlock(&mv->mv_mutex);
+			}
+		}
+	}
+	return rc;
+
+bad:
+	if (vt->vt_nbad == vt->vt_badcap) {
+		vt->vt_badcap = vt->vt_badcap ? vt->vt_badcap * 2 : 64;
+		if (!(p = realloc(vt->vt_bad, vt->vt_badcap * sizeof(pgno_t))))
+			return ENOMEM;
+		vt->vt_bad = p;
+	}
+	vt->vt_bad[vt->vt_nbad++] = vi->vi_pgno;
+	return MDB_SUCCESS;
+}
+
+	/** Add a thread's results to the shared ones. */
+static int ESECT
+mdb_verify_merge(mdb_vthr *vt)
+{
+	mdb_verify *mv = vt->vt_mv;
+	pgno_t *p;
+	int rc = MDB_SUCCESS;
+
+	pthread_mutex_lock(&mv->mv_mutex);
+	mv->mv_pages += vt->vt_pages;
+	if (vt->vt_nbad) {
+		if (!(p = realloc(mv->mv_bad, (mv->mv_nbad + vt->vt_nbad) * sizeof(pgno_t)))) {
+			rc = ENOMEM;
+		} else {
+			memcpy(p + mv->mv_nbad, vt->vt_bad, vt->vt_nbad * sizeof(pgno_t));
+			mv->mv_bad = p;
+			mv->mv_nbad += vt->vt_nbad;
+		}
+	}
+	pthread_mutex_unlock(&mv->mv_mutex);
+	vt->vt_pages = 0;
+	vt->vt_nbad = 0;
+	return rc;
+}
+
+	/** Thread that claims subtrees of a round and checks them depth-first. */
+static THREAD_RET ESECT CALL_CONV
+mdb_verify_thr(void *arg)
+{
+	mdb_vthr vt = {0};
+	mdb_verify *mv = arg;
+	mdb_vitem vi;
+	unsigned i;
+	int rc = MDB_SUCCESS;
+
+	vt.vt_mv = mv;
+	for (;;) {
+		pthread_mutex_lock(&mv->mv_mutex);
+		i = mv->mv_next++;
+		pthread_mutex_unlock(&mv->mv_mutex);
+		if (i >= mv->mv_work.vl_n || mv->mv_error)
+			break;
+		vt.vt_stack.vl_n = 0;
+		if ((rc = mdb_vlist_add(&vt.vt_stack, 0, 0, 0, 0)))
+			break;
+		vt.vt_stack.vl_items[0] = mv->mv_work.vl_items[i];
+		while (vt.vt_stack.vl_n && !rc) {
+			vi = vt.vt_stack.vl_items[--vt.vt_stack.vl_n];
+			rc = mdb_verify_page(&vt, &vi, &vt.vt_stack);
+		}
+		if (rc)
+			break;
+	}
+	if (!rc)
+		rc = mdb_verify_merge(&vt);
+	if (rc)
+		mv->mv_error = rc;
+	free(vt.vt_buf);
+	free(vt.vt_clr);
+	free(vt.vt_stack.vl_items);
+	free(vt.vt_bad);
+	return (THREAD_RET)0;
+}
+
+	/** Check the trees in \b mv_work with up to \b threads threads. The top
+	 *	levels are checked here, until there are enough subtrees to share.
+	 */
+static int ESECT
+mdb_verify_round(mdb_verify *mv, mdb_vthr *vt, int threads)
+{
+	pthread_t thr[MDB_WARM_MAXTHREADS];
+	mdb_vlist next = {0}, tmp;
+	mdb_vitem *vi;
+	unsigned i, branches;
+	int rc = MDB_SUCCESS;
+
+	do {
+		next.vl_n = 0;
+		for (i = branches = 0; i < mv->mv_work.vl_n && !rc; i++) {
+			vi = &mv->mv_work.vl_items[i];
+			if (vi->vi_pages || vi->vi_depth < 2) {
+				rc = mdb_vlist_add(&next, vi->vi_pgno, vi->vi_pages, vi->vi_depth, vi->vi_flags);
+			} else {
+				rc = mdb_verify_page(vt, vi, &next);
+				branches++;
+			}
+		}
+		tmp = mv->mv_work, mv->mv_work = next, next = tmp;
+	} while (!rc && branches && mv->mv_work.vl_n < (unsigned)threads * MDB_VERIFY_SPLIT);
+	free(next.vl_items);
+	if (rc)
+		return rc;
+
+	mv->mv_next = 0;
+	if (threads > (int)mv->mv_work.vl_n)
+		threads = mv->mv_work.vl_n;
+	for (i = 0; i < (unsigned)threads; i++) {
+		if ((rc = THREAD_CREATE(thr[i], mdb_verify_thr, mv)) != 0) {
+			mv->mv_error = rc;
+			break;
+		}
+	}
+	while (i > 0)
+		THREAD_FINISH(thr[--i]);
+	return mv->mv_error;
+}
+
+int
+mdb_txn_verify(MDB_txn *txn, int threads, mdb_size_t *pages,
+	mdb_size_t *bad, unsigned int max_bad, unsigned int *nbad)
+{
+	mdb_verify mv = {0};
+	mdb_vthr vt = {0};
+	mdb_vlist tmp;
+	MDB_db *db;
+	unsigned i;
+	int rc;
+
+	if (!txn || (!bad && max_bad))
+		return EINVAL;
+	/* dirty pages aren't in the file yet */
+	if (!(txn->mt_flags & MDB_TXN_RDONLY))
+		return EINVAL;
+	if (txn->mt_flags & MDB_TXN_BLOCKED)
+		return MDB_BAD_TXN;
+	if (threads < 1)
+		threads = 1;
+	if (threads > MDB_WARM_MAXTHREADS)
+		threads = MDB_WARM_MAXTHREADS;
+	mv.mv_txn = txn;
+	vt.vt_mv = &mv;
+#ifdef _WIN32
+	if (!(mv.mv_mutex = CreateMutex(NULL, FALSE, NULL)))
+		return ErrCode();
+#else
+	if ((rc = pthread_mutex_init(&mv.mv_mutex, NULL)) != 0)
+		return rc;
+#endif
+
+	db = &txn->mt_dbs[FREE_DBI];
+	rc = MDB_SUCCESS;
+	if (db->md_root != P_INVALID)
+		rc = mdb_vlist_add(&mv.mv_work, db->md_root, 0, db->md_depth, 0);
+	db = &txn->mt_dbs[MAIN_DBI];
+	if (!rc && db->md_root != P_INVALID)
+		rc = mdb_vlist_add(&mv.mv_work, db->md_root, 0, db->md_depth, MDB_VI_MAIN);
+	/* named DBs are only found in the main DB, so there are at most two rounds */
+	while (!rc && mv.mv_work.vl_n) {
+		if ((rc = mdb_verify_round(&mv, &vt, threads)))
+			break;
+		tmp = mv.mv_work, mv.mv_work = mv.mv_named, mv.mv_named = tmp;
+		mv.mv_named.vl_n = 0;
+	}
+	if (!rc)
+		rc = mdb_verify_merge(&vt);
+	if (!rc) {
+		qsort(mv.mv_bad, mv.mv_nbad, sizeof(pgno_t), mdb_warm_cmp);
+		for (i = 0; i < mv.mv_nbad && i < max_bad; i++)
+			bad[i] = mv.mv_bad[i];
+		if (nbad)
+			*nbad = mv.mv_nbad;
+		if (pages)
+			*pages = mv.mv_pages;
+	}
+#ifdef _WIN32
+	CloseHandle(mv.mv_mutex);
+#else
+	pthread_mutex_destroy(&mv.mv_mutex);
+#endif
+	free(vt.vt_buf);
+	free(vt.vt_clr);
+	free(vt.vt_bad);
+	free(mv.mv_work.vl_items);
+	free(mv.mv_named.vl_items);
+	free(mv.mv_bad);
+	return rc;
+}
+
 int mdb_set_compare(MDB_txn *txn, MDB_dbi dbi, MDB_cmp_func *cmp)
 {
 	if (!TXN_DBI_EXIST(txn, dbi, DB_USRVALID))
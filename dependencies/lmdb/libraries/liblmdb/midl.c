@@ -360,6 +360,107 @@ int mdb_midl_xmerge( MDB_IDL* idp, MDB_IDL merge )
 	return 0;
 }
 
+/* The length of the run of IDs that starts at this position, blocks are
+ * stored as a negative length followed by the first ID.
+ */
+static unsigned mdb_midl_run_at( MDB_IDL ids, unsigned x )
+{
+	intptr_t entry = ids[x];
+	if (entry < 0)
+		return -entry > UINT_MAX ? UINT_MAX : (unsigned) -entry;
+	if (entry == 0 || (x > 1 && (intptr_t)ids[x - 1] < 0))
+		return 0; /* empty, or the ID of a block (counted at its length) */
+	return 1;
+}
+
+int mdb_midl_runs_build( MDB_IDL_RUNS *runs, MDB_IDL ids )
+{
+	unsigned len = ids[0], size = 1, x, i;
+	while (size <= len)
+		size <<= 1;
+	if (size > runs->ir_alloc) {
+		unsigned *tree = realloc(runs->ir_runs, 2 * size * sizeof(unsigned));
+		if (!tree) {
+			runs->ir_ids = NULL;
+			return ENOMEM;
+		}
+		runs->ir_runs = tree;
+		runs->ir_alloc = size;
+	}
+	runs->ir_size = size;
+	runs->ir_len = len;
+	runs->ir_empty = 0;
+	runs->ir_runs[size] = 0;
+	for (x = 1; x < size; x++) {
+		if (x <= len) {
+			runs->ir_runs[size + x] = mdb_midl_run_at(ids, x);
+			if (!ids[x])
+				runs->ir_empty++;
+		} else
+			runs->ir_runs[size + x] = 0;
+	}
+	for (i = size - 1; i > 0; i--) {
+		unsigned left = runs->ir_runs[i << 1], right = runs->ir_runs[(i << 1) + 1];
+		runs->ir_runs[i] = left > right ? left : right;
+	}
+	runs->ir_ids = ids;
+	return 0;
+}
+
+void mdb_midl_runs_update( MDB_IDL_RUNS *runs, unsigned x )
+{
+	MDB_IDL ids = runs->ir_ids;
+	unsigned end = x + 1, i;
+	if (!ids)
+		return;
+	for (; x <= end && x <= runs->ir_len; x++) {
+		i = runs->ir_size + x;
+		runs->ir_runs[i] = mdb_midl_run_at(ids, x);
+		for (i >>= 1; i > 0; i >>= 1) {
+			unsigned left = runs->ir_runs[i << 1], right = runs->ir_runs[(i << 1) + 1];
+			unsigned max = left > right ? left : right;
+			if (runs->ir_runs[i] == max)
+				break;
+			runs->ir_runs[i] = max;
+		}
+	}
+}
+
+unsigned mdb_midl_runs_find( MDB_IDL_RUNS *runs, unsigned x, unsigned num )
+{
+	unsigned size = runs->ir_size, i;
+	if (x >= size || runs->ir_runs[1] < num)
+		return 0;
+	i = size + x;
+	if (runs->ir_runs[i] >= num)
+		return x;
+	/* climb until there is a subtree to the right with a long enough run */
+	for (;;) {
+		if (i == 1)
+			return 0;
+		if (!(i & 1) && runs->ir_runs[i + 1] >= num) {
+			i++;
+			break;
+		}
+		i >>= 1;
+	}
+	/* then descend to its leftmost leaf with a long enough run */
+	while (i < size) {
+		i <<= 1;
+		if (runs->ir_runs[i] < num)
+			i++;
+	}
+	return i - size;
+}
+
+void mdb_midl_runs_free( MDB_IDL_RUNS *runs )
+{
+	free(runs->ir_runs);
+	runs->ir_runs = NULL;
+	runs->ir_alloc = 0;
+	runs->ir_ids = NULL;
+}
+
 /* Quicksort + Insertion sort for small arrays */
 
 #define SMALL	8
@@ -156,6 +156,46 @@ int mdb_midl_xmerge( MDB_IDL* idl, MDB_IDL merge );
 	 */
 void mdb_midl_sort( MDB_IDL ids );
 
+	/** An index of the longest run of contiguous IDs within each range of
+	 * a sparse run-length IDL (as used for the free page list), so that a run
+	 * of a given length can be found in O(log n) instead of scanning the IDL.
+	 * This is a max segment tree, with the root at 1 and the leaf for each
+	 * IDL position at ir_size + position.
+	 */
+typedef struct MDB_IDL_RUNS {
+	MDB_IDL		ir_ids;		/**< The indexed IDL, NULL if the index needs to be rebuilt */
+	unsigned	ir_len;		/**< The length of the IDL when it was indexed */
+	unsigned	ir_size;	/**< Number of leaves, a power of two */
+	unsigned	ir_alloc;	/**< Number of leaves allocated */
+	unsigned	ir_empty;	/**< Number of empty entries in the IDL, callers count the entries they empty */
+	unsigned	*ir_runs;	/**< The tree of run lengths */
+} MDB_IDL_RUNS;
+
+	/** (Re)build the run index for an IDL.
+	 * @param[in,out] runs	The run index.
+	 * @param[in] ids	The IDL to index.
+	 * @return	0 on success, ENOMEM on failure.
+	 */
+int mdb_midl_runs_build( MDB_IDL_RUNS *runs, MDB_IDL ids );
+
+	/** Update the run index after the entry at a position (and so the run
+	 * length for the position after it) has changed.
+	 * @param[in,out] runs	The run index.
+	 * @param[in] x	The position in the indexed IDL that changed.
+	 */
+void mdb_midl_runs_update( MDB_IDL_RUNS *runs, unsigned x );
+
+	/** Find the first run of at least the given length at or after a position.
+	 * @param[in] runs	The run index.
+	 * @param[in] x	The position to start from.
+	 * @param[in] num	The minimum run length.
+	 * @return	The position of the run (the length entry, or the ID for a
+	 * single ID), or 0 if there is none.
+	 */
+unsigned mdb_midl_runs_find( MDB_IDL_RUNS *runs, unsigned x, unsigned num );
+
+void mdb_midl_runs_free( MDB_IDL_RUNS *runs );
+
 	/** An ID2 is an ID/pointer pair.
 	 */
 typedef struct MDB_ID2 {
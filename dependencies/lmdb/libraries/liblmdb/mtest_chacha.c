@@ -0,0 +1,58 @@
+/* mtest_chacha.c - cross-check the SIMD ChaCha8 code against the portable code */
+/*
+ * Copyright 2011-2021 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the Symas
+ * Dual-Use License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * source distribution.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "chacha8.h"
+
+#define MAXLEN	(64 * 1024 + 100)
+
+int main(int argc,char * argv[])
+{
+	static unsigned char data[MAXLEN], ref[MAXLEN], out[MAXLEN];
+	unsigned char key[CHACHA8_KEY_SIZE], iv[CHACHA8_IV_SIZE];
+	size_t i, len;
+	int level, best;
+
+	srand(time(NULL));
+	for (i = 0; i < sizeof(key); i++)
+		key[i] = rand();
+	for (i = 0; i < sizeof(iv); i++)
+		iv[i] = rand();
+	for (i = 0; i < MAXLEN; i++)
+		data[i] = rand();
+
+	best = chacha8_simd(-1);
+	printf("SIMD level %d\n", best);
+	for (len = 0; len < MAXLEN; len += len < 4200 ? 1 : 4093) {
+		chacha8_simd(0);
+		chacha8(data, len, key, iv, (char *)ref);
+		for (level = 1; level <= best; level++) {
+			chacha8_simd(level);
+			chacha8(data, len, key, iv, (char *)out);
+			if (memcmp(ref, out, len)) {
+				fprintf(stderr, "level %d differs at length %zu\n", level, len);
+				abort();
+			}
+			/* decrypting must restore the data */
+			chacha8(out, len, key, iv, (char *)out);
+			if (memcmp(data, out, len)) {
+				fprintf(stderr, "level %d round trip failed at length %zu\n", level, len);
+				abort();
+			}
+		}
+	}
+	chacha8_simd(-1);
+	return 0;
+}
@@ -0,0 +1,179 @@
+/* mtest_runs.c - check the free page run index and allocating from a fragmented free list */
+/*
+ * Copyright 2011-2021 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the Symas
+ * Dual-Use License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * source distribution.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lmdb.h"
+#include "midl.h"
+
+#define E(expr) CHECK((rc = (expr)) == MDB_SUCCESS, #expr)
+#define CHECK(test, msg) ((test) ? (void)0 : ((void)fprintf(stderr, \
+	"%s:%d: %s: %s\n", __FILE__, __LINE__, msg, mdb_strerror(rc)), abort()))
+
+#define DBPATH	"./testdb/data.mdb"
+#define PAGES	4096	/* page size */
+#define COUNT	4000	/* values, each of 1 to MAXRUN overflow pages */
+#define MAXRUN	9
+
+/* the first run of at least num IDs at or after x, by scanning the IDL */
+static unsigned scan(MDB_IDL ids, unsigned x, unsigned num)
+{
+	unsigned i;
+	for (i = x; i <= ids[0]; i++) {
+		intptr_t entry = ids[i];
+		if (entry < 0 ? (unsigned) -entry >= num :
+				entry > 0 && num <= 1 && !(i > 1 && (intptr_t)ids[i - 1] < 0))
+			return i;
+	}
+	return 0;
+}
+
+static void compare(MDB_IDL_RUNS *runs, MDB_IDL ids)
+{
+	unsigned x, num;
+	int rc = 0;
+	for (num = 1; num <= MAXRUN + 1; num++) {
+		for (x = 1; x <= ids[0]; x++)
+			CHECK(mdb_midl_runs_find(runs, x, num) == scan(ids, x, num), "run index disagrees with the IDL");
+	}
+}
+
+/* the index of a sparse run-length IDL, as it is updated by emptying entries */
+static void check_index(void)
+{
+	MDB_IDL ids = mdb_midl_alloc(3 * COUNT);
+	MDB_IDL_RUNS runs;
+	MDB_ID id = 10;
+	unsigned i, n = 0;
+	int rc = 0;
+
+	memset(&runs, 0, sizeof(runs));
+	srand(1);
+	for (i = 0; i < COUNT; i++) {
+		unsigned run = rand() % MAXRUN + 1;
+		if (rand() % 8 == 0)
+			ids[++n] = 0; /* an empty slot */
+		if (run > 1)
+			ids[++n] = -(intptr_t) run;
+		ids[++n] = id;
+		id += run + 1 + rand() % 3;
+	}
+	ids[0] = n;
+	E(mdb_midl_runs_build(&runs, ids));
+	compare(&runs, ids);
+
+	/* take runs out, the way allocation empties them */
+	for (i = 0; i < COUNT / 2; i++) {
+		unsigned x = rand() % n + 1;
+		if (!ids[x])
+			continue;
+		if ((intptr_t)ids[x] < 0)
+			x++;
+		ids[x] = 0;
+		if (x > 1 && (intptr_t)ids[x - 1] < 0)
+			ids[--x] = 0;
+		mdb_midl_runs_update(&runs, x);
+	}
+	compare(&runs, ids);
+	mdb_midl_runs_free(&runs);
+	mdb_midl_free(ids);
+}
+
+static size_t value_size(int i)
+{
+	/* fills (i % MAXRUN + 1) overflow pages, leaving room for the page header */
+	return (i % MAXRUN + 1) * PAGES - 64;
+}
+
+int main(int argc,char * argv[])
+{
+	int i, rc;
+	MDB_env *env;
+	MDB_dbi dbi;
+	MDB_val key, data;
+	MDB_txn *txn;
+	MDB_envinfo info;
+	mdb_size_t last_pgno;
+	char kval[16], *big;
+
+	check_index();
+
+	remove(DBPATH);
+	E(mdb_env_create(&env));
+	E(mdb_env_set_mapsize(env, 256*1024*1024));
+	E(mdb_env_open(env, "./testdb", MDB_NOSYNC, 0664));
+	big = malloc(MAXRUN * PAGES);
+
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	E(mdb_dbi_open(txn, NULL, 0, &dbi));
+	for (i = 0; i < COUNT; i++) {
+		sprintf(kval, "%08x", i);
+		key.mv_size = 8;
+		key.mv_data = kval;
+		data.mv_size = value_size(i);
+		memset(big, i & 0xff, data.mv_size);
+		data.mv_data = big;
+		E(mdb_put(txn, dbi, &key, &data, 0));
+	}
+	E(mdb_txn_commit(txn));
+
+	/* free every other value, leaving holes of every size throughout the file */
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	for (i = 1; i < COUNT; i += 2) {
+		sprintf(kval, "%08x", i);
+		key.mv_size = 8;
+		key.mv_data = kval;
+		E(mdb_del(txn, dbi, &key, NULL));
+	}
+	E(mdb_txn_commit(txn));
+	E(mdb_env_info(env, &info));
+	last_pgno = info.me_last_pgno;
+
+	/* put them back (in separate txns, so the free list is reused as it is consumed) */
+	for (i = COUNT - 1; i > 0; i -= 2) {
+		if (i % 200 == 199 || i == COUNT - 1)
+			E(mdb_txn_begin(env, NULL, 0, &txn));
+		sprintf(kval, "%08x", i);
+		key.mv_size = 8;
+		key.mv_data = kval;
+		data.mv_size = value_size(i);
+		memset(big, i & 0xff, data.mv_size);
+		data.mv_data = big;
+		E(mdb_put(txn, dbi, &key, &data, 0));
+		if (i % 200 == 1)
+			E(mdb_txn_commit(txn));
+	}
+	E(mdb_env_info(env, &info));
+	printf("%u pages before refilling the holes, %u after\n", (unsigned)last_pgno + 1,
+		(unsigned)info.me_last_pgno + 1);
+	/* only the new leaf and branch pages (and free list records) should have needed to grow the file */
+	CHECK(info.me_last_pgno < last_pgno + last_pgno / 20, "freed runs weren't reused");
+
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+	for (i = 0; i < COUNT; i++) {
+		size_t j;
+		unsigned char *p;
+		sprintf(kval, "%08x", i);
+		key.mv_size = 8;
+		key.mv_data = kval;
+		E(mdb_get(txn, dbi, &key, &data));
+		CHECK(data.mv_size == value_size(i), "wrong size");
+		p = data.mv_data;
+		for (j = 0; j < data.mv_size; j++)
+			CHECK(p[j] == (i & 0xff), "overlapping allocation");
+	}
+	mdb_txn_abort(txn);
+	mdb_env_close(env);
+	free(big);
+	return 0;
+}
@@ -0,0 +1,127 @@
+/* mtest_verify.c - check the pages of a checksummed database */
+/*
+ * Copyright 2011-2021 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the Symas
+ * Dual-Use License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * source distribution.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lmdb.h"
+
+#define E(expr) CHECK((rc = (expr)) == MDB_SUCCESS, #expr)
+#define CHECK(test, msg) ((test) ? (void)0 : ((void)fprintf(stderr, \
+	"%s:%d: %s: %s\n", __FILE__, __LINE__, msg, mdb_strerror(rc)), abort()))
+
+#define DBPATH	"./testdb/data.mdb"
+#define STRIDE	7
+
+/* FNV-1a, just to have something to store */
+static void sumfunc(const MDB_val *src, MDB_val *dst, const MDB_val *key)
+{
+	unsigned long long h = 0xcbf29ce484222325ULL;
+	const unsigned char *p = src->mv_data;
+	size_t i;
+	for (i = 0; i < src->mv_size; i++)
+		h = (h ^ p[i]) * 0x100000001b3ULL;
+	memcpy(dst->mv_data, &h, sizeof(h));
+}
+
+static MDB_env *openenv(unsigned int flags)
+{
+	MDB_env *env;
+	int rc;
+	E(mdb_env_create(&env));
+	E(mdb_env_set_checksum(env, sumfunc, 8));
+	E(mdb_env_set_maxdbs(env, 4));
+	E(mdb_env_set_mapsize(env, 64*1024*1024));
+	E(mdb_env_open(env, "./testdb", flags, 0664));
+	return env;
+}
+
+static unsigned int verify(MDB_env *env, int threads, mdb_size_t *pages, mdb_size_t *bad)
+{
+	MDB_txn *txn;
+	unsigned int nbad;
+	int rc;
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+	E(mdb_txn_verify(txn, threads, pages, bad, 16, &nbad));
+	mdb_txn_abort(txn);
+	return nbad;
+}
+
+int main(int argc,char * argv[])
+{
+	int i, rc;
+	MDB_env *env;
+	MDB_dbi dbi, dups;
+	MDB_val key, data;
+	MDB_txn *txn;
+	MDB_envinfo info;
+	mdb_size_t pages, pages2, bad[16], pg;
+	unsigned int nbad, n;
+	char kval[32], *big;
+	FILE *f;
+
+	remove(DBPATH);
+	env = openenv(0);
+	big = calloc(1, 20000);
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	E(mdb_dbi_open(txn, "main", MDB_CREATE, &dbi));
+	E(mdb_dbi_open(txn, "dups", MDB_CREATE|MDB_DUPSORT, &dups));
+	for (i = 0; i < 20000; i++) {
+		sprintf(kval, "%08x", i);
+		key.mv_size = 8;
+		key.mv_data = kval;
+		data.mv_size = i % 100 ? 64 : 5000 + i % 15000;
+		data.mv_data = big;
+		E(mdb_put(txn, dbi, &key, &data, 0));
+		data.mv_size = 8;
+		data.mv_data = kval;
+		key.mv_size = 2;
+		E(mdb_put(txn, dups, &key, &data, 0));
+	}
+	E(mdb_txn_commit(txn));
+
+	nbad = verify(env, 1, &pages, bad);
+	CHECK(!nbad, "clean database has corrupt pages");
+	nbad = verify(env, 4, &pages2, bad);
+	CHECK(!nbad && pages == pages2, "threads disagree");
+	E(mdb_env_info(env, &info));
+	printf("verified %u pages of %u\n", (unsigned)pages, (unsigned)info.me_last_pgno + 1);
+	mdb_env_close(env);
+
+	/* checksummed pages are also checked when they are remapped */
+	env = openenv(MDB_REMAP_CHUNKS);
+	nbad = verify(env, 4, &pages2, bad);
+	CHECK(!nbad && pages == pages2, "remapped pages disagree");
+	mdb_env_close(env);
+
+	/* flip a byte in every STRIDE'th page */
+	f = fopen(DBPATH, "r+b");
+	for (pg = STRIDE; pg <= info.me_last_pgno; pg += STRIDE) {
+		int c;
+		fseek(f, pg * 4096 + 2000, SEEK_SET);
+		c = fgetc(f);
+		fseek(f, pg * 4096 + 2000, SEEK_SET);
+		fputc(c ^ 0x40, f);
+	}
+	fclose(f);
+
+	env = openenv(MDB_RDONLY);
+	nbad = verify(env, 4, &pages2, bad);
+	printf("%u corrupt pages, checked %u\n", nbad, (unsigned)pages2);
+	/* a flipped overflow page is reported as the start of its run */
+	CHECK(nbad > 0 && nbad <= info.me_last_pgno / STRIDE, "corruption was not found");
+	for (n = 0; n < nbad && n < 16; n++)
+		CHECK(!n || bad[n] > bad[n-1], "pages aren't sorted");
+	mdb_env_close(env);
+	free(big);
+	return 0;
+}
@@ -2,6 +2,12 @@ declare namespace lmdb {
 	export function open<V = any, K extends Key = Key>(path: string, options: RootDatabaseOptions): RootDatabase<V, K>
 	export function open<V = any, K extends Key = Key>(options: RootDatabaseOptionsWithPath): RootDatabase<V, K>
 	export function openAsClass<V = any, K extends Key = Key>(options: RootDatabaseOptionsWithPath): DatabaseClass<V, K>
+	/**
+	* Open a store that partitions its entries across several environments, each with its own write thread
+	* @param path The directory of the shards (each shard is <path>/<index>.mdb)
+	**/
+	export function openSharded<V = any, K extends Key = Key>(path: string, options: ShardedStoreOptions<K>): ShardedStore<V, K>
+	export function openSharded<V = any, K extends Key = Key>(options: ShardedStoreOptions<K> & { path?: string }): ShardedStore<V, K>
 
 	class Database<V = any, K extends Key = Key> {
 		/**
@@ -284,9 +290,94 @@ declare namespace lmdb {
 		/**
 		* Make a snapshot copy of the current database at the indicated path
 	  * @param path Path to store the backup
-		* @param compact Apply compaction while making the backup (slower and smaller)
+		* @param compact Apply compaction while making the backup (slower and smaller), or options with the number of threads to compact with
 		**/
-		backup(path: string, compact: boolean): Promise<void>
+		backup(path: string, compact: boolean | { compact?: boolean, threads?: number }): Promise<void>
+		/**
+		* Write an incremental backup with only the pages that have changed since a previous backup
+		* @param path Path to store the backup
+		* @param sinceTxnId The txn id of the previous backup in the chain (0 for a full backup)
+		* @returns The txn id of this backup, to pass to the next incremental backup
+		**/
+		incrementalBackup(path: string, sinceTxnId: number): Promise<number>
+		/**
+		* Stream an lz4 compressed snapshot copy of the database to a file descriptor (a file, pipe or socket)
+		* @param fd The file descriptor to write to
+		* @param options.compact Apply compaction while making the backup
+		* @param options.threads The number of threads to compress (and compact) with
+		* @param options.level The lz4 compression level (above 2 uses lz4hc)
+		* @returns The uncompressed and compressed sizes of the backup
+		**/
+		backupStream(fd: number, options?: { compact?: boolean, threads?: number, level?: number }): Promise<{ size: number, compressedSize: number }>
+		/**
+		* Prefault the branch pages and then the leaf pages of this database (or the given databases) into the page cache
+		* @param options.dbs The databases to warm up, in order of priority (defaults to this database)
+		* @param options.budget The maximum number of bytes to prefault (defaults to no limit)
+		* @param options.threads The number of threads to prefault with (defaults to 4)
+		* @param options.onProgress Called with the number of bytes prefaulted so far and the total
+		* @returns The final progress
+		**/
+		warmUp(options?: WarmUpOptions): Promise<WarmUpProgress>
+		/**
+		* The promise from warming up the database when it was opened with warmUpOnOpen
+		**/
+		warmedUp?: Promise<WarmUpProgress>
+		/**
+		* Report how much of this database (or the given databases) is resident in the page cache
+		* @param options.dbs The databases to report on (defaults to this database)
+		* @param options.sample Only walk one in this many leaf pages, to make the report faster on large databases
+		* @returns The resident and total bytes of the file, and of each database by page type and depth
+		**/
+		residency(options?: { dbs?: Database[], sample?: number }): Promise<Residency>
+		/**
+		* Lock the branch pages (and optionally the leaf pages) of this database (or the given databases) in memory, so they
+		* stay resident under memory pressure, re-pinning them as commits copy them
+		* @param options.dbs The databases to pin, in order of priority (defaults to this database)
+		* @param options.budget The maximum number of bytes to lock (defaults to no limit)
+		* @param options.leaves Lock leaf pages too, after the branch pages
+		* @param options.interval How often (in milliseconds) to check for commits and re-pin (defaults to 1000, 0 to not re-pin)
+		* @returns The number of bytes that are locked
+		**/
+		pin(options?: { dbs?: Database[], budget?: number, leaves?: boolean, interval?: number }): Promise<number>
+		/**
+		* Stop re-pinning, and unlock the pinned pages
+		**/
+		unpin(): void
+		/**
+		* Check every reachable page in the environment (all of its databases), including the page checksums when it was opened with the checksum option
+		* @param options.threads The number of threads to check with (defaults to 4)
+		* @param options.maxCorrupt The maximum number of corrupt page numbers to report (defaults to 1000)
+		* @returns The number of pages checked, and the number and (lowest) page numbers of the corrupt pages
+		**/
+		verify(options?: { threads?: number, maxCorrupt?: number }): Promise<{ pages: number, corrupt: number[], corruptCount: number }>
+		/**
+		* Sample values from this database and train a compression dictionary from their most frequent substrings
+		* @param options.samples The number of entries to sample (evenly spaced through the database)
+		* @param options.size The maximum size of the dictionary (LZ4 uses up to 64KB)
+		**/
+		trainDictionary(options?: { samples?: number, size?: number }): Promise<{
+			dictionary: Buffer
+			sampleCount: number
+			sampleBytes: number
+			compressedBytes: number
+			previousCompressedBytes: number
+			ratio: number
+			previousRatio: number
+			decompressTime: number
+			previousDecompressTime: number
+		}>
+		/**
+		* Compact the database online, relocating pages from the end of the file into free space nearer the front
+		* in small write transactions, and then shrinking the file. The returned promise can be paused and resumed.
+		* @param options.pagesPerStep The maximum number of pages to relocate in each transaction (default 1000)
+		* @param options.delay The number of milliseconds to wait between transactions (default 10)
+		* @param options.onProgress Called after each transaction with the progress so far
+		**/
+		compact(options?: {
+			pagesPerStep?: number
+			delay?: number
+			onProgress?: (progress: CompactProgress) => void
+		}): Promise<CompactProgress> & { pause(): void, resume(): void }
 		/**
 		* Close the current database.
 		**/
@@ -296,6 +387,46 @@ declare namespace lmdb {
 		 */
 		on(event: 'beforecommit' | 'aftercommit', callback: (event: any) => void): void
 	}
+	interface CompactProgress {
+		/** The number of pages that have been relocated */
+		relocated: number
+		/** The estimated number of pages at the end of the file that still need to be relocated */
+		remaining: number
+		/** The number of pages the file has been shrunk by */
+		truncated: number
+	}
+	interface WarmUpOptions {
+		/** The databases to warm up, in order of priority */
+		dbs?: Database[]
+		/** The maximum number of bytes to prefault */
+		budget?: number
+		/** The number of threads to prefault with */
+		threads?: number
+		/** Called after each level of branch pages and each batch of leaf pages */
+		onProgress?: (progress: WarmUpProgress) => void
+	}
+	interface WarmUpProgress {
+		/** The number of bytes that have been prefaulted */
+		warmed: number
+		/** The number of bytes that will be prefaulted */
+		total: number
+	}
+	interface ResidentBytes {
+		/** The number of bytes that are resident in the page cache */
+		resident: number
+		/** The total number of bytes */
+		total: number
+	}
+	interface Residency extends ResidentBytes {
+		dbs: Array<ResidentBytes & {
+			name: string | null
+			branch: ResidentBytes
+			leaf: ResidentBytes
+			overflow: ResidentBytes
+			/** The branch and leaf pages by depth, starting with the root */
+			depths: ResidentBytes[]
+		}>
+	}
 	/* A constant that can be returned from a transaction to indicate that the transaction should be aborted */
 	export const ABORT: {};
 	/* A constant that can be returned in RangeIterable#map function to skip (filter out) the current value */
@@ -328,6 +459,8 @@ declare namespace lmdb {
 		keyEncoding?: 'uint32' | 'binary' | 'ordered-binary'
 		dupSort?: boolean
 		strictAsyncOrder?: boolean
+		/** Warm up the database when it is opened (see warmUp), with the promise available as warmedUp */
+		warmUpOnOpen?: boolean | WarmUpOptions
 	}
 	interface RootDatabaseOptions extends DatabaseOptions {
 		/** The maximum number of databases to be able to open (there is some extra overhead if this is set very high).*/
@@ -346,6 +479,24 @@ declare namespace lmdb {
 		pageSize?: number
 		/** This enables committing transactions where LMDB waits for a transaction to be fully flushed to disk after the transaction has been committed and defaults to being enabled on non-Windows OSes. This option is discussed in more detail below. */
 		overlappingSync?: boolean
+		/** On Linux, use io_uring to submit all the page writes of a commit as one batch. This can be true or the queue depth (defaults to 256). Falls back to standard writes if io_uring isn't available. */
+		ioUring?: boolean | number
+		/** On Linux, start writing each commit's pages to disk as soon as they are written to the file, so the data sync after the commit has less to wait for. */
+		earlyWriteback?: boolean
+		/** With overlappingSync, sync commits from a background thread that groups together the commits made while a sync is running, instead of each commit syncing itself. */
+		syncScheduler?: boolean
+		/** The maximum time (in milliseconds) the sync scheduler will wait for more commits to group into a sync. */
+		maxFlushDelay?: number
+		/** With overlappingSync, make commits durable by appending their writes to a sidecar log file and syncing that (in groups), while the database itself is synced lazily in checkpoints. The log is replayed on open after a crash. */
+		redoLog?: boolean
+		/** How often (in milliseconds) the database is checkpointed (synced, and the redo log truncated) with redoLog. Defaults to 5000. */
+		redoLogCheckpointInterval?: number
+		/** How long (in microseconds) the write thread spins waiting for the next instruction before it parks until woken. Defaults to 10. */
+		writerSpin?: number
+		/** Combine the write batches of all the threads using this database into shared transactions, committed by one of them. */
+		combineWrites?: boolean
+		/** Queue the write batches of all the processes using this database in shared memory, to be committed together by whichever process has the writer role (Linux only). */
+		writeQueue?: boolean
 		/** Resolve asynchronous operations when commits are finished and visible and include a separate promise for when a commit is flushed to disk, as a flushed property on the commit promise. Note that you can alternately use the flushed property on the database. */
 		separateFlushed?: boolean
 		/**
@@ -353,6 +504,12 @@ declare namespace lmdb {
 		 * This is enabled by default on 32-bit operating systems (which require this to go beyond 4GB database size) if mapSize is not specified, otherwise it is disabled by default.
 		 **/
 		remapChunks?: boolean
+		/** The number of pages mapped (and decrypted) at a time with remapChunks or encryption, a power of 2 up to 16 (the default). */
+		remapChunkPages?: number
+		/** The number of chunks a single transaction can reference with remapChunks or encryption (4096 by default). */
+		remapTxnChunks?: number
+		/** The number of chunks kept mapped for reuse across transactions with remapChunks or encryption (16384 by default). */
+		remapCacheChunks?: number
 		/** This provides a small performance boost (when not using useWritemap) for writes, by skipping zero'ing out malloc'ed data, but can leave application data in unused portions of the database. This is recommended unless there are concerns of database files being accessible. */
 		noMemInit?: boolean
 		/** Use writemaps, discouraged at this. This improves performance by reducing malloc calls, but it is possible for a stray pointer to corrupt data. */
@@ -372,6 +529,8 @@ declare namespace lmdb {
 		maxReaders?: number
 		/** This enables encryption, and the provided value is the key that is used for encryption. This may be a buffer or string, but must be 32 bytes/characters long. This uses the Chacha8 cipher for fast and secure on-disk encryption of data. */
 		encryptionKey?: string | Buffer
+		/** Store a checksum in every page, with CRC32C (true or 'crc32c') or XXH64 ('xxhash64'), which is checked when pages are read with remapChunks or encryption, and by verify(). This can't be used with useWritemap, and must be used every time the database is opened. */
+		checksum?: boolean | 'crc32c' | 'xxhash64'
 		/**
 		 * This is enabled by default and will ensure that all asynchronous write operations performed in the same event turn will be batched together into the same transaction.
 		 * Disabling this allows lmdb-js to commit a transaction at any time, and asynchronous operations will only be guaranteed to be in the same transaction if explicitly batched together (with transaction, batch, ifVersion).
@@ -387,9 +546,56 @@ declare namespace lmdb {
 	interface RootDatabaseOptionsWithPath extends RootDatabaseOptions {
 		path?: string
 	}
+	interface ShardedStoreOptions<K extends Key = Key> extends RootDatabaseOptions {
+		/** The number of shards (environments) to partition the entries across (defaults to 4) **/
+		shards?: number
+		/** How keys are assigned to shards: a function returning the shard index, or the sorted split keys that each
+		* shard after the first starts at (range partitioning). Defaults to a hash of the key **/
+		partitioner?: ((key: K, shardCount: number) => number) | K[]
+	}
+	interface BatchOperation<V = any, K extends Key = Key> {
+		type: 'put' | 'remove' | 'del'
+		key: K
+		value?: V
+	}
+	class ShardedStore<V = any, K extends Key = Key> {
+		shards: RootDatabase<V, K>[]
+		shardFor(key: K): RootDatabase<V, K>
+		get(id: K, options?: GetOptions): V | undefined
+		getEntry(id: K, options?: GetOptions): { value: V, version?: number } | undefined
+		doesExist(key: K, valueOrVersion?: V | number): boolean
+		put(id: K, value: V, version?: number, ifVersion?: number): Promise<boolean>
+		putSync(id: K, value: V, versionOrOptions?: number | PutOptions): void
+		remove(id: K, ifVersionOrValue?: number | V): Promise<boolean>
+		removeSync(id: K, valueToRemove?: V): boolean
+		/** Get the values of the keys from their shards, which are read in parallel **/
+		getMany(ids: K[]): Promise<(V | undefined)[]>
+		/** Iterate through the entries of all the shards, merged in key order **/
+		getRange(options?: RangeOptions): RangeIterable<{ key: K, value: V, version?: number }>
+		getKeys(options?: RangeOptions): RangeIterable<K>
+		getCount(options?: RangeOptions): number
+		/** Write the operations, atomically within each shard (but not across shards) **/
+		batch(operations: BatchOperation<V, K>[]): Promise<boolean>
+		/**
+		* Write the operations atomically across shards, by preparing each shard's part and then committing with a
+		* marker in the first shard. Interrupted batches are finished or discarded when the store is next opened
+		* while it isn't open anywhere else.
+		**/
+		atomicBatch(operations: BatchOperation<V, K>[]): Promise<boolean>
+		committed: Promise<boolean[]>
+		flushed: Promise<boolean[]>
+		getStats(): {}[]
+		close(): Promise<void>
+	}
 	interface CompressionOptions {
 		threshold?: number
 		dictionary?: Buffer
+		/** Table of dictionaries by id, new entries are compressed with the last one **/
+		dictionaries?: Buffer[]
+		/** Use LZ4-HC with this compression level (1-12), for better compression at the cost of slower writes **/
+		level?: number
+		/** The minimum fraction of space that compression must save, or values are stored uncompressed (defaults to 0) **/
+		minGain?: number
 	}
 	interface GetOptions {
 		transaction?: Transaction
@@ -449,6 +655,16 @@ declare namespace lmdb {
 		done(): void
 	}
 	export function getLastVersion(): number
+	/**
+	* Apply a chain of incremental backups, in order, to a database file that is not open
+	* @returns The txn id of the restored snapshot
+	**/
+	export function restoreIncrementalBackup(path: string, backupPaths: string[]): Promise<number>
+	/**
+	* Decompress a backup stream (from backupStream) read from a file descriptor into a new database file
+	* @returns The size of the restored database file
+	**/
+	export function restoreBackupStream(fd: number, path: string): Promise<number>
 	export function compareKeys(a: Key, b: Key): number
 	class Binary {}
 	/* Wrap a Buffer/Uint8Array for direct assignment as a value bypassing any encoding, for put (and doesExist) operations.
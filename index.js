@@ -27,7 +27,8 @@ import { nativeAddon } from './native.js';
 export let { noop } = nativeAddon;
 export const TIMESTAMP_PLACEHOLDER = new Uint8Array([1,1,1,1,0,0,0,0]);
 export const DIRECT_WRITE_PLACEHOLDER = new Uint8Array([1,1,1,2,0,0,0,0]);
-export { open, openAsClass, getLastVersion, allDbs, getLastTxnId } from './open.js';
+export { open, openAsClass, getLastVersion, allDbs, getLastTxnId, restoreIncrementalBackup, restoreBackupStream } from './open.js';
+export { openSharded, ShardedStore } from './sharded.js';
 import { toBufferKey as keyValueToBuffer, compareKeys as compareKey, fromBufferKey as bufferToKeyValue } from 'ordered-binary';
 import { open, openAsClass, getLastVersion } from './open.js';
 export const TransactionFlags = {
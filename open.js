@@ -12,7 +12,7 @@ export function setRequire(require) {
 setGetLastVersion(getLastVersion, getLastTxnId);
 let keyBytes, keyBytesView;
 const buffers = [];
-const { onExit, getEnvsPointer, setEnvsPointer, getEnvFlags, setJSFlags } = nativeAddon;
+const { onExit, getEnvsPointer, setEnvsPointer, getEnvFlags, setJSFlags, trainDictionary, restoreIncremental, restoreStream } = nativeAddon;
 if (globalThis.__lmdb_envs__)
 	setEnvsPointer(globalThis.__lmdb_envs__);
 else
@@ -104,6 +104,9 @@ export function open(path, options) {
 		let useDefault = typeof compressionOptions != 'object';
 		if (useDefault && defaultCompression)
 			return defaultCompression;
+		if (compressionOptions && compressionOptions.dictionaries)
+			// the first dictionary (id 0) is the one that is placed in front of the decompression buffer
+			compressionOptions = Object.assign({ dictionary: compressionOptions.dictionaries[0] }, compressionOptions);
 		compressionOptions = Object.assign({
 			threshold: 1000,
 			dictionary: fs.readFileSync(new URL('./dict/dict.txt', import.meta.url.replace(/dist[\\\/]index.cjs$/, ''))),
@@ -264,6 +267,8 @@ export function open(path, options) {
 			this.maxKeySize = maxKeySize;
 			applyKeyHandling(this);
 			allDbs.set(dbName ? name + '-' + dbName : name, this);
+			if (dbOptions.warmUpOnOpen)
+				this.warmedUp = this.warmUp(dbOptions.warmUpOnOpen === true ? {} : dbOptions.warmUpOnOpen);
 		}
 		openDB(dbName, dbOptions) {
 			if (this.dupSort && this.name == null)
@@ -295,8 +300,14 @@ export function open(path, options) {
 		backup(path, compact) {
 			if (noFSAccess)
 				return;
+			let threads = 1;
+			if (compact && typeof compact == 'object') {
+				// { compact, threads }: compacting copies can be split across threads
+				threads = compact.threads || 1;
+				compact = compact.compact !== false;
+			}
 			fs.mkdirSync(pathModule.dirname(path), { recursive: true });
-			return new Promise((resolve, reject) => env.copy(path, compact, (error) => {
+			return new Promise((resolve, reject) => env.copy(path, Boolean(compact), threads, (error) => {
 				if (error) {
 					reject(error);
 				} else {
@@ -304,6 +315,149 @@ export function open(path, options) {
 				}
 			}));
 		}
+		backupStream(fd, streamOptions) {
+			// write an lz4 frame compressed copy to a file descriptor (which can be a pipe or socket), with chunks of
+			// the copy compressed by multiple threads, resolving with { size, compressedSize }
+			let { compact, threads, level } = streamOptions || {};
+			return new Promise((resolve, reject) => env.copyStream(fd, Boolean(compact), threads || 1, level || 0, (error, result) => {
+				if (error) {
+					reject(error);
+				} else {
+					resolve(result);
+				}
+			}));
+		}
+		incrementalBackup(path, sinceTxnId) {
+			// write only the pages changed since the given txn id (of the previous backup), resolving with the txn id
+			// of this backup for the next one in the chain; backups from 0 are full backups
+			if (noFSAccess)
+				return;
+			fs.mkdirSync(pathModule.dirname(path), { recursive: true });
+			return new Promise((resolve, reject) => env.copyIncremental(path, sinceTxnId || 0, (error, txnId) => {
+				if (error) {
+					reject(error);
+				} else {
+					resolve(txnId);
+				}
+			}));
+		}
+		warmUp(warmUpOptions) {
+			// prefault the branch pages and then the leaf pages of this database (or the given databases) into the page
+			// cache from several threads, up to a budget in bytes, resolving with the final { warmed, total } progress
+			let dbs = warmUpOptions?.dbs || [this];
+			return new Promise((resolve, reject) => env.warmUp(dbs.map((store) => store.db.dbi), warmUpOptions?.budget || 0,
+				warmUpOptions?.threads || 4, warmUpOptions?.onProgress, (error, progress) => {
+				if (error) {
+					reject(error);
+				} else {
+					resolve(progress);
+				}
+			}));
+		}
+		pin(pinOptions) {
+			// lock the branch pages (and with leaves: true, the leaf pages) of this database (or the given databases) in
+			// memory up to a budget in bytes, re-pinning them from a background thread when commits copy them
+			let dbs = pinOptions?.dbs || [this];
+			return new Promise((resolve, reject) => env.pin(dbs.map((store) => store.db.dbi), pinOptions?.budget || 0,
+				Boolean(pinOptions?.leaves), pinOptions?.interval ?? 1000, (error, pinnedBytes) => {
+				if (error) {
+					reject(error);
+				} else {
+					resolve(pinnedBytes);
+				}
+			}));
+		}
+		unpin() {
+			env.unpin();
+		}
+		residency(residencyOptions) {
+			// report how much of this database (or the given databases) is resident in the page cache, in bytes by page
+			// type and tree depth, along with the whole file
+			let dbs = residencyOptions?.dbs || [this];
+			return new Promise((resolve, reject) => env.residency(dbs.map((store) => store.db.dbi), residencyOptions?.sample || 0,
+				(error, result) => {
+				if (error) {
+					reject(error);
+				} else {
+					result.dbs.forEach((dbResult, i) => {
+						dbResult.name = dbs[i].name;
+						dbResult.resident = dbResult.branch.resident + dbResult.leaf.resident + dbResult.overflow.resident;
+						dbResult.total = dbResult.branch.total + dbResult.leaf.total + dbResult.overflow.total;
+					});
+					resolve(result);
+				}
+			}));
+		}
+		verify(verifyOptions) {
+			// check every reachable page of the environment (and its checksum, when opened with the checksum option)
+			// from several threads, resolving with the number of pages checked and the corrupt page numbers
+			return new Promise((resolve, reject) => env.verify(verifyOptions?.threads || 4, verifyOptions?.maxCorrupt ?? 1000,
+				(error, result) => {
+				if (error) {
+					reject(error);
+				} else {
+					resolve(result);
+				}
+			}));
+		}
+		trainDictionary(options) {
+			// sample values from this database and build a compression dictionary for them (which can be
+			// used with compression.addDictionary), resolving with the dictionary and its projected ratio
+			let sampleCount = options?.samples || 1000;
+			let dictionarySize = options?.size || 0x10000;
+			return new Promise((resolve, reject) => trainDictionary(this.dbAddress, sampleCount, dictionarySize, (error, result) => {
+				if (error) {
+					reject(error);
+				} else {
+					resolve(result);
+				}
+			}));
+		}
+		compact(compactOptions) {
+			// online compaction: relocate pages from the end of the file into free space nearer the front, a limited
+			// number of pages per (separate) write transaction, and then shrink the file once the end of it is free
+			let pagesPerStep = compactOptions?.pagesPerStep || 1000;
+			let delay = compactOptions?.delay ?? 10;
+			let onProgress = compactOptions?.onProgress;
+			let progress = { relocated: 0, remaining: Infinity, truncated: 0 };
+			let paused, pausedStep, idleSteps = 0;
+			let promise = new Promise((resolve, reject) => {
+				let step = () => {
+					if (paused)
+						return pausedStep = step;
+					let result;
+					try {
+						result = this.transactionSync(() => env.compactStep(pagesPerStep), options.overlappingSync ? 0x10002 : 2);
+					} catch (error) {
+						return reject(error);
+					}
+					let previousRemaining = progress.remaining;
+					progress.relocated += result.relocated;
+					progress.truncated += result.truncated;
+					progress.remaining = result.remaining;
+					if (onProgress)
+						onProgress(progress);
+					// the file can only be shrunk once the transaction that freed the last pages is no longer in use, so we
+					// finish after a few steps without progress (which also stops if readers are holding on to the free space)
+					if (result.truncated || (result.relocated && (!result.remaining || result.remaining < previousRemaining)))
+						idleSteps = 0;
+					else if (++idleSteps > 2)
+						return resolve(progress);
+					setTimeout(step, delay);
+				};
+				step();
+			});
+			promise.pause = () => paused = true;
+			promise.resume = () => {
+				paused = false;
+				let step = pausedStep;
+				if (step) {
+					pausedStep = null;
+					setTimeout(step, 0);
+				}
+			};
+			return promise;
+		}
 		isOperational() {
 			return this.status == 'open';
 		}
@@ -405,6 +559,33 @@ export function openAsClass(path, options) {
 	return open(path, options);
 }
 
+export async function restoreIncrementalBackup(path, backupPaths) {
+	// apply a chain of incremental backups, in order, to a (closed) database file, resolving with the final txn id
+	let txnId;
+	for (let backupPath of backupPaths) {
+		txnId = await new Promise((resolve, reject) => restoreIncremental(path, backupPath, (error, txnId) => {
+			if (error) {
+				reject(error);
+			} else {
+				resolve(txnId);
+			}
+		}));
+	}
+	return txnId;
+}
+
+export function restoreBackupStream(fd, path) {
+	// decompress a stream written by backupStream into a new database file, resolving with its size
+	fs.mkdirSync(pathModule.dirname(path), { recursive: true });
+	return new Promise((resolve, reject) => restoreStream(fd, path, (error, size) => {
+		if (error) {
+			reject(error);
+		} else {
+			resolve(size);
+		}
+	}));
+}
+
 export function getLastVersion() {
 	return keyBytesView.getFloat64(16, true);
 }
@@ -113,6 +113,8 @@ export function addReadMethods(
 					this.lastSize = keyBytesView.getUint32(0, true);
 					let bufferId = keyBytesView.getUint32(4, true);
 					let bytes = getMMapBuffer(bufferId, this.lastSize);
+					// a native decompression slab is reused by the next read, like the global buffer
+					if (!bytes.buffer.isSharedMap) bytes.isGlobal = true;
 					return asSafeBuffer ? Buffer.from(bytes) : bytes;
 				} else throw lmdbError(rc);
 			}
@@ -958,6 +960,8 @@ export function addReadMethods(
 			dbStats.root = env.stat();
 			Object.assign(dbStats, env.info());
 			dbStats.free = env.freeStat();
+			if (this.compression?.getStats)
+				dbStats.compression = this.compression.getStats();
 			return dbStats;
 		},
 	});
@@ -0,0 +1,330 @@
+import { RangeIterable } from './util/RangeIterable.js';
+import { open } from './open.js';
+import { nativeAddon, lmdbError } from './native.js';
+
+// A store that partitions its keys across several environments (shards), each with its own write thread, so the
+// writes to different shards are committed in parallel, rather than one at a time through the single writer of one
+// environment.
+
+const DEFAULT_SHARD_COUNT = 4;
+const DATA_DB = 'data';
+const BATCHES_DB = 'sharded-batches'; // the parts of cross-shard atomic batches, while they are in progress
+const PREPARED = 'prepared';
+const COMMITTED = 'committed';
+const LOCK_FILE = 'batches.lock';
+const FNV_OFFSET = 0x811c9dc5;
+const FNV_PRIME = 0x01000193;
+let keyBuffer;
+
+export function openSharded(path, options) {
+	if (typeof path == 'object' && !options) {
+		options = path;
+		path = options.path;
+	}
+	return new ShardedStore(path, options || {});
+}
+
+export class ShardedStore {
+	constructor(path, options) {
+		let shardCount = options.shards || DEFAULT_SHARD_COUNT;
+		let partitioner = options.partitioner;
+		let shardOptions = Object.assign({}, options);
+		delete shardOptions.path;
+		delete shardOptions.shards;
+		delete shardOptions.partitioner;
+		delete shardOptions.name;
+		let envOptions = Object.assign({}, shardOptions);
+		delete envOptions.dupSort; // named databases can't be opened in a dupSort main database
+		// the entries are stored in a named database of each shard, so the main database only lists the databases
+		this.envs = [];
+		this.shards = [];
+		this.batchDbs = [];
+		for (let i = 0; i < shardCount; i++) {
+			let env = open(path == null ? null : path + '/' + i + '.mdb', envOptions);
+			this.envs.push(env);
+			this.shards.push(env.openDB(DATA_DB, shardOptions));
+			this.batchDbs.push(env.openDB(BATCHES_DB, { encoding: 'msgpack' }));
+		}
+		let first = this.shards[0];
+		this.numericKeys = first.keyIsUint32 || first.keyEncoding == 'uint32';
+		if (Array.isArray(partitioner)) {
+			// range partitioning, by the (sorted) keys that each shard after the first starts at
+			if (partitioner.length != shardCount - 1)
+				throw new Error('A range partitioner must have one split key for each shard after the first');
+			let splits = partitioner.map((key) => this.sortKey(key));
+			this.rangePartitioned = true;
+			this.shardIndex = (key) => {
+				let sortKey = this.sortKey(key);
+				let index = 0;
+				while (index < splits.length && compareSortKeys(sortKey, splits[index]) >= 0)
+					index++;
+				return index;
+			};
+		} else if (typeof partitioner == 'function') {
+			this.shardIndex = (key) => partitioner(key, shardCount);
+		} else {
+			// hash partitioning, by the FNV-1a hash of the key's bytes
+			this.shardIndex = (key) => {
+				let end = this.writeKey(key);
+				let hash = FNV_OFFSET;
+				for (let i = 0; i < end; i++)
+					hash = Math.imul(hash ^ keyBuffer[i], FNV_PRIME);
+				return (hash >>> 0) % shardCount;
+			};
+		}
+		if (path == null)
+			this.recoverBatches();
+		else {
+			// every open store holds a shared lock, so only an opener that has the store to itself (and can't be
+			// recovering a batch that another store is still in the middle of) can lock it exclusively to recover
+			let lockPath = path + '/' + LOCK_FILE;
+			let lock = lockFile(lockPath, true);
+			if (lock !== undefined) {
+				try {
+					this.recoverBatches();
+				} finally {
+					nativeAddon.unlockFile(lock);
+				}
+			}
+			this.batchLock = lockFile(lockPath, false);
+		}
+	}
+	writeKey(key) {
+		if (!keyBuffer)
+			keyBuffer = typeof Buffer != 'undefined' ? Buffer.alloc(4096) : new Uint8Array(4096);
+		return this.shards[0].writeKey(key, keyBuffer, 0);
+	}
+	// the keys are merged in the order of their encoded bytes (or as numbers), which is the order they are stored in
+	sortKey(key) {
+		if (this.numericKeys)
+			return key;
+		let end = this.writeKey(key);
+		// copied, since keyBuffer is reused for every key (and Buffer's slice doesn't copy)
+		return Uint8Array.prototype.slice.call(keyBuffer, 0, end);
+	}
+	shardFor(key) {
+		return this.shards[this.shardIndex(key)];
+	}
+	get(key, options) {
+		return this.shardFor(key).get(key, options);
+	}
+	getEntry(key, options) {
+		return this.shardFor(key).getEntry(key, options);
+	}
+	doesExist(key, versionOrValue) {
+		return this.shardFor(key).doesExist(key, versionOrValue);
+	}
+	put(key, value, versionOrOptions, ifVersion) {
+		return this.shardFor(key).put(key, value, versionOrOptions, ifVersion);
+	}
+	putSync(key, value, versionOrOptions, ifVersion) {
+		return this.shardFor(key).putSync(key, value, versionOrOptions, ifVersion);
+	}
+	remove(key, ifVersionOrValue) {
+		return this.shardFor(key).remove(key, ifVersionOrValue);
+	}
+	removeSync(key, ifVersionOrValue) {
+		return this.shardFor(key).removeSync(key, ifVersionOrValue);
+	}
+	getMany(keys) {
+		// fan out the keys to their shards, which prefetch them in parallel, and put the values back in order
+		let keysByShard = this.groupByShard(keys, (key) => key);
+		return Promise.all(Array.from(keysByShard, ([index, { items, positions }]) =>
+			this.shards[index].getMany(items).then((values) => {
+				return { values, positions };
+			}))).then((shardResults) => {
+				let results = new Array(keys.length);
+				for (let { values, positions } of shardResults) {
+					for (let i = 0; i < values.length; i++)
+						results[positions[i]] = values[i];
+				}
+				return results;
+			});
+	}
+	getRange(options) {
+		options = options || {};
+		let offset = options.offset || 0;
+		let limit = options.limit;
+		let shardOptions = Object.assign({}, options);
+		delete shardOptions.offset;
+		if (limit !== undefined)
+			shardOptions.limit = offset + limit; // no shard can contribute more than this
+		let iterable;
+		if (this.rangePartitioned) {
+			// the shards hold consecutive ranges of keys, so their ranges are concatenated
+			let shards = options.reverse ? this.shards.slice().reverse() : this.shards;
+			iterable = shards.map((shard) => shard.getRange(shardOptions)).reduce((first, next) => first.concat(next));
+		} else {
+			let keysOnly = options.values === false;
+			let reverse = options.reverse;
+			iterable = new RangeIterable();
+			iterable.iterate = () => mergeIterators(
+				this.shards.map((shard) => shard.getRange(shardOptions)[Symbol.iterator]()),
+				(item) => this.sortKey(keysOnly ? item : item.key), reverse);
+		}
+		if (offset || limit !== undefined)
+			iterable = iterable.slice(offset, limit === undefined ? Infinity : offset + limit);
+		return iterable;
+	}
+	getKeys(options) {
+		return this.getRange(Object.assign({}, options, { values: false }));
+	}
+	getCount(options) {
+		let count = 0;
+		for (let shard of this.shards)
+			count += shard.getCount(Object.assign({}, options));
+		return count;
+	}
+	// writes the operations ({ type: 'put' | 'remove', key, value }) to each shard as a batch, which is atomic within
+	// each shard, but not across them (see atomicBatch)
+	batch(operations) {
+		let operationsByShard = this.groupByShard(operations, (operation) => operation.key);
+		return Promise.all(Array.from(operationsByShard, ([index, { items }]) => this.shards[index].batch(items)))
+			.then(() => true);
+	}
+	// writes the operations atomically across shards: each shard's part is first recorded (prepared) in its shard, then
+	// a commit marker in the first shard decides the batch, and then the parts are applied. If this is interrupted, the
+	// batch is finished (if its marker was written) or discarded when the store is next opened while no other store has
+	// it open. Readers can still see the parts of a batch applied in some shards before others.
+	async atomicBatch(operations) {
+		let operationsByShard = this.groupByShard(operations, (operation) => operation.key);
+		if (operationsByShard.size < 2)
+			return this.batch(operations);
+		let id = Date.now().toString(36) + '-' + Math.random().toString(36).slice(2);
+		let indices = Array.from(operationsByShard.keys());
+		try {
+			await Promise.all(indices.map((index) => this.batchDbs[index].put([PREPARED, id],
+				operationsByShard.get(index).items.map(({ type, key, value }) => [type, key, value]))));
+			await Promise.all(indices.map((index) => this.shards[index].flushed));
+			await this.batchDbs[0].put([COMMITTED, id], indices);
+			await this.shards[0].flushed;
+		} catch (error) {
+			// not committed, discard whatever was prepared
+			await Promise.all(indices.map((index) => this.batchDbs[index].remove([PREPARED, id])));
+			throw error;
+		}
+		await Promise.all(indices.map((index) => this.shards[index].transaction(() => this.applyPrepared(index, id))));
+		await Promise.all(indices.map((index) => this.shards[index].flushed));
+		await this.batchDbs[0].remove([COMMITTED, id]);
+		return true;
+	}
+	applyPrepared(index, id) {
+		let shard = this.shards[index];
+		let batchDb = this.batchDbs[index];
+		let prepared = batchDb.get([PREPARED, id]);
+		if (!prepared)
+			throw new Error('The part of atomic batch ' + id + ' for shard ' + index + ' is missing');
+		for (let [type, key, value] of prepared)
+			shard[type](key, value);
+		batchDb.remove([PREPARED, id]);
+	}
+	// finish or discard the atomic batches that were interrupted (by a crash) since the store was last open, which must
+	// only be done while no other store has it open
+	recoverBatches() {
+		let markers = this.batchDbs[0];
+		for (let index = 0; index < this.shards.length; index++) {
+			let batchDb = this.batchDbs[index];
+			let ids = Array.from(batchDb.getKeys()).filter((key) => key[0] === PREPARED).map((key) => key[1]);
+			for (let id of ids) {
+				if (markers.doesExist([COMMITTED, id]))
+					this.shards[index].transactionSync(() => this.applyPrepared(index, id));
+				else
+					batchDb.removeSync([PREPARED, id]);
+			}
+		}
+		for (let key of Array.from(markers.getKeys()).filter((key) => key[0] === COMMITTED))
+			markers.removeSync(key);
+	}
+	groupByShard(items, getKey) {
+		let groups = new Map();
+		for (let i = 0; i < items.length; i++) {
+			let index = this.shardIndex(getKey(items[i]));
+			let group = groups.get(index);
+			if (!group)
+				groups.set(index, group = { items: [], positions: [] });
+			group.items.push(items[i]);
+			group.positions.push(i);
+		}
+		return groups;
+	}
+	get committed() {
+		return Promise.all(this.shards.map((shard) => shard.committed));
+	}
+	get flushed() {
+		return Promise.all(this.shards.map((shard) => shard.flushed));
+	}
+	getStats() {
+		return this.envs.map((env) => env.getStats());
+	}
+	close() {
+		return Promise.all(this.envs.map((env) => env.close())).then(() => {
+			if (this.batchLock !== undefined) {
+				nativeAddon.unlockFile(this.batchLock);
+				this.batchLock = undefined;
+			}
+		});
+	}
+}
+
+function lockFile(path, exclusive) {
+	let lock = nativeAddon.lockFile(path, exclusive);
+	if (lock < 0)
+		lmdbError(-lock);
+	return lock;
+}
+
+function compareSortKeys(a, b) {
+	if (typeof a == 'number')
+		return a - b;
+	let length = Math.min(a.length, b.length);
+	for (let i = 0; i < length; i++) {
+		if (a[i] !== b[i])
+			return a[i] - b[i];
+	}
+	return a.length - b.length;
+}
+
+// a k-way merge of the (sorted) shard iterators, by picking the least of their current entries (with few shards, a
+// scan of them is faster than maintaining a heap)
+function mergeIterators(iterators, getSortKey, reverse) {
+	let heads = [];
+	for (let iterator of iterators) {
+		let result = iterator.next();
+		if (!result.done)
+			heads.push({ iterator, value: result.value, sortKey: getSortKey(result.value) });
+	}
+	return {
+		next() {
+			if (heads.length === 0)
+				return { done: true, value: undefined };
+			let next = 0;
+			for (let i = 1; i < heads.length; i++) {
+				let comparison = compareSortKeys(heads[i].sortKey, heads[next].sortKey);
+				if (reverse ? comparison > 0 : comparison < 0)
+					next = i;
+			}
+			let head = heads[next];
+			let value = head.value;
+			let result = head.iterator.next();
+			if (result.done)
+				heads.splice(next, 1);
+			else {
+				head.value = result.value;
+				head.sortKey = getSortKey(result.value);
+			}
+			return { value };
+		},
+		return() {
+			for (let head of heads) {
+				if (head.iterator.return)
+					head.iterator.return();
+			}
+			heads = [];
+			return { done: true, value: undefined };
+		},
+		throw(error) {
+			this.return();
+			throw error;
+		},
+	};
+}
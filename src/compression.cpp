@@ -1,16 +1,39 @@
+#define LZ4_STATIC_LINKING_ONLY // for LZ4_attach_dictionary
+#define LZ4_HC_STATIC_LINKING_ONLY // for LZ4_attach_HC_dictionary
 #include "lz4.h"
+#include "lz4hc.h"
 #include "lmdb-js.h"
 #include <atomic>
 
 using namespace Napi;
 
 thread_local LZ4_stream_t* Compression::stream = nullptr;
+thread_local LZ4_streamHC_t* Compression::streamHC = nullptr;
+thread_local decompress_slab_t Compression::slabs[DECOMPRESS_SLAB_TIERS];
+// a thread's slabs are freed when it exits, through this key's destructor (thread_local may only be __thread, which
+// can't have destructors)
+#ifdef _WIN32
+static void NTAPI freeThreadSlabs(void* slabs) {
+	Compression::freeSlabs(slabs);
+}
+static DWORD slabsKey = FlsAlloc(freeThreadSlabs);
+#else
+static pthread_key_t slabsKey;
+static int slabsKeyCreated = pthread_key_create(&slabsKey, Compression::freeSlabs);
+#endif
 Compression::Compression(const CallbackInfo& info) : ObjectWrap<Compression>(info) {
 	unsigned int compressionThreshold = 1000;
 	char* dictionary = nullptr;
 	size_t dictSize = 0;
 	unsigned int startingOffset = 0;
+	this->dictionaries = new compression_dictionary_t[MAX_DICTIONARIES];
+	this->dictionaryCount.store(0, std::memory_order_relaxed);
+	this->level = 0;
+	double minGain = 0;
 	if (info[0].IsObject()) {
+		auto levelOption = info[0].As<Object>().Get("level");
+		if (levelOption.IsNumber()) // must be set before dictionaries are loaded
+			this->level = std::min(levelOption.As<Number>().Int32Value(), LZ4HC_CLEVEL_MAX);
 		auto dictionaryOption = info[0].As<Object>().Get("dictionary");
 		if (!dictionaryOption.IsUndefined()) {
 			if (!dictionaryOption.IsTypedArray()) {
@@ -20,15 +43,50 @@ Compression::Compression(const CallbackInfo& info) : ObjectWrap<Compression>(inf
 			napi_get_buffer_info(info.Env(), dictionaryOption, (void**) &dictionary, &dictSize);
 			dictSize = (dictSize >> 3) << 3; // make sure it is word-aligned
 		}
+		auto dictionariesOption = info[0].As<Object>().Get("dictionaries");
+		if (dictionariesOption.IsArray()) {
+			// the full table of dictionaries, by id, the first is the same as the dictionary option
+			Array dictionaryArray = dictionariesOption.As<Array>();
+			for (uint32_t i = 0; i < dictionaryArray.Length(); i++) {
+				Napi::Value dictionaryEntry = dictionaryArray.Get(i);
+				if (!dictionaryEntry.IsTypedArray()) {
+					throwError(info.Env(), "Dictionaries must be buffers");
+					return;
+				}
+				char* data;
+				size_t size;
+				napi_get_buffer_info(info.Env(), dictionaryEntry, (void**) &data, &size);
+				if (addDictionary(data, size) < 0) {
+					throwError(info.Env(), "Too many dictionaries");
+					return;
+				}
+			}
+		}
 		auto thresholdOption = info[0].As<Object>().Get("threshold");
 		if (thresholdOption.IsNumber())
 			compressionThreshold = thresholdOption.As<Number>();
 		auto offsetOption = info[0].As<Object>().Get("startingOffset");
 		if (offsetOption.IsNumber())
 			startingOffset = offsetOption.As<Number>();
+		auto minGainOption = info[0].As<Object>().Get("minGain");
+		if (minGainOption.IsNumber())
+			minGain = minGainOption.As<Number>();
 	}
+	this->maxRatio = minGain >= 1 ? 0 : (uint32_t) ((1 - std::max(minGain, 0.0)) * 0x10000);
+	this->buckets = new compression_bucket_t[COMPRESSION_SIZE_BUCKETS];
+	for (int i = 0; i < COMPRESSION_SIZE_BUCKETS; i++) {
+		buckets[i].ratio = 0;
+		buckets[i].count = 0;
+	}
+	bytesIn = 0;
+	bytesOut = 0;
+	compressedCount = 0;
+	skippedCount = 0;
+	compressionTime = 0;
 	this->startingOffset = startingOffset;
-	this->dictionary = this->compressDictionary = dictionary;
+	if (this->dictionaryCount.load(std::memory_order_relaxed) == 0)
+		addDictionary(dictionary, dictSize);
+	this->dictionary = dictionary;
 	this->dictionarySize = dictSize;
 	this->decompressTarget = dictionary + dictSize;
 	this->decompressSize = 0;
@@ -37,6 +95,52 @@ Compression::Compression(const CallbackInfo& info) : ObjectWrap<Compression>(inf
 	info.This().As<Object>().Set("address", Number::New(info.Env(), (double) (size_t) this));
 }
 
+Compression::~Compression() {
+	int count = dictionaryCount.load(std::memory_order_acquire);
+	for (int i = 0; i < count; i++) {
+		delete[] dictionaries[i].data;
+		LZ4_freeStream(dictionaries[i].stream);
+		if (dictionaries[i].streamHC)
+			LZ4_freeStreamHC(dictionaries[i].streamHC);
+	}
+	delete[] dictionaries;
+	delete[] buckets;
+}
+
+int Compression::addDictionary(char* data, size_t size) {
+	int id = dictionaryCount.load(std::memory_order_relaxed); // only added from the JS thread
+	if (id >= MAX_DICTIONARIES)
+		return -1;
+	compression_dictionary_t* entry = &dictionaries[id];
+	entry->size = (size >> 3) << 3; // make sure it is word-aligned
+	entry->data = new char[entry->size];
+	if (entry->size)
+		memcpy(entry->data, data, entry->size);
+	entry->stream = LZ4_createStream();
+	LZ4_loadDict(entry->stream, entry->data, entry->size);
+	if (level > 0) {
+		entry->streamHC = LZ4_createStreamHC();
+		LZ4_resetStreamHC_fast(entry->streamHC, level);
+		LZ4_loadDictHC(entry->streamHC, entry->data, entry->size);
+	} else
+		entry->streamHC = nullptr;
+	// publish it after it is fully loaded (released to the acquire loads of the compression threads)
+	dictionaryCount.store(id + 1, std::memory_order_release);
+	return id;
+}
+
+Napi::Value Compression::addDictionary(const CallbackInfo& info) {
+	if (!info[0].IsTypedArray())
+		return throwError(info.Env(), "Dictionary must be a buffer");
+	char* data;
+	size_t size;
+	napi_get_buffer_info(info.Env(), info[0], (void**) &data, &size);
+	int id = addDictionary(data, size);
+	if (id < 0)
+		return throwError(info.Env(), "Too many dictionaries");
+	return Number::New(info.Env(), id);
+}
+
 Napi::Value Compression::setBuffer(const CallbackInfo& info) {
 	size_t length;
 	napi_get_arraybuffer_info(info.Env(), info[0], (void**) &this->decompressTarget, &length);
@@ -47,40 +151,65 @@ Napi::Value Compression::setBuffer(const CallbackInfo& info) {
 	napi_get_buffer_info(info.Env(), info[3], (void**) &this->dictionary, &length);
 	return info.Env().Undefined();
 }
+int Compression::readHeader(unsigned char* charData, uint32_t* uncompressedLength, char** decompressDictionary, unsigned int* decompressDictionarySize) {
+	if (charData[0] == 254) {
+		*uncompressedLength = ((uint32_t)charData[1] << 16) | ((uint32_t)charData[2] << 8) | (uint32_t)charData[3];
+		return 4;
+	}
+	else if (charData[0] == 255) {
+		*uncompressedLength = ((uint32_t)charData[4] << 24) | ((uint32_t)charData[5] << 16) | ((uint32_t)charData[6] << 8) | (uint32_t)charData[7];
+		return 8;
+	}
+	else if (charData[0] == 253) {
+		// compressed with the dictionary identified by the second byte
+		unsigned int dictionaryId = charData[1];
+		if (dictionaryId >= (unsigned int) dictionaryCount.load(std::memory_order_acquire)) {
+			fprintf(stderr, "Unknown compression dictionary %u\n", dictionaryId);
+			return 0;
+		}
+		if (dictionaryId > 0) {
+			*decompressDictionary = dictionaries[dictionaryId].data;
+			*decompressDictionarySize = dictionaries[dictionaryId].size;
+		}
+		*uncompressedLength = ((uint32_t)charData[4] << 24) | ((uint32_t)charData[5] << 16) | ((uint32_t)charData[6] << 8) | (uint32_t)charData[7];
+		return 8;
+	}
+	fprintf(stderr, "Unknown status byte %u\n", charData[0]);
+	return 0;
+}
+
 void Compression::decompress(MDB_val& data, bool &isValid, bool canAllocate) {
 	uint32_t uncompressedLength;
-	int compressionHeaderSize;
 	uint32_t compressedLength = data.mv_size;
 	void* originalData = data.mv_data;
 	unsigned char* charData = (unsigned char*) data.mv_data + startingOffset;
+	char* decompressDictionary = dictionary;
+	unsigned int decompressDictionarySize = dictionarySize;
 
-	if (charData[0] == 254) {
-		uncompressedLength = ((uint32_t)charData[1] << 16) | ((uint32_t)charData[2] << 8) | (uint32_t)charData[3];
-		compressionHeaderSize = 4;
-	}
-	else if (charData[0] == 255) {
-		uncompressedLength = ((uint32_t)charData[4] << 24) | ((uint32_t)charData[5] << 16) | ((uint32_t)charData[6] << 8) | (uint32_t)charData[7];
-		compressionHeaderSize = 8;
-	}
-	else {
-		fprintf(stderr, "Unknown status byte %u\n", charData[0]);
+	int compressionHeaderSize = readHeader(charData, &uncompressedLength, &decompressDictionary, &decompressDictionarySize);
+	if (!compressionHeaderSize) {
 		//if (canAllocate)
 		//	Nan::ThrowError("Unknown status byte");
 		isValid = false;
 		return;
 	}
 	//fprintf(stdout, "compressed size %u uncompressedLength %u, target size %u, first byte %u\n", data.mv_size, uncompressedLength + startingOffset, decompressSize, charData[compressionHeaderSize]);
+	char* target = decompressTarget;
+	size_t targetSize = decompressSize;
 	data.mv_data = decompressTarget;
 	data.mv_size = uncompressedLength + startingOffset;
-	//TODO: For larger blocks with known encoding, it might make sense to allocate space for it and use an ExternalString
-	if (uncompressedLength + startingOffset > decompressSize) {
-		isValid = false;
-		return;
+	if (data.mv_size > decompressSize) {
+		// small values that don't fit signal JS to grow the target buffer, large values are decompressed into a slab
+		if (data.mv_size < SHARED_BUFFER_THRESHOLD || !(target = getSlab(data.mv_size, &targetSize))) {
+			isValid = false;
+			return;
+		}
+		data.mv_data = target;
 	}
 	int written = LZ4_decompress_safe_usingDict(
-		(char*)charData + compressionHeaderSize, decompressTarget + startingOffset,
-		compressedLength - compressionHeaderSize - startingOffset, decompressSize - startingOffset,
-		dictionary, dictionarySize);
+		(char*)charData + compressionHeaderSize, target + startingOffset,
+		compressedLength - compressionHeaderSize - startingOffset, targetSize - startingOffset,
+		decompressDictionary, decompressDictionarySize);
 	//fprintf(stdout, "first uncompressed byte %X %X %X %X %X %X\n", uncompressedData[0], uncompressedData[1], uncompressedData[2], uncompressedData[3], uncompressedData[4], uncompressedData[5]);
 	if (written < 0) {
 		fprintf(stderr, "Failed to decompress data %u %u bytes:\n", compressionHeaderSize, uncompressedLength);
@@ -93,18 +222,117 @@ void Compression::decompress(MDB_val& data, bool &isValid, bool canAllocate) {
 		return;
 	}
 	if (startingOffset)
-		memcpy(decompressTarget, originalData, startingOffset);
+		memcpy(target, originalData, startingOffset);
 	isValid = true;
 }
 
+char* Compression::getSlab(size_t size, size_t* slabSize) {
+	js_buffers_t* buffers = EnvWrap::sharedBuffers;
+	if (!buffers)
+		return nullptr;
+	int tier = 0;
+	while ((DECOMPRESS_SLAB_MIN_SIZE << tier) < size) {
+		if (++tier >= DECOMPRESS_SLAB_TIERS)
+			return nullptr;
+	}
+	decompress_slab_t* slab = &slabs[tier];
+	if (!slab->data) {
+		// first value of this size class in this thread, allocate it once and register it so JS can get it by id
+		slab->size = DECOMPRESS_SLAB_MIN_SIZE << tier;
+		slab->data = (char*) malloc(slab->size);
+		if (!slab->data)
+			return nullptr;
+		buffer_info_t bufferInfo;
+		bufferInfo.end = slab->data + slab->size;
+		bufferInfo.env = nullptr;
+		bufferInfo.isSharedMap = false;
+		bufferInfo.isSlab = true;
+		bufferInfo.ref = nullptr;
+		pthread_mutex_lock(&buffers->modification_lock);
+		bufferInfo.id = slab->id = buffers->nextId++;
+		buffers->buffers.emplace(slab->data, bufferInfo);
+		pthread_mutex_unlock(&buffers->modification_lock);
+		slab->buffers = buffers;
+#ifdef _WIN32
+		FlsSetValue(slabsKey, slabs);
+#else
+		if (slabsKeyCreated == 0)
+			pthread_setspecific(slabsKey, slabs);
+#endif
+	}
+	*slabSize = slab->size;
+	return slab->data;
+}
+
+// (at thread exit) unregister and free the slabs of the thread, its JS (which could access them) is gone by now
+void Compression::freeSlabs(void* threadSlabs) {
+	decompress_slab_t* slabs = (decompress_slab_t*) threadSlabs;
+	for (int tier = 0; tier < DECOMPRESS_SLAB_TIERS; tier++) {
+		decompress_slab_t* slab = &slabs[tier];
+		if (!slab->data)
+			continue;
+		pthread_mutex_lock(&slab->buffers->modification_lock);
+		slab->buffers->buffers.erase(slab->data);
+		pthread_mutex_unlock(&slab->buffers->modification_lock);
+		free(slab->data);
+		slab->data = nullptr;
+	}
+}
+
+int32_t Compression::getSlabId(void* data) {
+	for (int tier = 0; tier < DECOMPRESS_SLAB_TIERS; tier++) {
+		if (slabs[tier].data == data)
+			return slabs[tier].id;
+	}
+	return 0;
+}
+
+int32_t Compression::slabToSharedBuffer(uint32_t* keyBuffer, MDB_val data) {
+	*keyBuffer = data.mv_size;
+	int32_t id = getSlabId(data.mv_data);
+	if (!id)
+		return -30000; // not a slab, shouldn't happen
+	*(keyBuffer + 1) = id;
+	*(keyBuffer + 2) = 0;
+	return -30001;
+}
+
+// a view of a value that was decompressed into a slab, through the slab's one registered ArrayBuffer (V8 doesn't
+// allow a second backing store at the same address)
+napi_value Compression::slabView(napi_env env, MDB_val data, EnvWrap* ew) {
+	napi_value arrayBuffer = getSharedBufferById(env, getSlabId(data.mv_data), ew);
+	napi_value view;
+	napi_create_typedarray(env, napi_uint8_array, data.mv_size, arrayBuffer, 0, &view);
+	return view;
+}
+
+Napi::Value Compression::getStats(const CallbackInfo& info) {
+	Object stats = Object::New(info.Env());
+	stats.Set("bytesIn", Number::New(info.Env(), (double) bytesIn));
+	stats.Set("bytesOut", Number::New(info.Env(), (double) bytesOut));
+	stats.Set("compressed", Number::New(info.Env(), (double) compressedCount));
+	stats.Set("skipped", Number::New(info.Env(), (double) skippedCount));
+	stats.Set("compressionTime", Number::New(info.Env(), (double) compressionTime / TICKS_PER_SECOND));
+	Object ratios = Object::New(info.Env());
+	for (int i = 0; i < COMPRESSION_SIZE_BUCKETS; i++) {
+		if (buckets[i].count > 0) // keyed by the lower bound of the size class
+			ratios.Set(Number::New(info.Env(), (double) ((uint64_t) 1 << i)), Number::New(info.Env(), (double) buckets[i].ratio / 0x10000));
+	}
+	stats.Set("ratios", ratios);
+	return stats;
+}
+
 int Compression::compressInstruction(EnvWrap* env, double* compressionAddress) {
 	MDB_val value;
 	value.mv_data = (void*)((size_t) * (compressionAddress - 1));
 	value.mv_size = *(((uint32_t*)compressionAddress) - 3);
 	argtokey_callback_t compressedData = compress(&value, nullptr);
-	if (compressedData) {
-		*(((uint32_t*)compressionAddress) - 3) = value.mv_size;
-		*((size_t*)(compressionAddress - 1)) = (size_t)value.mv_data;
+	// if compression wasn't worth it, the value is left as is, and can be written uncompressed (as long as it doesn't start with a compression indicator)
+	if (compressedData || !(value.mv_size > startingOffset && ((uint8_t*)value.mv_data)[startingOffset] >= 250)) {
+		if (compressedData) {
+			*(((uint32_t*)compressionAddress) - 3) = value.mv_size;
+			*((size_t*)(compressionAddress - 1)) = (size_t)value.mv_data;
+		}
 		int64_t status = std::atomic_exchange((std::atomic<int64_t>*) compressionAddress, (int64_t) 0);
 		if (status == 1 && env) {
 			pthread_mutex_lock(env->writingLock);
@@ -123,24 +351,75 @@ int Compression::compressInstruction(EnvWrap* env, double* compressionAddress) {
 argtokey_callback_t Compression::compress(MDB_val* value, void (*freeValue)(MDB_val&)) {
 	size_t dataLength = value->mv_size - startingOffset;
 	char* data = (char*)value->mv_data;
-	if (value->mv_size < compressionThreshold && !(value->mv_size > startingOffset && ((uint8_t*)data)[startingOffset] >= 250))
+	bool mustCompress = value->mv_size > startingOffset && ((uint8_t*)data)[startingOffset] >= 250;
+	if (value->mv_size < compressionThreshold && !mustCompress)
 		return freeValue; // don't compress if less than threshold (but we must compress if the first byte is the compression indicator)
+	int bucket = 0;
+	while (bucket < COMPRESSION_SIZE_BUCKETS - 1 && (dataLength >> (bucket + 1)))
+		bucket++;
+	compression_bucket_t* sizeClass = &buckets[bucket];
+	bytesIn.fetch_add(value->mv_size, std::memory_order_relaxed);
+	if (!mustCompress && sizeClass->ratio.load(std::memory_order_relaxed) > maxRatio &&
+			sizeClass->count.fetch_add(1, std::memory_order_relaxed) % ADAPTIVE_SAMPLE_INTERVAL != 0) {
+		// values of this size haven't been compressing well, store it uncompressed
+		bytesOut.fetch_add(value->mv_size, std::memory_order_relaxed);
+		skippedCount.fetch_add(1, std::memory_order_relaxed);
+		return freeValue;
+	}
+	uint64_t start = get_time64();
+	int dictionaryId = dictionaryCount.load(std::memory_order_acquire) - 1; // always compress with the newest dictionary
 	bool longSize = dataLength >= 0x1000000;
-	int prefixSize = (longSize ? 8 : 4) + startingOffset;
+	int prefixSize = ((longSize || dictionaryId > 0) ? 8 : 4) + startingOffset;
 	int maxCompressedSize = LZ4_COMPRESSBOUND(dataLength);
 	char* compressed = new char[maxCompressedSize + prefixSize];
 	//fprintf(stdout, "compressing %u\n", dataLength);
-	if (!stream)
-		stream = LZ4_createStream();
-	LZ4_loadDict(stream, compressDictionary, dictionarySize);
-	int compressedSize = LZ4_compress_fast_continue(stream, data + startingOffset, compressed + prefixSize, dataLength, maxCompressedSize, acceleration);
+	int compressedSize;
+	if (level > 0) {
+		// LZ4-HC is much slower to compress, but the output is standard LZ4 blocks, so decompression is the same
+		if (!streamHC)
+			streamHC = LZ4_createStreamHC();
+		LZ4_resetStreamHC_fast(streamHC, level);
+		LZ4_attach_HC_dictionary(streamHC, dictionaries[dictionaryId].streamHC);
+		compressedSize = LZ4_compress_HC_continue(streamHC, data + startingOffset, compressed + prefixSize, dataLength, maxCompressedSize);
+	} else {
+		if (!stream)
+			stream = LZ4_createStream();
+		LZ4_resetStream_fast(stream);
+		LZ4_attach_dictionary(stream, dictionaries[dictionaryId].stream);
+		compressedSize = LZ4_compress_fast_continue(stream, data + startingOffset, compressed + prefixSize, dataLength, maxCompressedSize, acceleration);
+	}
+	compressionTime.fetch_add(get_time64() - start, std::memory_order_relaxed);
 	if (compressedSize > 0) {
+		// update the running ratio for this size class
+		uint32_t sampleRatio = (uint32_t) (((uint64_t) (compressedSize + prefixSize - startingOffset) << 16) / (dataLength ? dataLength : 1));
+		uint32_t ratio = sizeClass->ratio.load(std::memory_order_relaxed);
+		sizeClass->ratio.store(sizeClass->count.fetch_add(1, std::memory_order_relaxed) == 0 ?
+			sampleRatio : (uint32_t) (((uint64_t) ratio * 7 + sampleRatio) >> 3), std::memory_order_relaxed);
+		if (sampleRatio > maxRatio && !mustCompress) {
+			// not enough savings to be worth decompressing on reads, store it uncompressed
+			delete[] compressed;
+			bytesOut.fetch_add(value->mv_size, std::memory_order_relaxed);
+			skippedCount.fetch_add(1, std::memory_order_relaxed);
+			return freeValue;
+		}
+		bytesOut.fetch_add(compressedSize + prefixSize, std::memory_order_relaxed);
+		compressedCount.fetch_add(1, std::memory_order_relaxed);
 		if (startingOffset > 0) // copy the uncompressed prefix
 			memcpy(compressed, data, startingOffset);
 		if (freeValue)
 			freeValue(*value);
 		uint8_t* compressedData = (uint8_t*)compressed + startingOffset;
-		if (longSize) {
+		if (dictionaryId > 0) {
+			// dictionary 0 uses the original headers, so data is still readable by older versions
+			compressedData[0] = 253;
+			compressedData[1] = (uint8_t)dictionaryId;
+			compressedData[2] = (uint8_t)(dataLength >> 40u);
+			compressedData[3] = (uint8_t)(dataLength >> 32u);
+			compressedData[4] = (uint8_t)(dataLength >> 24u);
+			compressedData[5] = (uint8_t)(dataLength >> 16u);
+			compressedData[6] = (uint8_t)(dataLength >> 8u);
+			compressedData[7] = (uint8_t)dataLength;
+		} else if (longSize) {
 			compressedData[0] = 255;
 			compressedData[2] = (uint8_t)(dataLength >> 40u);
 			compressedData[3] = (uint8_t)(dataLength >> 32u);
@@ -201,11 +480,256 @@ NAPI_FUNCTION(EnvWrap::compress) {
 	RETURN_UNDEFINED;
 }
 
+// d-mers (hashed n-grams) of this size are scored when training a dictionary (LZ4 matches are at least 4 bytes)
+const int TRAINING_DMER_SIZE = 6;
+// the dictionary is assembled from segments of this size that have the most frequent d-mers
+const int TRAINING_SEGMENT_SIZE = 128;
+const int TRAINING_HASH_BITS = 20;
+const size_t MAX_TRAINING_SAMPLE_BYTES = 0x4000000;
+const unsigned int MAX_LZ4_DICTIONARY_SIZE = 0x10000; // LZ4 only references the last 64KB
+
+static inline uint32_t hashDmer(const char* position) {
+	uint64_t word;
+	memcpy(&word, position, 8);
+	return (uint32_t) (((word << (64 - TRAINING_DMER_SIZE * 8)) * 0xCF1BBCDCB7A56463ull) >> (64 - TRAINING_HASH_BITS));
+}
+
+typedef struct dictionary_evaluation_t {
+	size_t compressedBytes;
+	uint64_t decompressTime;
+} dictionary_evaluation_t;
+
+class DictionaryTrainingWorker : public AsyncWorker {
+  public:
+	DictionaryTrainingWorker(DbiWrap* dw, unsigned int sampleCount, unsigned int dictionarySize, const Function& callback)
+	  : AsyncWorker(callback), dw(dw), sampleCount(sampleCount), dictionarySize(dictionarySize) {}
+
+	void Execute() {
+		int rc = collectSamples();
+		if (rc)
+			return SetError(mdb_strerror(rc));
+		if (sampleOffsets.size() < 2)
+			return SetError("Not enough entries to sample for a dictionary");
+		train();
+		Compression* compression = dw->compression;
+		if (compression) {
+			// compare to the dictionary that new entries are currently compressed with
+			compression_dictionary_t* current = &compression->dictionaries[compression->dictionaryCount.load(std::memory_order_acquire) - 1];
+			previous = evaluate(current->data, current->size);
+		} else
+			previous = evaluate(nullptr, 0);
+		trained = evaluate(dictionary.data(), dictionary.size());
+	}
+
+	void OnOK() {
+		napi_env env = Env();
+		napi_value result, value;
+		napi_create_object(env, &result);
+		napi_create_buffer_copy(env, dictionary.size(), dictionary.data(), nullptr, &value);
+		napi_set_named_property(env, result, "dictionary", value);
+		size_t sampleBytes = sampleOffsets.back();
+		setNumber(result, "sampleCount", sampleOffsets.size() - 1);
+		setNumber(result, "sampleBytes", sampleBytes);
+		setNumber(result, "previousCompressedBytes", previous.compressedBytes);
+		setNumber(result, "compressedBytes", trained.compressedBytes);
+		setNumber(result, "previousRatio", (double) sampleBytes / previous.compressedBytes);
+		setNumber(result, "ratio", (double) sampleBytes / trained.compressedBytes);
+		setNumber(result, "previousDecompressTime", (double) previous.decompressTime / TICKS_PER_SECOND);
+		setNumber(result, "decompressTime", (double) trained.decompressTime / TICKS_PER_SECOND);
+		napi_value undefined, callbackResult;
+		napi_get_undefined(env, &undefined);
+		napi_value args[2] = { undefined, result };
+		// we use direct napi call here because node-addon-api interface with throw a fatal error if a worker thread is terminating
+		napi_call_function(env, undefined, Callback().Value(), 2, args, &callbackResult);
+	}
+	void OnError(const Error& e) {
+		napi_value result; // we use direct napi call here because node-addon-api interface with throw a fatal error if a worker thread is terminating
+		napi_value arg = e.Value();
+		napi_call_function(Env(), Env().Undefined(), Callback().Value(), 1, &arg, &result);
+	}
+
+  private:
+	DbiWrap* dw;
+	unsigned int sampleCount;
+	unsigned int dictionarySize;
+	std::vector<char> samples; // all the sampled (uncompressed) values, back to back
+	std::vector<size_t> sampleOffsets; // start of each sample, and the end of the last one
+	std::vector<char> dictionary;
+	dictionary_evaluation_t previous;
+	dictionary_evaluation_t trained;
+
+	void setNumber(napi_value target, const char* name, double number) {
+		napi_value value;
+		napi_create_double(Env(), number, &value);
+		napi_set_named_property(Env(), target, name, value);
+	}
+
+	int collectSamples() {
+		MDB_txn* txn = ExtendedEnv::getPrefetchReadTxn(dw->ew->env);
+		MDB_stat stat;
+		int rc = mdb_stat(txn, dw->dbi, &stat);
+		MDB_cursor *cursor;
+		if (!rc)
+			rc = mdb_cursor_open(txn, dw->dbi, &cursor);
+		if (rc) {
+			ExtendedEnv::donePrefetchReadTxn(txn);
+			return rc;
+		}
+		// take evenly spaced entries so the samples are representative of the whole database
+		size_t stride = sampleCount > 0 ? stat.ms_entries / sampleCount : 0;
+		if (stride == 0) stride = 1;
+		Compression* compression = dw->compression;
+		unsigned int startingOffset = compression ? compression->startingOffset : 0;
+		MDB_val key, data;
+		size_t position = 0;
+		sampleOffsets.push_back(0);
+		rc = mdb_cursor_get(cursor, &key, &data, MDB_FIRST);
+		while (!rc && sampleOffsets.size() <= sampleCount && samples.size() < MAX_TRAINING_SAMPLE_BYTES) {
+			if (position++ % stride == 0) {
+				unsigned char* value = (unsigned char*) data.mv_data;
+				size_t size = data.mv_size;
+				if (dw->hasVersions) {
+					value += 8;
+					size = size >= 8 ? size - 8 : 0;
+				}
+				if (size > startingOffset && value[startingOffset] >= 250 && compression) {
+					// already compressed, train on the original data
+					uint32_t uncompressedLength;
+					compression_dictionary_t* base = &compression->dictionaries[0];
+					char* decompressDictionary = base->data;
+					unsigned int decompressDictionarySize = base->size;
+					int headerSize = compression->readHeader(value + startingOffset, &uncompressedLength, &decompressDictionary, &decompressDictionarySize);
+					size_t start = samples.size();
+					if (headerSize) {
+						samples.resize(start + uncompressedLength);
+						int written = LZ4_decompress_safe_usingDict((char*) value + startingOffset + headerSize, samples.data() + start,
+							size - startingOffset - headerSize, uncompressedLength, decompressDictionary, decompressDictionarySize);
+						samples.resize(written > 0 ? start + written : start);
+					}
+				} else if (size > startingOffset)
+					samples.insert(samples.end(), value + startingOffset, value + size);
+				if (samples.size() > sampleOffsets.back())
+					sampleOffsets.push_back(samples.size());
+			}
+			rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT);
+		}
+		mdb_cursor_close(cursor);
+		ExtendedEnv::donePrefetchReadTxn(txn);
+		samples.resize(samples.size() + 8); // padding so d-mers can be read as words
+		return rc == MDB_NOTFOUND ? 0 : rc;
+	}
+
+	void train() {
+		// score each d-mer by how frequently it occurs (FastCover style), and then fill the dictionary with the
+		// highest scoring segment from each epoch, from the back since LZ4 favors the closest (last) bytes
+		size_t sampleBytes = sampleOffsets.back();
+		if (dictionarySize > MAX_LZ4_DICTIONARY_SIZE)
+			dictionarySize = MAX_LZ4_DICTIONARY_SIZE;
+		if (dictionarySize > sampleBytes)
+			dictionarySize = sampleBytes;
+		std::vector<uint32_t> frequencies(1 << TRAINING_HASH_BITS);
+		std::vector<uint16_t> segmentFrequencies(1 << TRAINING_HASH_BITS);
+		const char* data = samples.data();
+		for (size_t i = 1; i < sampleOffsets.size(); i++) {
+			for (size_t position = sampleOffsets[i - 1]; position + TRAINING_DMER_SIZE <= sampleOffsets[i]; position++)
+				frequencies[hashDmer(data + position)]++;
+		}
+		dictionary.resize(dictionarySize);
+		size_t tail = dictionarySize;
+		size_t epochs = std::max((size_t) 1, (size_t) dictionarySize / TRAINING_SEGMENT_SIZE / 4);
+		size_t epochSize = sampleBytes / epochs;
+		if (epochSize < TRAINING_SEGMENT_SIZE) {
+			epochSize = TRAINING_SEGMENT_SIZE;
+			epochs = std::max((size_t) 1, sampleBytes / epochSize);
+		}
+		const size_t dmersInSegment = TRAINING_SEGMENT_SIZE - TRAINING_DMER_SIZE + 1;
+		size_t emptyEpochs = 0;
+		for (size_t epoch = 0; tail > 0 && emptyEpochs < epochs; epoch = (epoch + 1) % epochs) {
+			size_t epochBegin = epoch * epochSize;
+			size_t epochEnd = std::min(epochBegin + epochSize, sampleBytes);
+			size_t begin = epochBegin, bestBegin = epochBegin;
+			uint64_t score = 0, bestScore = 0;
+			size_t end = epochBegin;
+			for (; end + TRAINING_DMER_SIZE <= epochEnd; end++) {
+				uint32_t hash = hashDmer(data + end);
+				if (segmentFrequencies[hash]++ == 0) // only count distinct d-mers in a segment
+					score += frequencies[hash];
+				if (end - begin + 1 == dmersInSegment) {
+					if (score > bestScore) {
+						bestScore = score;
+						bestBegin = begin;
+					}
+					hash = hashDmer(data + begin++);
+					if (--segmentFrequencies[hash] == 0)
+						score -= frequencies[hash];
+				}
+			}
+			for (; begin < end; begin++)
+				segmentFrequencies[hashDmer(data + begin)]--;
+			if (bestScore == 0) {
+				emptyEpochs++;
+				continue;
+			}
+			emptyEpochs = 0;
+			size_t segmentSize = std::min((size_t) TRAINING_SEGMENT_SIZE, tail);
+			tail -= segmentSize;
+			memcpy(dictionary.data() + tail, data + bestBegin, segmentSize);
+			// zero out the selected d-mers so other segments are picked for the rest of the dictionary
+			for (size_t position = bestBegin; position < bestBegin + dmersInSegment; position++)
+				frequencies[hashDmer(data + position)] = 0;
+		}
+		if (tail > 0) // ran out of useful segments
+			dictionary.erase(dictionary.begin(), dictionary.begin() + tail);
+		dictionary.resize((dictionary.size() >> 3) << 3); // word-aligned like other dictionaries
+	}
+
+	dictionary_evaluation_t evaluate(char* dictionaryData, unsigned int size) {
+		dictionary_evaluation_t evaluation = { 0, 0 };
+		LZ4_stream_t* dictionaryStream = LZ4_createStream();
+		LZ4_stream_t* stream = LZ4_createStream();
+		LZ4_loadDict(dictionaryStream, dictionaryData, size);
+		size_t maxSampleSize = 0;
+		for (size_t i = 1; i < sampleOffsets.size(); i++)
+			maxSampleSize = std::max(maxSampleSize, sampleOffsets[i] - sampleOffsets[i - 1]);
+		std::vector<char> compressed(LZ4_COMPRESSBOUND(maxSampleSize));
+		std::vector<char> decompressed(maxSampleSize);
+		for (size_t i = 1; i < sampleOffsets.size(); i++) {
+			int sampleSize = sampleOffsets[i] - sampleOffsets[i - 1];
+			LZ4_resetStream_fast(stream);
+			LZ4_attach_dictionary(stream, dictionaryStream);
+			int compressedSize = LZ4_compress_fast_continue(stream, samples.data() + sampleOffsets[i - 1], compressed.data(),
+				sampleSize, compressed.size(), 1);
+			evaluation.compressedBytes += compressedSize;
+			uint64_t start = get_time64();
+			LZ4_decompress_safe_usingDict(compressed.data(), decompressed.data(), compressedSize, sampleSize, dictionaryData, size);
+			evaluation.decompressTime += get_time64() - start;
+		}
+		LZ4_freeStream(stream);
+		LZ4_freeStream(dictionaryStream);
+		return evaluation;
+	}
+};
+
+NAPI_FUNCTION(trainDictionary) {
+	ARGS(4)
+	GET_INT64_ARG(0);
+	DbiWrap* dw = (DbiWrap*) i64;
+	uint32_t sampleCount, dictionarySize;
+	GET_UINT32_ARG(sampleCount, 1);
+	GET_UINT32_ARG(dictionarySize, 2);
+	DictionaryTrainingWorker* worker = new DictionaryTrainingWorker(dw, sampleCount, dictionarySize, Function(env, args[3]));
+	worker->Queue();
+	RETURN_UNDEFINED;
+}
+
 void Compression::setupExports(Napi::Env env, Object exports) {
 	Function CompressionClass = DefineClass(env, "Compression", {
 		Compression::InstanceMethod("setBuffer", &Compression::setBuffer),
+		Compression::InstanceMethod("addDictionary", &Compression::addDictionary),
+		Compression::InstanceMethod("getStats", &Compression::getStats),
 	});
 	exports.Set("Compression", CompressionClass);
+	EXPORT_NAPI_FUNCTION("trainDictionary", trainDictionary);
 //	compressionTpl->InstanceTemplate()->SetInternalFieldCount(1);
 }
 
@@ -99,19 +99,23 @@ int CursorWrap::returnEntry(int lastRC, MDB_val &key, MDB_val &data) {
 	if (flags & INCLUDE_VALUES) {
 		int result = getVersionAndUncompress(data, dw);
 		bool fits = true;
-		if (result) {
-			fits = valToBinaryFast(data, dw); // it fit in the global/compression-target buffer
-		}
+		if (result == 3) { // decompressed into a slab, which JS can access directly
+			Compression::slabToSharedBuffer((uint32_t*) keyBuffer, data);
+		} else {
+			if (result) {
+				fits = valToBinaryFast(data, dw); // it fit in the global/compression-target buffer
+			}
 #if ENABLE_V8_API
-		if (fits || result == 2 || data.mv_size < SHARED_BUFFER_THRESHOLD) {// if it was decompressed
+			if (fits || result == 2 || data.mv_size < SHARED_BUFFER_THRESHOLD) {// if it was decompressed
 #endif
-			*((uint32_t*)keyBuffer) = data.mv_size;
-			*((uint32_t*)(keyBuffer + 4)) = 0; // buffer id of 0
+				*((uint32_t*)keyBuffer) = data.mv_size;
+				*((uint32_t*)(keyBuffer + 4)) = 0; // buffer id of 0
 #if ENABLE_V8_API
-		} else {
-			EnvWrap::toSharedBuffer(dw->ew->env, (uint32_t*) dw->ew->keyBuffer, data);
-		}
+			} else {
+				EnvWrap::toSharedBuffer(dw->ew->env, (uint32_t*) dw->ew->keyBuffer, data);
+			}
 #endif
+		}
 	}
 	if (!(flags & VALUES_FOR_KEY)) {
 		memcpy(keyBuffer + 32, key.mv_data, key.mv_size);
@@ -339,7 +343,8 @@ NAPI_FUNCTION(getCurrentShared) {
 	int rc = mdb_cursor_get(cw->cursor, &key, &data, MDB_GET_CURRENT);
 	if (rc)
 		RETURN_INT32(cw->returnEntry(rc, key, data));
-	getVersionAndUncompress(data, cw->dw);
+	if (getVersionAndUncompress(data, cw->dw) == 3) // decompressed into a slab, which already has an ArrayBuffer
+		return Compression::slabView(env, data, cw->dw->ew);
 	napi_create_external_buffer(env, data.mv_size,
 		(char*) data.mv_data, noopCursor, nullptr, &returnValue);
 	return returnValue;
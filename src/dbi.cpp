@@ -112,7 +112,23 @@ Value DbiWrap::drop(const Napi::CallbackInfo& info) {
 	}
 
 	// Drop database
+	#ifdef REDO_LOG
+	RedoLog* redoLog = ((ExtendedEnv*) mdb_env_get_userctx(ew->env))->redoLog;
+	if (redoLog) {
+		// deleting the database closes its handle, so it is logged first, and taken back if it fails
+		redoLog->beginChild();
+		redoLog->logDrop(ew->writeTxn->txn, dbi, del);
+	}
+	#endif
 	rc = mdb_drop(ew->writeTxn->txn, dbi, del);
+	#ifdef REDO_LOG
+	if (redoLog) {
+		if (rc)
+			redoLog->abortChild();
+		else
+			redoLog->commitChild();
+	}
+	#endif
 	if (rc != 0) {
 		return throwLmdbError(info.Env(), rc);
 	}
@@ -160,6 +176,8 @@ int32_t DbiWrap::doGetByBinary(uint32_t keySize, uint32_t ifNotTxnId, int64_t tx
 		return -30004;
 	#endif
 	result = getVersionAndUncompress(data, this);
+	if (result == 3) // decompressed into a slab, which JS can access directly
+		return Compression::slabToSharedBuffer((uint32_t*) keyBuffer, data);
 	bool fits = true;
 	if (result) {
 		fits = valToBinaryFast(data, this); // it fits in the global/compression-target buffer
@@ -202,7 +220,14 @@ NAPI_FUNCTION(directWrite) {
 	data.mv_size = dataSize;
 	data.mv_data = (void*) (keyBuffer + (((keySize >> 3) + 1) << 3));
 #ifdef MDB_RPAGE_CACHE
-	int result = mdb_direct_write(txn, dw->dbi, &key, offset, &data);
+	int result;
+	#ifdef REDO_LOG
+	// written in place, outside of any commit, so it couldn't be replayed from the redo log
+	if (((ExtendedEnv*) mdb_env_get_userctx(ew->env))->redoLog)
+		result = MDB_INCOMPATIBLE;
+	else
+	#endif
+	result = mdb_direct_write(txn, dw->dbi, &key, offset, &data);
 #else
 	int result = -1;
 #endif
@@ -249,6 +274,8 @@ NAPI_FUNCTION(getSharedByBinary) {
 			return throwLmdbError(env, rc);
 	}
 	rc = getVersionAndUncompress(data, dw);
+	if (rc == 3) // decompressed into a slab, which already has an ArrayBuffer
+		return Compression::slabView(env, data, dw->ew);
 	napi_create_external_buffer(env, data.mv_size,
 		(char*) data.mv_data, noopDbi, nullptr, &returnValue);
 	return returnValue;
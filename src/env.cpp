@@ -1,6 +1,13 @@
     #include "lmdb-js.h"
 #include <atomic>
-#ifndef _WIN32
+#include <thread>
+#include <cerrno>
+#include "lz4frame.h"
+#include "xxhash.h"
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -61,6 +68,14 @@ EnvWrap::EnvWrap(const CallbackInfo& info) : ObjectWrap<EnvWrap>(info) {
     this->hasWrites = false;
 	this->writingLock = new pthread_mutex_t;
 	this->writingCond = new pthread_cond_t;
+	this->writerWakeups = 0;
+	this->writerParked = false;
+	this->writerSpin = 10 * TICKS_PER_SECOND / 1000000;
+	this->writerSpinWakeups = 0;
+	this->writerParks = 0;
+	this->writerNotifies = 0;
+	this->writeCombiner = nullptr;
+	this->writeQueue = nullptr;
 	info.This().As<Object>().Set("address", Number::New(info.Env(), (size_t) this));
 	pthread_mutex_init(this->writingLock, nullptr);
 	cond_init(this->writingCond);
@@ -155,6 +170,26 @@ class SyncWorker : public AsyncWorker {
 	}
 
 	void Execute() {
+		#ifdef REDO_LOG
+		RedoLog* redoLog = ((ExtendedEnv*) mdb_env_get_userctx(env->env))->redoLog;
+		if (redoLog) {
+			// commits are durable once their records in the log are synced
+			int rc = redoLog->syncAll();
+			if (rc != 0)
+				SetError(mdb_strerror(rc));
+			return;
+		}
+		#endif
+		#ifdef MDB_OVERLAPPINGSYNC
+		ExtendedEnv* extendedEnv = (ExtendedEnv*) mdb_env_get_userctx(env->env);
+		if (extendedEnv->hasSyncScheduler()) {
+			// group this with the other commits waiting for a sync
+			int rc = extendedEnv->syncLatest();
+			if (rc != 0)
+				SetError(mdb_strerror(rc));
+			return;
+		}
+		#endif
 		#ifdef _WIN32
 		int rc = mdb_env_sync(env->env, 1);
 		#else
@@ -181,15 +216,15 @@ class SyncWorker : public AsyncWorker {
 
 class CopyWorker : public AsyncWorker {
   public:
-	CopyWorker(MDB_env* env, std::string inPath, int flags, const Function& callback)
-	 : AsyncWorker(callback), env(env), path(inPath), flags(flags) {
+	CopyWorker(MDB_env* env, std::string inPath, int flags, int threads, const Function& callback)
+	 : AsyncWorker(callback), env(env), path(inPath), flags(flags), threads(threads) {
 	 }
 	~CopyWorker() {
 		//free(path);
 	}
 
 	void Execute() {
-		int rc = mdb_env_copy2(env, path.c_str(), flags);
+		int rc = mdb_env_copy3(env, path.c_str(), flags, threads);
 		if (rc != 0) {
 			SetError(mdb_strerror(rc));
 		}
@@ -199,6 +234,456 @@ class CopyWorker : public AsyncWorker {
 	MDB_env* env;
 	std::string path;
 	int flags;
+	int threads;
+};
+
+class IncrementalCopyWorker : public AsyncWorker {
+  public:
+	IncrementalCopyWorker(MDB_env* env, std::string inPath, mdb_size_t since, const Function& callback)
+	 : AsyncWorker(callback), env(env), path(inPath), since(since), txnId(0) {
+	 }
+
+	void Execute() {
+		int rc = mdb_env_copy_incr(env, path.c_str(), since, &txnId);
+		if (rc != 0) {
+			SetError(mdb_strerror(rc));
+		}
+	}
+	void OnOK() {
+		Callback().Call({ Env().Null(), Number::New(Env(), (double) txnId) });
+	}
+
+  private:
+	MDB_env* env;
+	std::string path;
+	mdb_size_t since;
+	mdb_size_t txnId;
+};
+
+class RestoreIncrementalWorker : public AsyncWorker {
+  public:
+	RestoreIncrementalWorker(std::string path, std::string incrementalPath, const Function& callback)
+	 : AsyncWorker(callback), path(path), incrementalPath(incrementalPath), txnId(0) {
+	 }
+
+	void Execute() {
+		int rc = mdb_env_restore_incr(path.c_str(), incrementalPath.c_str(), &txnId);
+		if (rc != 0) {
+			SetError(mdb_strerror(rc));
+		}
+	}
+	void OnOK() {
+		Callback().Call({ Env().Null(), Number::New(Env(), (double) txnId) });
+	}
+
+  private:
+	std::string path;
+	std::string incrementalPath;
+	mdb_size_t txnId;
+};
+
+// streamed backups are written as a sequence of independent lz4 frames (one per chunk of the copy), so chunks can be
+// compressed in parallel and the output is still a standard lz4 stream (that `lz4 -d` can decompress as well)
+#define STREAM_CHUNK_SIZE 0x400000
+#define STREAM_MAX_THREADS 64
+
+static int readFully(int fd, char* buffer, size_t size, size_t* bytesRead) {
+	size_t total = 0;
+	while (total < size) {
+#ifdef _WIN32
+		int count = _read(fd, buffer + total, (unsigned int) (size - total));
+#else
+		ssize_t count = ::read(fd, buffer + total, size - total);
+		if (count < 0 && errno == EINTR)
+			continue;
+#endif
+		if (count < 0)
+			return errno;
+		if (count == 0)
+			break;
+		total += count;
+	}
+	*bytesRead = total;
+	return 0;
+}
+
+static int writeFully(int fd, const char* buffer, size_t size) {
+	while (size > 0) {
+#ifdef _WIN32
+		int count = _write(fd, buffer, (unsigned int) size);
+#else
+		ssize_t count = ::write(fd, buffer, size);
+		if (count < 0 && errno == EINTR)
+			continue;
+#endif
+		if (count < 0)
+			return errno;
+		buffer += count;
+		size -= count;
+	}
+	return 0;
+}
+
+class CopyStreamWorker : public AsyncWorker {
+  public:
+	CopyStreamWorker(MDB_env* env, int fd, int flags, int threads, int level, const Function& callback)
+	 : AsyncWorker(callback), env(env), fd(fd), flags(flags), threads(threads), level(level), size(0), compressedSize(0) {
+	 }
+
+	void Execute() {
+		// the copy is written into a pipe by its own thread (mdb_env_copyfd3 only takes a file handle), and read back
+		// out in chunks that are compressed by up to `threads` threads at a time
+		int pipeRead;
+		mdb_filehandle_t pipeWrite;
+#ifdef _WIN32
+		HANDLE pipeReadHandle;
+		if (!CreatePipe(&pipeReadHandle, &pipeWrite, NULL, STREAM_CHUNK_SIZE))
+			return SetError(mdb_strerror(GetLastError()));
+		pipeRead = _open_osfhandle((intptr_t) pipeReadHandle, _O_RDONLY | _O_BINARY);
+#else
+		int pipeFds[2];
+		if (pipe(pipeFds))
+			return SetError(mdb_strerror(errno));
+		pipeRead = pipeFds[0];
+		pipeWrite = pipeFds[1];
+#endif
+		int copyRc = 0;
+		std::thread copier([&]() {
+			copyRc = mdb_env_copyfd3(env, pipeWrite, flags, threads);
+#ifdef _WIN32
+			CloseHandle(pipeWrite);
+#else
+			close(pipeWrite);
+#endif
+		});
+
+		LZ4F_preferences_t preferences = LZ4F_INIT_PREFERENCES;
+		preferences.frameInfo.blockSizeID = LZ4F_max4MB;
+		preferences.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+		preferences.compressionLevel = level;
+		size_t bound = LZ4F_compressFrameBound(STREAM_CHUNK_SIZE, &preferences);
+		std::vector<std::vector<char>> input(threads, std::vector<char>(STREAM_CHUNK_SIZE));
+		std::vector<std::vector<char>> output(threads, std::vector<char>(bound));
+		std::vector<size_t> inputSize(threads), outputSize(threads);
+		int rc = 0;
+		bool done = false;
+		while (!done && !rc) {
+			int count = 0;
+			while (count < threads) {
+				if ((rc = readFully(pipeRead, input[count].data(), STREAM_CHUNK_SIZE, &inputSize[count])))
+					break;
+				size_t bytesRead = inputSize[count];
+				if (bytesRead > 0)
+					count++;
+				if (bytesRead < STREAM_CHUNK_SIZE) {
+					done = true;
+					break;
+				}
+			}
+			if (rc)
+				break;
+			auto compressChunk = [&](int i) {
+				LZ4F_preferences_t chunkPreferences = preferences;
+				chunkPreferences.frameInfo.contentSize = inputSize[i];
+				outputSize[i] = LZ4F_compressFrame(output[i].data(), bound, input[i].data(), inputSize[i], &chunkPreferences);
+			};
+			std::vector<std::thread> compressors;
+			for (int i = 1; i < count; i++)
+				compressors.emplace_back(compressChunk, i);
+			if (count > 0)
+				compressChunk(0);
+			for (auto& compressor : compressors)
+				compressor.join();
+			for (int i = 0; i < count && !rc; i++) {
+				if (LZ4F_isError(outputSize[i])) {
+					closeAndJoin(pipeRead, copier);
+					return SetError(LZ4F_getErrorName(outputSize[i]));
+				}
+				rc = writeFully(fd, output[i].data(), outputSize[i]);
+				size += inputSize[i];
+				compressedSize += outputSize[i];
+			}
+		}
+		// closing the read end fails any pending write by the copy thread if we stopped early
+		closeAndJoin(pipeRead, copier);
+		if (copyRc)
+			rc = copyRc;
+		if (rc)
+			SetError(mdb_strerror(rc));
+	}
+	void OnOK() {
+		Object result = Object::New(Env());
+		result.Set("size", Number::New(Env(), (double) size));
+		result.Set("compressedSize", Number::New(Env(), (double) compressedSize));
+		Callback().Call({ Env().Null(), result });
+	}
+
+  private:
+	void closeAndJoin(int pipeRead, std::thread& copier) {
+#ifdef _WIN32
+		_close(pipeRead);
+#else
+		close(pipeRead);
+#endif
+		copier.join();
+	}
+	MDB_env* env;
+	int fd;
+	int flags;
+	int threads;
+	int level;
+	mdb_size_t size;
+	mdb_size_t compressedSize;
+};
+
+class RestoreStreamWorker : public AsyncWorker {
+  public:
+	RestoreStreamWorker(int fd, std::string path, const Function& callback)
+	 : AsyncWorker(callback), fd(fd), path(path), size(0) {
+	 }
+
+	void Execute() {
+		FILE* file = fopen(path.c_str(), "wbx"); // never overwrite an existing database
+		if (!file)
+			return SetError(mdb_strerror(errno));
+		LZ4F_dctx* context;
+		size_t hint = LZ4F_createDecompressionContext(&context, LZ4F_VERSION);
+		if (LZ4F_isError(hint)) {
+			fclose(file);
+			return SetError(LZ4F_getErrorName(hint));
+		}
+		std::vector<char> input(0x100000);
+		std::vector<char> output(STREAM_CHUNK_SIZE);
+		const char* error = nullptr;
+		int rc = 0;
+		size_t inputSize;
+		while (!rc && !error) {
+			if ((rc = readFully(fd, input.data(), input.size(), &inputSize)) || inputSize == 0)
+				break;
+			size_t position = 0;
+			while (position < inputSize) {
+				size_t consumed = inputSize - position;
+				size_t produced = output.size();
+				hint = LZ4F_decompress(context, output.data(), &produced, input.data() + position, &consumed, nullptr);
+				if (LZ4F_isError(hint)) {
+					error = LZ4F_getErrorName(hint);
+					break;
+				}
+				position += consumed;
+				if (produced > 0) {
+					if (fwrite(output.data(), 1, produced, file) != produced) {
+						rc = errno;
+						break;
+					}
+					size += produced;
+				}
+			}
+		}
+		LZ4F_freeDecompressionContext(context);
+		if (!rc && !error && hint != 0)
+			error = "Backup stream ended in the middle of a frame";
+		if (fflush(file) && !rc)
+			rc = errno;
+		fclose(file);
+		if (error)
+			SetError(error);
+		else if (rc)
+			SetError(mdb_strerror(rc));
+	}
+	void OnOK() {
+		Callback().Call({ Env().Null(), Number::New(Env(), (double) size) });
+	}
+
+  private:
+	int fd;
+	std::string path;
+	mdb_size_t size;
+};
+
+struct WarmProgress {
+	double warmed;
+	double total;
+};
+
+class WarmUpWorker : public AsyncProgressWorker<WarmProgress> {
+  public:
+	WarmUpWorker(MDB_env* env, std::vector<MDB_dbi> dbis, mdb_size_t budget, int threads, const Function& onProgress, const Function& callback)
+	 : AsyncProgressWorker(callback), env(env), dbis(dbis), budget(budget), threads(threads), executionProgress(nullptr) {
+		if (!onProgress.IsEmpty())
+			this->onProgress = Persistent(onProgress);
+		MDB_stat stat;
+		mdb_env_stat(env, &stat);
+		pageSize = stat.ms_psize;
+		result = { 0, 0 };
+	}
+
+	static void progress(void* ctx, mdb_size_t warmed, mdb_size_t total) {
+		WarmUpWorker* worker = (WarmUpWorker*) ctx;
+		worker->result = { (double) warmed * worker->pageSize, (double) total * worker->pageSize };
+		if (!worker->onProgress.IsEmpty())
+			worker->executionProgress->Send(&worker->result, 1);
+	}
+	void Execute(const ExecutionProgress& executionProgress) {
+		MDB_txn* txn;
+		int rc = mdb_txn_begin(env, nullptr, MDB_RDONLY, &txn);
+		if (rc != 0)
+			return SetError(mdb_strerror(rc));
+		this->executionProgress = &executionProgress;
+		rc = mdb_txn_warm(txn, dbis.data(), dbis.size(), budget, threads, progress, this);
+		mdb_txn_abort(txn);
+		if (rc != 0)
+			SetError(mdb_strerror(rc));
+	}
+	void OnProgress(const WarmProgress* data, size_t count) {
+		Object progress = Object::New(Env());
+		progress.Set("warmed", Number::New(Env(), data->warmed));
+		progress.Set("total", Number::New(Env(), data->total));
+		onProgress.Call({ progress });
+	}
+	void OnOK() {
+		Object progress = Object::New(Env());
+		progress.Set("warmed", Number::New(Env(), result.warmed));
+		progress.Set("total", Number::New(Env(), result.total));
+		Callback().Call({ Env().Null(), progress });
+	}
+
+  private:
+	MDB_env* env;
+	std::vector<MDB_dbi> dbis;
+	mdb_size_t budget;
+	int threads;
+	unsigned int pageSize;
+	WarmProgress result;
+	const ExecutionProgress* executionProgress;
+	FunctionReference onProgress;
+};
+
+class ResidencyWorker : public AsyncWorker {
+  public:
+	ResidencyWorker(MDB_env* env, std::vector<MDB_dbi> dbis, unsigned int sample, const Function& callback)
+	 : AsyncWorker(callback), env(env), dbis(dbis), sample(sample), residency(dbis.size()), filePages(0), fileResident(0) {
+		MDB_stat stat;
+		mdb_env_stat(env, &stat);
+		pageSize = stat.ms_psize;
+	}
+
+	void Execute() {
+		MDB_txn* txn;
+		int rc = mdb_txn_begin(env, nullptr, MDB_RDONLY, &txn);
+		if (rc != 0)
+			return SetError(mdb_strerror(rc));
+		rc = mdb_txn_residency(txn, dbis.data(), dbis.size(), sample, residency.data(), &filePages, &fileResident);
+		mdb_txn_abort(txn);
+		if (rc != 0)
+			SetError(mdb_strerror(rc));
+	}
+	void OnOK() {
+		Object result = Object::New(Env());
+		result.Set("resident", bytes(fileResident));
+		result.Set("total", bytes(filePages));
+		Array dbResults = Array::New(Env(), residency.size());
+		for (size_t i = 0; i < residency.size(); i++) {
+			MDB_residency& res = residency[i];
+			Object dbResult = Object::New(Env());
+			dbResult.Set("branch", pages(res.mr_resident[MDB_RES_BRANCH], res.mr_pages[MDB_RES_BRANCH]));
+			dbResult.Set("leaf", pages(res.mr_resident[MDB_RES_LEAF], res.mr_pages[MDB_RES_LEAF]));
+			dbResult.Set("overflow", pages(res.mr_resident[MDB_RES_OVERFLOW], res.mr_pages[MDB_RES_OVERFLOW]));
+			int depths = MDB_RESIDENCY_DEPTHS;
+			while (depths > 0 && !res.mr_depth_pages[depths - 1])
+				depths--;
+			Array depthResults = Array::New(Env(), depths);
+			for (int depth = 0; depth < depths; depth++)
+				depthResults.Set(depth, pages(res.mr_depth_resident[depth], res.mr_depth_pages[depth]));
+			dbResult.Set("depths", depthResults);
+			dbResults.Set(i, dbResult);
+		}
+		result.Set("dbs", dbResults);
+		Callback().Call({ Env().Null(), result });
+	}
+
+  private:
+	Number bytes(mdb_size_t pages) {
+		return Number::New(Env(), (double) pages * pageSize);
+	}
+	Object pages(mdb_size_t resident, mdb_size_t total) {
+		Object result = Object::New(Env());
+		result.Set("resident", bytes(resident));
+		result.Set("total", bytes(total));
+		return result;
+	}
+	MDB_env* env;
+	std::vector<MDB_dbi> dbis;
+	unsigned int sample;
+	std::vector<MDB_residency> residency;
+	mdb_size_t filePages;
+	mdb_size_t fileResident;
+	unsigned int pageSize;
+};
+
+class PinWorker : public AsyncWorker {
+  public:
+	PinWorker(MDB_env* env, std::vector<MDB_dbi> dbis, mdb_size_t budget, unsigned int flags, int interval, const Function& callback)
+	 : AsyncWorker(callback), env(env), dbis(dbis), budget(budget), flags(flags), interval(interval) {
+	 }
+
+	void Execute() {
+		ExtendedEnv* extendedEnv = (ExtendedEnv*) mdb_env_get_userctx(env);
+		int rc = extendedEnv->pin(env, dbis, budget, flags, interval);
+		{
+			// the pin thread may already be re-pinning
+			std::unique_lock<std::mutex> lock(extendedEnv->pinLock);
+			pinnedBytes = extendedEnv->pinnedBytes;
+		}
+		if (rc != 0)
+			SetError(mdb_strerror(rc));
+	}
+	void OnOK() {
+		Callback().Call({ Env().Null(), Number::New(Env(), (double) pinnedBytes) });
+	}
+
+  private:
+	MDB_env* env;
+	std::vector<MDB_dbi> dbis;
+	mdb_size_t budget;
+	unsigned int flags;
+	int interval;
+	mdb_size_t pinnedBytes;
+};
+
+class VerifyWorker : public AsyncWorker {
+  public:
+	VerifyWorker(MDB_env* env, int threads, unsigned int maxCorrupt, const Function& callback)
+	 : AsyncWorker(callback), env(env), threads(threads), corrupt(maxCorrupt), pages(0), corruptCount(0) {
+	}
+
+	void Execute() {
+		MDB_txn* txn;
+		int rc = mdb_txn_begin(env, nullptr, MDB_RDONLY, &txn);
+		if (rc != 0)
+			return SetError(mdb_strerror(rc));
+		rc = mdb_txn_verify(txn, threads, &pages, corrupt.data(), corrupt.size(), &corruptCount);
+		mdb_txn_abort(txn);
+		if (rc != 0)
+			SetError(mdb_strerror(rc));
+	}
+	void OnOK() {
+		Object result = Object::New(Env());
+		result.Set("pages", Number::New(Env(), (double) pages));
+		size_t reported = corruptCount < corrupt.size() ? corruptCount : corrupt.size();
+		Array corruptPages = Array::New(Env(), reported);
+		for (size_t i = 0; i < reported; i++)
+			corruptPages.Set(i, Number::New(Env(), (double) corrupt[i]));
+		result.Set("corrupt", corruptPages);
+		result.Set("corruptCount", Number::New(Env(), corruptCount));
+		Callback().Call({ Env().Null(), result });
+	}
+
+  private:
+	MDB_env* env;
+	int threads;
+	std::vector<mdb_size_t> corrupt;
+	mdb_size_t pages;
+	unsigned int corruptCount;
 };
 
 MDB_txn* EnvWrap::getReadTxn(int64_t tw_address) {
@@ -225,6 +710,84 @@ static int encfunc(const MDB_val* src, MDB_val* dst, const MDB_val* key, int enc
 	chacha8(src->mv_data, src->mv_size, (uint8_t*) key[0].mv_data, (uint8_t*) key[1].mv_data, (char*)dst->mv_data);
 	return 0;
 }
+
+// CRC32C (Castagnoli), with the SSE4.2 or ARMv8 CRC instructions when they are available
+static uint32_t crc32cTable[256];
+static uint32_t crc32cSoftware(uint32_t crc, const uint8_t* p, size_t n) {
+	for (; n; n--)
+		crc = crc32cTable[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+#if defined(__x86_64__) || defined(_M_X64)
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CRC32C_TARGET
+#else
+#define CRC32C_TARGET __attribute__((target("sse4.2")))
+#endif
+CRC32C_TARGET static uint32_t crc32cHardware(uint32_t crc, const uint8_t* p, size_t n) {
+	uint64_t crc64 = crc, word;
+	for (; n >= 8; n -= 8, p += 8) {
+		memcpy(&word, p, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+	}
+	crc = (uint32_t) crc64;
+	for (; n; n--)
+		crc = _mm_crc32_u8(crc, *p++);
+	return crc;
+}
+static bool hasHardwareCrc32c() {
+#ifdef _MSC_VER
+	int cpuInfo[4];
+	__cpuid(cpuInfo, 1);
+	return cpuInfo[2] & (1 << 20);
+#else
+	return __builtin_cpu_supports("sse4.2");
+#endif
+}
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+static uint32_t crc32cHardware(uint32_t crc, const uint8_t* p, size_t n) {
+	uint64_t word;
+	for (; n >= 8; n -= 8, p += 8) {
+		memcpy(&word, p, 8);
+		crc = __crc32cd(crc, word);
+	}
+	for (; n; n--)
+		crc = __crc32cb(crc, *p++);
+	return crc;
+}
+static bool hasHardwareCrc32c() {
+	return true;
+}
+#else
+#define crc32cHardware crc32cSoftware
+static bool hasHardwareCrc32c() {
+	return false;
+}
+#endif
+typedef uint32_t (*crc32c_func)(uint32_t crc, const uint8_t* p, size_t n);
+static crc32c_func initCrc32c() {
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t crc = i;
+		for (int j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (crc & 1 ? 0x82f63b78 : 0);
+		crc32cTable[i] = crc;
+	}
+	return hasHardwareCrc32c() ? crc32cHardware : crc32cSoftware;
+}
+static void crc32cSum(const MDB_val* src, MDB_val* dst, const MDB_val* key)
+{
+	static crc32c_func crc32c = initCrc32c();
+	uint32_t crc = ~crc32c(~0u, (const uint8_t*) src->mv_data, src->mv_size);
+	memcpy(dst->mv_data, &crc, sizeof(crc));
+}
+static void xxhash64Sum(const MDB_val* src, MDB_val* dst, const MDB_val* key)
+{
+	uint64_t hash = XXH64(src->mv_data, src->mv_size, 0);
+	memcpy(dst->mv_data, &hash, sizeof(hash));
+}
 #endif
 
 void cleanup(void* data) {
@@ -285,6 +848,25 @@ Napi::Value EnvWrap::open(const CallbackInfo& info) {
 	if (option.IsNumber())
 		maxFreeSpaceToRetain = option.As<Number>();
 
+	#ifdef MDB_RPAGE_CACHE
+	// sizing of the chunk cache used with remapChunks/encryption, 0 keeps the default
+	unsigned int remapChunkPages = 0, remapTxnChunks = 0, remapCacheChunks = 0;
+	option = options.Get("remapChunkPages");
+	if (option.IsNumber())
+		remapChunkPages = option.As<Number>().Uint32Value();
+	option = options.Get("remapTxnChunks");
+	if (option.IsNumber())
+		remapTxnChunks = option.As<Number>().Uint32Value();
+	option = options.Get("remapCacheChunks");
+	if (option.IsNumber())
+		remapCacheChunks = option.As<Number>().Uint32Value();
+	if (remapChunkPages || remapTxnChunks || remapCacheChunks) {
+		rc = mdb_env_set_rpage_cache(env, remapChunkPages, remapTxnChunks, remapCacheChunks);
+		if (rc)
+			return throwError(info.Env(), "Invalid chunk cache options, remapChunkPages must be a power of 2 up to 16 and remapCacheChunks must be at least remapTxnChunks");
+	}
+	#endif
+
 	Napi::Value encryptionKey = options.Get("encryptionKey");
 	std::string encryptKey;
 	if (!encryptionKey.IsUndefined()) {
@@ -297,11 +879,131 @@ Napi::Value EnvWrap::open(const CallbackInfo& info) {
 		#endif
 	}
 
+	option = options.Get("checksum");
+	if (option.IsString() || (option.IsBoolean() && option.As<Boolean>().Value())) {
+		#ifdef MDB_RPAGE_CACHE
+		std::string checksum = option.IsString() ? option.As<String>().Utf8Value() : "crc32c";
+		// pages written through a writemap never get their checksums
+		if (flags & MDB_WRITEMAP)
+			return throwError(info.Env(), "Checksums can not be used with useWritemap");
+		if (checksum == "crc32c")
+			rc = mdb_env_set_checksum(env, crc32cSum, sizeof(uint32_t));
+		else if (checksum == "xxhash64")
+			rc = mdb_env_set_checksum(env, xxhash64Sum, sizeof(uint64_t));
+		else
+			return throwError(info.Env(), "The checksum option must be true, \"crc32c\" or \"xxhash64\"");
+		if (rc)
+			return throwLmdbError(info.Env(), rc);
+		#else
+		return throwError(info.Env(), "Checksums not supported with data format version 1");
+		#endif
+	}
+
 	napiEnv = info.Env();
 	rc = openEnv(flags, jsFlags, (const char*)pathString.c_str(), (char*) keyBuffer, compression, maxDbs, maxReaders, mapSize, pageSize, maxFreeSpaceToLoad, maxFreeSpaceToRetain, encryptKey.empty() ? nullptr : (char*)encryptKey.c_str());
 	//delete[] pathBytes;
 	if (rc != 0)
 		return throwLmdbError(info.Env(), rc);
+	option = options.Get("ioUring");
+	if (option.IsNumber() || (option.IsBoolean() && option.As<Boolean>().Value())) {
+		// if io_uring isn't available (unsupported OS or kernel, or blocked), page writes just use pwritev
+		mdb_env_set_io_uring(env, option.IsNumber() ? option.As<Number>().Uint32Value() : 256);
+	}
+	option = options.Get("earlyWriteback");
+	if (option.IsBoolean() && option.As<Boolean>().Value()) {
+		// only supported on Linux, elsewhere writeback just starts with the data sync
+		mdb_env_set_early_writeback(env, 1);
+	}
+	option = options.Get("writerSpin");
+	if (option.IsNumber()) // in microseconds
+		writerSpin = (uint64_t) (option.As<Number>().DoubleValue() * TICKS_PER_SECOND / 1000000);
+	#ifdef REDO_LOG
+	option = options.Get("redoLog");
+	ExtendedEnv* extendedEnv = (ExtendedEnv*) mdb_env_get_userctx(env);
+	if (option.IsBoolean() && option.As<Boolean>().Value() && !extendedEnv->redoLog) {
+		unsigned int envFlags;
+		mdb_env_get_flags(env, &envFlags);
+		if ((envFlags & MDB_OVERLAPPINGSYNC) && !(envFlags & MDB_RDONLY)) {
+			const char* envPath;
+			mdb_env_get_path(env, &envPath);
+			Napi::Value checkpointInterval = options.Get("redoLogCheckpointInterval");
+			RedoLog* redoLog = new RedoLog(env, std::string(envPath) + ((envFlags & MDB_NOSUBDIR) ? "-redo" : "/redo"),
+				checkpointInterval.IsNumber() ? checkpointInterval.As<Number>().Int32Value() : 5000);
+			rc = redoLog->open();
+			if (rc == 0)
+				extendedEnv->redoLog = redoLog;
+			else {
+				delete redoLog;
+				// if another process is using the log, this one just syncs its commits as usual
+				if (rc != EWOULDBLOCK)
+					return throwLmdbError(info.Env(), rc);
+			}
+		}
+	}
+	#endif
+	#ifdef MDB_OVERLAPPINGSYNC
+	option = options.Get("syncScheduler");
+	if (option.IsBoolean() && option.As<Boolean>().Value() && !((ExtendedEnv*) mdb_env_get_userctx(env))->redoLog) {
+		unsigned int envFlags;
+		mdb_env_get_flags(env, &envFlags);
+		if (envFlags & MDB_OVERLAPPINGSYNC) {
+			Napi::Value maxFlushDelay = options.Get("maxFlushDelay");
+			((ExtendedEnv*) mdb_env_get_userctx(env))->startSyncScheduler(env,
+				maxFlushDelay.IsNumber() ? maxFlushDelay.As<Number>().Int32Value() : 0);
+		}
+	}
+	option = options.Get("combineWrites");
+	if (option.IsBoolean() && option.As<Boolean>().Value()) {
+		unsigned int envFlags;
+		mdb_env_get_flags(env, &envFlags);
+		// a synchronous txn that interrupts a combined batch runs in a child txn, which isn't available with a write map
+		if (!(envFlags & (MDB_WRITEMAP | MDB_RDONLY))) {
+			// only one of a thread's handles of the env can combine its writes, since a leader waits for the others to
+			// finish writing, which could need JS on this thread that is waiting on the leader
+			bool combinedOnThread = false;
+			if (openEnvWraps) {
+				for (auto envWrap : *openEnvWraps) {
+					if (envWrap != this && envWrap->env == env && envWrap->writeCombiner)
+						combinedOnThread = true;
+				}
+			}
+			if (!combinedOnThread) {
+				ExtendedEnv* combinedEnv = (ExtendedEnv*) mdb_env_get_userctx(env);
+				pthread_mutex_lock(envTracking->envsLock);
+				if (!combinedEnv->writeCombiner)
+					combinedEnv->writeCombiner = new WriteCombiner();
+				writeCombiner = combinedEnv->writeCombiner;
+				pthread_mutex_unlock(envTracking->envsLock);
+			}
+		}
+	}
+	#endif
+	#ifdef WRITE_QUEUE
+	option = options.Get("writeQueue");
+	if (option.IsBoolean() && option.As<Boolean>().Value()) {
+		unsigned int envFlags;
+		mdb_env_get_flags(env, &envFlags);
+		if (!(envFlags & MDB_RDONLY)) {
+			// one queue (mapping of the file) is shared by the handles of the env in this process
+			ExtendedEnv* queuedEnv = (ExtendedEnv*) mdb_env_get_userctx(env);
+			pthread_mutex_lock(envTracking->envsLock);
+			if (!queuedEnv->writeQueue) {
+				const char* envPath;
+				mdb_env_get_path(env, &envPath);
+				WriteQueue* queue = new WriteQueue(env, std::string(envPath) + ((envFlags & MDB_NOSUBDIR) ? "-write-queue" : "/write-queue"));
+				rc = queue->open();
+				if (rc) {
+					delete queue;
+					pthread_mutex_unlock(envTracking->envsLock);
+					return throwLmdbError(info.Env(), rc);
+				}
+				queuedEnv->writeQueue = queue;
+			}
+			writeQueue = queuedEnv->writeQueue;
+			pthread_mutex_unlock(envTracking->envsLock);
+		}
+	}
+	#endif
 	napi_add_env_cleanup_hook(napiEnv, cleanup, this);
 	return info.Env().Undefined();
 }
@@ -353,6 +1055,8 @@ int EnvWrap::openEnv(int flags, int jsFlags, const char* path, char* keyBuffer,
 	#endif
 
 	timeTxnWaiting = 0;
+	batchInterruptions = 0;
+	interruptionCommits = 0;
 	// Set MDB_NOTLS to enable multiple read-only transactions on the same thread (in this case, the nodejs main thread)
 	flags |= MDB_NOTLS;
 	// TODO: make file attributes configurable
@@ -438,7 +1142,7 @@ NAPI_FUNCTION(getEnvsPointer) {
 	napi_create_double(env, (double) (size_t) EnvWrap::envTracking, &returnValue);
 	if (!EnvWrap::sharedBuffers) {
 		EnvWrap::sharedBuffers = new js_buffers_t;
-		EnvWrap::sharedBuffers->nextId = 0;
+		EnvWrap::sharedBuffers->nextId = 1; // buffer id 0 is used to indicate no shared buffer
 		pthread_mutex_init(&EnvWrap::sharedBuffers->modification_lock, nullptr);
 	}
 	return returnValue;
@@ -488,18 +1192,15 @@ napi_finalize cleanupExternal = [](napi_env env, void* data, void* buffer_info)
 };
 
 
-NAPI_FUNCTION(getSharedBuffer) {
-	ARGS(2)
-	int32_t bufferId;
-	GET_UINT32_ARG(bufferId, 0);
-	GET_INT64_ARG(1);
-	EnvWrap* ew = (EnvWrap*) i64;
+napi_value getSharedBufferById(napi_env env, int32_t bufferId, EnvWrap* ew) {
+	napi_value returnValue;
 	pthread_mutex_lock(&EnvWrap::sharedBuffers->modification_lock);
 	for (auto bufferRef = EnvWrap::sharedBuffers->buffers.begin(); bufferRef != EnvWrap::sharedBuffers->buffers.end(); bufferRef++) {
 		if (bufferRef->second.id == bufferId) {
 			char *start = bufferRef->first;
 			buffer_info_t *buffer = &bufferRef->second;
-			if (buffer->env == ew->env) {
+			if (buffer->env == ew->env || (buffer->isSlab && buffer->ref)) {
+				// a slab isn't tied to an env, and keeps its one ArrayBuffer (for any env)
 				//fprintf(stderr, "found existing buffer for %u\n", bufferId);
 				napi_get_reference_value(env, buffer->ref, &returnValue);
 				pthread_mutex_unlock(&EnvWrap::sharedBuffers->modification_lock);
@@ -545,7 +1246,7 @@ NAPI_FUNCTION(getSharedBuffer) {
 			} else
 #endif
 			napi_create_external_arraybuffer(env, start, size,
-				 buffer->isSharedMap ? cleanupLMDB : cleanupExternal, (void*) buffer, &returnValue);
+				 (buffer->isSharedMap || buffer->isSlab) ? cleanupLMDB : cleanupExternal, (void*) buffer, &returnValue);
 			int64_t result;
 			napi_create_reference(env, returnValue, 1, &buffer->ref);
 			if (buffer->isSharedMap) {
@@ -562,6 +1263,13 @@ NAPI_FUNCTION(getSharedBuffer) {
 	pthread_mutex_unlock(&EnvWrap::sharedBuffers->modification_lock);
 	RETURN_UNDEFINED;
 }
+NAPI_FUNCTION(getSharedBuffer) {
+	ARGS(2)
+	int32_t bufferId;
+	GET_UINT32_ARG(bufferId, 0);
+	GET_INT64_ARG(1);
+	return getSharedBufferById(env, bufferId, (EnvWrap*) i64);
+}
 NAPI_FUNCTION(setTestRef) {
 	ARGS(1)
 	napi_create_reference(env, args[0], 1, &testRef);
@@ -652,6 +1360,7 @@ int32_t EnvWrap::toSharedBuffer(MDB_env* env, uint32_t* keyBuffer,  MDB_val data
         bufferInfo.end = (char*) end;
         bufferInfo.env = nullptr;
 		bufferInfo.isSharedMap = true;
+		bufferInfo.isSlab = false;
         bufferInfo.id = sharedBuffers->nextId++;
         sharedBuffers->buffers.emplace((char*)bufferStart, bufferInfo);
 	} else {
@@ -707,10 +1416,26 @@ void EnvWrap::closeEnv(bool hasLock) {
 				unsigned int envFlags; // This is primarily useful for detecting termination of threads and sync'ing on their termination
 				mdb_env_get_flags(env, &envFlags);
 				#ifdef MDB_OVERLAPPINGSYNC
-				if ((envFlags & MDB_OVERLAPPINGSYNC) && envPath->hasWrites) {
-					mdb_env_sync(env, 1);
+				ExtendedEnv* extendedEnv = (ExtendedEnv*) mdb_env_get_userctx(env);
+				extendedEnv->stopSyncScheduler();
+				RedoLog* redoLog = extendedEnv->redoLog;
+				#ifdef REDO_LOG
+				if (redoLog)
+					redoLog->stop(); // commits sync themselves again
+				#endif
+				int syncRc = 0;
+				if ((envFlags & MDB_OVERLAPPINGSYNC) && (envPath->hasWrites || redoLog)) {
+					syncRc = mdb_env_sync(env, 1);
+				}
+				#ifdef REDO_LOG
+				if (redoLog) {
+					// once the database is synced, the log isn't needed anymore
+					redoLog->close(syncRc == 0);
+					delete redoLog;
+					extendedEnv->redoLog = nullptr;
 				}
-				delete (ExtendedEnv*) mdb_env_get_userctx(env);
+				#endif
+				delete extendedEnv;
 				#endif
 				char* path;
 				mdb_env_get_path(env, (const char**)&path);
@@ -741,6 +1466,8 @@ void EnvWrap::closeEnv(bool hasLock) {
 	}
 	if (!hasLock)
 		pthread_mutex_unlock(envTracking->envsLock);
+	writeCombiner = nullptr;
+	writeQueue = nullptr;
 	env = nullptr;
 }
 
@@ -821,6 +1548,11 @@ Napi::Value EnvWrap::info(const CallbackInfo& info) {
 		stats.Set("timePageFlushes", Number::New(info.Env(), (double) metrics->time_page_flushes / TICKS_PER_SECOND));
 		stats.Set("timeSync", Number::New(info.Env(), (double) metrics->time_sync / TICKS_PER_SECOND));
 		stats.Set("timeTxnWaiting", Number::New(info.Env(), (double) timeTxnWaiting / TICKS_PER_SECOND));
+		stats.Set("batchInterruptions", Number::New(info.Env(), batchInterruptions));
+		stats.Set("interruptionCommits", Number::New(info.Env(), interruptionCommits));
+		stats.Set("writerSpinWakeups", Number::New(info.Env(), writerSpinWakeups));
+		stats.Set("writerParks", Number::New(info.Env(), writerParks));
+		stats.Set("writerNotifies", Number::New(info.Env(), writerNotifies));
 		stats.Set("txns", Number::New(info.Env(), metrics->txns));
 		stats.Set("pageFlushes", Number::New(info.Env(), metrics->page_flushes));
 		stats.Set("pagesWritten", Number::New(info.Env(), metrics->pages_written));
@@ -828,6 +1560,75 @@ Napi::Value EnvWrap::info(const CallbackInfo& info) {
 		stats.Set("puts", Number::New(info.Env(), metrics->puts));
 		stats.Set("deletes", Number::New(info.Env(), metrics->deletes));
 	}
+	#ifdef MDB_RPAGE_CACHE
+	if (envFlags & MDB_REMAP_CHUNKS) {
+		MDB_rpage_stat rpstat;
+		mdb_env_rpage_stat(this->env, &rpstat);
+		Object chunkCache = Object::New(info.Env());
+		chunkCache.Set("chunkPages", Number::New(info.Env(), rpstat.rs_chunk));
+		chunkCache.Set("txnChunks", Number::New(info.Env(), rpstat.rs_txn_size));
+		chunkCache.Set("cacheChunks", Number::New(info.Env(), rpstat.rs_env_size));
+		chunkCache.Set("cachedChunks", Number::New(info.Env(), rpstat.rs_cached));
+		chunkCache.Set("txnHits", Number::New(info.Env(), (double) rpstat.rs_txn_hits));
+		chunkCache.Set("hits", Number::New(info.Env(), (double) rpstat.rs_env_hits));
+		chunkCache.Set("misses", Number::New(info.Env(), (double) rpstat.rs_misses));
+		chunkCache.Set("maps", Number::New(info.Env(), (double) rpstat.rs_maps));
+		chunkCache.Set("unmaps", Number::New(info.Env(), (double) rpstat.rs_unmaps));
+		chunkCache.Set("decrypts", Number::New(info.Env(), (double) rpstat.rs_decrypts));
+		chunkCache.Set("bytesDecrypted", Number::New(info.Env(), (double) rpstat.rs_decrypted_bytes));
+		stats.Set("chunkCache", chunkCache);
+	}
+	#endif
+	ExtendedEnv* extendedEnv = (ExtendedEnv*) mdb_env_get_userctx(this->env);
+	{
+		// written by the pin thread as it re-pins
+		std::unique_lock<std::mutex> lock(extendedEnv->pinLock);
+		if (extendedEnv->pinnedBytes || extendedEnv->pinError) {
+			stats.Set("pinnedBytes", Number::New(info.Env(), (double) extendedEnv->pinnedBytes));
+			if (extendedEnv->pinError)
+				stats.Set("pinError", String::New(info.Env(), mdb_strerror(extendedEnv->pinError)));
+		}
+	}
+	if (extendedEnv->hasSyncScheduler()) {
+		std::unique_lock<std::mutex> lock(extendedEnv->syncLock);
+		Object syncStats = Object::New(info.Env());
+		syncStats.Set("syncs", Number::New(info.Env(), (double) extendedEnv->syncs));
+		syncStats.Set("syncedCommits", Number::New(info.Env(), (double) extendedEnv->syncedCommits));
+		syncStats.Set("averageSyncTime", Number::New(info.Env(), extendedEnv->averageSyncTime));
+		syncStats.Set("syncedTxnId", Number::New(info.Env(), (double) extendedEnv->syncedTxnId));
+		stats.Set("syncScheduler", syncStats);
+	}
+	if (writeCombiner) {
+		Object combinerStats = Object::New(info.Env());
+		combinerStats.Set("txns", Number::New(info.Env(), (double) writeCombiner->txns));
+		combinerStats.Set("batches", Number::New(info.Env(), (double) writeCombiner->batches));
+		stats.Set("writeCombiner", combinerStats);
+	}
+	#ifdef WRITE_QUEUE
+	if (writeQueue) {
+		Object queueStats = Object::New(info.Env());
+		queueStats.Set("batches", Number::New(info.Env(), (double) writeQueue->batches));
+		queueStats.Set("drains", Number::New(info.Env(), (double) writeQueue->drains));
+		queueStats.Set("drainedBatches", Number::New(info.Env(), (double) writeQueue->drainedBatches));
+		queueStats.Set("bypassed", Number::New(info.Env(), (double) writeQueue->bypassed));
+		stats.Set("writeQueue", queueStats);
+	}
+	#endif
+	#ifdef REDO_LOG
+	if (extendedEnv->redoLog) {
+		RedoLog* redoLog = extendedEnv->redoLog;
+		std::unique_lock<std::mutex> lock(redoLog->logLock);
+		Object redoStats = Object::New(info.Env());
+		redoStats.Set("records", Number::New(info.Env(), (double) redoLog->records));
+		redoStats.Set("bytes", Number::New(info.Env(), (double) redoLog->bytes));
+		redoStats.Set("syncs", Number::New(info.Env(), (double) redoLog->syncs));
+		redoStats.Set("checkpoints", Number::New(info.Env(), (double) redoLog->checkpoints));
+		redoStats.Set("replayed", Number::New(info.Env(), (double) redoLog->replayed));
+		if (redoLog->checkpointError)
+			redoStats.Set("checkpointError", String::New(info.Env(), mdb_strerror(redoLog->checkpointError)));
+		stats.Set("redoLog", redoStats);
+	}
+	#endif
 	#endif
 	return stats;
 }
@@ -874,24 +1675,173 @@ Napi::Value EnvWrap::copy(const CallbackInfo& info) {
 
 	// Check that the correct number/type of arguments was given.
 	if (!info[0].IsString()) {
-		return throwError(info.Env(), "Call env.copy(path, compact?, callback) with a file path.");
+		return throwError(info.Env(), "Call env.copy(path, compact?, threads?, callback) with a file path.");
 	}
 	if (!info[info.Length() - 1].IsFunction()) {
-		return throwError(info.Env(), "Call env.copy(path, compact?, callback) with a file path.");
+		return throwError(info.Env(), "Call env.copy(path, compact?, threads?, callback) with a file path.");
 	}
 
 	int flags = 0;
 	if (info.Length() > 1 && info[1].IsBoolean() && info[1].ToBoolean()) {
 		flags = MDB_CP_COMPACT;
 	}
+	int threads = 1;
+	if (info.Length() > 3 && info[2].IsNumber()) {
+		threads = info[2].As<Number>();
+	}
 
 	CopyWorker* worker = new CopyWorker(
-		this->env, info[0].As<String>().Utf8Value(), flags, info[info.Length()	> 2 ? 2 : 1].As<Function>()
+		this->env, info[0].As<String>().Utf8Value(), flags, threads, info[info.Length() - 1].As<Function>()
+	);
+	worker->Queue();
+	return info.Env().Undefined();
+}
+
+Napi::Value EnvWrap::copyIncremental(const CallbackInfo& info) {
+	if (!this->env) {
+		return throwError(info.Env(), "The environment is already closed.");
+	}
+	if (!info[0].IsString() || !info[2].IsFunction()) {
+		return throwError(info.Env(), "Call env.copyIncremental(path, sinceTxnId, callback) with a file path.");
+	}
+	IncrementalCopyWorker* worker = new IncrementalCopyWorker(
+		this->env, info[0].As<String>().Utf8Value(), (mdb_size_t) info[1].As<Number>().Int64Value(), info[2].As<Function>()
+	);
+	worker->Queue();
+	return info.Env().Undefined();
+}
+
+Napi::Value EnvWrap::copyStream(const CallbackInfo& info) {
+	if (!this->env) {
+		return throwError(info.Env(), "The environment is already closed.");
+	}
+	if (!info[0].IsNumber() || !info[info.Length() - 1].IsFunction()) {
+		return throwError(info.Env(), "Call env.copyStream(fd, compact?, threads?, level?, callback) with a file descriptor.");
+	}
+	int flags = 0;
+	if (info.Length() > 2 && info[1].IsBoolean() && info[1].ToBoolean()) {
+		flags = MDB_CP_COMPACT;
+	}
+	int threads = 1;
+	if (info.Length() > 3 && info[2].IsNumber()) {
+		threads = info[2].As<Number>();
+		if (threads < 1)
+			threads = 1;
+		if (threads > STREAM_MAX_THREADS)
+			threads = STREAM_MAX_THREADS;
+	}
+	int level = 0;
+	if (info.Length() > 4 && info[3].IsNumber()) {
+		level = info[3].As<Number>();
+	}
+	CopyStreamWorker* worker = new CopyStreamWorker(
+		this->env, info[0].As<Number>(), flags, threads, level, info[info.Length() - 1].As<Function>()
+	);
+	worker->Queue();
+	return info.Env().Undefined();
+}
+
+Napi::Value EnvWrap::warmUp(const CallbackInfo& info) {
+	if (!this->env) {
+		return throwError(info.Env(), "The environment is already closed.");
+	}
+	if (!info[0].IsArray() || !info[4].IsFunction()) {
+		return throwError(info.Env(), "Call env.warmUp(dbis, budget, threads, onProgress, callback) with an array of dbis.");
+	}
+	Array dbiArray = info[0].As<Array>();
+	std::vector<MDB_dbi> dbis;
+	for (uint32_t i = 0; i < dbiArray.Length(); i++) {
+		dbis.push_back(dbiArray.Get(i).As<Number>().Uint32Value());
+	}
+	mdb_size_t budget = info[1].IsNumber() ? (mdb_size_t) info[1].As<Number>().Int64Value() : 0;
+	int threads = info[2].IsNumber() ? info[2].As<Number>().Int32Value() : 1;
+	WarmUpWorker* worker = new WarmUpWorker(
+		this->env, dbis, budget, threads, info[3].IsFunction() ? info[3].As<Function>() : Function(), info[4].As<Function>()
 	);
 	worker->Queue();
 	return info.Env().Undefined();
 }
 
+Napi::Value EnvWrap::residency(const CallbackInfo& info) {
+	if (!this->env) {
+		return throwError(info.Env(), "The environment is already closed.");
+	}
+	if (!info[0].IsArray() || !info[2].IsFunction()) {
+		return throwError(info.Env(), "Call env.residency(dbis, sample, callback) with an array of dbis.");
+	}
+	Array dbiArray = info[0].As<Array>();
+	std::vector<MDB_dbi> dbis;
+	for (uint32_t i = 0; i < dbiArray.Length(); i++) {
+		dbis.push_back(dbiArray.Get(i).As<Number>().Uint32Value());
+	}
+	unsigned int sample = info[1].IsNumber() ? info[1].As<Number>().Uint32Value() : 0;
+	ResidencyWorker* worker = new ResidencyWorker(this->env, dbis, sample, info[2].As<Function>());
+	worker->Queue();
+	return info.Env().Undefined();
+}
+
+Napi::Value EnvWrap::pin(const CallbackInfo& info) {
+	if (!this->env) {
+		return throwError(info.Env(), "The environment is already closed.");
+	}
+	if (!info[0].IsArray() || !info[4].IsFunction()) {
+		return throwError(info.Env(), "Call env.pin(dbis, budget, leaves, interval, callback) with an array of dbis.");
+	}
+	Array dbiArray = info[0].As<Array>();
+	std::vector<MDB_dbi> dbis;
+	for (uint32_t i = 0; i < dbiArray.Length(); i++) {
+		dbis.push_back(dbiArray.Get(i).As<Number>().Uint32Value());
+	}
+	mdb_size_t budget = info[1].IsNumber() ? (mdb_size_t) info[1].As<Number>().Int64Value() : 0;
+	unsigned int flags = info[2].ToBoolean() ? MDB_PIN_LEAVES : 0;
+	int interval = info[3].IsNumber() ? info[3].As<Number>().Int32Value() : 0;
+	PinWorker* worker = new PinWorker(this->env, dbis, budget, flags, interval, info[4].As<Function>());
+	worker->Queue();
+	return info.Env().Undefined();
+}
+
+Napi::Value EnvWrap::verify(const CallbackInfo& info) {
+	if (!this->env) {
+		return throwError(info.Env(), "The environment is already closed.");
+	}
+	if (!info[2].IsFunction()) {
+		return throwError(info.Env(), "Call env.verify(threads, maxCorrupt, callback) with a callback.");
+	}
+	int threads = info[0].IsNumber() ? info[0].As<Number>().Int32Value() : 1;
+	unsigned int maxCorrupt = info[1].IsNumber() ? info[1].As<Number>().Uint32Value() : 1000;
+	VerifyWorker* worker = new VerifyWorker(this->env, threads, maxCorrupt, info[2].As<Function>());
+	worker->Queue();
+	return info.Env().Undefined();
+}
+
+Napi::Value EnvWrap::unpin(const CallbackInfo& info) {
+	if (!this->env) {
+		return throwError(info.Env(), "The environment is already closed.");
+	}
+	((ExtendedEnv*) mdb_env_get_userctx(this->env))->unpin(this->env);
+	return info.Env().Undefined();
+}
+
+NAPI_FUNCTION(restoreStream) {
+	ARGS(3)
+	int fd;
+	GET_INT32_ARG(fd, 0);
+	RestoreStreamWorker* worker = new RestoreStreamWorker(
+		fd, String(env, args[1]).Utf8Value(), Function(env, args[2])
+	);
+	worker->Queue();
+	RETURN_UNDEFINED;
+}
+
+NAPI_FUNCTION(restoreIncremental) {
+	ARGS(3)
+	RestoreIncrementalWorker* worker = new RestoreIncrementalWorker(
+		String(env, args[0]).Utf8Value(), String(env, args[1]).Utf8Value(), Function(env, args[2])
+	);
+	worker->Queue();
+	RETURN_UNDEFINED;
+}
+
 Napi::Value EnvWrap::beginTxn(const CallbackInfo& info) {
 	int flags = info[0].As<Number>();
 	if (!(flags & MDB_RDONLY)) {
@@ -917,7 +1867,12 @@ Napi::Value EnvWrap::beginTxn(const CallbackInfo& info) {
 				else {
 					// child txn
 					mdb_txn_begin(env, txn, flags & 0xf0000, &txn);
-					TxnTracked* childTxn = new TxnTracked(txn, flags);
+					#ifdef REDO_LOG
+					RedoLog* redoLog = ((ExtendedEnv*) mdb_env_get_userctx(env))->redoLog;
+					if (redoLog)
+						redoLog->beginChild();
+					#endif
+					TxnTracked* childTxn = new TxnTracked(txn, flags | TXN_CHILD);
 					childTxn->parent = this->writeTxn;
 					this->writeTxn = childTxn;
 					return info.Env().Undefined();
@@ -943,15 +1898,41 @@ Napi::Value EnvWrap::commitTxn(const CallbackInfo& info) {
 	//fprintf(stderr, "commitTxn %p\n", currentTxn);
 	int rc = 0;
 	if (currentTxn->flags & TXN_ABORTABLE) {
+		#ifdef REDO_LOG
+		RedoLog* redoLog = ((ExtendedEnv*) mdb_env_get_userctx(env))->redoLog;
+		mdb_size_t txnId = mdb_txn_id(currentTxn->txn);
+		std::string redoOps;
+		if (redoLog && !(currentTxn->flags & TXN_CHILD))
+			redoOps = redoLog->detach();
+		#endif
 		//fprintf(stderr, "txn_commit\n");
 		rc = mdb_txn_commit(currentTxn->txn);
+		#ifdef REDO_LOG
+		if (redoLog) {
+			if (currentTxn->flags & TXN_CHILD) {
+				// a child's writes become part of its parent's, unless it failed
+				if (rc)
+					redoLog->abortChild();
+				else
+					redoLog->commitChild();
+			} else if (rc == 0 && !redoOps.empty()) {
+				// this is durable once the log is synced, with env.sync()
+				int64_t position = redoLog->append(txnId, redoOps);
+				if (position < 0)
+					rc = (int) -position;
+			}
+		}
+		#endif
 	}
 	this->writeTxn = currentTxn->parent;
 	if (!this->writeTxn) {
 		//fprintf(stderr, "unlock txn\n");
-		if (this->writeWorker)
+		if (this->writeWorker) {
+			if (rc == 0 && this->writeWorker->interruptionStatus == LEND_WORKER_TXN)
+				// we ran in the batch's txn, so have the worker commit it (with the batch so far)
+				rc = this->writeWorker->CommitLentTxn(currentTxn->flags);
 			this->writeWorker->UnlockTxn();
-		else
+		} else
 			pthread_mutex_unlock(this->writingLock);
 	}
 	delete currentTxn;
@@ -969,6 +1950,15 @@ Napi::Value EnvWrap::commitTxn(const CallbackInfo& info) {
 Napi::Value EnvWrap::abortTxn(const CallbackInfo& info) {
 	TxnTracked *currentTxn = this->writeTxn;
 	if (currentTxn->flags & TXN_ABORTABLE) {
+		#ifdef REDO_LOG
+		RedoLog* redoLog = ((ExtendedEnv*) mdb_env_get_userctx(env))->redoLog;
+		if (redoLog) {
+			if (currentTxn->flags & TXN_CHILD)
+				redoLog->abortChild();
+			else
+				redoLog->abortTxn();
+		}
+		#endif
 		mdb_txn_abort(currentTxn->txn);
 	} else {
 		throwError(info.Env(), "Can not abort this transaction");
@@ -994,6 +1984,23 @@ Napi::Value EnvWrap::getWriteTxnId(const Napi::CallbackInfo& info) {
 	return Number::New(info.Env(), txn_id);
 }
 
+Napi::Value EnvWrap::compactStep(const Napi::CallbackInfo& info) {
+	TxnTracked *currentTxn = this->writeTxn;
+	if (!currentTxn)
+		return throwError(info.Env(), "There is no active write transaction.");
+	MDB_compact_stat stat;
+	int64_t maxPages = info[0].As<Number>().Int64Value();
+	int rc = mdb_txn_compact(currentTxn->txn, maxPages, &stat);
+	if (rc)
+		return throwLmdbError(info.Env(), rc);
+	Object result = Object::New(info.Env());
+	result.Set("target", Number::New(info.Env(), stat.cs_target));
+	result.Set("relocated", Number::New(info.Env(), stat.cs_relocated));
+	result.Set("remaining", Number::New(info.Env(), stat.cs_remaining));
+	result.Set("truncated", Number::New(info.Env(), stat.cs_truncated));
+	return result;
+}
+
 
 /*Napi::Value EnvWrap::openDbi(const CallbackInfo& info) {
 
@@ -1040,17 +2047,205 @@ int32_t writeFFI(double ewPointer, uint64_t instructionAddress) {
 	if (instructionAddress)
 		rc = WriteWorker::DoWrites(ew->writeTxn->txn, ew, (uint32_t*)instructionAddress, nullptr);
 	else {
-		pthread_cond_signal(ew->writingCond);
+		ew->wakeWriter();
 		rc = 0;
 	}
 	return rc;
 }
 ExtendedEnv::ExtendedEnv() {
 	pthread_mutex_init(&locksModificationLock, nullptr);
+	pinThread = nullptr;
+	pinStopping = false;
+	pinnedTxnId = 0;
+	pinnedBytes = 0;
+	pinError = 0;
+	syncThread = nullptr;
+	syncEnv = nullptr;
+	requestedTxnId = 0;
+	syncedTxnId = 0;
+	attemptedTxnId = 0;
+	syncError = 0;
+	syncStopping = false;
+	maxSyncDelay = 0;
+	averageSyncTime = 0;
+	commitsSinceSync = 0;
+	lastSyncCommits = 0;
+	syncs = 0;
+	syncedCommits = 0;
+	redoLog = nullptr;
+	writeCombiner = nullptr;
+	writeQueue = nullptr;
 }
 ExtendedEnv::~ExtendedEnv() {
+	stopPinThread();
+	stopSyncScheduler();
+	#ifdef REDO_LOG
+	delete redoLog;
+	#endif
+	delete writeCombiner;
+	#ifdef WRITE_QUEUE
+	delete writeQueue;
+	#endif
 	pthread_mutex_destroy(&locksModificationLock);
 }
+
+// (re)pin the configured databases in the latest snapshot, with the pin lock held
+int ExtendedEnv::repin(MDB_env* env) {
+	MDB_txn* txn;
+	int rc = mdb_txn_begin(env, nullptr, MDB_RDONLY, &txn);
+	if (rc == 0) {
+		pinnedTxnId = mdb_txn_id(txn);
+		rc = mdb_txn_pin(txn, pinDbis.data(), pinDbis.size(), pinBudget, pinFlags, &pinnedBytes);
+		mdb_txn_abort(txn);
+	}
+	pinError = rc;
+	return rc;
+}
+
+int ExtendedEnv::pin(MDB_env* env, std::vector<MDB_dbi> dbis, mdb_size_t budget, unsigned int flags, int interval) {
+	stopPinThread();
+	std::unique_lock<std::mutex> lock(pinLock);
+	pinDbis = dbis;
+	pinBudget = budget;
+	pinFlags = flags;
+	pinInterval = interval;
+	int rc = repin(env);
+	if (interval > 0 && (rc == 0 || rc == ENOMEM || rc == EPERM || rc == EAGAIN)) {
+		// commits copy the pages they change, so the new copies are pinned (and the old ones unpinned) when the txn id changes
+		pinStopping = false;
+		pinThread = new std::thread([this, env]() {
+			std::unique_lock<std::mutex> lock(pinLock);
+			while (!pinCondition.wait_for(lock, std::chrono::milliseconds(pinInterval), [this] { return pinStopping; })) {
+				MDB_envinfo info;
+				if (mdb_env_info(env, &info) == 0 && info.me_last_txnid != pinnedTxnId)
+					repin(env);
+			}
+		});
+	}
+	return rc;
+}
+
+void ExtendedEnv::unpin(MDB_env* env) {
+	stopPinThread();
+	std::unique_lock<std::mutex> lock(pinLock);
+	pinDbis.clear();
+	repin(env);
+}
+
+void ExtendedEnv::stopPinThread() {
+	if (!pinThread)
+		return;
+	{
+		std::unique_lock<std::mutex> lock(pinLock);
+		pinStopping = true;
+	}
+	pinCondition.notify_all();
+	pinThread->join();
+	delete pinThread;
+	pinThread = nullptr;
+}
+void ExtendedEnv::startSyncScheduler(MDB_env* env, int maxDelay) {
+	std::unique_lock<std::mutex> lock(syncLock);
+	if (syncThread)
+		return; // already started by another thread that opened this env
+	MDB_envinfo info;
+	mdb_env_info(env, &info);
+	syncEnv = env;
+	requestedTxnId = syncedTxnId = attemptedTxnId = info.me_last_txnid;
+	maxSyncDelay = maxDelay;
+	syncStopping = false;
+	syncThread = new std::thread([this]() { syncScheduler(); });
+	mdb_env_set_sync_scheduler(env, requestSync, this);
+}
+
+void ExtendedEnv::stopSyncScheduler() {
+	if (!syncThread)
+		return;
+	// commits go back to syncing themselves, and the thread syncs anything outstanding before it exits
+	mdb_env_set_sync_scheduler(syncEnv, nullptr, nullptr);
+	{
+		std::unique_lock<std::mutex> lock(syncLock);
+		syncStopping = true;
+	}
+	syncRequested.notify_all();
+	syncThread->join();
+	std::thread* thread = syncThread;
+	{
+		std::unique_lock<std::mutex> lock(syncLock);
+		syncThread = nullptr;
+		// any later commits sync themselves
+		syncedTxnId = (mdb_size_t) -1;
+	}
+	syncFinished.notify_all();
+	delete thread;
+}
+
+bool ExtendedEnv::hasSyncScheduler() {
+	return syncThread != nullptr;
+}
+
+// called by each commit (once it is visible and the write lock is released)
+void ExtendedEnv::requestSync(void* ctx, mdb_size_t txnId) {
+	ExtendedEnv* extendedEnv = (ExtendedEnv*) ctx;
+	std::unique_lock<std::mutex> lock(extendedEnv->syncLock);
+	if (txnId > extendedEnv->requestedTxnId)
+		extendedEnv->requestedTxnId = txnId;
+	extendedEnv->commitsSinceSync++;
+	extendedEnv->syncRequested.notify_one();
+}
+
+void ExtendedEnv::syncScheduler() {
+	std::unique_lock<std::mutex> lock(syncLock);
+	for (;;) {
+		syncRequested.wait(lock, [this] { return syncStopping || requestedTxnId > attemptedTxnId; });
+		if (requestedTxnId <= attemptedTxnId)
+			break; // stopping, with nothing left to sync
+		// if the last sync covered more than one commit, commits are arriving faster than syncs, so wait part of a
+		// sync for more of them to group with this one; otherwise sync right away for the lowest latency
+		if (lastSyncCommits > 1 && !syncStopping) {
+			double delay = averageSyncTime / 2;
+			if (maxSyncDelay > 0 && delay > maxSyncDelay)
+				delay = maxSyncDelay;
+			syncRequested.wait_for(lock, std::chrono::microseconds((int64_t) (delay * 1000)), [this] { return syncStopping; });
+		}
+		mdb_size_t targetTxnId = requestedTxnId;
+		unsigned int commits = commitsSinceSync;
+		commitsSinceSync = 0;
+		lock.unlock();
+		auto start = std::chrono::steady_clock::now();
+		int rc = mdb_env_sync(syncEnv, 0);
+		double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		lock.lock();
+		averageSyncTime = averageSyncTime > 0 ? averageSyncTime * 0.8 + elapsed * 0.2 : elapsed;
+		lastSyncCommits = commits;
+		attemptedTxnId = targetTxnId;
+		syncError = rc;
+		if (rc == 0) {
+			syncedTxnId = targetTxnId;
+			syncs++;
+			syncedCommits += commits;
+		}
+		syncFinished.notify_all();
+	}
+}
+
+// wait for the sync that covers the given txn, returning its error if it failed
+int ExtendedEnv::waitForSync(mdb_size_t txnId) {
+	std::unique_lock<std::mutex> lock(syncLock);
+	if (!syncThread)
+		return 0;
+	syncFinished.wait(lock, [this, txnId] { return syncedTxnId >= txnId || attemptedTxnId >= txnId; });
+	return syncedTxnId >= txnId ? 0 : syncError;
+}
+
+// request a sync of the latest commit (even if it was made by another process) and wait for it
+int ExtendedEnv::syncLatest() {
+	MDB_envinfo info;
+	mdb_env_info(syncEnv, &info);
+	requestSync(this, info.me_last_txnid);
+	return waitForSync(info.me_last_txnid);
+}
+
 uint64_t ExtendedEnv::getNextTime() {
 	uint64_t next_time_int = next_time_double();
 	if (next_time_int == lastTime) next_time_int++;
@@ -1229,6 +2424,7 @@ void EnvWrap::setupExports(Napi::Env env, Object exports) {
 		EnvWrap::InstanceMethod("commitTxn", &EnvWrap::commitTxn),
 		EnvWrap::InstanceMethod("abortTxn", &EnvWrap::abortTxn),
 		EnvWrap::InstanceMethod("getWriteTxnId", &EnvWrap::getWriteTxnId),
+		EnvWrap::InstanceMethod("compactStep", &EnvWrap::compactStep),
 		EnvWrap::InstanceMethod("sync", &EnvWrap::sync),
 		EnvWrap::InstanceMethod("resumeWriting", &EnvWrap::resumeWriting),
 		EnvWrap::InstanceMethod("startWriting", &EnvWrap::startWriting),
@@ -1238,6 +2434,13 @@ void EnvWrap::setupExports(Napi::Env env, Object exports) {
 		EnvWrap::InstanceMethod("readerCheck", &EnvWrap::readerCheck),
 		EnvWrap::InstanceMethod("readerList", &EnvWrap::readerList),
 		EnvWrap::InstanceMethod("copy", &EnvWrap::copy),
+		EnvWrap::InstanceMethod("copyIncremental", &EnvWrap::copyIncremental),
+		EnvWrap::InstanceMethod("copyStream", &EnvWrap::copyStream),
+		EnvWrap::InstanceMethod("warmUp", &EnvWrap::warmUp),
+		EnvWrap::InstanceMethod("residency", &EnvWrap::residency),
+		EnvWrap::InstanceMethod("pin", &EnvWrap::pin),
+		EnvWrap::InstanceMethod("unpin", &EnvWrap::unpin),
+		EnvWrap::InstanceMethod("verify", &EnvWrap::verify),
 		//EnvWrap::InstanceMethod("detachBuffer", &EnvWrap::detachBuffer),
 	});
 	EXPORT_NAPI_FUNCTION("compress", compress);
@@ -1253,6 +2456,8 @@ void EnvWrap::setupExports(Napi::Env env, Object exports) {
 	EXPORT_NAPI_FUNCTION("getIncrementer", getIncrementer);
 	EXPORT_NAPI_FUNCTION("attemptLock", attemptLock);
 	EXPORT_NAPI_FUNCTION("unlock", unlock);
+	EXPORT_NAPI_FUNCTION("restoreIncremental", restoreIncremental);
+	EXPORT_NAPI_FUNCTION("restoreStream", restoreStream);
 	EXPORT_FUNCTION_ADDRESS("writePtr", writeFFI);
 	//envTpl->InstanceTemplate()->SetInternalFieldCount(1);
 	exports.Set("Env", EnvClass);
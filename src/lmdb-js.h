@@ -2,6 +2,10 @@
 #define NODE_LMDB_H
 
 #include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <unordered_map>
 #include <algorithm>
 #include <ctime>
@@ -13,6 +17,7 @@
 
 #include "lmdb.h"
 #include "lz4.h"
+#include "lz4hc.h"
 #ifdef MDB_RPAGE_CACHE
 #include "chacha8.h"
 #endif
@@ -90,6 +95,12 @@ uint64_t last_time_double();
 
 int cond_init(pthread_cond_t *cond);
 int cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, uint64_t ns);
+#ifdef __linux__
+// the write thread parks on a futex, so it can be woken exactly when an instruction is published
+#define WRITER_FUTEX
+int futex_wait(std::atomic<uint32_t>* word, uint32_t expected);
+int futex_wake(std::atomic<uint32_t>* word);
+#endif
 
 // if we need to add others: https://stackoverflow.com/questions/41770887/cross-platform-definition-of-byteswap-uint64-and-byteswap-ulong/46137633#46137633
 #ifdef _WIN32
@@ -138,6 +149,8 @@ class TxnWrap;
 class DbiWrap;
 class EnvWrap;
 class CursorWrap;
+class WriteCombiner;
+class WriteQueue;
 class Compression;
 
 // Exports misc stuff to the module
@@ -159,7 +172,10 @@ napi_value lmdbError(napi_env env, napi_callback_info info);
 napi_value createBufferForAddress(napi_env env, napi_callback_info info);
 napi_value getBufferAddress(napi_env env, napi_callback_info info);
 napi_value getAddress(napi_env env, napi_callback_info info);
+napi_value getSharedBufferById(napi_env env, int32_t bufferId, EnvWrap* ew);
 napi_value detachBuffer(napi_env env, napi_callback_info info);
+napi_value lockFile(napi_env env, napi_callback_info info);
+napi_value unlockFile(napi_env env, napi_callback_info info);
 napi_value enableThreadSafeCalls(napi_env env, napi_callback_info info);
 napi_value startRead(napi_env env, napi_callback_info info);
 napi_value setReadCallback(napi_env env, napi_callback_info info);
@@ -213,6 +229,9 @@ const int WORKER_WAITING = 9997;
 const int RESTART_WORKER_TXN = 9999;
 const int RESUME_BATCH = 9996;
 const int USER_HAS_LOCK = 9995;
+const int LEND_WORKER_TXN = 9994;
+const int COMMIT_WORKER_TXN = 9993;
+const int WORKER_TXN_COMMITTED = 9992;
 const int SEPARATE_FLUSHED = 1;
 const int DELETE_ON_CLOSE = 2;
 const int OPEN_FAILED = 0x10000;
@@ -224,11 +243,17 @@ class WriteWorker {
 	MDB_txn* txn;
 	MDB_txn* AcquireTxn(int* flags);
 	void UnlockTxn();
+	int CommitLentTxn(int flags);
 	int WaitForCallbacks(MDB_txn** txn, bool allowCommit, uint32_t* target);
 	virtual void SendUpdate();
 	int interruptionStatus;
 	bool finishedProgress;
 	int resultCode;
+	int64_t redoPosition; // the end of this batch's records in the redo log
+	int lentTxnFlags; // flags of the synchronous txn that our txn was lent to
+	int lentTxnResult;
+	WriteCombiner* combiner; // set if our batch shares a txn with the batches of other threads
+	bool combinedLeader; // if we began (and commit) the shared txn
 	bool hasError;
 	napi_ref callback;
 	napi_async_work work;
@@ -240,6 +265,51 @@ class WriteWorker {
 	MDB_env* env;
 	static int DoWrites(MDB_txn* txn, EnvWrap* envForTxn, uint32_t* instruction, WriteWorker* worker);
 	static bool threadSafeCallsEnabled;
+	int BeginTxn(MDB_txn** txn);
+	int CommitPartialBatch(MDB_txn* txn);
+	// batches that are committed through a write queue
+	int QueueBatch(char* ops, uint32_t space, std::vector<uint32_t*>& operations);
+	void FinishQueuedBatch(std::vector<uint32_t*>& operations, std::string& results, int rc, mdb_size_t txnId);
+  private:
+	int RestartTxn(MDB_txn** txn);
+};
+/*
+	Combines the write batches of the threads using an env into shared txns. The first worker to write begins the txn
+	and leads it; the workers that arrive while it is writing join it, taking turns using the txn, and the leader then
+	commits all of their writes at once and notifies them of the result. This avoids handing the write lock off
+	between threads for every batch.
+*/
+class WriteCombiner {
+  public:
+	WriteCombiner();
+	int join(WriteWorker* worker, MDB_txn** txn);
+	int finishJoined(WriteWorker* worker, int rc, mdb_size_t* txnId);
+	int finishLeading(WriteWorker* worker, int rc, MDB_txn** txn, int* batchResult);
+	void complete(int rc, mdb_size_t txnId, int64_t redoPosition);
+	int commitPartial(WriteWorker* worker, MDB_txn** txn);
+	uint64_t txns;
+	uint64_t batches;
+  private:
+	int restart(WriteWorker* worker);
+	int beginBatch(WriteWorker* worker, MDB_txn** txn);
+	int endBatch(WriteWorker* worker, int rc);
+	std::mutex combinerLock;
+	std::condition_variable changed;
+	MDB_txn* txn;
+	WriteWorker* leader;
+	bool admitting; // if workers can still join the txn
+	bool turnTaken; // if a worker is using the txn
+	int waiting; // workers waiting for their turn
+	int nextWaiting; // workers waiting for the next txn to begin
+	int joined; // workers that joined and haven't finished
+	int failure; // a failure of the shared txn itself (the batches fail separately, in their own child txns)
+	bool commitRequested; // a joined worker needs the batch so far committed (for an interrupting sync txn)
+	bool commitDone;
+	int commitPartialResult;
+	uint64_t completed; // the number of shared txns that have ended
+	int commitResult;
+	mdb_size_t committedTxnId;
+	int64_t redoPosition;
 };
 class TxnTracked {
   public:
@@ -266,6 +336,7 @@ typedef struct env_tracking_t {
 typedef struct buffer_info_t { // definition of a buffer that is available/used in JS
 	int32_t id;
 	bool isSharedMap;
+	bool isSlab; // a decompression slab, owned by its thread and reused, never freed by JS
 	char* end;
 	MDB_env* env;
 	napi_ref ref;
@@ -282,6 +353,101 @@ typedef struct callback_holder_t {
 	EnvWrap* ew;
 	std::vector<napi_threadsafe_function> callbacks;
 } callback_holder_t;
+
+#if defined(MDB_OVERLAPPINGSYNC) && !defined(_WIN32)
+#define REDO_LOG 1
+#endif
+// An append-only log of the writes of each commit, in a sidecar file. With the redoLog option, commits are made durable
+// by (group) syncing this log instead of the database, and a background thread checkpoints the database (syncs it,
+// and then truncates the log) lazily. On open, the records of any commits newer than the database are replayed.
+class RedoLog {
+public:
+	RedoLog(MDB_env* env, std::string path, int checkpointInterval);
+	~RedoLog();
+	int open();
+	void stop();
+	void close(bool checkpointed);
+	// recording the writes of the current write txn (which is serialized by the write lock)
+	void logPut(MDB_txn* txn, MDB_dbi dbi, MDB_val* key, MDB_val* value);
+	void logDel(MDB_txn* txn, MDB_dbi dbi, MDB_val* key, MDB_val* value);
+	void logDrop(MDB_txn* txn, MDB_dbi dbi, int del);
+	void beginChild();
+	void commitChild();
+	void abortChild();
+	void abortTxn();
+	// taken before the txn is committed (while it still has the write lock), and appended once the commit succeeds
+	std::string detach();
+	int64_t append(mdb_size_t txnId, std::string& ops);
+	int waitForSync(int64_t position);
+	int syncAll();
+	uint64_t records;
+	uint64_t bytes;
+	uint64_t syncs;
+	uint64_t checkpoints;
+	uint64_t replayed;
+	int checkpointError;
+	std::mutex logLock;
+private:
+	void logDbi(MDB_txn* txn, uint8_t op, MDB_dbi dbi, unsigned int flags);
+	int replay();
+	int checkpoint();
+	void checkpointer();
+	static void deferSync(void* ctx, mdb_size_t txnId);
+	MDB_env* env;
+	std::string path;
+	int fds[2];
+	int64_t fileSizes[2];
+	int current; // the file that is appended to
+	std::string pending;
+	std::vector<size_t> childMarks;
+	int64_t writtenPosition; // position (in bytes appended, across files) of the end of the log
+	int64_t syncedPosition;
+	int64_t attemptedPosition;
+	int syncError;
+	bool syncing;
+	std::condition_variable syncFinished;
+	std::thread* checkpointThread;
+	std::condition_variable checkpointCondition;
+	int checkpointInterval; // in milliseconds
+	bool stopping;
+	mdb_size_t deferredTxnId; // the latest commit that left syncing the database to the checkpointer
+	mdb_size_t checkpointedTxnId; // the latest commit covered by a checkpoint
+};
+#if defined(MDB_OVERLAPPINGSYNC) && defined(__linux__)
+#define WRITE_QUEUE 1
+#endif
+const int WRITE_QUEUE_BYPASS = -1; // the batch can't be queued, and is written as usual
+// ops of the batches in a write queue (see write-queue.cpp)
+const uint8_t QUEUED_PUT = 1;
+const uint8_t QUEUED_DEL = 2;
+const uint8_t QUEUED_DEL_VALUE = 3;
+/*
+	A queue of write batches in shared memory (a file next to the database), for the processes that use an env. A
+	process enqueues each of its batches of plain puts and deletes, and then either takes the writer role, committing
+	the queued batches of every process together in one txn, or waits (on a shared futex) for the process that has
+	the role to commit it. Writing is handed off between processes once per group of batches, instead of each batch
+	contending for the write lock.
+*/
+class WriteQueue {
+public:
+	WriteQueue(MDB_env* env, std::string path);
+	~WriteQueue();
+	int open();
+	// commits the worker's batch through the queue, or returns WRITE_QUEUE_BYPASS (before doing anything)
+	int write(WriteWorker* worker);
+	std::atomic<uint64_t> batches; // batches this process queued
+	std::atomic<uint64_t> drains; // txns this process committed for the queue
+	std::atomic<uint64_t> drainedBatches; // batches (of any process) committed in them
+	std::atomic<uint64_t> bypassed;
+private:
+	int drain(WriteWorker* worker);
+	void notify();
+	MDB_env* env;
+	std::string path;
+	int fd;
+	char* map;
+	size_t mapSize;
+};
 class ExtendedEnv {
 public:
 	ExtendedEnv();
@@ -301,6 +467,51 @@ public:
 	static MDB_txn* getPrefetchReadTxn(MDB_env* env);
 	static void donePrefetchReadTxn(MDB_txn* txn);
 	static void removeReadTxns(MDB_env* env);
+	// pinning the top pages of databases in memory, which a background thread re-pins after commits
+	int pin(MDB_env* env, std::vector<MDB_dbi> dbis, mdb_size_t budget, unsigned int flags, int interval);
+	void unpin(MDB_env* env);
+	std::thread* pinThread;
+	std::mutex pinLock;
+	std::condition_variable pinCondition;
+	std::vector<MDB_dbi> pinDbis;
+	mdb_size_t pinBudget;
+	unsigned int pinFlags;
+	int pinInterval;
+	bool pinStopping;
+	mdb_size_t pinnedTxnId;
+	mdb_size_t pinnedBytes;
+	int pinError;
+	// group commit with overlappingSync: a background thread syncs all the commits made since its last sync, and
+	// then wakes up everything waiting for them
+	void startSyncScheduler(MDB_env* env, int maxDelay);
+	void stopSyncScheduler();
+	int waitForSync(mdb_size_t txnId);
+	int syncLatest();
+	bool hasSyncScheduler();
+	std::thread* syncThread;
+	std::mutex syncLock;
+	std::condition_variable syncRequested;
+	std::condition_variable syncFinished;
+	MDB_env* syncEnv;
+	mdb_size_t requestedTxnId;
+	mdb_size_t syncedTxnId;
+	mdb_size_t attemptedTxnId;
+	int syncError;
+	bool syncStopping;
+	int maxSyncDelay; // in milliseconds
+	double averageSyncTime; // in milliseconds
+	unsigned int commitsSinceSync;
+	unsigned int lastSyncCommits;
+	uint64_t syncs;
+	uint64_t syncedCommits;
+	RedoLog* redoLog;
+	WriteCombiner* writeCombiner;
+	WriteQueue* writeQueue;
+private:
+	int repin(MDB_env* env);
+	void stopPinThread();
+	static void requestSync(void* ctx, mdb_size_t txnId);
+	void syncScheduler();
 };
 
 class EnvWrap : public ObjectWrap<EnvWrap> {
@@ -342,6 +553,17 @@ public:
 	bool readTxnRenewed;
     bool hasWrites;
 	uint64_t timeTxnWaiting;
+	uint64_t batchInterruptions; // synchronous txns that interrupted a batch
+	uint64_t interruptionCommits; // commits of partial batches made for them
+	std::atomic<uint32_t> writerWakeups; // counts the events the write thread may be waiting for
+	std::atomic<bool> writerParked;
+	uint64_t writerSpin; // how long the write thread spins for the next instruction before parking, in ticks
+	uint64_t writerSpinWakeups; // waits that ended while spinning
+	uint64_t writerParks;
+	uint64_t writerNotifies; // wakeups of a parked write thread
+	void wakeWriter();
+	WriteCombiner* writeCombiner; // if this env's batches are combined with those of other threads
+	WriteQueue* writeQueue; // if this env's batches are queued for the process with the writer role
 	unsigned int jsFlags;
 	char* keyBuffer;
 	int pageSize;
@@ -397,16 +619,100 @@ public:
 
 	/*
 		Copies the database environment to a file.
-		(Wrapper for `mdb_env_copy2`)
+		(Wrapper for `mdb_env_copy3`)
 
 		Parameters:
 
 		* path - Path to the target file
 		* compact (optional) - Copy using compact setting
+		* threads (optional) - Number of threads for a compacting copy
 		* callback - Callback when finished (this is performed asynchronously)
 	*/
 	Napi::Value copy(const CallbackInfo& info);	
 
+	/*
+		Writes an incremental backup with the pages changed since a txn id.
+		(Wrapper for `mdb_env_copy_incr`)
+
+		Parameters:
+
+		* path - Path to the target file
+		* since - Txn id of the previous backup (0 for a full backup)
+		* callback - Callback with the txn id of the backup when finished
+	*/
+	Napi::Value copyIncremental(const CallbackInfo& info);
+
+	/*
+		Streams an lz4 frame compressed copy of the environment to a file descriptor (a file, pipe or socket).
+		(Uses `mdb_env_copyfd3` for the copy)
+
+		Parameters:
+
+		* fd - File descriptor to write to
+		* compact - If true, compacts the copy
+		* threads - Number of threads for the compacting copy and compression
+		* level - lz4 compression level (values above 2 use lz4hc)
+		* callback - Callback with the uncompressed and compressed sizes when finished
+	*/
+	Napi::Value copyStream(const CallbackInfo& info);
+
+	/*
+		Prefaults the branch and then leaf pages of databases into the page cache.
+		(Wrapper for `mdb_txn_warm`)
+
+		Parameters:
+
+		* dbis - Array of dbis to warm up, in order of priority
+		* budget - Maximum number of bytes to prefault (0 for no limit)
+		* threads - Number of threads to prefault with
+		* onProgress - Optional callback with the bytes warmed so far and the total
+		* callback - Callback with the final progress when finished
+	*/
+	Napi::Value warmUp(const CallbackInfo& info);
+
+	/*
+		Reports how much of databases (and the file) is resident in the page cache, by page type and depth.
+		(Wrapper for `mdb_txn_residency`)
+
+		Parameters:
+
+		* dbis - Array of dbis to report on
+		* sample - Only walk one in this many leaf pages (0 for all of them)
+		* callback - Callback with the report when finished
+	*/
+	Napi::Value residency(const CallbackInfo& info);
+
+	/*
+		Locks the branch (and optionally leaf) pages of databases in memory, re-pinning them after commits.
+		(Wrapper for `mdb_txn_pin`)
+
+		Parameters:
+
+		* dbis - Array of dbis to pin, in order of priority
+		* budget - Maximum number of bytes to lock (0 for no limit)
+		* leaves - If true, leaf pages are locked too (after the branch pages)
+		* interval - How often (in milliseconds) to check for commits to re-pin after (0 to not re-pin)
+		* callback - Callback with the number of bytes that were locked
+	*/
+	Napi::Value pin(const CallbackInfo& info);
+
+	/*
+		Stops re-pinning and unlocks the pinned pages.
+	*/
+	Napi::Value unpin(const CallbackInfo& info);
+
+	/*
+		Checks every reachable page (and its checksum, with the checksum option) from several threads.
+		(Wrapper for `mdb_txn_verify`)
+
+		Parameters:
+
+		* threads - Number of threads to check subtrees with
+		* maxCorrupt - Maximum number of corrupt page numbers to report
+		* callback - Callback with the number of pages checked and the corrupt page numbers
+	*/
+	Napi::Value verify(const CallbackInfo& info);
+
 	/*
 		Closes the database environment.
 		(Wrapper for `mdb_env_close`)
@@ -429,6 +735,15 @@ public:
 	Napi::Value commitTxn(const CallbackInfo& info);
 	Napi::Value abortTxn(const CallbackInfo& info);
 	Napi::Value getWriteTxnId(const CallbackInfo& info);
+	/*
+		Runs a step of online compaction in the current write transaction
+		(Wrapper for `mdb_txn_compact`)
+
+		Parameters:
+
+		* The maximum number of pages to relocate
+	*/
+	Napi::Value compactStep(const CallbackInfo& info);
 
 	/*
 		Flushes all data to the disk asynchronously.
@@ -458,6 +773,7 @@ public:
 const int TXN_ABORTABLE = 1;
 const int TXN_SYNCHRONOUS_COMMIT = 2;
 const int TXN_FROM_WORKER = 4;
+const int TXN_CHILD = 8;
 
 /*
 	`Txn`
@@ -580,24 +896,75 @@ public:
 	static void setupExports(Napi::Env env, Object exports);
 };
 
+// large decompressed values go into per-thread slabs, tiered by power-of-two size class starting at this size
+const size_t DECOMPRESS_SLAB_MIN_SIZE = 0x10000;
+const int DECOMPRESS_SLAB_TIERS = 17;
+typedef struct decompress_slab_t {
+	char* data;
+	size_t size;
+	int32_t id; // shared buffer id, so JS can access the slab directly
+	js_buffers_t* buffers; // the shared buffers it is registered in
+} decompress_slab_t;
+
+// dictionary ids are recorded in a single byte of the compression header
+const int MAX_DICTIONARIES = 256;
+typedef struct compression_dictionary_t {
+	char* data; // our own copy, since the dictionary stream references it in place
+	unsigned int size;
+	LZ4_stream_t* stream; // dictionary loaded once, and then attached to the working stream for each compression
+	LZ4_streamHC_t* streamHC; // same for LZ4-HC, only loaded if a compression level is used
+} compression_dictionary_t;
+
+// compression statistics are tracked by power of two size classes
+const int COMPRESSION_SIZE_BUCKETS = 32;
+// when a size class isn't compressing well, only one in this many of its values is compressed (to keep its ratio current)
+const uint32_t ADAPTIVE_SAMPLE_INTERVAL = 16;
+typedef struct compression_bucket_t {
+	std::atomic<uint32_t> ratio; // running ratio of stored size to original size, in 16.16 fixed point
+	std::atomic<uint32_t> count;
+} compression_bucket_t;
+
 class Compression : public ObjectWrap<Compression> {
 public:
-	char* dictionary; // dictionary to use to decompress
-	char* compressDictionary; // separate dictionary to use to compress since the decompression dictionary can move around in the main thread
+	char* dictionary; // dictionary to use to decompress (id 0), this can be moved by JS to precede the decompress target
 	unsigned int dictionarySize;
+	compression_dictionary_t* dictionaries; // table of dictionaries by id, new values are compressed with the newest
+	std::atomic<int> dictionaryCount;
 	char* decompressTarget;
 	unsigned int decompressSize;
 	unsigned int compressionThreshold;
 	unsigned int startingOffset; // compression can be configured to start compression at a certain offset, so header bytes are left uncompressed.
 	// compression acceleration (defaults to 1)
 	int acceleration;
+	// LZ4-HC compression level, 0 uses standard (fast) LZ4 compression
+	int level;
+	// values are stored uncompressed if their ratio of compressed size to original size is above this (16.16 fixed point)
+	uint32_t maxRatio;
+	compression_bucket_t* buckets;
+	std::atomic<uint64_t> bytesIn;
+	std::atomic<uint64_t> bytesOut;
+	std::atomic<uint64_t> compressedCount;
+	std::atomic<uint64_t> skippedCount;
+	std::atomic<uint64_t> compressionTime;
 	static thread_local LZ4_stream_t* stream;
+	static thread_local LZ4_streamHC_t* streamHC;
+	static thread_local decompress_slab_t slabs[DECOMPRESS_SLAB_TIERS];
+	static char* getSlab(size_t size, size_t* slabSize);
+	static void freeSlabs(void* slabs);
+	static int32_t getSlabId(void* data);
+	static int32_t slabToSharedBuffer(uint32_t* keyBuffer, MDB_val data);
+	static napi_value slabView(napi_env env, MDB_val data, EnvWrap* ew);
+	int readHeader(unsigned char* charData, uint32_t* uncompressedLength, char** decompressDictionary, unsigned int* decompressDictionarySize);
 	void decompress(MDB_val& data, bool &isValid, bool canAllocate);
 	argtokey_callback_t compress(MDB_val* value, argtokey_callback_t freeValue);
 	int compressInstruction(EnvWrap* env, double* compressionAddress);
+	int addDictionary(char* data, size_t size);
 	Napi::Value ctor(const CallbackInfo& info);
 	Napi::Value setBuffer(const CallbackInfo& info);
+	Napi::Value addDictionary(const CallbackInfo& info);
+	Napi::Value getStats(const CallbackInfo& info);
 	Compression(const CallbackInfo& info);
+	~Compression();
 	friend class EnvWrap;
 	friend class DbiWrap;
 	//NAN_METHOD(Compression::startCompressing);
@@ -4,6 +4,16 @@
 #include <stdio.h>
 #include <node_version.h>
 #include <time.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#endif
 
 using namespace Napi;
 
@@ -31,6 +41,8 @@ void setupExportMisc(Napi::Env env, Object exports) {
 	EXPORT_NAPI_FUNCTION("getAddress", getAddress);
 	EXPORT_NAPI_FUNCTION("getBufferAddress", getBufferAddress);
 	EXPORT_NAPI_FUNCTION("detachBuffer", detachBuffer);
+	EXPORT_NAPI_FUNCTION("lockFile", lockFile);
+	EXPORT_NAPI_FUNCTION("unlockFile", unlockFile);
 	EXPORT_NAPI_FUNCTION("startRead", startRead);
 	EXPORT_NAPI_FUNCTION("setReadCallback", setReadCallback);
 	EXPORT_NAPI_FUNCTION("enableThreadSafeCalls", enableThreadSafeCalls);
@@ -120,7 +132,10 @@ int getVersionAndUncompress(MDB_val &data, DbiWrap* dw) {
 		bool isValid;
 
 		dw->compression->decompress(data, isValid, !dw->getFast);
-		return isValid ? 2 : 0;
+		if (!isValid)
+			return 0;
+		return data.mv_data == dw->compression->decompressTarget ? 2 : 3; // 3 if it was decompressed into a slab
+
 	}
 	return 1;
 }
@@ -181,6 +196,58 @@ NAPI_FUNCTION(detachBuffer) {
 	RETURN_UNDEFINED;
 }
 
+// opens (creating) the file and locks it, either exclusively, failing with undefined if anyone else holds a lock on
+// it, or shared, waiting for an exclusive holder. Returns the handle to unlock it with, or a negative error code.
+// The lock is on the open file, so it is also released if the process exits.
+NAPI_FUNCTION(lockFile) {
+	ARGS(2)
+	size_t length;
+	napi_get_value_string_utf8(env, args[0], nullptr, 0, &length);
+	std::string path(length, 0);
+	napi_get_value_string_utf8(env, args[0], &path[0], length + 1, &length);
+	bool exclusive = false;
+	napi_get_value_bool(env, args[1], &exclusive);
+#ifdef _WIN32
+	HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (handle == INVALID_HANDLE_VALUE)
+		RETURN_INT32(-(int32_t) GetLastError());
+	OVERLAPPED overlapped = {};
+	if (!LockFileEx(handle, exclusive ? LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY : 0, 0, 1, 0, &overlapped)) {
+		DWORD error = GetLastError();
+		CloseHandle(handle);
+		if (error == ERROR_LOCK_VIOLATION)
+			RETURN_UNDEFINED;
+		RETURN_INT32(-(int32_t) error);
+	}
+	napi_create_double(env, (double) (size_t) handle, &returnValue);
+	return returnValue;
+#else
+	int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0664);
+	if (fd < 0)
+		RETURN_INT32(-errno);
+	if (flock(fd, exclusive ? LOCK_EX | LOCK_NB : LOCK_SH)) {
+		int error = errno;
+		close(fd);
+		if (error == EWOULDBLOCK)
+			RETURN_UNDEFINED;
+		RETURN_INT32(-error);
+	}
+	RETURN_INT32(fd);
+#endif
+}
+
+NAPI_FUNCTION(unlockFile) {
+	ARGS(1)
+	GET_INT64_ARG(0);
+#ifdef _WIN32
+	CloseHandle((HANDLE) i64);
+#else
+	close((int) i64);
+#endif
+	RETURN_UNDEFINED;
+}
+
 class ReadWorker : public AsyncWorker {
   public:
 	ReadWorker(uint32_t* start, const Function& callback)
@@ -334,6 +401,7 @@ void do_read(napi_env nenv, void* instruction_pointer) {
 			buffer_info.end = read_buffer->data + size;
 			buffer_info.env = nullptr;
 			buffer_info.isSharedMap = false;
+			buffer_info.isSlab = false;
 			pthread_mutex_lock(&readInstruction->buffers->modification_lock);
 			buffer_info.id = read_buffer->id = readInstruction->buffers->nextId++;
 			readInstruction->buffers->buffers.emplace(read_buffer->data, buffer_info);
@@ -585,6 +653,15 @@ int cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, uint64_t cms)
 	return pthread_cond_timedwait(cond, mutex, &ts);
 }
 
+#ifdef WRITER_FUTEX
+int futex_wait(std::atomic<uint32_t>* word, uint32_t expected) {
+	return syscall(SYS_futex, (uint32_t*) word, FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+int futex_wake(std::atomic<uint32_t>* word) {
+	return syscall(SYS_futex, (uint32_t*) word, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+#endif
+
 uint64_t get_time64() {
     struct timespec time;
     clock_gettime(CLOCK_MONOTONIC, &time);
@@ -0,0 +1,448 @@
+/* redo log records
+
+0-3 magic
+4-7 size of the ops
+8-15 txn id
+16-23 hash of the ops (xxhash64, seeded with the txn id)
+ops, each one:
+1 op
+4 database flags
+4 database name size, followed by the name (empty for the main database)
+4 key size, followed by the key
+4 value size, followed by the value (put and delete value), or 1 byte for drop (whether to delete the database)
+*/
+#include "lmdb-js.h"
+#ifdef REDO_LOG
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "xxhash.h"
+
+const uint32_t REDO_MAGIC = 0x6f646552; // "Redo"
+const uint8_t REDO_PUT = 1;
+const uint8_t REDO_DEL = 2;
+const uint8_t REDO_DEL_VALUE = 3;
+const uint8_t REDO_DROP = 4;
+const size_t REDO_HEADER_SIZE = 24;
+const int64_t CHECKPOINT_SIZE = 0x4000000; // checkpoint early once the log reaches 64MB
+
+RedoLog::RedoLog(MDB_env* env, std::string path, int checkpointInterval)
+		: env(env),
+		path(path),
+		checkpointInterval(checkpointInterval) {
+	fds[0] = fds[1] = -1;
+	fileSizes[0] = fileSizes[1] = 0;
+	current = 0;
+	writtenPosition = 0;
+	syncedPosition = 0;
+	attemptedPosition = 0;
+	syncError = 0;
+	syncing = false;
+	checkpointThread = nullptr;
+	stopping = false;
+	records = 0;
+	bytes = 0;
+	syncs = 0;
+	checkpoints = 0;
+	replayed = 0;
+	deferredTxnId = 0;
+	checkpointedTxnId = 0;
+	checkpointError = 0;
+}
+
+RedoLog::~RedoLog() {
+	stop();
+	close(false);
+}
+
+int RedoLog::open() {
+	for (int i = 0; i < 2; i++) {
+		// the two files take turns being appended to, so one can be truncated by a checkpoint while the other is in use
+		std::string filePath = path + (char) ('0' + i);
+		fds[i] = ::open(filePath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0664);
+		if (fds[i] < 0)
+			return errno;
+	}
+	// only one process can use the log, any others just sync their commits as usual
+	if (flock(fds[0], LOCK_EX | LOCK_NB))
+		return errno;
+	int rc = replay();
+	if (rc)
+		return rc;
+	mdb_env_set_sync_scheduler(env, deferSync, this);
+	checkpointThread = new std::thread([this]() { checkpointer(); });
+	return 0;
+}
+
+void RedoLog::stop() {
+	if (!checkpointThread)
+		return;
+	// commits go back to syncing themselves
+	mdb_env_set_sync_scheduler(env, nullptr, nullptr);
+	{
+		std::unique_lock<std::mutex> lock(logLock);
+		stopping = true;
+	}
+	checkpointCondition.notify_all();
+	checkpointThread->join();
+	delete checkpointThread;
+	checkpointThread = nullptr;
+}
+
+// with checkpointed, the database has been synced since the last commit, so the log can be discarded
+void RedoLog::close(bool checkpointed) {
+	for (int i = 0; i < 2; i++) {
+		if (fds[i] < 0)
+			continue;
+		if (checkpointed && ftruncate(fds[i], 0)) {
+			// the records will just be skipped when they are replayed
+		}
+		::close(fds[i]);
+		fds[i] = -1;
+	}
+}
+
+static void appendUint32(std::string& out, uint32_t value) {
+	out.append((const char*) &value, 4);
+}
+static void appendVal(std::string& out, MDB_val* value) {
+	appendUint32(out, (uint32_t) value->mv_size);
+	if (value->mv_size)
+		out.append((const char*) value->mv_data, value->mv_size);
+}
+
+void RedoLog::logDbi(MDB_txn* txn, uint8_t op, MDB_dbi dbi, unsigned int flags) {
+	MDB_val name;
+	if (mdb_dbi_name(txn, dbi, &name))
+		name.mv_size = 0;
+	pending.push_back((char) op);
+	appendUint32(pending, flags);
+	appendVal(pending, &name);
+}
+
+void RedoLog::logPut(MDB_txn* txn, MDB_dbi dbi, MDB_val* key, MDB_val* value) {
+	unsigned int flags = 0;
+	mdb_dbi_flags(txn, dbi, &flags);
+	MDB_val stored = *value;
+	// log what was actually stored (with any version, timestamp or direct write applied), except with duplicates,
+	// which are stored as they are given
+	if (!(flags & MDB_DUPSORT) && mdb_get(txn, dbi, key, &stored))
+		stored = *value;
+	logDbi(txn, REDO_PUT, dbi, flags);
+	appendVal(pending, key);
+	appendVal(pending, &stored);
+}
+
+void RedoLog::logDel(MDB_txn* txn, MDB_dbi dbi, MDB_val* key, MDB_val* value) {
+	unsigned int flags = 0;
+	mdb_dbi_flags(txn, dbi, &flags);
+	logDbi(txn, value ? REDO_DEL_VALUE : REDO_DEL, dbi, flags);
+	appendVal(pending, key);
+	if (value)
+		appendVal(pending, value);
+}
+
+void RedoLog::logDrop(MDB_txn* txn, MDB_dbi dbi, int del) {
+	unsigned int flags = 0;
+	mdb_dbi_flags(txn, dbi, &flags);
+	logDbi(txn, REDO_DROP, dbi, flags);
+	pending.push_back((char) del);
+}
+
+void RedoLog::beginChild() {
+	childMarks.push_back(pending.size());
+}
+void RedoLog::commitChild() {
+	if (!childMarks.empty())
+		childMarks.pop_back();
+}
+void RedoLog::abortChild() {
+	if (!childMarks.empty()) {
+		pending.resize(childMarks.back());
+		childMarks.pop_back();
+	}
+}
+void RedoLog::abortTxn() {
+	pending.clear();
+	childMarks.clear();
+}
+
+std::string RedoLog::detach() {
+	std::string ops;
+	ops.swap(pending);
+	childMarks.clear();
+	return ops;
+}
+
+// append the record of a commit, returning the log position to wait for, or a negative error code
+int64_t RedoLog::append(mdb_size_t txnId, std::string& ops) {
+	char header[REDO_HEADER_SIZE];
+	uint32_t magic = REDO_MAGIC;
+	uint32_t size = (uint32_t) ops.size();
+	uint64_t id = txnId;
+	uint64_t hash = XXH64(ops.data(), ops.size(), id);
+	memcpy(header, &magic, 4);
+	memcpy(header + 4, &size, 4);
+	memcpy(header + 8, &id, 8);
+	memcpy(header + 16, &hash, 8);
+	struct iovec iov[2];
+	iov[0].iov_base = header;
+	iov[0].iov_len = REDO_HEADER_SIZE;
+	iov[1].iov_base = (void*) ops.data();
+	iov[1].iov_len = ops.size();
+	std::unique_lock<std::mutex> lock(logLock);
+	int fd = fds[current];
+	ssize_t written = pwritev(fd, iov, 2, fileSizes[current]);
+	if (written != (ssize_t) (REDO_HEADER_SIZE + size)) {
+		int rc = written < 0 ? errno : EIO;
+		// don't leave a partial record behind, replaying stops at the first invalid record
+		if (ftruncate(fd, fileSizes[current])) {}
+		return -rc;
+	}
+	fileSizes[current] += written;
+	writtenPosition += written;
+	records++;
+	bytes += written;
+	if (fileSizes[current] > CHECKPOINT_SIZE)
+		checkpointCondition.notify_one();
+	return writtenPosition;
+}
+
+// wait for the log to be synced through the given position; one waiter syncs everything appended so far while the
+// others wait for it, so commits that arrive during a sync are grouped into the next one
+int RedoLog::waitForSync(int64_t position) {
+	std::unique_lock<std::mutex> lock(logLock);
+	while (syncedPosition < position) {
+		if (attemptedPosition >= position)
+			return syncError;
+		if (syncing) {
+			syncFinished.wait(lock);
+			continue;
+		}
+		syncing = true;
+		int fd = fds[current];
+		int64_t target = writtenPosition;
+		lock.unlock();
+		int rc = fdatasync(fd) ? errno : 0;
+		lock.lock();
+		syncing = false;
+		if (target > attemptedPosition)
+			attemptedPosition = target;
+		if (rc)
+			syncError = rc;
+		else {
+			if (target > syncedPosition)
+				syncedPosition = target;
+			syncs++;
+		}
+		syncFinished.notify_all();
+	}
+	return 0;
+}
+
+int RedoLog::syncAll() {
+	int64_t position;
+	{
+		std::unique_lock<std::mutex> lock(logLock);
+		position = writtenPosition;
+	}
+	return waitForSync(position);
+}
+
+// called by each commit instead of syncing the database; the commit is made durable by syncing the log, and the
+// checkpointer syncs the database through the latest commit recorded here (even one that didn't log any records)
+void RedoLog::deferSync(void* ctx, mdb_size_t txnId) {
+	RedoLog* log = (RedoLog*) ctx;
+	std::unique_lock<std::mutex> lock(log->logLock);
+	if (txnId > log->deferredTxnId)
+		log->deferredTxnId = txnId;
+}
+
+int RedoLog::checkpoint() {
+	int previous;
+	mdb_size_t txnId;
+	{
+		std::unique_lock<std::mutex> lock(logLock);
+		txnId = deferredTxnId;
+		previous = current ^ 1;
+		if (fileSizes[previous] == 0 && fileSizes[current] == 0) {
+			if (txnId <= checkpointedTxnId)
+				return 0; // nothing has been committed since the last checkpoint
+			// only commits without any records, there is no log to truncate
+			lock.unlock();
+			int rc = mdb_env_sync(env, 1);
+			if (rc)
+				return rc;
+			lock.lock();
+			checkpointedTxnId = txnId;
+			checkpoints++;
+			return 0;
+		}
+		if (fileSizes[previous] == 0) {
+			// waiters only sync the file being appended to, so sync this one before switching away from it
+			if (syncedPosition < writtenPosition) {
+				if (fdatasync(fds[current]))
+					return errno;
+				syncedPosition = attemptedPosition = writtenPosition;
+				syncFinished.notify_all();
+			}
+			current = previous;
+			previous = current ^ 1;
+		} // else the last checkpoint failed to sync the database, and its file still needs to be truncated
+	}
+	// every record in the previous file was appended after its commit, so syncing the database now covers all of them
+	int rc = mdb_env_sync(env, 1);
+	if (rc)
+		return rc;
+	std::unique_lock<std::mutex> lock(logLock);
+	if (ftruncate(fds[previous], 0))
+		return errno;
+	fileSizes[previous] = 0;
+	checkpointedTxnId = txnId;
+	checkpoints++;
+	return 0;
+}
+
+void RedoLog::checkpointer() {
+	std::unique_lock<std::mutex> lock(logLock);
+	while (!stopping) {
+		checkpointCondition.wait_for(lock, std::chrono::milliseconds(checkpointInterval),
+			[this] { return stopping || fileSizes[current] > CHECKPOINT_SIZE; });
+		if (stopping)
+			break;
+		lock.unlock();
+		int rc = checkpoint();
+		lock.lock();
+		checkpointError = rc;
+	}
+}
+
+static int replayOps(MDB_txn* txn, const char* ops, size_t size) {
+	const char* end = ops + size;
+	auto readVal = [&](MDB_val* value) {
+		uint32_t valueSize;
+		if (end - ops < 4)
+			return false;
+		memcpy(&valueSize, ops, 4);
+		ops += 4;
+		if ((size_t) (end - ops) < valueSize)
+			return false;
+		value->mv_size = valueSize;
+		value->mv_data = (void*) ops;
+		ops += valueSize;
+		return true;
+	};
+	while (ops < end) {
+		uint8_t op = (uint8_t) *ops++;
+		uint32_t flags;
+		MDB_val name, key, value;
+		if (end - ops < 4)
+			return MDB_CORRUPTED;
+		memcpy(&flags, ops, 4);
+		ops += 4;
+		if (!readVal(&name))
+			return MDB_CORRUPTED;
+		std::string nameString((const char*) name.mv_data, name.mv_size);
+		MDB_dbi dbi;
+		int rc = mdb_dbi_open(txn, name.mv_size ? nameString.c_str() : nullptr, flags | MDB_CREATE, &dbi);
+		if (rc)
+			return rc;
+		if (op == REDO_DROP) {
+			if (ops >= end)
+				return MDB_CORRUPTED;
+			rc = mdb_drop(txn, dbi, *ops++);
+		} else {
+			if (!readVal(&key))
+				return MDB_CORRUPTED;
+			if (op == REDO_PUT || op == REDO_DEL_VALUE) {
+				if (!readVal(&value))
+					return MDB_CORRUPTED;
+			}
+			if (op == REDO_PUT)
+				rc = mdb_put(txn, dbi, &key, &value, 0);
+			else if (op == REDO_DEL || op == REDO_DEL_VALUE)
+				rc = mdb_del(txn, dbi, &key, op == REDO_DEL_VALUE ? &value : nullptr);
+			else
+				return MDB_CORRUPTED;
+			if (rc == MDB_NOTFOUND)
+				rc = 0;
+		}
+		if (rc)
+			return rc;
+	}
+	return 0;
+}
+
+// apply the records of any commits that are newer than the database (they weren't synced before a crash), and then
+// start with empty log files
+int RedoLog::replay() {
+	struct Record {
+		mdb_size_t txnId;
+		const char* ops;
+		size_t size;
+	};
+	std::string contents[2];
+	std::vector<Record> found;
+	MDB_envinfo info;
+	mdb_env_info(env, &info);
+	for (int i = 0; i < 2; i++) {
+		struct stat st;
+		if (fstat(fds[i], &st))
+			return errno;
+		contents[i].resize(st.st_size);
+		size_t length = 0;
+		while (length < (size_t) st.st_size) {
+			ssize_t bytesRead = pread(fds[i], &contents[i][length], st.st_size - length, length);
+			if (bytesRead < 0)
+				return errno;
+			if (bytesRead == 0)
+				break;
+			length += bytesRead;
+		}
+		const char* data = contents[i].data();
+		size_t offset = 0;
+		while (offset + REDO_HEADER_SIZE <= length) {
+			uint32_t magic, size;
+			uint64_t id, hash;
+			memcpy(&magic, data + offset, 4);
+			memcpy(&size, data + offset + 4, 4);
+			memcpy(&id, data + offset + 8, 8);
+			memcpy(&hash, data + offset + 16, 8);
+			const char* ops = data + offset + REDO_HEADER_SIZE;
+			// anything after a torn or partial record wasn't acknowledged as durable
+			if (magic != REDO_MAGIC || size > length - offset - REDO_HEADER_SIZE || XXH64(ops, size, id) != hash)
+				break;
+			if (id > info.me_last_txnid)
+				found.push_back({ (mdb_size_t) id, ops, size });
+			offset += REDO_HEADER_SIZE + size;
+		}
+	}
+	if (!found.empty()) {
+		std::stable_sort(found.begin(), found.end(), [](const Record& a, const Record& b) { return a.txnId < b.txnId; });
+		MDB_txn* txn;
+		int rc = mdb_txn_begin(env, nullptr, 0, &txn);
+		if (rc)
+			return rc;
+		for (auto& record : found) {
+			rc = replayOps(txn, record.ops, record.size);
+			if (rc) {
+				mdb_txn_abort(txn);
+				return rc;
+			}
+		}
+		rc = mdb_txn_commit(txn); // this syncs the database, so the log is no longer needed
+		if (rc)
+			return rc;
+		replayed = found.size();
+	}
+	for (int i = 0; i < 2; i++) {
+		if (ftruncate(fds[i], 0))
+			return errno;
+	}
+	return 0;
+}
+#endif
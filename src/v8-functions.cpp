@@ -70,7 +70,7 @@ int32_t writeFast(Local<v8::Object> instance, double ewPointer, uint64_t instruc
 	if (instructionAddress)
 		rc = WriteWorker::DoWrites(ew->writeTxn->txn, ew, (uint32_t*)instructionAddress, nullptr);
 	else {
-		pthread_cond_signal(ew->writingCond);
+		ew->wakeWriter();
 		rc = 0;
 	}
 	return rc;
@@ -85,7 +85,7 @@ void writeV8(const v8::FunctionCallbackInfo<v8::Value>& info) {
 	if (instructionAddress)
 		rc = WriteWorker::DoWrites(ew->writeTxn->txn, ew, (uint32_t*)instructionAddress, nullptr);
 	else {
-		pthread_cond_signal(ew->writingCond);
+		ew->wakeWriter();
 		rc = 0;
 	}
 	info.GetReturnValue().Set(v8::Number::New(isolate, rc));
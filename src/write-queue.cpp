@@ -0,0 +1,447 @@
+/* write queue file
+
+0-63 header: magic, slot count, slot size, pid of the process with the writer role, next sequence number, and a
+	count of the events (batches committed, the role released) that waiting processes wait on
+slots, each one:
+0-63 state, pid of the process that queued it, pid of the process that committed it, sequence number, number of ops,
+	size of the ops, result code, whether the commit was synced, txn id, redo log position
+ops, each one:
+1 op
+1 result (set to 1 if the write wasn't made, because the key existed or wasn't found)
+2 (unused)
+4 put flags
+4 database flags
+4 database name size, followed by the name (empty for the main database)
+4 key size, followed by the key
+4 value size, followed by the value (put and delete value)
+*/
+#include "lmdb-js.h"
+#ifdef WRITE_QUEUE
+#include <cstring>
+#include <climits>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+const uint32_t QUEUE_MAGIC = 0x75655157; // "WQue"
+const uint32_t SLOT_COUNT = 64;
+const uint32_t SLOT_SIZE = 0x10000; // batches that don't fit are written as usual
+const size_t QUEUE_HEADER_SIZE = 64;
+const size_t SLOT_HEADER_SIZE = 64;
+const int DRAIN_ROUNDS = 4; // how many times the writer looks for more batches to add to its txn
+const int WAIT_TIMEOUT = 50; // how often (in milliseconds) a waiting process checks that the writer is still alive
+
+enum : uint32_t {
+	SLOT_FREE,
+	SLOT_FILLING,
+	SLOT_PENDING,
+	SLOT_CLAIMED,
+	SLOT_DONE,
+};
+struct QueueHeader {
+	uint32_t magic;
+	uint32_t slotCount;
+	uint32_t slotSize;
+	std::atomic<uint32_t> writer;
+	std::atomic<uint32_t> nextSequence;
+	std::atomic<uint32_t> events;
+};
+struct QueueSlot {
+	std::atomic<uint32_t> state;
+	uint32_t pid;
+	uint32_t drainer;
+	uint32_t sequence;
+	uint32_t count;
+	uint32_t size;
+	int32_t result;
+	uint32_t synced;
+	uint64_t txnId;
+	int64_t redoPosition;
+};
+struct QueuedOp {
+	uint8_t op;
+	uint8_t* result;
+	uint32_t putFlags;
+	uint32_t dbFlags;
+	MDB_val name;
+	MDB_val key;
+	MDB_val value;
+};
+static_assert(sizeof(QueueHeader) <= QUEUE_HEADER_SIZE && sizeof(QueueSlot) <= SLOT_HEADER_SIZE,
+	"write queue headers don't fit");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "write queue atomics must be lock free to be shared");
+
+// the futexes are shared with other processes, unlike the private one the write thread parks on
+static bool waitForEvent(std::atomic<uint32_t>* word, uint32_t expected, int ms) {
+	struct timespec timeout = { ms / 1000, (ms % 1000) * 1000000 };
+	return syscall(SYS_futex, (uint32_t*) word, FUTEX_WAIT, expected, &timeout, nullptr, 0) == 0 || errno != ETIMEDOUT;
+}
+static void wakeAll(std::atomic<uint32_t>* word) {
+	syscall(SYS_futex, (uint32_t*) word, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+static bool isAlive(uint32_t pid) {
+	return pid == 0 || kill((pid_t) pid, 0) == 0 || errno != ESRCH;
+}
+static QueueSlot* slotAt(char* map, uint32_t index) {
+	return (QueueSlot*) (map + QUEUE_HEADER_SIZE + (size_t) index * SLOT_SIZE);
+}
+static const char* readOp(const char* position, QueuedOp* op) {
+	auto readVal = [&](MDB_val* value) {
+		uint32_t size;
+		memcpy(&size, position, 4);
+		value->mv_size = size;
+		value->mv_data = (void*) (position + 4);
+		position += 4 + size;
+	};
+	op->op = (uint8_t) position[0];
+	op->result = (uint8_t*) position + 1;
+	memcpy(&op->putFlags, position + 4, 4);
+	memcpy(&op->dbFlags, position + 8, 4);
+	position += 12;
+	readVal(&op->name);
+	readVal(&op->key);
+	if (op->op == QUEUED_DEL) {
+		op->value.mv_size = 0;
+		op->value.mv_data = nullptr;
+	} else
+		readVal(&op->value);
+	return position;
+}
+
+WriteQueue::WriteQueue(MDB_env* env, std::string path)
+		: env(env),
+		path(path) {
+	fd = -1;
+	map = nullptr;
+	mapSize = QUEUE_HEADER_SIZE + (size_t) SLOT_COUNT * SLOT_SIZE;
+	batches = 0;
+	drains = 0;
+	drainedBatches = 0;
+	bypassed = 0;
+}
+
+WriteQueue::~WriteQueue() {
+	if (map)
+		munmap(map, mapSize);
+	if (fd >= 0)
+		::close(fd); // releases our (shared) lock on the file
+}
+
+int WriteQueue::open() {
+	fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0664);
+	if (fd < 0)
+		return errno;
+	// every process using the queue holds a shared lock on it, so the first one can tell that it should start it empty
+	// (discarding anything left by processes that exited)
+	bool first = flock(fd, LOCK_EX | LOCK_NB) == 0;
+	if (first) {
+		if (ftruncate(fd, 0) || ftruncate(fd, mapSize))
+			return errno;
+	} else {
+		if (errno != EWOULDBLOCK || flock(fd, LOCK_SH))
+			return errno;
+		struct stat st;
+		if (fstat(fd, &st))
+			return errno;
+		if ((size_t) st.st_size < mapSize)
+			return MDB_INCOMPATIBLE;
+	}
+	void* address = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (address == MAP_FAILED)
+		return errno;
+	map = (char*) address;
+	QueueHeader* header = (QueueHeader*) map;
+	if (first) {
+		header->magic = QUEUE_MAGIC;
+		header->slotCount = SLOT_COUNT;
+		header->slotSize = SLOT_SIZE;
+		if (flock(fd, LOCK_SH))
+			return errno;
+	} else if (header->magic != QUEUE_MAGIC || header->slotCount != SLOT_COUNT || header->slotSize != SLOT_SIZE)
+		return MDB_INCOMPATIBLE;
+	return 0;
+}
+
+void WriteQueue::notify() {
+	QueueHeader* header = (QueueHeader*) map;
+	header->events++;
+	wakeAll(&header->events);
+}
+
+int WriteQueue::write(WriteWorker* worker) {
+	QueueHeader* header = (QueueHeader*) map;
+	uint32_t pid = getpid();
+	QueueSlot* slot = nullptr;
+	for (uint32_t i = 0; i < SLOT_COUNT && !slot; i++) {
+		QueueSlot* candidate = slotAt(map, (pid + i) % SLOT_COUNT);
+		uint32_t state = SLOT_FREE;
+		if (candidate->state.compare_exchange_strong(state, SLOT_FILLING))
+			slot = candidate;
+	}
+	for (uint32_t i = 0; i < SLOT_COUNT && !slot; i++) {
+		// take back a batch's slot from a process that exited before it read the result
+		QueueSlot* candidate = slotAt(map, i);
+		uint32_t state = SLOT_DONE;
+		if (candidate->state.load() == SLOT_DONE && !isAlive(candidate->pid) &&
+				candidate->state.compare_exchange_strong(state, SLOT_FILLING))
+			slot = candidate;
+	}
+	if (!slot) {
+		bypassed++;
+		return WRITE_QUEUE_BYPASS;
+	}
+	std::vector<uint32_t*> operations;
+	int size = worker->QueueBatch((char*) slot + SLOT_HEADER_SIZE, SLOT_SIZE - SLOT_HEADER_SIZE, operations);
+	if (size < 0) {
+		slot->state = SLOT_FREE;
+		bypassed++;
+		return WRITE_QUEUE_BYPASS;
+	}
+	slot->pid = pid;
+	slot->drainer = 0;
+	slot->count = operations.size();
+	slot->size = size;
+	slot->result = 0;
+	slot->synced = 0;
+	slot->txnId = 0;
+	slot->redoPosition = 0;
+	slot->sequence = header->nextSequence++;
+	slot->state = SLOT_PENDING;
+	batches++;
+	int rc = 0;
+	std::string results;
+	while (true) {
+		uint32_t events = header->events;
+		uint32_t state = slot->state;
+		if (state == SLOT_DONE)
+			break;
+		uint32_t writer = 0;
+		if (state == SLOT_PENDING && header->writer.compare_exchange_strong(writer, pid)) {
+			// we have the writer role, so we commit our batch, and any others that are queued
+			rc = drain(worker);
+			header->writer = 0;
+			notify();
+			state = SLOT_PENDING;
+			if (rc && slot->state.compare_exchange_strong(state, SLOT_FREE)) {
+				// we couldn't start a txn for it
+				worker->FinishQueuedBatch(operations, results, rc, 0);
+				return rc;
+			}
+			continue;
+		}
+		if (waitForEvent(&header->events, events, WAIT_TIMEOUT))
+			continue;
+		// nothing has happened for a while, check if the process committing our batch has exited
+		writer = header->writer;
+		if (writer && !isAlive(writer))
+			header->writer.compare_exchange_strong(writer, 0);
+		state = SLOT_CLAIMED;
+		if (slot->state == SLOT_CLAIMED && !isAlive(slot->drainer)) {
+			MDB_envinfo info;
+			mdb_env_info(env, &info);
+			if (info.me_last_txnid < slot->txnId)
+				slot->state.compare_exchange_strong(state, SLOT_PENDING); // its txn was aborted, so queue it again
+			else {
+				// another txn has been committed since, so we can't tell if it was ours
+				slot->result = EOWNERDEAD;
+				slot->state.compare_exchange_strong(state, SLOT_DONE);
+			}
+		}
+	}
+	rc = slot->result;
+	mdb_size_t txnId = slot->txnId;
+	bool drainedHere = slot->drainer == pid;
+	bool synced = slot->synced;
+	int64_t redoPosition = slot->redoPosition;
+	const char* position = (const char*) slot + SLOT_HEADER_SIZE;
+	for (uint32_t i = 0; i < slot->count; i++) {
+		QueuedOp op;
+		position = readOp(position, &op);
+		results.push_back((char) *op.result);
+	}
+	slot->state = SLOT_FREE;
+	worker->FinishQueuedBatch(operations, results, rc, txnId);
+	if (rc)
+		return rc;
+	ExtendedEnv* extendedEnv = (ExtendedEnv*) mdb_env_get_userctx(env);
+	if (drainedHere) {
+		// committed by this process, so it is synced like our other commits
+		#ifdef REDO_LOG
+		if (extendedEnv->redoLog) {
+			if (redoPosition > 0)
+				rc = extendedEnv->redoLog->waitForSync(redoPosition);
+		} else
+		#endif
+		if (worker->envForTxn->jsFlags & MDB_OVERLAPPINGSYNC)
+			rc = extendedEnv->waitForSync(txnId);
+	} else if (!synced) {
+		// the process that committed it deferred the sync, which we can't wait for, so we sync it ourselves
+		unsigned int envFlags;
+		mdb_env_get_flags(env, &envFlags);
+		if (!(envFlags & MDB_NOSYNC))
+			rc = extendedEnv->hasSyncScheduler() ? extendedEnv->syncLatest() : mdb_env_sync(env, 1);
+	}
+	if (rc)
+		worker->resultCode = rc;
+	return rc;
+}
+
+static int applyOps(MDB_txn* txn, QueueSlot* slot, RedoLog* redoLog) {
+	const char* position = (const char*) slot + SLOT_HEADER_SIZE;
+	MDB_dbi dbi = 0;
+	MDB_val dbName = { 0, nullptr };
+	bool opened = false;
+	for (uint32_t i = 0; i < slot->count; i++) {
+		QueuedOp op;
+		int rc;
+		position = readOp(position, &op);
+		if (!opened || op.name.mv_size != dbName.mv_size || memcmp(op.name.mv_data, dbName.mv_data, dbName.mv_size)) {
+			std::string name((const char*) op.name.mv_data, op.name.mv_size);
+			rc = mdb_dbi_open(txn, op.name.mv_size ? name.c_str() : nullptr, op.dbFlags, &dbi);
+			if (rc)
+				return rc;
+			dbName = op.name;
+			opened = true;
+		}
+		if (op.op == QUEUED_PUT)
+			rc = mdb_put(txn, dbi, &op.key, &op.value, op.putFlags);
+		else
+			rc = mdb_del(txn, dbi, &op.key, op.op == QUEUED_DEL_VALUE ? &op.value : nullptr);
+		#ifdef REDO_LOG
+		if (redoLog && !rc) {
+			if (op.op == QUEUED_PUT)
+				redoLog->logPut(txn, dbi, &op.key, &op.value);
+			else
+				redoLog->logDel(txn, dbi, &op.key, op.op == QUEUED_DEL_VALUE ? &op.value : nullptr);
+		}
+		#endif
+		if (rc == MDB_KEYEXIST || rc == MDB_NOTFOUND)
+			*op.result = 1;
+		else if (rc)
+			return rc;
+	}
+	return 0;
+}
+
+// with the writer role, commit the queued batches (of every process) in one txn
+int WriteQueue::drain(WriteWorker* worker) {
+	uint32_t pid = getpid();
+	MDB_txn* txn;
+	int rc = worker->BeginTxn(&txn);
+	if (rc)
+		return rc;
+	mdb_size_t txnId = mdb_txn_id(txn);
+	RedoLog* redoLog = nullptr;
+	#ifdef REDO_LOG
+	redoLog = ((ExtendedEnv*) mdb_env_get_userctx(env))->redoLog;
+	#endif
+	std::vector<QueueSlot*> claimed;
+	std::vector<int> slotResults;
+	// without nested txns (with a write map), a failed batch fails the txn of all of them
+	unsigned int envFlags;
+	mdb_env_get_flags(env, &envFlags);
+	bool nested = !(envFlags & MDB_WRITEMAP);
+	for (int round = 0; round < DRAIN_ROUNDS && !rc; round++) {
+		size_t first = claimed.size();
+		for (uint32_t i = 0; i < SLOT_COUNT; i++) {
+			QueueSlot* slot = slotAt(map, i);
+			uint32_t state = SLOT_PENDING;
+			if (slot->state != SLOT_PENDING)
+				continue;
+			if (slot->pid != pid && !isAlive(slot->pid)) {
+				// the process that queued it exited before it could be committed
+				slot->state.compare_exchange_strong(state, SLOT_FREE);
+				continue;
+			}
+			slot->drainer = pid;
+			slot->txnId = txnId;
+			if (slot->state.compare_exchange_strong(state, SLOT_CLAIMED))
+				claimed.push_back(slot);
+		}
+		if (claimed.size() == first)
+			break;
+		slotResults.resize(claimed.size());
+		// the batches are written in the order they were queued
+		std::sort(claimed.begin() + first, claimed.end(), [](QueueSlot* a, QueueSlot* b) {
+			return (int32_t) (a->sequence - b->sequence) < 0;
+		});
+		for (size_t i = first; i < claimed.size() && !rc; i++) {
+			if (!nested) {
+				rc = applyOps(txn, claimed[i], redoLog);
+				continue;
+			}
+			// each batch is written in a child txn, so a failed batch is only taken back (and reported) by itself,
+			// without failing the batches of other processes
+			MDB_txn* child;
+			rc = mdb_txn_begin(env, txn, 0, &child);
+			if (rc)
+				break;
+			#ifdef REDO_LOG
+			if (redoLog)
+				redoLog->beginChild();
+			#endif
+			int slotRc = applyOps(child, claimed[i], redoLog);
+			if (slotRc)
+				mdb_txn_abort(child);
+			else
+				slotRc = mdb_txn_commit(child);
+			#ifdef REDO_LOG
+			if (redoLog) {
+				if (slotRc)
+					redoLog->abortChild();
+				else
+					redoLog->commitChild();
+			}
+			#endif
+			slotResults[i] = slotRc;
+		}
+	}
+	drains++;
+	drainedBatches += claimed.size();
+	#ifdef REDO_LOG
+	std::string redoOps;
+	#endif
+	if (rc) {
+		#ifdef REDO_LOG
+		if (redoLog)
+			redoLog->abortTxn();
+		#endif
+		mdb_txn_abort(txn);
+	} else {
+		#ifdef REDO_LOG
+		if (redoLog)
+			redoOps = redoLog->detach();
+		#endif
+		rc = mdb_txn_commit(txn);
+	}
+#ifdef MDB_EMPTY_TXN
+	if (rc == MDB_EMPTY_TXN)
+		rc = 0;
+#endif
+	int64_t redoPosition = 0;
+	#ifdef REDO_LOG
+	if (redoLog && rc == 0 && !redoOps.empty()) {
+		int64_t position = redoLog->append(txnId, redoOps);
+		if (position < 0)
+			rc = (int) -position;
+		else
+			redoPosition = position;
+	}
+	#endif
+	// unless its sync was deferred (to the sync scheduler or the redo log), the commit is durable now
+	bool synced = !redoLog && !((ExtendedEnv*) mdb_env_get_userctx(env))->hasSyncScheduler();
+	for (size_t i = 0; i < claimed.size(); i++) {
+		QueueSlot* slot = claimed[i];
+		slot->result = rc ? rc : slotResults[i];
+		slot->synced = synced;
+		slot->redoPosition = redoPosition;
+		slot->state = SLOT_DONE;
+	}
+	return rc;
+}
+#endif
@@ -73,6 +73,11 @@ WriteWorker::WriteWorker(MDB_env* env, EnvWrap* envForTxn, uint32_t* instruction
 		interruptionStatus = 0;
 		resultCode = 0;
 		txn = nullptr;
+		redoPosition = 0;
+		lentTxnFlags = 0;
+		lentTxnResult = 0;
+		combiner = nullptr;
+		combinedLeader = false;
 	}
 
 void WriteWorker::SendUpdate() {
@@ -87,9 +92,13 @@ MDB_txn* WriteWorker::AcquireTxn(int* flags) {
 	retry:
 	if (commitSynchronously && interruptionStatus == WORKER_WAITING) {
 		interruptionStatus = INTERRUPT_BATCH;
-		pthread_cond_signal(envForTxn->writingCond);
+		envForTxn->wakeWriter();
 		pthread_cond_wait(envForTxn->writingCond, envForTxn->writingLock);
-		if (interruptionStatus == RESTART_WORKER_TXN) {
+		if (interruptionStatus == LEND_WORKER_TXN) {
+			// the worker has paused and lent us its txn, so we run in it (as a child txn, if abortable)
+			*flags |= TXN_FROM_WORKER;
+			return txn;
+		} else if (interruptionStatus == RESTART_WORKER_TXN) {
 			*flags |= TXN_FROM_WORKER;
 			return nullptr;
 		} else if (interruptionStatus == WORKER_WAITING || interruptionStatus == INTERRUPT_BATCH) {
@@ -109,6 +118,31 @@ MDB_txn* WriteWorker::AcquireTxn(int* flags) {
 	}
 }
 
+// called (on the JS thread) when a synchronous txn that was run in our lent txn commits; the worker thread owns the
+// write lock, so it does the commit, of the synchronous txn's writes and the batch so far together
+int WriteWorker::CommitLentTxn(int flags) {
+	lentTxnFlags = flags;
+	interruptionStatus = COMMIT_WORKER_TXN;
+	pthread_cond_signal(envForTxn->writingCond);
+	do {
+		pthread_cond_wait(envForTxn->writingCond, envForTxn->writingLock);
+	} while (interruptionStatus == COMMIT_WORKER_TXN);
+	return lentTxnResult;
+}
+
+// notify the write thread of an event it may be waiting for: a published instruction, an interruption or
+// finished callbacks
+void EnvWrap::wakeWriter() {
+	writerWakeups++;
+#ifdef WRITER_FUTEX
+	if (writerParked) {
+		writerNotifies++;
+		futex_wake(&writerWakeups);
+	}
+#endif
+	pthread_cond_signal(writingCond);
+}
+
 void WriteWorker::UnlockTxn() {
 	interruptionStatus = 0;
 	pthread_cond_signal(envForTxn->writingCond);
@@ -128,10 +162,12 @@ int WriteWorker::WaitForCallbacks(MDB_txn** txn, bool allowCommit, uint32_t* tar
 		start = get_time64();
 #endif
 	if (target) {
+#ifndef WRITER_FUTEX
 		uint64_t delay = 1;
-		do {
-			cond_timedwait(envForTxn->writingCond, envForTxn->writingLock, delay);
-			delay = delay << 1ll;
+#endif
+		while (true) {
+			// any event after this point changes writerWakeups, so we can't miss it by waiting for it to change
+			uint32_t wakeups = envForTxn->writerWakeups;
 			if ((*target & 0xf) || (allowCommit && finishedProgress)) {
 				// we are in position to continue writing or commit, so forward progress can be made without interrupting yet
 #ifdef MDB_TRACK_METRICS
@@ -141,7 +177,36 @@ int WriteWorker::WaitForCallbacks(MDB_txn** txn, bool allowCommit, uint32_t* tar
 				interruptionStatus = 0;
 				return 0;
 			}
-		} while(interruptionStatus != INTERRUPT_BATCH);
+			if (interruptionStatus == INTERRUPT_BATCH)
+				break;
+			// spin briefly (without the lock), since the next instruction is often published right away
+			pthread_mutex_unlock(envForTxn->writingLock);
+			uint64_t spinStart = get_time64();
+			bool woken;
+			while (!(woken = envForTxn->writerWakeups != wakeups ||
+					(std::atomic_load((std::atomic<uint32_t>*) target) & 0xf)) &&
+					get_time64() - spinStart < envForTxn->writerSpin) {}
+			if (woken)
+				envForTxn->writerSpinWakeups++;
+#ifdef WRITER_FUTEX
+			else {
+				// park until JS wakes us (futex_wait returns immediately if writerWakeups has already changed)
+				envForTxn->writerParks++;
+				envForTxn->writerParked = true;
+				futex_wait(&envForTxn->writerWakeups, wakeups);
+				envForTxn->writerParked = false;
+			}
+			pthread_mutex_lock(envForTxn->writingLock);
+#else
+			pthread_mutex_lock(envForTxn->writingLock);
+			if (!woken) {
+				// without a futex, a wakeup can be signalled before we wait on the condition, so we also poll
+				envForTxn->writerParks++;
+				cond_timedwait(envForTxn->writingCond, envForTxn->writingLock, delay);
+				delay = delay << 1ll;
+			}
+#endif
+		}
 	} else {
 		pthread_cond_wait(envForTxn->writingCond, envForTxn->writingLock);
     }
@@ -150,12 +215,40 @@ int WriteWorker::WaitForCallbacks(MDB_txn** txn, bool allowCommit, uint32_t* tar
 		envForTxn->timeTxnWaiting += get_time64() - start;
 #endif
 	if (interruptionStatus == INTERRUPT_BATCH) { // interrupted by JS code that wants to run a synchronous transaction
-		interruptionStatus = RESTART_WORKER_TXN;
-		rc = mdb_txn_commit(*txn);
-#ifdef MDB_EMPTY_TXN
-		if (rc == MDB_EMPTY_TXN)
-			rc = 0;
+		envForTxn->batchInterruptions++;
+		if (!(envFlags & MDB_WRITEMAP)) {
+			// lend our txn to the synchronous transaction, which runs as a child txn of it. If it aborts, we just
+			// continue the batch, and if it commits, we commit its writes with the batch so far, in one commit
+			interruptionStatus = LEND_WORKER_TXN;
+			pthread_cond_signal(envForTxn->writingCond);
+			do {
+				pthread_cond_wait(envForTxn->writingCond, envForTxn->writingLock);
+			} while (interruptionStatus == LEND_WORKER_TXN);
+			if (interruptionStatus != COMMIT_WORKER_TXN) {
+				interruptionStatus = 0;
+				return 0;
+			}
+			mdb_size_t txnId = mdb_txn_id(*txn);
+			rc = RestartTxn(txn);
+#ifdef MDB_OVERLAPPINGSYNC
+			// a synchronous txn that wasn't started with MDB_NOSYNC expects its commit to be synced when it returns
+			if (rc == 0 && !(lentTxnFlags & MDB_NOSYNC) && (envForTxn->jsFlags & MDB_OVERLAPPINGSYNC))
+				lentTxnResult = ((ExtendedEnv*) mdb_env_get_userctx(env))->waitForSync(txnId);
+			else
 #endif
+				lentTxnResult = rc;
+			interruptionStatus = WORKER_TXN_COMMITTED;
+			pthread_cond_signal(envForTxn->writingCond);
+			do {
+				pthread_cond_wait(envForTxn->writingCond, envForTxn->writingLock);
+			} while (interruptionStatus == WORKER_TXN_COMMITTED);
+			interruptionStatus = 0;
+			return rc;
+		}
+		// with a write map, child txns can't be used, so commit the batch so far and let the synchronous
+		// transaction start its own txn
+		interruptionStatus = RESTART_WORKER_TXN;
+		rc = CommitPartialBatch(*txn);
 		if (rc == 0) {
 			// wait again until the sync transaction is completed
 			this->txn = *txn = nullptr;
@@ -175,6 +268,247 @@ int WriteWorker::WaitForCallbacks(MDB_txn** txn, bool allowCommit, uint32_t* tar
 		interruptionStatus = 0;
 	return 0;
 }
+int WriteWorker::BeginTxn(MDB_txn** txn) {
+	return mdb_txn_begin(env, nullptr,
+#ifdef MDB_OVERLAPPINGSYNC
+		(envForTxn->jsFlags & MDB_OVERLAPPINGSYNC) ? MDB_NOSYNC :
+#endif
+		0, txn);
+}
+// commit the batch so far and start a new txn for the rest of it
+int WriteWorker::RestartTxn(MDB_txn** txn) {
+	int rc;
+	if (combiner)
+		rc = combiner->commitPartial(this, txn);
+	else {
+		rc = CommitPartialBatch(*txn);
+		*txn = nullptr;
+		if (rc == 0)
+			rc = BeginTxn(txn);
+	}
+	this->txn = *txn;
+	return rc;
+}
+// commit the batch so far, when it is interrupted by a synchronous transaction
+int WriteWorker::CommitPartialBatch(MDB_txn* txn) {
+	envForTxn->interruptionCommits++;
+#ifdef REDO_LOG
+	RedoLog* redoLog = ((ExtendedEnv*) mdb_env_get_userctx(env))->redoLog;
+	mdb_size_t txnId = mdb_txn_id(txn);
+	std::string redoOps;
+	if (redoLog)
+		redoOps = redoLog->detach();
+#endif
+	int rc = mdb_txn_commit(txn);
+#ifdef MDB_EMPTY_TXN
+	if (rc == MDB_EMPTY_TXN)
+		rc = 0;
+#endif
+#ifdef REDO_LOG
+	if (redoLog && rc == 0 && !redoOps.empty()) {
+		// the rest of the batch is committed (and waits for the log to be synced) later
+		int64_t position = redoLog->append(txnId, redoOps);
+		if (position < 0)
+			rc = (int) -position;
+		else if (position > redoPosition)
+			redoPosition = position;
+	}
+#endif
+	return rc;
+}
+WriteCombiner::WriteCombiner() {
+	txn = nullptr;
+	leader = nullptr;
+	admitting = false;
+	turnTaken = false;
+	waiting = 0;
+	nextWaiting = 0;
+	joined = 0;
+	failure = 0;
+	commitRequested = false;
+	commitDone = false;
+	commitPartialResult = 0;
+	completed = 0;
+	commitResult = 0;
+	committedTxnId = 0;
+	redoPosition = 0;
+	txns = 0;
+	batches = 0;
+}
+// join the shared txn if it is still being written, or else begin one and lead it
+int WriteCombiner::join(WriteWorker* worker, MDB_txn** txn) {
+	std::unique_lock<std::mutex> lock(combinerLock);
+	bool admitted = false;
+	if (leader && admitting) {
+		waiting++;
+		admitted = true;
+	}
+	while (leader && !admitted) {
+		// the leader is beginning or committing its txn, and we will be admitted to the next txn when it begins (or
+		// lead it)
+		uint64_t txnNumber = txns;
+		nextWaiting++;
+		changed.wait(lock, [this, txnNumber] { return txns != txnNumber || !leader; });
+		if (txns != txnNumber)
+			admitted = true; // moved to waiting
+		else
+			nextWaiting--;
+	}
+	if (admitted) {
+		changed.wait(lock, [this] { return !turnTaken; });
+		waiting--;
+		turnTaken = true;
+		worker->combinedLeader = false;
+		int rc = beginBatch(worker, txn);
+		if (rc) {
+			turnTaken = false;
+			changed.notify_all();
+			return rc;
+		}
+		joined++;
+		batches++;
+		return 0;
+	}
+	leader = worker;
+	worker->combinedLeader = true;
+	turnTaken = true;
+	failure = 0;
+	lock.unlock();
+	int rc = worker->BeginTxn(&this->txn);
+	if (rc == 0) {
+		rc = beginBatch(worker, txn);
+		if (rc)
+			mdb_txn_abort(this->txn);
+	}
+	lock.lock();
+	if (rc) {
+		this->txn = nullptr;
+		leader = nullptr;
+		turnTaken = false;
+	} else {
+		admitting = true;
+		txns++;
+		batches++;
+		// admit the workers that arrived while the last txn was committing
+		waiting += nextWaiting;
+		nextWaiting = 0;
+	}
+	changed.notify_all();
+	return rc;
+}
+// each batch is written in a child txn of the shared txn (during its turn), so a batch that fails is taken back by
+// itself, without failing the batches of the other workers
+int WriteCombiner::beginBatch(WriteWorker* worker, MDB_txn** txn) {
+	int rc = mdb_txn_begin(worker->env, this->txn, 0, txn);
+	if (rc)
+		return rc;
+#ifdef REDO_LOG
+	RedoLog* redoLog = ((ExtendedEnv*) mdb_env_get_userctx(worker->env))->redoLog;
+	if (redoLog)
+		redoLog->beginChild();
+#endif
+	worker->txn = *txn;
+	return 0;
+}
+// (while the worker still has its turn)
+int WriteCombiner::endBatch(WriteWorker* worker, int rc) {
+	if (!worker->txn)
+		return rc ? rc : EINVAL; // already ended by a partial commit that failed
+	if (rc)
+		mdb_txn_abort(worker->txn);
+	else
+		rc = mdb_txn_commit(worker->txn);
+#ifdef REDO_LOG
+	RedoLog* redoLog = ((ExtendedEnv*) mdb_env_get_userctx(worker->env))->redoLog;
+	if (redoLog) {
+		if (rc)
+			redoLog->abortChild();
+		else
+			redoLog->commitChild();
+	}
+#endif
+	worker->txn = this->txn;
+	return rc;
+}
+// a joined worker is done writing, so give up our turn and wait for the leader to commit
+int WriteCombiner::finishJoined(WriteWorker* worker, int rc, mdb_size_t* txnId) {
+	rc = endBatch(worker, rc);
+	std::unique_lock<std::mutex> lock(combinerLock);
+	turnTaken = false;
+	joined--;
+	uint64_t txnNumber = completed;
+	changed.notify_all();
+	changed.wait(lock, [this, txnNumber] { return completed != txnNumber; });
+	*txnId = committedTxnId;
+	if (redoPosition > worker->redoPosition)
+		worker->redoPosition = redoPosition;
+	return rc ? rc : commitResult;
+}
+// the leader is done writing, so let the workers that are waiting for a turn write (but no more), and then return
+// the txn to commit (with the result of our own batch), or a failure of the shared txn
+int WriteCombiner::finishLeading(WriteWorker* worker, int rc, MDB_txn** txn, int* batchResult) {
+	*batchResult = endBatch(worker, rc);
+	std::unique_lock<std::mutex> lock(combinerLock);
+	turnTaken = false;
+	admitting = false;
+	changed.notify_all();
+	while (waiting || joined) {
+		if (commitRequested) {
+			commitRequested = false;
+			commitPartialResult = restart(worker);
+			commitDone = true;
+			changed.notify_all();
+		} else
+			changed.wait(lock);
+	}
+	*txn = this->txn;
+	return failure;
+}
+// the leader has committed (or aborted) the shared txn
+void WriteCombiner::complete(int rc, mdb_size_t txnId, int64_t redoPosition) {
+	std::unique_lock<std::mutex> lock(combinerLock);
+	commitResult = rc;
+	committedTxnId = txnId;
+	this->redoPosition = redoPosition;
+	txn = nullptr;
+	leader = nullptr;
+	completed++;
+	changed.notify_all();
+}
+// commit the shared txn so far for a synchronous txn that interrupted a worker, and start a new one. Only the leader
+// can commit (it owns the write lock), so a joined worker asks it to
+int WriteCombiner::commitPartial(WriteWorker* worker, MDB_txn** txn) {
+	// our batch so far (with the sync txn's writes) goes into the shared txn first
+	int rc = endBatch(worker, 0);
+	std::unique_lock<std::mutex> lock(combinerLock);
+	if (rc == 0) {
+		if (worker->combinedLeader)
+			rc = restart(worker);
+		else {
+			commitRequested = true;
+			commitDone = false;
+			changed.notify_all();
+			changed.wait(lock, [this] { return commitDone; });
+			rc = commitPartialResult;
+		}
+	}
+	if (rc == 0)
+		return beginBatch(worker, txn); // and the rest of our batch is written in a new child txn
+	// our batch has no txn left to write in, so it fails (without ending the shared txn)
+	worker->txn = *txn = nullptr;
+	return rc;
+}
+// (on the leader's thread, with the lock held)
+int WriteCombiner::restart(WriteWorker* leader) {
+	int rc = leader->CommitPartialBatch(txn);
+	txn = nullptr;
+	if (rc == 0)
+		rc = leader->BeginTxn(&txn);
+	leader->txn = txn;
+	if (rc && !failure)
+		failure = rc;
+	return rc;
+}
 int WriteWorker::DoWrites(MDB_txn* txn, EnvWrap* envForTxn, uint32_t* instruction, WriteWorker* worker) {
 	MDB_val key, value;
 	int rc = 0;
@@ -183,6 +517,9 @@ int WriteWorker::DoWrites(MDB_txn* txn, EnvWrap* envForTxn, uint32_t* instructio
 	double conditionalVersion, setVersion = 0;
 	bool overlappedWord = !!worker;
 	uint32_t* start;
+#ifdef REDO_LOG
+	RedoLog* redoLog = ((ExtendedEnv*) mdb_env_get_userctx(envForTxn->env))->redoLog;
+#endif
     do {
 next_inst:	start = instruction++;
 		uint32_t flags = *start;
@@ -338,7 +675,13 @@ next_inst:	start = instruction++;
 							bytes_to_write.mv_size = value.mv_size - 8;
 #ifdef MDB_RPAGE_CACHE
 							rc = mdb_direct_write(txn, dbi, &key, offset, &bytes_to_write);
-							if (!rc) break; // success
+							if (!rc) {
+#ifdef REDO_LOG
+								if (redoLog)
+									redoLog->logPut(txn, dbi, &key, &value);
+#endif
+								break; // success
+							}
 #endif
 							// if no success, this means we probably weren't able to write to a single
 							// word safely, so we need to do a real put
@@ -353,6 +696,10 @@ next_inst:	start = instruction++;
 								memcpy(bytes_to_write.mv_data, last_data.mv_data, last_data.mv_size);
 								// copy the changes
 								memcpy((char*)bytes_to_write.mv_data + offset, (char*)value.mv_data + 8, value.mv_size - 8);
+#ifdef REDO_LOG
+								if (redoLog)
+									redoLog->logPut(txn, dbi, &key, &value);
+#endif
 							}
 							break; // done
 						}
@@ -363,14 +710,26 @@ next_inst:	start = instruction++;
 					rc = putWithVersion(txn, dbi, &key, &value, flags & (MDB_NOOVERWRITE | MDB_NODUPDATA | MDB_APPEND | MDB_APPENDDUP), setVersion);
 				else
 					rc = mdb_put(txn, dbi, &key, &value, flags & (MDB_NOOVERWRITE | MDB_NODUPDATA | MDB_APPEND | MDB_APPENDDUP));
+#ifdef REDO_LOG
+				if (redoLog && !rc)
+					redoLog->logPut(txn, dbi, &key, &value);
+#endif
 				if (flags & COMPRESSIBLE)
 					delete value.mv_data;
 				break;
 			case DEL:
 				rc = mdb_del(txn, dbi, &key, nullptr);
+#ifdef REDO_LOG
+				if (redoLog && !rc)
+					redoLog->logDel(txn, dbi, &key, nullptr);
+#endif
 				break;
 			case DEL_VALUE:
 				rc = mdb_del(txn, dbi, &key, &value);
+#ifdef REDO_LOG
+				if (redoLog && !rc)
+					redoLog->logDel(txn, dbi, &key, &value);
+#endif
 				if (flags & COMPRESSIBLE)
 					delete value.mv_data;
 				break;
@@ -392,7 +751,22 @@ next_inst:	start = instruction++;
 				}
 				break;
 			case DROP_DB:
+#ifdef REDO_LOG
+				if (redoLog) {
+					// deleting the database closes its handle, so it is logged first, and taken back if it fails
+					redoLog->beginChild();
+					redoLog->logDrop(txn, dbi, (flags & DELETE_DATABASE) ? 1 : 0);
+				}
+#endif
 				rc = mdb_drop(txn, dbi, (flags & DELETE_DATABASE) ? 1 : 0);
+#ifdef REDO_LOG
+				if (redoLog) {
+					if (rc)
+						redoLog->abortChild();
+					else
+						redoLog->commitChild();
+				}
+#endif
 				break;
 			case POINTER_NEXT:
 				instruction = (uint32_t*)(size_t) * ((double*)instruction);
@@ -427,6 +801,122 @@ next_inst:	start = instruction++;
 	return rc;
 }
 
+#ifdef WRITE_QUEUE
+// copy our batch into the ops of a write queue slot, if it is just puts and deletes (without conditions, timestamps or
+// compression) that fit, and then end the batch, returning the size of the ops, or -1 if it can't be queued
+int WriteWorker::QueueBatch(char* ops, uint32_t space, std::vector<uint32_t*>& operations) {
+	// the databases are identified by name in the queue, since their handles are specific to each process
+	MDB_txn* readTxn = ExtendedEnv::getPrefetchReadTxn(env);
+	if (!readTxn)
+		return -1;
+	char* position = ops;
+	char* end = ops + space;
+	auto append = [&](const void* data, uint32_t size) {
+		if ((size_t) (end - position) < size)
+			return false;
+		if (size)
+			memcpy(position, data, size);
+		position += size;
+		return true;
+	};
+	uint32_t* instruction = instructions;
+	int size = -1;
+	while (true) {
+		uint32_t* start = instruction++;
+		uint32_t flags = *start;
+		MDB_dbi dbi = 0;
+		MDB_val key, value;
+		double version = 0;
+		value.mv_size = 0;
+		value.mv_data = nullptr;
+		if (flags & HAS_KEY) {
+			dbi = (MDB_dbi) *instruction++;
+			key.mv_size = *instruction++;
+			key.mv_data = instruction;
+			instruction = (uint32_t*) (((size_t) instruction + key.mv_size + 16) & (~7));
+			if (flags & HAS_VALUE) {
+				if (flags & COMPRESSIBLE)
+					break;
+				value.mv_data = (void*)(size_t) * ((double*)instruction);
+				value.mv_size = *(instruction - 1);
+				instruction += 2;
+			}
+			if (flags & CONDITIONAL_VERSION)
+				break;
+			if (flags & SET_VERSION) {
+				version = *((double*) instruction);
+				instruction += 2;
+			}
+		} else
+			instruction++;
+		uint8_t op = 0;
+		switch (flags & 0xf) {
+		case NO_INSTRUCTION_YET:
+			if (std::atomic_compare_exchange_strong((std::atomic<uint32_t>*) start,
+					(uint32_t*) &flags,
+					(uint32_t)TXN_DELIMITER)) {
+				instructions = start;
+				size = position - ops;
+				break;
+			}
+			instruction = start;
+			continue;
+		case POINTER_NEXT:
+			instruction = (uint32_t*)(size_t) * ((double*)instruction);
+			continue;
+		case PUT:
+			op = QUEUED_PUT;
+			break;
+		case DEL:
+			op = QUEUED_DEL;
+			break;
+		case DEL_VALUE:
+			op = QUEUED_DEL_VALUE;
+			break;
+		}
+		if (!op || (flags & ASSIGN_TIMESTAMP))
+			break;
+		MDB_val name;
+		unsigned int dbFlags;
+		if (mdb_dbi_name(readTxn, dbi, &name) || mdb_dbi_flags(readTxn, dbi, &dbFlags))
+			break;
+		uint8_t header[4] = { op, 0, 0, 0 };
+		uint32_t putFlags = op == QUEUED_PUT ? flags & (MDB_NOOVERWRITE | MDB_NODUPDATA | MDB_APPEND | MDB_APPENDDUP) : 0;
+		uint32_t nameSize = name.mv_size, keySize = key.mv_size;
+		if (!(append(header, 4) && append(&putFlags, 4) && append(&dbFlags, 4) && append(&nameSize, 4) &&
+				append(name.mv_data, nameSize) && append(&keySize, 4) && append(key.mv_data, keySize)))
+			break;
+		if (op != QUEUED_DEL) {
+			// a version is stored in front of the value, like putWithVersion does
+			bool versioned = op == QUEUED_PUT && (flags & SET_VERSION);
+			uint32_t valueSize = value.mv_size + (versioned ? 8 : 0);
+			if (!(append(&valueSize, 4) && (!versioned || append(&version, 8)) && append(value.mv_data, value.mv_size)))
+				break;
+		}
+		operations.push_back(start);
+	}
+	ExtendedEnv::donePrefetchReadTxn(readTxn);
+	return size;
+}
+// mark the operations of a batch that was committed through a write queue with their results (1 for a write that
+// wasn't made, like a delete of a missing key), and then the batch itself
+void WriteWorker::FinishQueuedBatch(std::vector<uint32_t*>& operations, std::string& results, int rc, mdb_size_t txnId) {
+	for (size_t i = 0; i < operations.size(); i++) {
+		std::atomic_fetch_or((std::atomic<uint32_t>*) operations[i],
+			(uint32_t) ((i < results.size() && results[i]) ? FINISHED_OPERATION | FAILED_CONDITION : FINISHED_OPERATION));
+	}
+	progressStatus = 1;
+	UnlockTxn();
+	if (rc) {
+		resultCode = rc;
+		std::atomic_fetch_or((std::atomic<uint32_t>*) instructions, (uint32_t) TXN_HAD_ERROR);
+		return;
+	}
+	*(instructions - 1) = (uint32_t) txnId;
+	std::atomic_fetch_or((std::atomic<uint32_t>*) instructions, (uint32_t) TXN_COMMITTED);
+}
+#endif
+
 bool WriteWorker::threadSafeCallsEnabled = false;
 void txn_callback(const void* data, int finished) {
 	auto worker = (WriteWorker*) data;
@@ -465,49 +955,100 @@ void WriteWorker::Write() {
 		envForTxn->lastReaderCheck = now;
 	}
 	pthread_mutex_lock(envForTxn->writingLock);
-	#ifndef _WIN32
-	int retries = 0;
-	retry:
-	#endif
-	rc = mdb_txn_begin(env, nullptr,
-	#ifdef MDB_OVERLAPPINGSYNC
-		(envForTxn->jsFlags & MDB_OVERLAPPINGSYNC) ? MDB_NOSYNC :
+	combiner = envForTxn->writeCombiner;
+	#ifdef WRITE_QUEUE
+	if (envForTxn->writeQueue) {
+		// hand the batch to whichever process is writing, to be committed with the batches of the others
+		if (envForTxn->writeQueue->write(this) != WRITE_QUEUE_BYPASS)
+			return;
+	}
 	#endif
-		0, &txn);
-	#if !defined(_WIN32) && defined(MDB_RPAGE_CACHE)
-	if (rc == MDB_LOCK_FAILURE) {
-		if (retries++ < 4) {
-			sleep(1);
-			goto retry;
+	if (combiner) // share a txn with the batches of other threads
+		rc = combiner->join(this, &txn);
+	else {
+		#ifndef _WIN32
+		int retries = 0;
+		retry:
+		#endif
+		rc = BeginTxn(&txn);
+		#if !defined(_WIN32) && defined(MDB_RPAGE_CACHE)
+		if (rc == MDB_LOCK_FAILURE) {
+			if (retries++ < 4) {
+				sleep(1);
+				goto retry;
+			}
 		}
+		#endif
 	}
-	#endif
 	if (rc != 0) {
 		resultCode = rc;
 		return;
 	}
 	uint32_t* start = instructions;
 	rc = DoWrites(txn, envForTxn, instructions, this);
-	uint32_t txnId = (uint32_t) mdb_txn_id(txn);
 	if (!(*instructions & TXN_DELIMITER))
 		fprintf(stderr, "after writes %p %p NOT still valid %p\n", start, instructions, *instructions);
 	progressStatus = 1;
-	#ifdef MDB_OVERLAPPINGSYNC
-	if (envForTxn->jsFlags & MDB_OVERLAPPINGSYNC) {
-		mdb_txn_set_callback(txn, txn_callback, this);
-	}
+	#ifdef REDO_LOG
+	RedoLog* redoLog = ((ExtendedEnv*) mdb_env_get_userctx(env))->redoLog;
 	#endif
-	if (rc || resultCode) {
-		fprintf(stderr, "do_write error %u %u\n", rc, resultCode);
-		mdb_txn_abort(txn);
-	} else
-		rc = mdb_txn_commit(txn);
-	#ifdef MDB_OVERLAPPINGSYNC
+	mdb_size_t committedTxnId;
+	int batchResult = 0;
+	if (combiner && !combinedLeader) {
+		// the leader commits our writes with the rest of the shared txn
+		rc = combiner->finishJoined(this, rc ? rc : resultCode, &committedTxnId);
+		if (rc)
+			resultCode = rc;
+	} else {
+		if (combiner) {
+			// wait for the workers that joined us to finish their writes. If our own batch failed, it was taken back,
+			// and the shared txn is still committed for the others
+			rc = combiner->finishLeading(this, rc ? rc : resultCode, &txn, &batchResult);
+			resultCode = rc;
+		}
+		committedTxnId = mdb_txn_id(txn);
+		#ifdef MDB_OVERLAPPINGSYNC
+		if (envForTxn->jsFlags & MDB_OVERLAPPINGSYNC) {
+			mdb_txn_set_callback(txn, txn_callback, this);
+		}
+		#endif
+		#ifdef REDO_LOG
+		std::string redoOps;
+		#endif
+		if (rc || resultCode) {
+			fprintf(stderr, "do_write error %u %u\n", rc, resultCode);
+			#ifdef REDO_LOG
+			if (redoLog)
+				redoLog->abortTxn();
+			#endif
+			mdb_txn_abort(txn);
+		} else {
+			#ifdef REDO_LOG
+			// take the writes of this txn while it still holds the write lock
+			if (redoLog)
+				redoOps = redoLog->detach();
+			#endif
+			rc = mdb_txn_commit(txn);
+		}
+	#ifdef MDB_EMPTY_TXN
+		if (rc == MDB_EMPTY_TXN)
+			rc = 0;
 	#endif
-#ifdef MDB_EMPTY_TXN
-	if (rc == MDB_EMPTY_TXN)
-		rc = 0;
-#endif
+		#ifdef REDO_LOG
+		if (redoLog && rc == 0 && !redoOps.empty()) {
+			int64_t position = redoLog->append(committedTxnId, redoOps);
+			if (position < 0)
+				rc = (int) -position;
+			else
+				redoPosition = position;
+		}
+		#endif
+		if (combiner) {
+			combiner->complete(rc ? rc : resultCode, committedTxnId, redoPosition);
+			if (batchResult && !rc)
+				resultCode = batchResult;
+		}
+	}
 	if (!(*instructions & TXN_DELIMITER))
 		fprintf(stderr, "end write %p, next start %p NOT still valid %p\n", start, instructions, *instructions);
 	txn_callback(this, 1);
@@ -517,8 +1058,28 @@ void WriteWorker::Write() {
 			resultCode = rc ? rc : resultCode;
 		return;
 	}
-	*(instructions - 1) = txnId;
+	*(instructions - 1) = (uint32_t) committedTxnId;
 	std::atomic_fetch_or((std::atomic<uint32_t>*) instructions, (uint32_t) TXN_COMMITTED);
+	#ifdef REDO_LOG
+	if (redoLog) {
+		// the commits of this batch are durable once their records in the log are synced
+		if (redoPosition > 0) {
+			rc = redoLog->waitForSync(redoPosition);
+			if (rc)
+				resultCode = rc;
+		}
+		return;
+	}
+	#endif
+	#ifdef MDB_OVERLAPPINGSYNC
+	if (envForTxn->jsFlags & MDB_OVERLAPPINGSYNC) {
+		// with the sync scheduler, the commit hasn't been synced yet, so wait for the group sync that covers it before
+		// the flushed promises are resolved
+		rc = ((ExtendedEnv*) mdb_env_get_userctx(env))->waitForSync(committedTxnId);
+		if (rc)
+			resultCode = rc;
+	}
+	#endif
 }
 
 void write_progress(napi_env env,
@@ -552,7 +1113,7 @@ void write_progress(napi_env env,
 	if (!is_async) {
 		delete envForTxn->writeTxn;
 		envForTxn->writeTxn = nullptr;
-		pthread_cond_signal(envForTxn->writingCond);
+		envForTxn->wakeWriter();
 		pthread_mutex_unlock(envForTxn->writingLock);
 	}
 }
@@ -576,7 +1137,7 @@ Value EnvWrap::resumeWriting(const Napi::CallbackInfo& info) {
 	// if we had async txns, now we resume
 	delete writeTxn;
 	writeTxn = nullptr;
-	pthread_cond_signal(writingCond);
+	wakeWriter();
 	pthread_mutex_unlock(writingLock);
 	return info.Env().Undefined();
 }
@@ -621,7 +1182,7 @@ NAPI_FUNCTION(EnvWrap::write) {
 	if (instructionAddress)
 		rc = WriteWorker::DoWrites(ew->writeTxn->txn, ew, instructionAddress, nullptr);
 	else if (ew->writeWorker) {
-		pthread_cond_signal(ew->writingCond);
+		ew->wakeWriter();
 	}
 	if (rc && !(rc == MDB_KEYEXIST || rc == MDB_NOTFOUND)) {
 		throwLmdbError(env, rc);
@@ -5,7 +5,7 @@ import rimraf from 'rimraf';
 let should = chai.should();
 let expect = chai.expect;
 import { spawn } from 'child_process';
-import { unlinkSync } from 'fs';
+import { unlinkSync, openSync, closeSync, copyFileSync } from 'fs';
 import { fileURLToPath } from 'url';
 import { Worker } from 'worker_threads';
 import { encoder as orderedBinaryEncoder } from 'ordered-binary/index.js';
@@ -24,6 +24,9 @@ import {
 	keyValueToBuffer,
 	levelup,
 	open,
+	openSharded,
+	restoreIncrementalBackup,
+	restoreBackupStream,
 	TIMESTAMP_PLACEHOLDER,
 	DIRECT_WRITE_PLACEHOLDER,
 } from '../node-index.js';
@@ -79,6 +82,23 @@ describe('lmdb-js', function () {
 			encryptionKey: 'Use this key to encrypt the data',
 		}),
 	);
+	describe(
+		'Basic use with encryption and smaller remapped chunks',
+		basicTests({
+			compression: false,
+			encryptionKey: 'Use this key to encrypt the data',
+			remapChunkPages: 8,
+			remapTxnChunks: 1024,
+		}),
+	);
+	describe(
+		'Basic use with checksums',
+		basicTests({
+			compression: false,
+			remapChunks: true,
+			checksum: true,
+		}),
+	);
 	//describe('Check encrypted data', basicTests({ compression: false, encryptionKey: 'Use this key to encrypt the data', checkLast: true }));
 	describe('Basic use with JSON', basicTests({ encoding: 'json' }));
 	describe(
@@ -264,6 +284,45 @@ describe('lmdb-js', function () {
 					await db.put('key1', 'Hello world!');
 					expect(db.getStats().timeDuringTxns).gte(0);
 				});
+			if (options.trackMetrics)
+				it('sync transactions interrupting a batch', async function () {
+					await db.committed;
+					let batch = [];
+					for (let i = 0; i < 20; i++)
+						batch.push(db.put('batch-key' + i, 'batch'));
+					let asyncTxn = db.transaction(() => {
+						db.put('batch-key-in-txn', 'async');
+					});
+					// let the batch start, and then keep the event loop busy, so the write thread is left waiting for
+					// the transaction callback to run, with the batch's txn open
+					await new Promise((resolve) => setImmediate(resolve));
+					let end = Date.now() + 50;
+					while (Date.now() < end) {}
+					let before = db.getStats();
+					expect(() => db.transactionSync(() => {
+						db.put('sync-aborted', 'aborted');
+						throw new Error('abort');
+					})).to.throw('abort');
+					let afterAbort = db.getStats();
+					expect(afterAbort.batchInterruptions).equal(before.batchInterruptions + 1);
+					// the batch just continues in the same txn, nothing is committed
+					expect(afterAbort.interruptionCommits).equal(before.interruptionCommits);
+					expect(afterAbort.txns).equal(before.txns);
+					db.transactionSync(() => {
+						db.put('sync-committed', 'committed');
+					});
+					let afterCommit = db.getStats();
+					expect(afterCommit.batchInterruptions).equal(before.batchInterruptions + 2);
+					expect(afterCommit.interruptionCommits).equal(before.interruptionCommits + 1);
+					// the sync transaction is committed together with the batch so far, in one commit
+					expect(afterCommit.txns).equal(before.txns + 1);
+					should.equal(db.get('sync-committed'), 'committed');
+					should.equal(db.get('batch-key19'), 'batch');
+					should.equal(db.get('sync-aborted'), undefined);
+					await Promise.all(batch);
+					await asyncTxn;
+					should.equal(db.get('batch-key-in-txn'), 'async');
+				});
 			it('string', async function () {
 				await db.put('key1', 'Hello world!');
 				let data = db.get('key1');
@@ -399,6 +458,93 @@ describe('lmdb-js', function () {
 				(await db.remove('key1')).should.equal(true);
 			});
 			if (options.encoding == 'ordered-binary') return; // no more tests need to be applied for this
+			it('large compressed values', async function () {
+				let dbCompressed = db.openDB('mydb-large-compressed', {
+					compression: true,
+				});
+				let small = expand('Hello world!');
+				let large = small;
+				while (large.length < 0x40000) large += large;
+				let larger = large + large + large;
+				dbCompressed.put('small', small);
+				dbCompressed.put('large', large);
+				await dbCompressed.put('larger', larger);
+				dbCompressed.get('large').should.equal(large);
+				dbCompressed.get('larger').should.equal(larger);
+				dbCompressed.get('small').should.equal(small);
+				dbCompressed.get('large').should.equal(large);
+				let values = dbCompressed.getRange().map(({ value }) => value).asArray;
+				values.should.deep.equal([large, larger, small]);
+				await dbCompressed.drop();
+			});
+			it('multiple compression dictionaries', async function () {
+				let dbCompressed = db.openDB('mydb-dictionaries', {
+					compression: {
+						threshold: 100,
+						dictionaries: [Buffer.from(expand('first dictionary'))],
+					},
+				});
+				let first = expand('first value');
+				await dbCompressed.put('first', first);
+				dbCompressed.compression
+					.addDictionary(Buffer.from(expand('second dictionary')))
+					.should.equal(1);
+				let second = expand('second value');
+				await dbCompressed.put('second', second);
+				dbCompressed.get('first').should.equal(first);
+				dbCompressed.get('second').should.equal(second);
+				await dbCompressed.drop();
+			});
+			it('compression with LZ4-HC level', async function () {
+				let dbCompressed = db.openDB('mydb-compression-level', {
+					compression: { threshold: 100, level: 9 },
+				});
+				let value = expand('High compression value');
+				await dbCompressed.put('hc', value);
+				dbCompressed.get('hc').should.equal(value);
+				await dbCompressed.drop();
+			});
+			it('store incompressible values uncompressed', async function () {
+				let dbCompressed = db.openDB('mydb-min-gain', {
+					compression: { threshold: 100, minGain: 0.2 },
+				});
+				let characters = 'abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789';
+				let randomString = '';
+				for (let i = 0; i < 2000; i++) randomString += characters[Math.floor(Math.random() * characters.length)];
+				for (let i = 0; i < 20; i++) dbCompressed.put('random' + i, randomString);
+				let text = expand('compressible text');
+				await dbCompressed.put('text', text);
+				dbCompressed.get('random1').should.equal(randomString);
+				dbCompressed.get('text').should.equal(text);
+				let stats = dbCompressed.getStats().compression;
+				stats.skipped.should.be.above(0);
+				stats.compressed.should.be.above(0);
+				stats.bytesOut.should.be.below(stats.bytesIn);
+				await dbCompressed.drop();
+			});
+			it('train compression dictionary', async function () {
+				let dbCompressed = db.openDB('mydb-train-dictionary', {
+					compression: { threshold: 100 },
+				});
+				for (let i = 0; i < 200; i++) {
+					dbCompressed.put('key' + i, {
+						name: 'user ' + i,
+						description: 'a user record that has a fair amount of repeated text in it',
+						tags: ['first tag', 'second tag', 'third tag'],
+					});
+				}
+				await dbCompressed.committed;
+				let result = await dbCompressed.trainDictionary({ samples: 100, size: 4096 });
+				result.sampleCount.should.equal(100);
+				result.dictionary.length.should.be.above(0);
+				result.dictionary.length.should.be.most(4096);
+				result.ratio.should.be.above(result.previousRatio);
+				dbCompressed.compression.addDictionary(result.dictionary).should.equal(1);
+				await dbCompressed.put('after', { name: 'after training' });
+				dbCompressed.get('after').name.should.equal('after training');
+				dbCompressed.get('key1').name.should.equal('user 1');
+				await dbCompressed.drop();
+			});
 			it('bigger puts, testing free space management', async function () {
 				let seed = 15325223;
 				function random() {
@@ -425,6 +571,21 @@ describe('lmdb-js', function () {
 				await promise;
 			});
 
+			it('online compaction', async function () {
+				let dbToCompact = db.openDB('mydb-compact');
+				let value = 'x'.repeat(3000);
+				for (let i = 0; i < 1000; i++) dbToCompact.put('key' + i, value + i);
+				await dbToCompact.committed;
+				for (let i = 0; i < 900; i++) dbToCompact.remove('key' + i);
+				await dbToCompact.committed;
+				let steps = 0;
+				let progress = await db.compact({ pagesPerStep: 100, delay: 0, onProgress() { steps++; } });
+				steps.should.be.above(1);
+				progress.relocated.should.be.above(0);
+				for (let i = 900; i < 1000; i++) dbToCompact.get('key' + i).should.equal(value + i);
+				await dbToCompact.drop();
+			});
+
 			it('store objects', async function () {
 				let dataIn = { foo: 3, bar: true };
 				await db.put('key1', dataIn);
@@ -1818,6 +1979,157 @@ describe('lmdb-js', function () {
 					await backupDb.close();
 				}
 			});
+			it('can make a compacting backup with multiple threads', async function () {
+				if (options.encryptionKey)
+					// it won't match the environment
+					return;
+				for (let i = 0; i < 1000; i++) db.put('for-parallel-backup-' + i, 'value ' + i);
+				await db.flushed;
+				try {
+					unlinkSync(testDirPath + '/backup-parallel.mdb');
+				} catch (error) {}
+				await db.backup(testDirPath + '/backup-parallel.mdb', { threads: 4 });
+				let backupDb = open(testDirPath + '/backup-parallel.mdb', options);
+				try {
+					backupDb.get('for-parallel-backup-500').should.equal('value 500');
+					backupDb.getKeysCount({ start: 'for-parallel-backup-', end: 'for-parallel-backup-~' }).should.equal(1000);
+				} finally {
+					await backupDb.close();
+				}
+			});
+			it('can warm up databases', async function () {
+				for (let i = 0; i < 1000; i++) db.put('for-warm-up-' + i, 'value ' + i);
+				await db.flushed;
+				let progressCalls = 0;
+				let progress = await db.warmUp({
+					dbs: [db, db2],
+					threads: 2,
+					onProgress(progress) {
+						progress.warmed.should.be.at.most(progress.total);
+						progressCalls++;
+					},
+				});
+				progress.total.should.be.above(0);
+				progress.warmed.should.equal(progress.total);
+				progressCalls.should.be.above(0);
+				let limited = await db.warmUp({ budget: 8192 });
+				limited.warmed.should.be.at.most(8192);
+			});
+			it('can report residency', async function () {
+				if (options.encryptionKey || process.platform == 'win32')
+					return; // not supported
+				for (let i = 0; i < 1000; i++) db.put('for-residency-' + i, 'value ' + i);
+				await db.flushed;
+				let result = await db.residency({ dbs: [db, db2] });
+				result.total.should.be.above(0);
+				result.resident.should.be.at.most(result.total);
+				result.dbs.length.should.equal(2);
+				let dbResult = result.dbs[0];
+				dbResult.leaf.total.should.be.above(0);
+				dbResult.resident.should.be.at.most(dbResult.total);
+				dbResult.depths[0].total.should.be.above(0);
+				let sampled = await db.residency({ sample: 4 });
+				sampled.dbs[0].branch.total.should.equal(dbResult.branch.total);
+			});
+			it('can pin databases in memory', async function () {
+				if (options.encryptionKey)
+					return; // not supported
+				for (let i = 0; i < 1000; i++) db.put('for-pinning-' + i, 'value ' + i);
+				await db.flushed;
+				let pinnedBytes = await db.pin({ dbs: [db, db2], leaves: true, budget: 0x10000, interval: 10 });
+				pinnedBytes.should.be.above(0);
+				pinnedBytes.should.be.at.most(0x10000);
+				db.getStats().pinnedBytes.should.equal(pinnedBytes);
+				await db.put('for-pinning-0', 'changed');
+				await delay(50);
+				db.getStats().pinnedBytes.should.be.above(0);
+				db.unpin();
+				should.not.exist(db.getStats().pinnedBytes);
+			});
+			it('reports chunk cache counters', async function () {
+				if (!options.remapChunkPages)
+					return; // only with configured chunks
+				for (let i = 0; i < 1000; i++) db.put('for-chunk-cache-' + i, 'value ' + i);
+				await db.flushed;
+				for (let i = 0; i < 1000; i++) db.get('for-chunk-cache-' + i).should.equal('value ' + i);
+				db.resetReadTxn();
+				let chunkCache = db.getStats().chunkCache;
+				chunkCache.chunkPages.should.equal(8);
+				chunkCache.txnChunks.should.equal(1024);
+				chunkCache.cacheChunks.should.be.at.least(1024);
+				chunkCache.misses.should.be.above(0);
+				chunkCache.maps.should.be.at.least(chunkCache.misses);
+				chunkCache.decrypts.should.be.above(0);
+				chunkCache.bytesDecrypted.should.be.above(chunkCache.decrypts);
+			});
+			it('can verify the pages of the database', async function () {
+				let value = 'large value';
+				for (let i = 0; i < 10; i++) value += value;
+				for (let i = 0; i < 1000; i++) db.put('for-verify-' + i, i % 100 ? 'value ' + i : value);
+				for (let i = 0; i < 100; i++) db2.put('for-verify', 'dup ' + i);
+				await db.flushed;
+				let result = await db.verify({ threads: 4 });
+				result.pages.should.be.above(0);
+				result.corruptCount.should.equal(0);
+				result.corrupt.length.should.equal(0);
+				let singleThreaded = await db.verify({ threads: 1 });
+				singleThreaded.pages.should.equal(result.pages);
+			});
+			it('can stream a compressed backup and restore it', async function () {
+				for (let i = 0; i < 100; i++) db.put('for-stream-backup-' + i, 'value ' + i);
+				await db.flushed;
+				for (let name of ['stream.lz4', 'stream-restored.mdb']) {
+					try {
+						unlinkSync(testDirPath + '/backup-' + name);
+					} catch (error) {}
+				}
+				let fd = openSync(testDirPath + '/backup-stream.lz4', 'w');
+				let result;
+				try {
+					result = await db.backupStream(fd, { compact: true, threads: 2 });
+				} finally {
+					closeSync(fd);
+				}
+				if (!options.encryptionKey) result.compressedSize.should.be.below(result.size);
+				fd = openSync(testDirPath + '/backup-stream.lz4', 'r');
+				try {
+					(await restoreBackupStream(fd, testDirPath + '/backup-stream-restored.mdb')).should.equal(result.size);
+				} finally {
+					closeSync(fd);
+				}
+				let restoredDb = open(testDirPath + '/backup-stream-restored.mdb', options);
+				try {
+					restoredDb.get('for-stream-backup-50').should.equal('value 50');
+				} finally {
+					await restoredDb.close();
+				}
+			});
+			it('can make and restore incremental backups', async function () {
+				for (let i = 0; i < 100; i++) db.put('for-incremental-' + i, 'first ' + i);
+				await db.flushed;
+				for (let name of ['full', 'incremental', 'restored']) {
+					try {
+						unlinkSync(testDirPath + '/backup-' + name + '.mdb');
+					} catch (error) {}
+				}
+				let fullTxnId = await db.incrementalBackup(testDirPath + '/backup-full.mdb', 0);
+				for (let i = 0; i < 10; i++) db.put('for-incremental-' + i, 'second ' + i);
+				await db.flushed;
+				let txnId = await db.incrementalBackup(testDirPath + '/backup-incremental.mdb', fullTxnId);
+				txnId.should.be.above(fullTxnId);
+				let restoredTxnId = await restoreIncrementalBackup(testDirPath + '/backup-restored.mdb', [
+					testDirPath + '/backup-full.mdb',
+					testDirPath + '/backup-incremental.mdb',
+				]);
+				restoredTxnId.should.equal(txnId);
+				let restoredDb = open(testDirPath + '/backup-restored.mdb', options);
+				try {
+					restoredDb.get('for-incremental-5').should.equal('second 5');
+					restoredDb.get('for-incremental-50').should.equal('first 50');
+				} finally {
+					await restoredDb.close();
+				}
+			});
 			after(function (done) {
 				db.get('key1');
 				let iterator = db.getRange({})[Symbol.iterator]();
@@ -1938,6 +2250,298 @@ describe('lmdb-js', function () {
 			await lastPromise;
 		});
 	});
+	describe('io_uring page writes', function () {
+		it('commits large transactions with io_uring (or falls back)', async function () {
+			let db = open(testDirPath + '/test-io-uring.mdb', {
+				ioUring: true,
+				overlappingSync: false,
+			});
+			let value = 'io_uring value ';
+			for (let i = 0; i < 8; i++) value += value;
+			await db.transaction(() => {
+				for (let i = 0; i < 5000; i++) db.put('key' + i, value + i);
+			});
+			await db.close();
+			db = open(testDirPath + '/test-io-uring.mdb', {});
+			db.get('key1').should.equal(value + 1);
+			db.get('key4999').should.equal(value + 4999);
+			await db.close();
+		});
+	});
+	describe('Early writeback', function () {
+		it('commits with writeback started for each commit', async function () {
+			let db = open(testDirPath + '/test-early-writeback.mdb', {
+				earlyWriteback: true,
+				overlappingSync: true,
+			});
+			let value = 'writeback value ';
+			for (let i = 0; i < 6; i++) value += value;
+			for (let i = 0; i < 20; i++) {
+				for (let j = 0; j < 100; j++) db.put('key' + (j * 20 + i), value + i);
+				await db.flushed;
+			}
+			await db.close();
+			db = open(testDirPath + '/test-early-writeback.mdb', {});
+			db.get('key0').should.equal(value + 0);
+			db.get('key1999').should.equal(value + 19);
+			await db.close();
+		});
+	});
+	describe('Redo log', function () {
+		it('replays commits that are in the log but not the database', async function () {
+			let path = testDirPath + '/test-redo.mdb';
+			let db = open(path, { overlappingSync: true, redoLog: true });
+			await db.put('before', 'in the database');
+			await db.close();
+			// a copy of the database from before the next commits, as if they weren't synced before a crash
+			copyFileSync(path, testDirPath + '/test-redo-copy.mdb');
+			db = open(path, { overlappingSync: true, redoLog: true, redoLogCheckpointInterval: 100000 });
+			await db.put('after', 'only in the log');
+			let named = db.openDB('named-redo');
+			await named.put('named', 'also in the log');
+			await db.remove('before');
+			db.getStats().redoLog.records.should.be.above(0);
+			copyFileSync(path + '-redo0', testDirPath + '/test-redo-copy.mdb-redo0');
+			copyFileSync(path + '-redo1', testDirPath + '/test-redo-copy.mdb-redo1');
+			await db.close();
+			let copy = open(testDirPath + '/test-redo-copy.mdb', { overlappingSync: true, redoLog: true });
+			copy.getStats().redoLog.replayed.should.be.above(0);
+			copy.get('after').should.equal('only in the log');
+			should.not.exist(copy.get('before'));
+			copy.openDB('named-redo').get('named').should.equal('also in the log');
+			await copy.close();
+		});
+	});
+	describe('Sync scheduler', function () {
+		it('groups the syncs of overlapping commits', async function () {
+			let db = open(testDirPath + '/test-sync-scheduler.mdb', {
+				overlappingSync: true,
+				syncScheduler: true,
+			});
+			let flushes = [];
+			for (let i = 0; i < 20; i++) {
+				db.put('key' + i, 'value ' + i);
+				flushes.push(db.flushed);
+				await delay(1);
+			}
+			db.putSync('sync-key', 'sync value');
+			await Promise.all(flushes);
+			await db.flushed;
+			let stats = db.getStats().syncScheduler;
+			stats.syncs.should.be.above(0);
+			stats.syncedCommits.should.be.at.least(stats.syncs);
+			await db.close();
+			db = open(testDirPath + '/test-sync-scheduler.mdb', {});
+			db.get('key19').should.equal('value 19');
+			db.get('sync-key').should.equal('sync value');
+			await db.close();
+		});
+	});
+	describe('Sharded store', function () {
+		this.timeout(1000000);
+		// this runs first, so that it is the first store to route a key (before the key buffer is allocated)
+		it('partitions by key ranges', async function () {
+			let store = openSharded(testDirPath + '/test-sharded-range', { shards: 3, partitioner: ['g', 'p'] });
+			await store.batch(['a', 'h', 'z', 'b', 'q', 'g', 'p'].map((key) => ({ type: 'put', key, value: key.toUpperCase() })));
+			store.shards.map((shard) => shard.getCount()).should.deep.equal([2, 2, 3]);
+			store.get('q').should.equal('Q');
+			Array.from(store.getKeys()).should.deep.equal(['a', 'b', 'g', 'h', 'p', 'q', 'z']);
+			Array.from(store.getKeys({ reverse: true, limit: 2 })).should.deep.equal(['z', 'q']);
+			await store.close();
+		});
+		it('routes writes to shards and merges ranges in key order', async function () {
+			let store = openSharded(testDirPath + '/test-sharded', { shards: 4 });
+			let writes = [];
+			for (let i = 0; i < 100; i++)
+				writes.push(store.put('key' + (1000 + i), 'value ' + i));
+			await Promise.all(writes);
+			store.get('key1042').should.equal('value 42');
+			store.shards.filter((shard) => shard.getCount() > 0).length.should.be.above(1);
+			store.getCount().should.equal(100);
+			let keys = Array.from(store.getKeys({ start: 'key1010', end: 'key1020' }));
+			keys.should.deep.equal(Array.from({ length: 10 }, (v, i) => 'key' + (1010 + i)));
+			let entries = Array.from(store.getRange({ reverse: true, offset: 2, limit: 3 }));
+			entries.map(({ key }) => key).should.deep.equal(['key1097', 'key1096', 'key1095']);
+			entries[0].value.should.equal('value 97');
+			(await store.getMany(['key1003', 'missing', 'key1099'])).should.deep.equal(['value 3', undefined, 'value 99']);
+			// keys of different lengths and prefixes, spread across the shards, are merged in order
+			let mixedKeys = ['b', 'a', 'ab', 'abc', 'b0', 'aa', 'c', 'ba', 'd', 'a0'];
+			await Promise.all(mixedKeys.map((key) => store.put(key, key)));
+			let sorted = mixedKeys.slice().sort();
+			Array.from(store.getKeys({ end: 'k' })).should.deep.equal(sorted);
+			Array.from(store.getRange({ start: 'd', end: 'a', reverse: true }), ({ key }) => key)
+				.should.deep.equal(sorted.slice(1).reverse());
+			(await store.remove('key1003')).should.equal(true);
+			should.equal(store.get('key1003'), undefined);
+			await store.close();
+		});
+		it('writes atomic batches across shards and recovers them on open', async function () {
+			let path = testDirPath + '/test-sharded-atomic';
+			let store = openSharded(path, { shards: 2 });
+			let operations = [];
+			for (let i = 0; i < 10; i++)
+				operations.push({ type: 'put', key: 'atomic' + i, value: i });
+			await store.atomicBatch(operations);
+			store.getCount().should.equal(10);
+			store.batchDbs.map((batchDb) => batchDb.getCount()).should.deep.equal([0, 0]);
+			// a batch that was prepared and committed, but not applied, is finished when the store is opened
+			store.batchDbs[store.shardIndex('recovered')].putSync(['prepared', 'interrupted'], [['put', 'recovered', 'yes']]);
+			store.batchDbs[0].putSync(['committed', 'interrupted'], [store.shardIndex('recovered')]);
+			// and a batch that was only prepared is discarded
+			store.batchDbs[store.shardIndex('discarded')].putSync(['prepared', 'uncommitted'], [['put', 'discarded', 'no']]);
+			await store.close();
+			store = openSharded(path, { shards: 2 });
+			store.get('recovered').should.equal('yes');
+			should.equal(store.get('discarded'), undefined);
+			store.batchDbs.map((batchDb) => batchDb.getCount()).should.deep.equal([0, 0]);
+			// a committed batch must have all of its parts
+			(() => store.applyPrepared(0, 'missing')).should.throw();
+			await store.close();
+		});
+		it('only recovers atomic batches when no other store has it open', async function () {
+			let path = testDirPath + '/test-sharded-atomic-open';
+			let store = openSharded(path, { shards: 2 });
+			// as if another store was in the middle of writing this batch
+			store.batchDbs[store.shardIndex('pending')].putSync(['prepared', 'in-progress'], [['put', 'pending', 'yes']]);
+			let other = openSharded(path, { shards: 2 });
+			other.batchDbs[store.shardIndex('pending')].getCount().should.equal(1);
+			await other.close();
+			await store.close();
+			store = openSharded(path, { shards: 2 });
+			store.batchDbs.map((batchDb) => batchDb.getCount()).should.deep.equal([0, 0]);
+			await store.close();
+		});
+	});
+	describe('Write combining', function () {
+		this.timeout(1000000);
+		it('combines the write batches of threads', function (done) {
+			var child = spawn('node', [
+				fileURLToPath(new URL('./threads.cjs', import.meta.url)),
+			], { env: Object.assign({}, process.env, { COMBINE_WRITES: '1' }) });
+			child.stdout.on('data', function (data) {
+				console.log(data.toString());
+			});
+			child.stderr.on('data', function (data) {
+				console.error(data.toString());
+			});
+			child.on('close', function (code) {
+				code.should.equal(0);
+				done();
+			});
+		});
+		it('interrupts a combined batch with a sync transaction', async function () {
+			let db = open(testDirPath + '/test-combine-writes.mdb', {
+				overlappingSync: true,
+				combineWrites: true,
+			});
+			let writes = [];
+			for (let i = 0; i < 20; i++)
+				writes.push(db.put('key' + i, 'value ' + i));
+			let asyncTxn = db.transaction(() => {
+				db.put('async-key', 'async value');
+			});
+			db.transactionSync(() => {
+				db.put('sync-key', 'sync value');
+			});
+			db.get('sync-key').should.equal('sync value');
+			await Promise.all(writes);
+			await asyncTxn;
+			db.get('key19').should.equal('value 19');
+			db.get('async-key').should.equal('async value');
+			let stats = db.getStats().writeCombiner;
+			stats.txns.should.be.above(0);
+			stats.batches.should.be.at.least(stats.txns);
+			await db.close();
+		});
+	});
+	describe('Writer wakeups', function () {
+		// transactions that keep the write thread waiting (for the rest of their writes) for about a millisecond
+		async function waitingTxns(db) {
+			for (let i = 0; i < 10; i++) {
+				await db.transaction(async () => {
+					db.put('wakeup-key' + i, 'before');
+					await new Promise((resolve) => setTimeout(resolve, 1));
+					db.put('wakeup-key' + i, 'after');
+				});
+				should.equal(db.get('wakeup-key' + i), 'after');
+			}
+		}
+		it('parks the write thread, and wakes it', async function () {
+			let db = open(testDirPath + '/test-writer-park.mdb', {
+				trackMetrics: true,
+				writerSpin: 0,
+			});
+			await waitingTxns(db);
+			let stats = db.getStats();
+			stats.writerParks.should.be.above(0);
+			if (process.platform == 'linux') // elsewhere, a parked write thread polls instead of being woken
+				stats.writerNotifies.should.be.above(0);
+			await db.close();
+		});
+		it('wakes a spinning write thread', async function () {
+			let db = open(testDirPath + '/test-writer-spin.mdb', {
+				trackMetrics: true,
+				writerSpin: 1000000, // a second, far longer than the waits
+			});
+			await waitingTxns(db);
+			db.getStats().writerSpinWakeups.should.be.above(0);
+			await db.close();
+		});
+	});
+	describe('Write queue', function () {
+		this.timeout(1000000);
+		before(function () {
+			if (process.platform != 'linux')
+				this.skip(); // only available on Linux
+		});
+		it('commits the write batches of processes through the queue', function (done) {
+			var child = spawn('node', [
+				fileURLToPath(new URL('./write-queue.cjs', import.meta.url)),
+			], { stdio: ['inherit', 'pipe', 'pipe', 'ipc'] });
+			var result;
+			child.on('message', function (msg) {
+				result = msg;
+			});
+			child.stdout.on('data', function (data) {
+				console.log(data.toString());
+			});
+			child.stderr.on('data', function (data) {
+				console.error(data.toString());
+			});
+			child.on('close', function (code) {
+				code.should.equal(0);
+				result.done.should.equal(true);
+				for (let prefix in result.workers)
+					result.workers[prefix].batches.should.be.above(0);
+				done();
+			});
+		});
+		it('queues puts and removes, and writes other batches as usual', async function () {
+			let db = open(testDirPath + '/test-write-queue.mdb', {
+				overlappingSync: true,
+				useVersions: true,
+				writeQueue: true,
+			});
+			let writes = [];
+			for (let i = 0; i < 20; i++)
+				writes.push(db.put('key' + i, 'value ' + i, i + 1));
+			await Promise.all(writes);
+			let entry = db.getEntry('key19');
+			entry.value.should.equal('value 19');
+			entry.version.should.equal(20);
+			(await db.remove('key0')).should.equal(true);
+			(await db.remove('missing')).should.equal(false);
+			should.equal(db.get('key0'), undefined);
+			// a conditional write isn't queued
+			(await db.put('key1', 'changed', 3, 2)).should.equal(true);
+			db.get('key1').should.equal('changed');
+			let stats = db.getStats().writeQueue;
+			stats.batches.should.be.above(0);
+			stats.drains.should.be.above(0);
+			stats.bypassed.should.be.above(0);
+			await db.close();
+		});
+	});
 	describe('Threads', function () {
 		this.timeout(1000000);
 		it('will run a group of threads with write transactions', function (done) {
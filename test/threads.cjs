@@ -17,6 +17,7 @@ if (isMainThread) {
     mapSize: MAX_DB_SIZE,
     maxReaders: 126,
     overlappingSync: true,
+    combineWrites: !!process.env.COMBINE_WRITES,
   });
 
   var workerCount = Math.min(numCPUs * 2, 20);
@@ -75,6 +76,7 @@ if (isMainThread) {
     mapSize: MAX_DB_SIZE,
     maxReaders: 126,
     overlappingSync: true,
+    combineWrites: !!process.env.COMBINE_WRITES,
   });
 
 
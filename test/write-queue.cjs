@@ -0,0 +1,75 @@
+var assert = require('assert');
+var cluster = require('cluster');
+var path = require('path');
+var numCPUs = require('os').cpus().length;
+
+const { open } = require('../dist/index.cjs');
+const MAX_DB_SIZE = 256 * 1024 * 1024;
+const WRITES = 1000;
+
+function openDb() {
+  return open({
+    path: path.resolve(__dirname, './testdata/write-queue.mdb'),
+    maxDbs: 10,
+    mapSize: MAX_DB_SIZE,
+    maxReaders: 126,
+    overlappingSync: true,
+    writeQueue: true,
+  });
+}
+
+if (cluster.isPrimary) {
+
+  // The primary process
+
+  let db = openDb();
+  var workerCount = Math.min(numCPUs * 2, 8);
+  var exited = 0;
+  var workerStats = {};
+  for (var i = 0; i < workerCount; i++) {
+    var worker = cluster.fork();
+    worker.on('message', function(msg) {
+      workerStats[msg.prefix] = msg.stats;
+    });
+    worker.on('exit', function(code) {
+      assert.equal(code, 0);
+      if (++exited === workerCount) {
+        // every write of every process was committed
+        for (var i = 0; i < workerCount; i++) {
+          assert.equal(db.get('worker' + i + '-' + (WRITES - 1)), 'value ' + (WRITES - 1));
+          assert.equal(db.getKeysCount({ start: 'worker' + i + '-', end: 'worker' + i + '.' }), WRITES);
+        }
+        assert.equal(Object.keys(workerStats).length, workerCount);
+        db.close();
+        // report to the test that spawned this, if it did so with an IPC channel
+        if (process.send)
+          process.send({ done: true, workers: workerStats }, function() {
+            process.disconnect();
+          });
+      }
+    });
+  }
+
+} else {
+
+  // The worker process
+
+  let db = openDb();
+  let prefix = 'worker' + (cluster.worker.id - 1) + '-';
+  (async function() {
+    let writes = [];
+    for (let i = 0; i < WRITES; i++) {
+      writes.push(db.put(prefix + i, 'value ' + i));
+      if (i % 100 === 99)
+        await writes[i];
+    }
+    await Promise.all(writes);
+    assert.equal(await db.remove(prefix + 'missing'), false);
+    let stats = db.getStats().writeQueue;
+    assert(stats.batches > 0);
+    await db.close();
+    process.send({ prefix, stats }, function() {
+      process.exit(0);
+    });
+  })();
+}
@@ -36,7 +36,7 @@ const queueTask = typeof setImmediate != 'undefined' ? setImmediate : setTimeout
 const WRITE_BUFFER_SIZE = 0x10000;
 var log = [];
 export function addWriteMethods(LMDBStore, { env, fixedBuffer, resetReadTxn, useWritemap, maxKeySize,
-	eventTurnBatching, txnStartThreshold, batchStartThreshold, overlappingSync, commitDelay, separateFlushed, maxFlushDelay }) {
+	eventTurnBatching, txnStartThreshold, batchStartThreshold, overlappingSync, commitDelay, separateFlushed, maxFlushDelay, syncScheduler, redoLog }) {
 	//  stands for write instructions
 	var dynamicBytes;
 	function allocateInstructionBuffer(lastPosition) {
@@ -269,12 +269,10 @@ export function addWriteMethods(LMDBStore, { env, fixedBuffer, resetReadTxn, use
 
 		return (callback) => {
 			if (writtenBatchDepth) {
-				// if we are in a batch, the transaction can't close, so we do the faster,
-				// but non-deterministic updates, knowing that the write thread can
-				// just poll for the status change if we miss a status update
-				writeStatus = uint32[flagPosition];
-				uint32[flagPosition] = flags;
-				//writeStatus = Atomics.or(uint32, flagPosition, flags)
+				// if we are in a batch, the transaction can't close, so we can just
+				// replace the status, but this still needs to be atomic, so we reliably
+				// see if the write thread is waiting on it and needs to be woken
+				writeStatus = Atomics.exchange(uint32, flagPosition, flags);
 				if (writeBatchStart && !writeStatus) {
 					outstandingBatchCount += 1 + (valueSize >> 12);
 					if (outstandingBatchCount > batchStartThreshold) {
@@ -504,13 +502,10 @@ export function addWriteMethods(LMDBStore, { env, fixedBuffer, resetReadTxn, use
 	}
 	function atomicStatus(uint32, flagPosition, newStatus) {
 		if (batchDepth) {
-			// if we are in a batch, the transaction can't close, so we do the faster,
-			// but non-deterministic updates, knowing that the write thread can
-			// just poll for the status change if we miss a status update
-			let writeStatus = uint32[flagPosition];
-			uint32[flagPosition] = newStatus;
-			return writeStatus;
-			//return Atomics.or(uint32, flagPosition, newStatus)
+			// if we are in a batch, the transaction can't close, so we can just
+			// replace the status, but this still needs to be atomic, so we reliably
+			// see if the write thread is waiting on it and needs to be woken
+			return Atomics.exchange(uint32, flagPosition, newStatus);
 		} else // otherwise the transaction could end at any time and we need to know the
 			// deterministically if it is ending, so we can reset the commit promise
 			// so we use the slower atomic operation
@@ -840,6 +835,8 @@ export function addWriteMethods(LMDBStore, { env, fixedBuffer, resetReadTxn, use
 						else {
 							env.commitTxn();
 							resetReadTxn();
+							if ((flags & 0x10000) && (syncScheduler || redoLog)) // the sync of this commit is left to the scheduler or the redo log
+								lastSyncTxnFlush = new Promise((resolve, reject) => env.sync((error) => error ? reject(error) : resolve()));
 						}
 						return result;
 					} finally {